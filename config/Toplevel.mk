@@ -0,0 +1,2 @@
+SUBSYSTEMS               :=  tools
+GIT_HTTP                 ?= n
@@ -0,0 +1 @@
+/root/repo/tools/include/../../xen/include/acpi/acpixf.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/tools/include/../../xen/include/acpi/acutils.h
\ No newline at end of file
@@ -1414,6 +1414,32 @@ void libxl_mac_copy(libxl_ctx *ctx, libxl_mac *dst, const libxl_mac *src);
  */
 #define LIBXL_HAVE_CREATEINFO_XEND_SUSPEND_EVTCHN_COMPAT
 
+/*
+ * LIBXL_HAVE_SUSPEND_COMPRESS
+ *
+ * If this is defined, libxl_domain_suspend() accepts LIBXL_SUSPEND_COMPRESS,
+ * which compresses guest memory in the migration stream.  The receiving end
+ * must support the COMPRESSED_PAGE_DATA stream record.
+ */
+#define LIBXL_HAVE_SUSPEND_COMPRESS 1
+
+/*
+ * LIBXL_HAVE_DOMAIN_POSTCOPY
+ *
+ * If this is defined, libxl_domain_suspend() accepts LIBXL_SUSPEND_POSTCOPY,
+ * and libxl_domain_postcopy_send() and libxl_domain_postcopy_receive() are
+ * available to complete a post-copy live migration.
+ */
+#define LIBXL_HAVE_DOMAIN_POSTCOPY 1
+
+/*
+ * LIBXL_HAVE_SUSPEND_ADAPTIVE
+ *
+ * If this is defined, libxl_domain_suspend_adaptive() is available, and
+ * accepts LIBXL_SUSPEND_THROTTLE.
+ */
+#define LIBXL_HAVE_SUSPEND_ADAPTIVE 1
+
 typedef char **libxl_string_list;
 void libxl_string_list_dispose(libxl_string_list *sl);
 int libxl_string_list_length(const libxl_string_list *sl);
@@ -1776,6 +1802,49 @@ int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd,
                          LIBXL_EXTERNAL_CALLERS_ONLY;
 #define LIBXL_SUSPEND_DEBUG 1
 #define LIBXL_SUSPEND_LIVE 2
+#define LIBXL_SUSPEND_COMPRESS 4
+#define LIBXL_SUSPEND_POSTCOPY 8
+#define LIBXL_SUSPEND_THROTTLE 16
+
+/*
+ * As libxl_domain_suspend(), but a live suspend ends its precopy phase once
+ * the downtime predicted from the measured bandwidth and dirty rate is within
+ * max_downtime_ms, rather than after a fixed number of iterations.  With
+ * LIBXL_SUSPEND_THROTTLE, a guest dirtying memory faster than it can be sent
+ * has its CPU time capped until the migration converges.  A max_downtime_ms
+ * of 0 behaves as libxl_domain_suspend().
+ */
+int libxl_domain_suspend_adaptive(libxl_ctx *ctx, uint32_t domid, int fd,
+                                  int flags, /* LIBXL_SUSPEND_* */
+                                  unsigned int max_downtime_ms,
+                                  const libxl_asyncop_how *ao_how)
+                                  LIBXL_EXTERNAL_CALLERS_ONLY;
+
+/*
+ * Post-copy live migration.  A live libxl_domain_suspend() with
+ * LIBXL_SUSPEND_POSTCOPY leaves out the memory dirtied in the final
+ * iteration.  After the receiving end has restored the domain (paused), the
+ * sender calls libxl_domain_postcopy_send() and the receiver calls
+ * libxl_domain_postcopy_receive(), which resumes the domain (if 'unpause')
+ * and pages the remaining memory in from the sender on demand.  Both return
+ * once all memory has arrived, at which point the sender's copy of the domain
+ * may be destroyed.
+ *
+ * Only HVM guests are supported.  Should either fail once the domain has
+ * been resumed at the receiving end, neither copy of the domain is usable.
+ * If the receiving end fails before resuming the domain,
+ * libxl_domain_postcopy_send() fails with ERROR_ABORTED, and the domain may
+ * be resumed at the sending end with libxl_domain_resume().
+ */
+int libxl_domain_postcopy_send(libxl_ctx *ctx, uint32_t domid,
+                               int send_fd, int recv_fd,
+                               int flags, /* LIBXL_SUSPEND_* */
+                               const libxl_asyncop_how *ao_how)
+                               LIBXL_EXTERNAL_CALLERS_ONLY;
+int libxl_domain_postcopy_receive(libxl_ctx *ctx, uint32_t domid,
+                                  int recv_fd, int send_fd, int unpause,
+                                  const libxl_asyncop_how *ao_how)
+                                  LIBXL_EXTERNAL_CALLERS_ONLY;
 
 /*
  * Only suspend domain, do not save its state to file, do not destroy it.
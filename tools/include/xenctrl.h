@@ -892,10 +892,32 @@ long long xc_logdirty_control(xc_interface *xch,
                               unsigned long pages,
                               unsigned int mode,
                               xc_shadow_op_stats_t *stats);
+/*
+ * As xc_logdirty_control(), additionally filling dirty_summary with one bit
+ * per 2^XEN_DOMCTL_SHADOW_SUMMARY_ORDER pages.  Only the parts of the dirty
+ * bitmap covered by set summary bits are written.
+ */
+long long xc_logdirty_control_summary(xc_interface *xch,
+                                      uint32_t domid,
+                                      unsigned int sop,
+                                      xc_hypercall_buffer_t *dirty_bitmap,
+                                      xc_hypercall_buffer_t *dirty_summary,
+                                      unsigned long pages,
+                                      unsigned int mode,
+                                      xc_shadow_op_stats_t *stats);
 
 int xc_get_paging_mempool_size(xc_interface *xch, uint32_t domid, uint64_t *size);
 int xc_set_paging_mempool_size(xc_interface *xch, uint32_t domid, uint64_t size);
 
+/*
+ * Fill orders with the order of the p2m entry mapping each of the nr gfns
+ * from start, or XEN_DOMCTL_P2M_ORDER_NONE for gfns not mapped to RAM.
+ * x86 HVM guests only.
+ */
+int xc_domain_get_p2m_orders(xc_interface *xch, uint32_t domid,
+                             xen_pfn_t start, unsigned long nr,
+                             uint8_t *orders);
+
 int xc_sched_credit_domain_set(xc_interface *xch,
                                uint32_t domid,
                                struct xen_domctl_sched_credit *sdom);
@@ -26,6 +26,8 @@
 
 #define XCFLAGS_LIVE      (1 << 0)
 #define XCFLAGS_DEBUG     (1 << 1)
+#define XCFLAGS_COMPRESS  (1 << 2)
+#define XCFLAGS_POSTCOPY  (1 << 3)
 
 #define X86_64_B_SIZE   64 
 #define X86_32_B_SIZE   32
@@ -439,6 +441,17 @@ struct precopy_stats
     unsigned int iteration;
     unsigned long total_written;
     long dirty_count; /* -1 if unknown */
+
+    /*
+     * Measured over the previous iteration, 0 if unknown.  dirty_rate is the
+     * rate at which the guest dirtied memory, and bandwidth the rate at which
+     * memory was sent, both in pages per second.
+     */
+    unsigned long dirty_rate;
+    unsigned long bandwidth;
+
+    /* Share of its CPU time the guest is throttled to, in percent. */
+    unsigned int throttle;
 };
 
 /*
@@ -447,6 +460,26 @@ struct precopy_stats
  */
 typedef int (*precopy_policy_t)(struct precopy_stats, void *);
 
+/*
+ * Adaptive precopy policy.  Predicts the downtime of stopping now from the
+ * remaining dirty memory and the measured bandwidth, and stops the precopy
+ * phase once it is within max_downtime_ms.  If the measured dirty rate means
+ * the target will not be reached within max_iterations, the guest is
+ * throttled (if permitted) to force convergence.  The precopy phase always
+ * stops after max_iterations.
+ *
+ * May be used directly as the precopy_policy callback with data pointing to
+ * a struct xc_precopy_adaptive, or called from the caller's own policy.
+ */
+struct xc_precopy_adaptive
+{
+    unsigned int max_downtime_ms;
+    unsigned int max_iterations;
+    bool throttle;
+};
+
+int xc_precopy_policy_adaptive(struct precopy_stats stats, void *data);
+
 /* callbacks provided by xc_domain_save */
 struct save_callbacks {
     /*
@@ -467,6 +500,10 @@ struct save_callbacks {
 #define XGS_POLICY_CONTINUE_PRECOPY 0  /* Remain in the precopy phase. */
 #define XGS_POLICY_STOP_AND_COPY    1  /* Immediately suspend and transmit the
                                         * remaining dirty pages. */
+#define XGS_POLICY_THROTTLE         2  /* Remain in the precopy phase, and
+                                        * halve the guest's share of CPU time
+                                        * (via its scheduler cap) to help the
+                                        * migration converge. */
     precopy_policy_t precopy_policy;
 
     /*
@@ -534,6 +571,24 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
                    uint32_t flags, struct save_callbacks *callbacks,
                    xc_stream_type_t stream_type, int recv_fd);
 
+/**
+ * As xc_domain_save(), but additionally spreads the domain's memory across
+ * a number of auxiliary page streams, each written by its own thread.  All
+ * other records are written to io_fd.  The receiving end must restore with
+ * xc_domain_restore_streams(), using the same number of page streams,
+ * connected in the same order.
+ *
+ * Only supported for XC_STREAM_PLAIN.
+ *
+ * @param page_fds the file descriptors of the auxiliary page streams
+ * @param nr_page_fds the number of entries in page_fds.  0 is equivalent to
+ *        xc_domain_save()
+ */
+int xc_domain_save_streams(xc_interface *xch, int io_fd, uint32_t dom,
+                           uint32_t flags, struct save_callbacks *callbacks,
+                           xc_stream_type_t stream_type, int recv_fd,
+                           const int *page_fds, unsigned int nr_page_fds);
+
 /* callbacks provided by xc_domain_restore */
 struct restore_callbacks {
     /*
@@ -616,6 +671,74 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
                       xc_stream_type_t stream_type,
                       struct restore_callbacks *callbacks, int send_back_fd);
 
+/**
+ * As xc_domain_restore(), but additionally reads page data from a number of
+ * auxiliary page streams, each processed by its own thread.  See
+ * xc_domain_save_streams().
+ *
+ * @param page_fds the file descriptors of the auxiliary page streams
+ * @param nr_page_fds the number of entries in page_fds.  0 is equivalent to
+ *        xc_domain_restore()
+ */
+int xc_domain_restore_streams(xc_interface *xch, int io_fd, uint32_t dom,
+                              unsigned int store_evtchn,
+                              unsigned long *store_mfn, uint32_t store_domid,
+                              unsigned int console_evtchn,
+                              unsigned long *console_mfn,
+                              uint32_t console_domid,
+                              xc_stream_type_t stream_type,
+                              struct restore_callbacks *callbacks,
+                              int send_back_fd,
+                              const int *page_fds, unsigned int nr_page_fds);
+
+/**
+ * Post-copy live migration.
+ *
+ * A live xc_domain_save() with XCFLAGS_POSTCOPY stops after the domain has
+ * been suspended without sending the pages dirtied in the final iteration,
+ * and leaves log-dirty mode enabled to remember them.  Once the receiving
+ * end has restored the domain, the sender calls xc_domain_postcopy_send()
+ * and the receiver calls xc_domain_postcopy_receive(), each with a pair of
+ * file descriptors connected to the other end.
+ *
+ * The receiver pages the outstanding pages out of the restored domain using
+ * the mem_paging interface, resumes it, and fetches pages from the sender as
+ * the guest faults on them, while the sender pushes the remaining pages in
+ * the background.  Both functions return once every outstanding page has
+ * arrived.
+ *
+ * Only HVM guests using HAP are supported.  If paging can not be enabled on
+ * the receiving end, all outstanding pages are fetched before resuming.  A
+ * failure once the domain has been resumed on the receiving end is fatal
+ * to the guest: neither end holds a complete copy of its state.  Should the
+ * receiver fail before resuming the domain, it tells the sender, which then
+ * fails with errno set to ECANCELED, and may resume the domain itself.
+ */
+
+/**
+ * @param io_fd the file descriptor to send page data to
+ * @param dom the id of the (suspended) domain
+ * @param flags XCFLAGS_xxx.  Only XCFLAGS_COMPRESS is meaningful.
+ * @param recv_fd the file descriptor to read page requests from
+ * @return 0 on success, -1 on failure
+ */
+int xc_domain_postcopy_send(xc_interface *xch, int io_fd, uint32_t dom,
+                            uint32_t flags, int recv_fd);
+
+/**
+ * @param io_fd the file descriptor to read page data from
+ * @param dom the id of the restored, still paused, domain
+ * @param send_fd the file descriptor to send page requests to
+ * @param resume called to resume the domain once the pages which can not
+ *        be paged out have arrived.  Returns 0 on success.
+ * @param data passed to resume
+ * @return 0 on success, -1 on failure
+ */
+int xc_domain_postcopy_receive(xc_interface *xch, int io_fd, uint32_t dom,
+                               int send_fd,
+                               int (*resume)(uint32_t domid, void *data),
+                               void *data);
+
 /**
  * This function will create a domain for a paravirtualized Linux
  * using file names pointing to kernel and ramdisk
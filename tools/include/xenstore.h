@@ -48,6 +48,14 @@
  */
 #define XS_UNWATCH_FILTER     (1UL<<2)
 
+/*
+ * Setting XS_OPEN_RING makes a local connection to xenstored exchange
+ * messages via a ring in shared memory instead of the socket, which needs
+ * fewer system calls per request.  If xenstored doesn't support this the
+ * socket is used as usual.  Linux only.
+ */
+#define XS_OPEN_RING          (1UL<<3)
+
 struct xs_handle;
 typedef uint32_t xs_transaction_t;
 
@@ -174,6 +182,15 @@ bool xs_set_permissions(struct xs_handle *h, xs_transaction_t t,
  */
 bool xs_watch(struct xs_handle *h, const char *path, const char *token);
 
+/* Like xs_watch(), but further changes while an event for the watch is
+ * still queued in the daemon are merged into that event.  If the changed
+ * paths differ, the event reports path itself.  Daemons not supporting
+ * this get a normal watch set up.
+ * Returns false on failure.
+ */
+bool xs_watch_coalesce(struct xs_handle *h, const char *path,
+		       const char *token);
+
 /* Return the FD to poll on to see if a watch has fired. */
 int xs_fileno(struct xs_handle *h);
 
@@ -219,6 +236,42 @@ xs_transaction_t xs_transaction_start(struct xs_handle *h);
 bool xs_transaction_end(struct xs_handle *h, xs_transaction_t t,
 			bool abort);
 
+/* A batch of write, mkdir, rm and set_permissions operations, sent to the
+ * daemon in one request by xs_batch_commit().  The operations of a batch
+ * are limited to XENSTORE_PAYLOAD_MAX bytes in total.
+ */
+struct xs_batch;
+
+/* Allocate an empty batch.
+ * Returns NULL on failure.
+ */
+struct xs_batch *xs_batch_start(void);
+
+/* Free a batch (committed or not). */
+void xs_batch_free(struct xs_batch *b);
+
+/* Add an operation to a batch, with the semantics of the respective
+ * function without "batch_".
+ * Returns false on failure: errno == E2BIG if the batch is full.
+ */
+bool xs_batch_write(struct xs_batch *b, const char *path,
+		    const void *data, unsigned int len);
+bool xs_batch_mkdir(struct xs_batch *b, const char *path);
+bool xs_batch_rm(struct xs_batch *b, const char *path);
+bool xs_batch_set_permissions(struct xs_batch *b, const char *path,
+			      struct xs_permissions *perms,
+			      unsigned int num_perms);
+
+/* Do all operations of a batch in order.
+ * Outside of a transaction (t == XBT_NULL) either all operations take
+ * effect, or none does.  Within a transaction the transaction should be
+ * aborted on failure.  The batch is left unchanged, so it can be
+ * committed again, e.g. in a restarted transaction.
+ * Returns false on failure, with errno set by the first failing operation.
+ */
+bool xs_batch_commit(struct xs_handle *h, xs_transaction_t t,
+		     struct xs_batch *b);
+
 /* Introduce a new domain.
  * This tells the store daemon about a shared memory page, event channel and
  * store path associated with a domain: the domain uses these to communicate.
@@ -706,6 +706,40 @@ long long xc_logdirty_control(xc_interface *xch,
     return (rc == 0) ? domctl.u.shadow_op.pages : rc;
 }
 
+long long xc_logdirty_control_summary(xc_interface *xch,
+                                      uint32_t domid,
+                                      unsigned int sop,
+                                      xc_hypercall_buffer_t *dirty_bitmap,
+                                      xc_hypercall_buffer_t *dirty_summary,
+                                      unsigned long pages,
+                                      unsigned int mode,
+                                      xc_shadow_op_stats_t *stats)
+{
+    int rc;
+    struct xen_domctl domctl = {
+        .cmd         = XEN_DOMCTL_shadow_op,
+        .domain      = domid,
+        .u.shadow_op = {
+            .op    = sop,
+            .pages = pages,
+            .mode  = mode | XEN_DOMCTL_SHADOW_LOGDIRTY_SUMMARY,
+        }
+    };
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(dirty_bitmap);
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(dirty_summary);
+
+    set_xen_guest_handle(domctl.u.shadow_op.dirty_bitmap, dirty_bitmap);
+    set_xen_guest_handle(domctl.u.shadow_op.dirty_summary, dirty_summary);
+
+    rc = do_domctl(xch, &domctl);
+
+    if ( stats )
+        memcpy(stats, &domctl.u.shadow_op.stats,
+               sizeof(xc_shadow_op_stats_t));
+
+    return (rc == 0) ? domctl.u.shadow_op.pages : rc;
+}
+
 int xc_get_paging_mempool_size(xc_interface *xch, uint32_t domid, uint64_t *size)
 {
     int rc;
@@ -735,6 +769,42 @@ int xc_set_paging_mempool_size(xc_interface *xch, uint32_t domid, uint64_t size)
     return do_domctl(xch, &domctl);
 }
 
+int xc_domain_get_p2m_orders(xc_interface *xch, uint32_t domid,
+                             xen_pfn_t start, unsigned long nr,
+                             uint8_t *orders)
+{
+    DECLARE_DOMCTL;
+    DECLARE_HYPERCALL_BOUNCE(orders, nr, XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+    unsigned long done = 0;
+    int rc = 0;
+
+    if ( xc_hypercall_bounce_pre(xch, orders) )
+    {
+        PERROR("Could not bounce memory for XEN_DOMCTL_get_p2m_orders");
+        return -1;
+    }
+
+    /* The hypervisor reports as much as it can before preemption. */
+    while ( done < nr )
+    {
+        domctl.cmd = XEN_DOMCTL_get_p2m_orders;
+        domctl.domain = domid;
+        domctl.u.p2m_orders.start_gfn = start + done;
+        domctl.u.p2m_orders.nr_gfns = nr - done;
+        set_xen_guest_handle_offset(domctl.u.p2m_orders.orders, orders, done);
+
+        rc = do_domctl(xch, &domctl);
+        if ( rc )
+            break;
+
+        done += domctl.u.p2m_orders.nr_gfns;
+    }
+
+    xc_hypercall_bounce_post(xch, orders);
+
+    return rc;
+}
+
 int xc_domain_setmaxmem(xc_interface *xch,
                         uint32_t domid,
                         uint64_t max_memkb)
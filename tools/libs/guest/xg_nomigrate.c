@@ -39,6 +39,46 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
     return -1;
 }
 
+int xc_domain_save_streams(xc_interface *xch, int io_fd, uint32_t dom,
+                           uint32_t flags, struct save_callbacks *callbacks,
+                           xc_stream_type_t stream_type, int recv_fd,
+                           const int *page_fds, unsigned int nr_page_fds)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int xc_domain_restore_streams(xc_interface *xch, int io_fd, uint32_t dom,
+                              unsigned int store_evtchn,
+                              unsigned long *store_mfn, uint32_t store_domid,
+                              unsigned int console_evtchn,
+                              unsigned long *console_mfn,
+                              uint32_t console_domid,
+                              xc_stream_type_t stream_type,
+                              struct restore_callbacks *callbacks,
+                              int send_back_fd,
+                              const int *page_fds, unsigned int nr_page_fds)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int xc_domain_postcopy_send(xc_interface *xch, int io_fd, uint32_t dom,
+                            uint32_t flags, int recv_fd)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int xc_domain_postcopy_receive(xc_interface *xch, int io_fd, uint32_t dom,
+                               int send_fd,
+                               int (*resume)(uint32_t domid, void *data),
+                               void *data)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
 /*
  * Local variables:
  * mode: C
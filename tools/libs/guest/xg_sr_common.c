@@ -39,6 +39,17 @@ static const char *const mandatory_rec_types[] =
     [REC_TYPE_STATIC_DATA_END]              = "Static data end",
     [REC_TYPE_X86_CPUID_POLICY]             = "x86 CPUID policy",
     [REC_TYPE_X86_MSR_POLICY]               = "x86 MSR policy",
+    [REC_TYPE_PAGE_STREAMS]                 = "Page streams",
+    [REC_TYPE_PAGE_STREAMS_SYNC]            = "Page streams sync",
+    [REC_TYPE_COMPRESSED_PAGE_DATA]         = "Compressed page data",
+    [REC_TYPE_POSTCOPY_PFNS]                = "Post-copy pfns",
+    [REC_TYPE_POSTCOPY_REQUEST]             = "Post-copy request",
+    [REC_TYPE_POSTCOPY_ABORT]               = "Post-copy abort",
+};
+
+static const char *const optional_rec_types[] =
+{
+    [REC_TYPE_SUPERPAGES & ~REC_TYPE_OPTIONAL] = "Superpages",
 };
 
 const char *rec_type_to_str(uint32_t type)
@@ -49,12 +60,20 @@ const char *rec_type_to_str(uint32_t type)
              (mandatory_rec_types[type]) )
             return mandatory_rec_types[type];
     }
+    else
+    {
+        type &= ~REC_TYPE_OPTIONAL;
+
+        if ( (type < ARRAY_SIZE(optional_rec_types)) &&
+             (optional_rec_types[type]) )
+            return optional_rec_types[type];
+    }
 
     return "Reserved";
 }
 
-int write_split_record(struct xc_sr_context *ctx, struct xc_sr_record *rec,
-                       void *buf, size_t sz)
+int write_split_record_fd(struct xc_sr_context *ctx, int fd,
+                          struct xc_sr_record *rec, void *buf, size_t sz)
 {
     static const char zeroes[(1u << REC_ALIGN_ORDER) - 1] = { 0 };
 
@@ -81,7 +100,7 @@ int write_split_record(struct xc_sr_context *ctx, struct xc_sr_record *rec,
     if ( sz )
         assert(buf);
 
-    if ( writev_exact(ctx->fd, parts, ARRAY_SIZE(parts)) )
+    if ( writev_exact(fd, parts, ARRAY_SIZE(parts)) )
         goto err;
 
     return 0;
@@ -148,6 +167,9 @@ static void __attribute__((unused)) build_assertions(void)
     BUILD_BUG_ON(sizeof(struct xc_sr_rhdr) != 8);
 
     BUILD_BUG_ON(sizeof(struct xc_sr_rec_page_data_header)  != 8);
+    BUILD_BUG_ON(sizeof(struct xc_sr_rec_page_streams)      != 8);
+    BUILD_BUG_ON(sizeof(struct xc_sr_rec_page_streams_sync) != 8);
+    BUILD_BUG_ON(sizeof(struct xc_sr_compressed_page)       != 8);
     BUILD_BUG_ON(sizeof(struct xc_sr_rec_x86_pv_info)       != 8);
     BUILD_BUG_ON(sizeof(struct xc_sr_rec_x86_pv_p2m_frames) != 8);
     BUILD_BUG_ON(sizeof(struct xc_sr_rec_x86_pv_vcpu_hdr)   != 8);
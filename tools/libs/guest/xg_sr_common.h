@@ -2,6 +2,7 @@
 #define __COMMON__H
 
 #include <stdbool.h>
+#include <pthread.h>
 
 #include "xg_private.h"
 #include "xg_save_restore.h"
@@ -17,6 +18,8 @@ const char *rec_type_to_str(uint32_t type);
 
 struct xc_sr_context;
 struct xc_sr_record;
+struct xc_sr_postcopy;
+struct xc_sr_restore_pipeline;
 
 /**
  * Save operations.  To be implemented for each type of guest, for use by the
@@ -211,6 +214,67 @@ static inline int update_blob(struct xc_sr_blob *blob,
     return 0;
 }
 
+/*
+ * Auxiliary page data stream.  PAGE_DATA records may be spread across several
+ * of these in addition to the main stream, each serviced by its own thread.
+ * See PAGE_STREAMS in docs/specs/libxc-migration-stream.pandoc.
+ *
+ * All mutable fields are protected by the owning context's save.lock or
+ * restore.lock, as appropriate.
+ */
+struct xc_sr_page_stream
+{
+    struct xc_sr_context *ctx;
+    unsigned int id;
+    int fd;
+
+    pthread_t thread;
+    bool started;
+
+    /* Error from the worker.  Sticky. */
+    int rc;
+
+    union
+    {
+        struct /* Save data. */
+        {
+            /* Batch being filled by the main thread. */
+            xen_pfn_t *batch_pfns;
+            unsigned int nr_batch_pfns;
+
+            /* Batch being written by the worker, valid while busy. */
+            xen_pfn_t *work_pfns;
+            unsigned int nr_work_pfns;
+
+            bool busy, quit;
+        } save;
+
+        struct /* Restore data. */
+        {
+            /* Sequence number of the last PAGE_STREAMS_SYNC seen. */
+            uint32_t synced;
+
+            /* END record seen, or the worker has exited due to error. */
+            bool done;
+        } restore;
+    };
+};
+
+/*
+ * Maximum number of pfns in a single POSTCOPY_PFNS or POSTCOPY_REQUEST record.
+ */
+#define POSTCOPY_MAX_PFNS (1U << 19)
+
+/*
+ * Pages are distributed across auxiliary streams in 2M aligned chunks, so a
+ * given pfn is always sent on the same stream.
+ */
+#define PAGE_STREAM_SHIFT 9
+
+/* Orders of the superpage ranges described by SUPERPAGES records. */
+#define SUPERPAGE_2MB_SHIFT 9
+#define SUPERPAGE_1GB_SHIFT 18
+
 struct xc_sr_context
 {
     xc_interface *xch;
@@ -237,15 +301,70 @@ struct xc_sr_context
             /* Further debugging information in the stream. */
             bool debug;
 
+            /* Send page data as COMPRESSED_PAGE_DATA records. */
+            bool compress;
+
+            /*
+             * Leave the pages dirtied in the final iteration for
+             * xc_domain_postcopy_send().
+             */
+            bool postcopy;
+
+            /*
+             * Direct mapped cache of the last copy of normal pages sent,
+             * against which repeatedly dirtied pages are sent as XBZRLE
+             * deltas.  The slots are split into one region per page stream,
+             * so the stream workers never share a slot.
+             */
+            struct xc_sr_xbzrle_cache
+            {
+                bool enabled;
+                unsigned int nr_regions;
+                unsigned int region_slots;
+                xen_pfn_t *tags;
+                void *pages;
+
+                /* Statistics, protected by lock. */
+                uint64_t hits, misses, bytes_saved;
+            } xbzrle;
+
             unsigned long p2m_size;
 
             struct precopy_stats stats;
 
+            /*
+             * Throttling requested by the precopy policy.  sched_id is the
+             * scheduler whose cap has been changed, 0 if not yet throttled.
+             */
+            struct
+            {
+                unsigned int sched_id;
+                unsigned int level;
+                uint16_t orig_cap;
+            } throttle;
+
             xen_pfn_t *batch_pfns;
             unsigned int nr_batch_pfns;
             unsigned long *deferred_pages;
             unsigned long nr_deferred_pages;
+
+            /*
+             * dirty_bitmap is clear between iterations.  Log-dirty state is
+             * retrieved sparsely: Xen only writes the dirty parts of the
+             * bitmap, and marks them in dirty_summary, one bit per
+             * 2^XEN_DOMCTL_SHADOW_SUMMARY_ORDER pages.  summary_valid is
+             * cleared when bits are set in the bitmap by other means.
+             */
             xc_hypercall_buffer_t dirty_bitmap_hbuf;
+            xc_hypercall_buffer_t dirty_summary_hbuf;
+            bool summary_valid;
+
+            /* Auxiliary page data streams, and their synchronisation. */
+            struct xc_sr_page_stream *streams;
+            unsigned int nr_streams;
+            uint32_t sync_seq;
+            pthread_mutex_t lock;
+            pthread_cond_t cond;
         } save;
 
         struct /* Restore data. */
@@ -295,8 +414,34 @@ struct xc_sr_context
             unsigned long *populated_pfns;
             xen_pfn_t max_populated_pfn;
 
+            /*
+             * Ranges the sender described as 1G and 2M superpages, and not
+             * yet populated, as bitmaps of extents of each order.
+             */
+            unsigned long *superpages_1g, *superpages_2m;
+            unsigned long nr_superpages_1g, nr_superpages_2m;
+
             /* Sender has invoked verify mode on the stream. */
             bool verify;
+
+            /*
+             * Auxiliary page data streams.  The lock serialises updates to
+             * the physmap and page type tracking between the main thread
+             * and stream workers.
+             */
+            struct xc_sr_page_stream *streams;
+            unsigned int nr_streams;
+            bool streams_started;
+            uint32_t sync_released;
+            bool streams_abort;
+            pthread_mutex_t lock;
+            pthread_cond_t cond;
+
+            /* Pager state while in xc_domain_postcopy_receive(). */
+            struct xc_sr_postcopy *postcopy;
+
+            /* Reader, populate and copy threads for plain streams. */
+            struct xc_sr_restore_pipeline *pipeline;
         } restore;
     };
 
@@ -404,7 +549,7 @@ struct xc_sr_record
 };
 
 /*
- * Writes a split record to the stream, applying correct padding where
+ * Writes a split record to the stream 'fd', applying correct padding where
  * appropriate.  It is common when sending records containing blobs from Xen
  * that the header and blob data are separate.  This function accepts a second
  * buffer and length, and will merge it with the main record when sending.
@@ -414,8 +559,18 @@ struct xc_sr_record
  *
  * Returns 0 on success and non0 on failure.
  */
-int write_split_record(struct xc_sr_context *ctx, struct xc_sr_record *rec,
-                       void *buf, size_t sz);
+int write_split_record_fd(struct xc_sr_context *ctx, int fd,
+                          struct xc_sr_record *rec, void *buf, size_t sz);
+
+/*
+ * Writes a split record to the main stream.  See write_split_record_fd().
+ */
+static inline int write_split_record(struct xc_sr_context *ctx,
+                                     struct xc_sr_record *rec,
+                                     void *buf, size_t sz)
+{
+    return write_split_record_fd(ctx, ctx->fd, rec, buf, sz);
+}
 
 /*
  * Writes a record to the stream, applying correct padding where appropriate.
@@ -452,6 +607,31 @@ int read_record(struct xc_sr_context *ctx, int fd, struct xc_sr_record *rec);
 int populate_pfns(struct xc_sr_context *ctx, unsigned int count,
                   const xen_pfn_t *original_pfns, const uint32_t *types);
 
+/*
+ * Encode a page of data for a COMPRESSED_PAGE_DATA record.  'buf' must have
+ * space for a full page.  Returns the length of the encoded data, and the
+ * encoding used in 'encoding'.
+ */
+uint32_t encode_page(const void *page, void *buf, uint16_t *encoding);
+
+/*
+ * Encode 'new_page' as an XBZRLE delta against 'old_page', into at most
+ * 'buf_size' octets of 'buf'.  Returns the length of the delta, or -1 if it
+ * would not fit.
+ */
+int xbzrle_encode_page(const void *old_page, const void *new_page,
+                       void *buf, uint32_t buf_size);
+
+/*
+ * Decode a page of data from a COMPRESSED_PAGE_DATA record into 'page'.  For
+ * an XBZRLE delta, 'page' must hold the previous contents of the page, which
+ * are updated in place.
+ *
+ * Returns 0 on success and non-0 on failure.
+ */
+int decode_page(struct xc_sr_context *ctx, uint16_t encoding,
+                const void *data, uint32_t length, void *page);
+
 /* Handle a STATIC_DATA_END record. */
 int handle_static_data_end(struct xc_sr_context *ctx);
 
@@ -0,0 +1,336 @@
+/*
+ * Page encodings for the COMPRESSED_PAGE_DATA record.
+ *
+ * The LZ4 encoder produces plain LZ4 block format, and is decoded with the
+ * LZ4 decompressor shared with the domain builder.
+ *
+ * An XBZRLE delta is a sequence of (skip, count, data[count]) runs against
+ * the previous contents of the page, with skip and count as ULEB128 values.
+ * Bytes not covered by a run are unchanged.
+ */
+
+#include "xg_sr_common.h"
+
+#include "../../xen/include/xen/lz4.h"
+
+/* Parsing restrictions from the LZ4 block format. */
+#define LZ4_MIN_MATCH      4
+#define LZ4_LAST_LITERALS  5
+#define LZ4_MF_LIMIT       12
+#define LZ4_RUN_MASK       15
+#define LZ4_ML_MASK        15
+
+#define LZ4_HASH_BITS      12
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline unsigned int lz4_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+/* Write an LZ4 length extension of 'len', which is >= the field mask. */
+static uint8_t *lz4_put_length(uint8_t *op, size_t len)
+{
+    for ( ; len >= 255; len -= 255 )
+        *op++ = 255;
+    *op++ = len;
+
+    return op;
+}
+
+/*
+ * Greedy single pass LZ4 compression of one page.  Returns the length of the
+ * compressed data, or 0 if it would not fit in 'dst_size' octets.
+ */
+static size_t lz4_compress_page(const uint8_t *src, uint8_t *dst,
+                                size_t dst_size)
+{
+    uint16_t table[1U << LZ4_HASH_BITS] = { 0 };
+    const uint8_t *ip = src + 1, *anchor = src;
+    const uint8_t *const iend = src + PAGE_SIZE;
+    const uint8_t *const mflimit = iend - LZ4_MF_LIMIT;
+    const uint8_t *const matchlimit = iend - LZ4_LAST_LITERALS;
+    uint8_t *op = dst, *const oend = dst + dst_size;
+    const uint8_t *ref, *mp, *rp;
+    uint8_t *token;
+    size_t lit, mlen, offset;
+    uint32_t seq;
+    unsigned int h;
+
+    while ( ip < mflimit )
+    {
+        seq = read32(ip);
+        h = lz4_hash(seq);
+        ref = src + table[h];
+        table[h] = ip - src;
+
+        if ( read32(ref) != seq )
+        {
+            ++ip;
+            continue;
+        }
+
+        for ( mp = ip + LZ4_MIN_MATCH, rp = ref + LZ4_MIN_MATCH;
+              mp < matchlimit && *mp == *rp; ++mp, ++rp )
+            ;
+
+        offset = ip - ref;
+        lit = ip - anchor;
+        mlen = mp - ip - LZ4_MIN_MATCH;
+
+        /* Token, literals, offset and worst case length extensions. */
+        if ( op + 1 + lit + (lit / 255) + 1 + 2 + (mlen / 255) + 1 > oend )
+            return 0;
+
+        token = op++;
+        if ( lit >= LZ4_RUN_MASK )
+        {
+            *token = LZ4_RUN_MASK << 4;
+            op = lz4_put_length(op, lit - LZ4_RUN_MASK);
+        }
+        else
+            *token = lit << 4;
+
+        memcpy(op, anchor, lit);
+        op += lit;
+
+        *op++ = offset & 0xff;
+        *op++ = offset >> 8;
+
+        if ( mlen >= LZ4_ML_MASK )
+        {
+            *token |= LZ4_ML_MASK;
+            op = lz4_put_length(op, mlen - LZ4_ML_MASK);
+        }
+        else
+            *token |= mlen;
+
+        ip = anchor = mp;
+    }
+
+    /* Final run of literals. */
+    lit = iend - anchor;
+    if ( op + 1 + lit + (lit / 255) + 1 > oend )
+        return 0;
+
+    token = op++;
+    if ( lit >= LZ4_RUN_MASK )
+    {
+        *token = LZ4_RUN_MASK << 4;
+        op = lz4_put_length(op, lit - LZ4_RUN_MASK);
+    }
+    else
+        *token = lit << 4;
+
+    memcpy(op, anchor, lit);
+    op += lit;
+
+    return op - dst;
+}
+
+static bool page_is_zero(const void *page)
+{
+    const unsigned long *p = page;
+    unsigned int i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*p); ++i )
+        if ( p[i] )
+            return false;
+
+    return true;
+}
+
+uint32_t encode_page(const void *page, void *buf, uint16_t *encoding)
+{
+    size_t len;
+
+    if ( page_is_zero(page) )
+    {
+        *encoding = PAGE_ENCODING_ZERO;
+        return 0;
+    }
+
+    /* Only bother if at least an eighth of the page is saved. */
+    len = lz4_compress_page(page, buf, PAGE_SIZE - (PAGE_SIZE / 8));
+    if ( len )
+    {
+        *encoding = PAGE_ENCODING_LZ4;
+        return len;
+    }
+
+    memcpy(buf, page, PAGE_SIZE);
+    *encoding = PAGE_ENCODING_RAW;
+    return PAGE_SIZE;
+}
+
+static uint8_t *put_uleb128(uint8_t *p, uint32_t v)
+{
+    for ( ; v >= 0x80; v >>= 7 )
+        *p++ = v | 0x80;
+    *p++ = v;
+
+    return p;
+}
+
+static const uint8_t *get_uleb128(const uint8_t *p, const uint8_t *end,
+                                  uint32_t *v)
+{
+    unsigned int shift;
+
+    for ( *v = 0, shift = 0; p < end && shift < 32; shift += 7 )
+    {
+        *v |= (uint32_t)(*p & 0x7f) << shift;
+        if ( !(*p++ & 0x80) )
+            return p;
+    }
+
+    return NULL;
+}
+
+static inline unsigned long read_ulong(const uint8_t *p)
+{
+    unsigned long v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+int xbzrle_encode_page(const void *old_page, const void *new_page,
+                       void *buf, uint32_t buf_size)
+{
+    const uint8_t *old = old_page, *new = new_page;
+    uint8_t *op = buf, *const oend = op + buf_size;
+    unsigned int i = 0, start, skip, count;
+
+    while ( i < PAGE_SIZE )
+    {
+        /* Unchanged bytes, a word at a time where possible. */
+        for ( start = i; i < PAGE_SIZE; ++i )
+        {
+            while ( i < PAGE_SIZE && !(i % sizeof(unsigned long)) &&
+                    read_ulong(old + i) == read_ulong(new + i) )
+                i += sizeof(unsigned long);
+
+            if ( i == PAGE_SIZE || old[i] != new[i] )
+                break;
+        }
+
+        if ( i == PAGE_SIZE )
+            break;
+
+        skip = i - start;
+
+        /*
+         * Changed bytes.  A single unchanged byte is cheaper to resend than
+         * to start a new run for.
+         */
+        for ( start = i; i < PAGE_SIZE; ++i )
+            if ( old[i] == new[i] &&
+                 (i + 1 == PAGE_SIZE || old[i + 1] == new[i + 1]) )
+                break;
+
+        count = i - start;
+
+        /* Each ULEB128 value is at most 2 octets for a 4k page. */
+        if ( op + 4 + count > oend )
+            return -1;
+
+        op = put_uleb128(op, skip);
+        op = put_uleb128(op, count);
+        memcpy(op, new + start, count);
+        op += count;
+    }
+
+    return op - (uint8_t *)buf;
+}
+
+static int xbzrle_decode_page(const uint8_t *data, uint32_t length,
+                              uint8_t *page)
+{
+    const uint8_t *p = data, *const end = data + length;
+    uint32_t pos = 0, skip, count;
+
+    while ( p < end )
+    {
+        p = get_uleb128(p, end, &skip);
+        if ( p )
+            p = get_uleb128(p, end, &count);
+        if ( !p || skip > PAGE_SIZE - pos || count > PAGE_SIZE - pos - skip ||
+             count > end - p )
+            return -1;
+
+        pos += skip;
+        memcpy(page + pos, p, count);
+        pos += count;
+        p += count;
+    }
+
+    return 0;
+}
+
+int decode_page(struct xc_sr_context *ctx, uint16_t encoding,
+                const void *data, uint32_t length, void *page)
+{
+    xc_interface *xch = ctx->xch;
+    size_t out_len = PAGE_SIZE;
+
+    switch ( encoding )
+    {
+    case PAGE_ENCODING_RAW:
+        if ( length != PAGE_SIZE )
+            break;
+        memcpy(page, data, PAGE_SIZE);
+        return 0;
+
+    case PAGE_ENCODING_ZERO:
+        if ( length != 0 )
+            break;
+        memset(page, 0, PAGE_SIZE);
+        return 0;
+
+    case PAGE_ENCODING_LZ4:
+        if ( length == 0 || length >= PAGE_SIZE )
+            break;
+        if ( lz4_decompress_unknownoutputsize(data, length, page, &out_len) ||
+             out_len != PAGE_SIZE )
+        {
+            ERROR("Corrupt LZ4 page data (length %u)", length);
+            return -1;
+        }
+        return 0;
+
+    case PAGE_ENCODING_XBZRLE:
+        if ( length >= PAGE_SIZE )
+            break;
+        if ( xbzrle_decode_page(data, length, page) )
+        {
+            ERROR("Corrupt XBZRLE page data (length %u)", length);
+            return -1;
+        }
+        return 0;
+
+    default:
+        ERROR("Unknown page encoding %u", encoding);
+        return -1;
+    }
+
+    ERROR("Invalid length %u for page encoding %u", length, encoding);
+    return -1;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -1,6 +1,10 @@
 #include <arpa/inet.h>
 
 #include <assert.h>
+#include <poll.h>
+
+#include <xenevtchn.h>
+#include <xen/vm_event.h>
 
 #include "xg_sr_common.h"
 
@@ -129,6 +133,111 @@ static int pfn_set_populated(struct xc_sr_context *ctx, xen_pfn_t pfn)
     return 0;
 }
 
+/*
+ * Grow a bitmap of superpage extents to cover at least nr extents.
+ */
+static int superpages_grow(struct xc_sr_context *ctx, unsigned long **bitmap,
+                           unsigned long *size, unsigned long nr)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned long *p;
+
+    if ( nr <= *size )
+        return 0;
+
+    p = realloc(*bitmap, bitmap_size(nr));
+    if ( !p )
+    {
+        ERROR("Failed to realloc superpage bitmap");
+        errno = ENOMEM;
+        return -1;
+    }
+
+    memset((uint8_t *)p + bitmap_size(*size), 0x00,
+           bitmap_size(nr) - bitmap_size(*size));
+
+    *bitmap = p;
+    *size = nr;
+
+    return 0;
+}
+
+/*
+ * Populate an aligned range of 2^order pfns as a single extent, if none of
+ * it is populated yet.  Returns 1 if the range was populated, 0 if not, or
+ * -1 on error.
+ */
+static int populate_extent(struct xc_sr_context *ctx, xen_pfn_t base,
+                           unsigned int order)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned long i, nr = 1UL << order;
+    xen_pfn_t extent = base;
+
+    for ( i = 0; i < nr; ++i )
+        if ( pfn_is_populated(ctx, base + i) )
+            return 0;
+
+    /*
+     * Only used for HVM guests, for which the extent list isn't written back
+     * and set_gfn() is a no-op.
+     */
+    if ( xc_domain_populate_physmap(xch, ctx->domid, 1, order, 0,
+                                    &extent) != 1 )
+    {
+        DPRINTF("Unable to populate order %u superpage at pfn %#"PRIpfn,
+                order, base);
+        return 0;
+    }
+
+    /* Setting the last pfn first expands the bitmap to cover the range. */
+    if ( pfn_set_populated(ctx, base + nr - 1) )
+        return -1;
+
+    for ( i = 0; i < nr - 1; ++i )
+        set_bit(base + i, ctx->restore.populated_pfns);
+
+    return 1;
+}
+
+/*
+ * If pfn lies in a range the sender described as a superpage, populate the
+ * whole range at once.  Each range is tried only once, and a 1G range which
+ * Xen can't find the memory for falls back to its 2M ranges.  Returns 1 if
+ * pfn was populated, 0 if not, or -1 on error.
+ */
+static int populate_superpage(struct xc_sr_context *ctx, xen_pfn_t pfn)
+{
+    unsigned long idx = pfn >> SUPERPAGE_1GB_SHIFT, i;
+    unsigned int sub = SUPERPAGE_1GB_SHIFT - SUPERPAGE_2MB_SHIFT;
+    int rc;
+
+    if ( idx < ctx->restore.nr_superpages_1g &&
+         test_and_clear_bit(idx, ctx->restore.superpages_1g) )
+    {
+        rc = populate_extent(ctx, idx << SUPERPAGE_1GB_SHIFT,
+                             SUPERPAGE_1GB_SHIFT);
+        if ( rc )
+            return rc;
+
+        if ( superpages_grow(ctx, &ctx->restore.superpages_2m,
+                             &ctx->restore.nr_superpages_2m,
+                             (idx + 1) << sub) )
+            return -1;
+
+        for ( i = idx << sub; i < (idx + 1) << sub; ++i )
+            set_bit(i, ctx->restore.superpages_2m);
+    }
+
+    idx = pfn >> SUPERPAGE_2MB_SHIFT;
+    if ( idx < ctx->restore.nr_superpages_2m &&
+         test_and_clear_bit(idx, ctx->restore.superpages_2m) )
+        return populate_extent(ctx, idx << SUPERPAGE_2MB_SHIFT,
+                               SUPERPAGE_2MB_SHIFT);
+
+    return 0;
+}
+
 /*
  * Given a set of pfns, obtain memory from Xen to fill the physmap for the
  * unpopulated subset.  If types is NULL, no page type checking is performed
@@ -155,6 +264,12 @@ int populate_pfns(struct xc_sr_context *ctx, unsigned int count,
         if ( (!types || page_type_to_populate(types[i])) &&
              !pfn_is_populated(ctx, original_pfns[i]) )
         {
+            rc = populate_superpage(ctx, original_pfns[i]);
+            if ( rc < 0 )
+                goto err;
+            if ( rc )
+                continue;
+
             rc = pfn_set_populated(ctx, original_pfns[i]);
             if ( rc )
                 goto err;
@@ -220,9 +335,16 @@ static int process_page_data(struct xc_sr_context *ctx, unsigned int count,
         goto err;
     }
 
+    /*
+     * Physmap and page type tracking are shared with any page stream
+     * workers.  Only the mapping and copying of data runs in parallel.
+     */
+    pthread_mutex_lock(&ctx->restore.lock);
+
     rc = populate_pfns(ctx, count, pfns, types);
     if ( rc )
     {
+        pthread_mutex_unlock(&ctx->restore.lock);
         ERROR("Failed to populate pfns for batch of %u pages", count);
         goto err;
     }
@@ -235,6 +357,8 @@ static int process_page_data(struct xc_sr_context *ctx, unsigned int count,
             mfns[nr_pages++] = ctx->restore.ops.pfn_to_gfn(ctx, pfns[i]);
     }
 
+    pthread_mutex_unlock(&ctx->restore.lock);
+
     /* Nothing to do? */
     if ( nr_pages == 0 )
         goto done;
@@ -263,8 +387,18 @@ static int process_page_data(struct xc_sr_context *ctx, unsigned int count,
             goto err;
         }
 
-        /* Undo page normalisation done by the saver. */
-        rc = ctx->restore.ops.localise_page(ctx, types[i], page_data);
+        /*
+         * Undo page normalisation done by the saver.  Pagetables may refer to
+         * other pfns, so need to consult (and possibly populate) the physmap.
+         */
+        if ( types[i] != XEN_DOMCTL_PFINFO_NOTAB )
+        {
+            pthread_mutex_lock(&ctx->restore.lock);
+            rc = ctx->restore.ops.localise_page(ctx, types[i], page_data);
+            pthread_mutex_unlock(&ctx->restore.lock);
+        }
+        else
+            rc = ctx->restore.ops.localise_page(ctx, types[i], page_data);
         if ( rc )
         {
             ERROR("Failed to localise pfn %#"PRIpfn" (type %#"PRIx32")",
@@ -304,10 +438,209 @@ static int process_page_data(struct xc_sr_context *ctx, unsigned int count,
 }
 
 /*
- * Validate a PAGE_DATA record from the stream, and pass the results to
- * process_page_data() to actually perform the legwork.
+ * Copy the current contents of the pages which XBZRLE deltas apply to into
+ * their slots in 'buf'.  Such pages must be normal pages which have already
+ * been received.
  */
-static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
+static int read_delta_bases(struct xc_sr_context *ctx, unsigned int count,
+                            const xen_pfn_t *pfns, const uint32_t *types,
+                            const struct xc_sr_compressed_page *descs,
+                            uint8_t *buf)
+{
+    xc_interface *xch = ctx->xch;
+    xen_pfn_t *gfns = malloc(count * sizeof(*gfns));
+    unsigned int *slots = malloc(count * sizeof(*slots));
+    int *map_errs = malloc(count * sizeof(*map_errs));
+    unsigned int i, p, nr = 0;
+    void *mapping = NULL;
+    int rc = -1;
+
+    if ( !gfns || !slots || !map_errs )
+    {
+        ERROR("Failed to allocate memory for %u delta pages", count);
+        goto err;
+    }
+
+    pthread_mutex_lock(&ctx->restore.lock);
+    for ( i = 0, p = 0; i < count; ++i )
+    {
+        if ( !page_type_has_stream_data(types[i]) )
+            continue;
+
+        if ( descs[p].encoding == PAGE_ENCODING_XBZRLE )
+        {
+            if ( types[i] != XEN_DOMCTL_PFINFO_NOTAB ||
+                 !pfn_is_populated(ctx, pfns[i]) )
+            {
+                pthread_mutex_unlock(&ctx->restore.lock);
+                ERROR("XBZRLE delta for pfn %#"PRIpfn" with no previous page",
+                      pfns[i]);
+                goto err;
+            }
+
+            gfns[nr] = ctx->restore.ops.pfn_to_gfn(ctx, pfns[i]);
+            slots[nr++] = p;
+        }
+        ++p;
+    }
+    pthread_mutex_unlock(&ctx->restore.lock);
+
+    if ( nr == 0 )
+    {
+        rc = 0;
+        goto err;
+    }
+
+    mapping = xenforeignmemory_map(xch->fmem, ctx->domid, PROT_READ,
+                                   nr, gfns, map_errs);
+    if ( !mapping )
+    {
+        PERROR("Unable to map %u pages for XBZRLE deltas", nr);
+        goto err;
+    }
+
+    for ( i = 0; i < nr; ++i )
+    {
+        if ( map_errs[i] )
+        {
+            ERROR("Mapping gfn %#"PRIpfn" for XBZRLE delta failed with %d",
+                  gfns[i], map_errs[i]);
+            goto err;
+        }
+
+        memcpy(buf + ((size_t)slots[i] * PAGE_SIZE),
+               mapping + ((size_t)i * PAGE_SIZE), PAGE_SIZE);
+    }
+
+    rc = 0;
+
+ err:
+    if ( mapping )
+        xenforeignmemory_unmap(xch->fmem, mapping, nr);
+    free(map_errs);
+    free(slots);
+    free(gfns);
+
+    return rc;
+}
+
+/*
+ * Validate the page descriptors of a COMPRESSED_PAGE_DATA record, which follow
+ * the pfn array as 'pages_of_data' descriptors and then the encoded pages.
+ * Returns the descriptors, and the start of the encoded data in '*enc', or
+ * NULL if the record is malformed.
+ */
+static struct xc_sr_compressed_page *compressed_page_descs(
+    struct xc_sr_context *ctx, struct xc_sr_record *rec, unsigned int count,
+    unsigned int pages_of_data, const uint8_t **enc, unsigned int *nr_deltas)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_page_data_header *pages = rec->data;
+    struct xc_sr_compressed_page *descs =
+        (struct xc_sr_compressed_page *)&pages->pfn[count];
+    size_t hdr_len = sizeof(*pages) + (sizeof(uint64_t) * count) +
+        (sizeof(*descs) * pages_of_data);
+    size_t enc_len = 0;
+    unsigned int i;
+
+    if ( rec->length < hdr_len )
+    {
+        ERROR("COMPRESSED_PAGE_DATA record (length %u) too short to contain "
+              "%u page descriptors", rec->length, pages_of_data);
+        return NULL;
+    }
+
+    for ( i = 0, *nr_deltas = 0; i < pages_of_data; ++i )
+    {
+        enc_len += descs[i].length;
+        if ( descs[i].encoding == PAGE_ENCODING_XBZRLE )
+            ++*nr_deltas;
+    }
+
+    if ( rec->length != hdr_len + enc_len )
+    {
+        ERROR("COMPRESSED_PAGE_DATA record wrong size: length %u, expected "
+              "%zu + %zu", rec->length, hdr_len, enc_len);
+        return NULL;
+    }
+
+    *enc = rec->data + hdr_len;
+
+    return descs;
+}
+
+/*
+ * Decode the page data of a COMPRESSED_PAGE_DATA record.  On success, '*data'
+ * is a newly allocated buffer of 'pages_of_data' plain pages.
+ */
+static int decode_compressed_pages(struct xc_sr_context *ctx,
+                                   struct xc_sr_record *rec,
+                                   unsigned int count, const xen_pfn_t *pfns,
+                                   const uint32_t *types,
+                                   unsigned int pages_of_data, void **data)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_compressed_page *descs;
+    const uint8_t *enc;
+    uint8_t *buf;
+    unsigned int i, nr_deltas;
+
+    descs = compressed_page_descs(ctx, rec, count, pages_of_data,
+                                  &enc, &nr_deltas);
+    if ( !descs )
+        return -1;
+
+    /* Post-copy pages are sent once, and the base may be paged out. */
+    if ( nr_deltas && ctx->restore.postcopy )
+    {
+        ERROR("XBZRLE delta in post-copy page data");
+        return -1;
+    }
+
+    buf = malloc((size_t)pages_of_data * PAGE_SIZE);
+    if ( !buf && pages_of_data )
+    {
+        ERROR("Unable to allocate %u pages for decompression", pages_of_data);
+        return -1;
+    }
+
+    if ( nr_deltas &&
+         read_delta_bases(ctx, count, pfns, types, descs, buf) )
+    {
+        free(buf);
+        return -1;
+    }
+
+    for ( i = 0; i < pages_of_data; ++i )
+    {
+        if ( decode_page(ctx, descs[i].encoding, enc, descs[i].length,
+                         buf + ((size_t)i * PAGE_SIZE)) )
+        {
+            ERROR("Failed to decode page %u of %u", i, pages_of_data);
+            free(buf);
+            return -1;
+        }
+        enc += descs[i].length;
+    }
+
+    *data = buf;
+    return 0;
+}
+
+static int postcopy_load_pages(struct xc_sr_context *ctx, unsigned int count,
+                               const xen_pfn_t *pfns, const uint32_t *types,
+                               void *page_data);
+
+/*
+ * Validate a PAGE_DATA or COMPRESSED_PAGE_DATA record from the stream, and
+ * extract its pfns and types.  The page data of a PAGE_DATA record is fully
+ * checked here; that of a COMPRESSED_PAGE_DATA record is checked when it is
+ * decoded.  On success, '*pfns_out' and '*types_out' are newly allocated
+ * arrays of one entry per pfn in the record.
+ */
+static int parse_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec,
+                           xen_pfn_t **pfns_out, uint32_t **types_out,
+                           unsigned int *pages_of_data_out)
 {
     xc_interface *xch = ctx->xch;
     struct xc_sr_rec_page_data_header *pages = rec->data;
@@ -397,7 +730,8 @@ static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
         types[i] = type;
     }
 
-    if ( rec->length != (sizeof(*pages) +
+    if ( rec->type == REC_TYPE_PAGE_DATA &&
+         rec->length != (sizeof(*pages) +
                          (sizeof(uint64_t) * pages->count) +
                          (PAGE_SIZE * pages_of_data)) )
     {
@@ -407,8 +741,12 @@ static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
         goto err;
     }
 
-    rc = process_page_data(ctx, pages->count, pfns, types,
-                           &pages->pfn[pages->count]);
+    *pfns_out = pfns;
+    *types_out = types;
+    *pages_of_data_out = pages_of_data;
+
+    return 0;
+
  err:
     free(types);
     free(pfns);
@@ -417,443 +755,2604 @@ static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
 }
 
 /*
- * Send checkpoint dirty pfn list to primary.
+ * Validate a PAGE_DATA or COMPRESSED_PAGE_DATA record from the stream, and
+ * pass the results to process_page_data() to actually perform the legwork.
  */
-static int send_checkpoint_dirty_pfn_list(struct xc_sr_context *ctx)
+static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
 {
-    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_page_data_header *pages = rec->data;
+    unsigned int pages_of_data;
     int rc = -1;
-    unsigned int count, written;
-    uint64_t i, *pfns = NULL;
-    struct iovec *iov = NULL;
-    xc_shadow_op_stats_t stats = { 0, ctx->restore.p2m_size };
-    struct xc_sr_record rec = {
-        .type = REC_TYPE_CHECKPOINT_DIRTY_PFN_LIST,
-    };
-    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
-                                    &ctx->restore.dirty_bitmap_hbuf);
 
-    if ( xc_logdirty_control(
-             xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
-             HYPERCALL_BUFFER(dirty_bitmap), ctx->restore.p2m_size,
-             0, &stats) != ctx->restore.p2m_size )
-    {
-        PERROR("Failed to retrieve logdirty bitmap");
-        goto err;
-    }
+    xen_pfn_t *pfns;
+    uint32_t *types;
+    void *data, *decoded = NULL;
 
-    for ( i = 0, count = 0; i < ctx->restore.p2m_size; i++ )
+    if ( parse_page_data(ctx, rec, &pfns, &types, &pages_of_data) )
+        return -1;
+
+    if ( rec->type == REC_TYPE_COMPRESSED_PAGE_DATA )
     {
-        if ( test_bit(i, dirty_bitmap) )
-            count++;
+        if ( decode_compressed_pages(ctx, rec, pages->count, pfns, types,
+                                     pages_of_data, &decoded) )
+            goto err;
+        data = decoded;
     }
+    else
+        data = &pages->pfn[pages->count];
 
+    if ( ctx->restore.postcopy )
+        rc = postcopy_load_pages(ctx, pages->count, pfns, types, data);
+    else
+        rc = process_page_data(ctx, pages->count, pfns, types, data);
+ err:
+    free(decoded);
+    free(types);
+    free(pfns);
 
-    pfns = malloc(count * sizeof(*pfns));
-    if ( !pfns )
-    {
-        ERROR("Unable to allocate %zu bytes of memory for dirty pfn list",
-              count * sizeof(*pfns));
-        goto err;
-    }
+    return rc;
+}
 
-    for ( i = 0, written = 0; i < ctx->restore.p2m_size; ++i )
+/*
+ * Page stream worker.  Processes PAGE_DATA records from its auxiliary stream
+ * until an END record is found, waiting at each sync point for the main
+ * stream to catch up.
+ */
+static void *page_stream_worker(void *arg)
+{
+    struct xc_sr_page_stream *s = arg;
+    struct xc_sr_context *ctx = s->ctx;
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_page_streams_sync *sync;
+    struct xc_sr_record rec;
+    int rc;
+
+    /* Only permit cancellation while blocked reading from the stream. */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    for ( ; ; )
     {
-        if ( !test_bit(i, dirty_bitmap) )
-            continue;
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        rc = read_record(ctx, s->fd, &rec);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if ( rc )
+            break;
 
-        if ( written > count )
+        switch ( rec.type )
         {
-            ERROR("Dirty pfn list exceed");
-            goto err;
+        case REC_TYPE_END:
+            break;
+
+        case REC_TYPE_PAGE_DATA:
+        case REC_TYPE_COMPRESSED_PAGE_DATA:
+            rc = handle_page_data(ctx, &rec);
+            break;
+
+        case REC_TYPE_PAGE_STREAMS_SYNC:
+            if ( rec.length != sizeof(*sync) )
+            {
+                ERROR("PAGE_STREAMS_SYNC record wrong size: length %u,"
+                      " expected %zu", rec.length, sizeof(*sync));
+                rc = -1;
+                break;
+            }
+            sync = rec.data;
+
+            pthread_mutex_lock(&ctx->restore.lock);
+            s->restore.synced = sync->seq;
+            pthread_cond_broadcast(&ctx->restore.cond);
+            while ( ctx->restore.sync_released != sync->seq &&
+                    !ctx->restore.streams_abort )
+                pthread_cond_wait(&ctx->restore.cond, &ctx->restore.lock);
+            if ( ctx->restore.streams_abort )
+                rc = -1;
+            pthread_mutex_unlock(&ctx->restore.lock);
+            break;
+
+        default:
+            ERROR("Unexpected record %#x (%s) in page stream %u",
+                  rec.type, rec_type_to_str(rec.type), s->id);
+            rc = -1;
+            break;
         }
 
-        pfns[written++] = i;
-    }
+        free(rec.data);
 
-    /* iovec[] for writev(). */
-    iov = malloc(3 * sizeof(*iov));
-    if ( !iov )
-    {
-        ERROR("Unable to allocate memory for sending dirty bitmap");
-        goto err;
+        if ( rc || rec.type == REC_TYPE_END )
+            break;
     }
 
-    rec.length = count * sizeof(*pfns);
+    pthread_mutex_lock(&ctx->restore.lock);
+    s->rc = rc;
+    s->restore.done = true;
+    pthread_cond_broadcast(&ctx->restore.cond);
+    pthread_mutex_unlock(&ctx->restore.lock);
 
-    iov[0].iov_base = &rec.type;
-    iov[0].iov_len = sizeof(rec.type);
+    return NULL;
+}
 
-    iov[1].iov_base = &rec.length;
-    iov[1].iov_len = sizeof(rec.length);
+/*
+ * Handle a SUPERPAGES record, noting the ranges to populate as superpages
+ * when page data for them first arrives.  Only HVM guests are populated with
+ * superpages.
+ */
+static int handle_superpages(struct xc_sr_context *ctx,
+                             struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_superpages *sp = rec->data;
+    unsigned long **bitmap, *size, idx;
+    unsigned int i, count;
+    int rc = -1;
 
-    iov[2].iov_base = pfns;
-    iov[2].iov_len = count * sizeof(*pfns);
+    if ( rec->length < sizeof(*sp) ||
+         (rec->length - sizeof(*sp)) % sizeof(sp->pfn[0]) )
+    {
+        ERROR("SUPERPAGES record wrong size: length %u", rec->length);
+        return -1;
+    }
 
-    if ( writev_exact(ctx->restore.send_back_fd, iov, 3) )
+    if ( !ctx->dominfo.hvm )
     {
-        PERROR("Failed to write dirty bitmap to stream");
-        goto err;
+        DPRINTF("Ignoring superpages for PV guest");
+        return 0;
     }
 
-    rc = 0;
- err:
-    free(pfns);
-    free(iov);
-    return rc;
-}
+    switch ( sp->order )
+    {
+    case SUPERPAGE_1GB_SHIFT:
+        bitmap = &ctx->restore.superpages_1g;
+        size = &ctx->restore.nr_superpages_1g;
+        break;
+
+    case SUPERPAGE_2MB_SHIFT:
+        bitmap = &ctx->restore.superpages_2m;
+        size = &ctx->restore.nr_superpages_2m;
+        break;
+
+    default:
+        DPRINTF("Ignoring superpages of order %u", sp->order);
+        return 0;
+    }
+
+    count = (rec->length - sizeof(*sp)) / sizeof(sp->pfn[0]);
+
+    pthread_mutex_lock(&ctx->restore.lock);
+
+    for ( i = 0; i < count; ++i )
+    {
+        if ( sp->pfn[i] & ((1ULL << sp->order) - 1) )
+        {
+            ERROR("Superpage pfn %#"PRIx64" not aligned to order %u",
+                  sp->pfn[i], sp->order);
+            goto err;
+        }
+
+        idx = sp->pfn[i] >> sp->order;
+        if ( superpages_grow(ctx, bitmap, size, idx + 1) )
+            goto err;
+
+        set_bit(idx, *bitmap);
+    }
+
+    DPRINTF("%u order %u superpages", count, sp->order);
+    rc = 0;
+
+ err:
+    pthread_mutex_unlock(&ctx->restore.lock);
+
+    return rc;
+}
+
+/*
+ * Handle a PAGE_STREAMS record, starting a worker for each auxiliary stream.
+ */
+static int handle_page_streams(struct xc_sr_context *ctx,
+                               struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_page_streams *info = rec->data;
+    struct xc_sr_page_stream *s;
+    unsigned int i;
+    int rc;
+
+    if ( rec->length != sizeof(*info) )
+    {
+        ERROR("PAGE_STREAMS record wrong size: length %u, expected %zu",
+              rec->length, sizeof(*info));
+        return -1;
+    }
+
+    if ( ctx->restore.streams_started )
+    {
+        ERROR("Multiple PAGE_STREAMS records found");
+        return -1;
+    }
+
+    if ( !ctx->restore.seen_static_data_end )
+    {
+        ERROR("PAGE_STREAMS record ahead of STATIC_DATA_END");
+        return -1;
+    }
+
+    if ( info->count != ctx->restore.nr_streams )
+    {
+        ERROR("Stream uses %u page streams, but %u were provided",
+              info->count, ctx->restore.nr_streams);
+        return -1;
+    }
+
+    ctx->restore.streams_started = true;
+
+    for ( i = 0; i < ctx->restore.nr_streams; ++i )
+    {
+        s = &ctx->restore.streams[i];
+
+        rc = pthread_create(&s->thread, NULL, page_stream_worker, s);
+        if ( rc )
+        {
+            errno = rc;
+            PERROR("Unable to start worker for page stream %u", i);
+            return -1;
+        }
+        s->started = true;
+    }
+
+    DPRINTF("Started %u page streams", ctx->restore.nr_streams);
+
+    return 0;
+}
+
+/*
+ * Handle a PAGE_STREAMS_SYNC record on the main stream.  Wait for every page
+ * stream to reach the same sync point, then release them.
+ */
+static int handle_page_streams_sync(struct xc_sr_context *ctx,
+                                    struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_page_streams_sync *sync = rec->data;
+    struct xc_sr_page_stream *s;
+    unsigned int i;
+    int rc = 0;
+
+    if ( rec->length != sizeof(*sync) )
+    {
+        ERROR("PAGE_STREAMS_SYNC record wrong size: length %u, expected %zu",
+              rec->length, sizeof(*sync));
+        return -1;
+    }
+
+    if ( !ctx->restore.streams_started )
+    {
+        ERROR("PAGE_STREAMS_SYNC record without PAGE_STREAMS");
+        return -1;
+    }
+
+    pthread_mutex_lock(&ctx->restore.lock);
+
+    for ( i = 0; i < ctx->restore.nr_streams; ++i )
+    {
+        s = &ctx->restore.streams[i];
+
+        while ( s->restore.synced != sync->seq && !s->restore.done )
+            pthread_cond_wait(&ctx->restore.cond, &ctx->restore.lock);
+
+        if ( s->restore.synced != sync->seq )
+        {
+            ERROR("Page stream %u failed before sync point %u",
+                  i, sync->seq);
+            rc = -1;
+            break;
+        }
+    }
+
+    if ( !rc )
+    {
+        ctx->restore.sync_released = sync->seq;
+        pthread_cond_broadcast(&ctx->restore.cond);
+    }
+
+    pthread_mutex_unlock(&ctx->restore.lock);
+
+    return rc;
+}
+
+/*
+ * Stop the page stream workers.  On success, they are expected to have found
+ * their END records.  Otherwise, they are told to abort, and cancelled in
+ * case they are blocked reading from their stream.
+ */
+static int stop_page_streams(struct xc_sr_context *ctx, bool abort)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_page_stream *s;
+    unsigned int i;
+    int rc = 0;
+
+    if ( abort )
+    {
+        pthread_mutex_lock(&ctx->restore.lock);
+        ctx->restore.streams_abort = true;
+        pthread_cond_broadcast(&ctx->restore.cond);
+        pthread_mutex_unlock(&ctx->restore.lock);
+    }
+
+    for ( i = 0; i < ctx->restore.nr_streams; ++i )
+    {
+        s = &ctx->restore.streams[i];
+
+        if ( !s->started )
+            continue;
+
+        if ( abort )
+            pthread_cancel(s->thread);
+        pthread_join(s->thread, NULL);
+        s->started = false;
+
+        if ( s->rc && !rc )
+        {
+            ERROR("Page stream %u failed", i);
+            rc = s->rc;
+        }
+    }
+
+    return rc;
+}
+
+/*
+ * Pipelined restore of plain streams.
+ *
+ * Records are read from the stream by a reader thread into a ring, so the
+ * sender is not stalled while earlier records are processed.  The main
+ * thread validates PAGE_DATA and COMPRESSED_PAGE_DATA records, and queues
+ * them as batches for two further stages:
+ *
+ *  - A populate thread, which takes every queued batch at once and
+ *    populates their unpopulated pfns in as few hypercalls as possible.  For
+ *    HVM guests, aligned runs are populated as 1G and 2M extents, so the
+ *    guest keeps its superpages.
+ *  - A pool of copy workers, which map, decode and copy the pages.  Pfns are
+ *    assigned to workers in 2M chunks, and each worker processes its share
+ *    of the batches in stream order, so a later copy of a page (or an XBZRLE
+ *    delta against it) is always applied after an earlier one.
+ *
+ * All other records wait for the page data ahead of them to be complete, and
+ * are processed by the main thread as before.
+ */
+#define PIPELINE_RING_RECORDS  16
+#define PIPELINE_MAX_BATCHES   32
+#define PIPELINE_MAX_WORKERS   8
+#define PIPELINE_CHUNK_SHIFT   9
+
+/* A page in a batch. */
+struct pipeline_page
+{
+    /* Encoded data, for pages with stream data. */
+    const uint8_t *data;
+    uint32_t length;
+    uint16_t encoding;
+
+    /* Populated by this batch, so without previous contents. */
+    bool fresh;
+};
+
+/* A page data record, between the main thread and the copy workers. */
+struct pipeline_batch
+{
+    struct pipeline_batch *next;
+
+    void *rec_data;
+    unsigned int count;
+    xen_pfn_t *pfns;
+    uint32_t *types;
+    struct pipeline_page *pages;
+
+    /* Parts not yet completed by the copy workers. */
+    unsigned int pending;
+};
+
+/* The pages of a batch belonging to one copy worker, as batch indices. */
+struct pipeline_part
+{
+    struct pipeline_part *next;
+    struct pipeline_batch *batch;
+    unsigned int nr;
+    unsigned int idx[];
+};
+
+struct pipeline_worker
+{
+    struct xc_sr_restore_pipeline *pl;
+    pthread_t thread;
+    bool started;
+
+    struct pipeline_part *head, **tail;
+};
+
+struct xc_sr_restore_pipeline
+{
+    struct xc_sr_context *ctx;
+
+    /* Protects everything below.  Broadcast on any change of state. */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    /* Set to stop every thread.  rc is the first error from any of them. */
+    bool quit;
+    int rc;
+
+    /* Reader thread, and the records it has read. */
+    pthread_t reader;
+    bool reader_started, reader_done;
+    int reader_rc, reader_errno;
+    struct xc_sr_record ring[PIPELINE_RING_RECORDS];
+    unsigned int ring_prod, ring_cons;
+
+    /* Populate thread, and the batches waiting for it. */
+    pthread_t populater;
+    bool populater_started;
+    struct pipeline_batch *pop_head, **pop_tail;
+
+    /* Batches queued and not yet completed. */
+    unsigned int nr_batches;
+
+    struct pipeline_worker workers[PIPELINE_MAX_WORKERS];
+    unsigned int nr_workers;
+
+    /* Superpage statistics, for the populate thread only. */
+    unsigned long nr_1g, nr_2m;
+};
+
+static void pipeline_free_batch(struct pipeline_batch *b)
+{
+    free(b->pages);
+    free(b->types);
+    free(b->pfns);
+    free(b->rec_data);
+    free(b);
+}
+
+/* Record an error and stop every thread.  Called with the lock held. */
+static void pipeline_fail(struct xc_sr_restore_pipeline *pl, int rc)
+{
+    if ( !pl->rc )
+        pl->rc = rc ?: -1;
+    pl->quit = true;
+    pthread_cond_broadcast(&pl->cond);
+}
+
+/* Drop a reference to a batch.  Called with the lock held. */
+static void pipeline_put_batch(struct xc_sr_restore_pipeline *pl,
+                               struct pipeline_batch *b)
+{
+    if ( --b->pending )
+        return;
+
+    pipeline_free_batch(b);
+    pl->nr_batches--;
+    pthread_cond_broadcast(&pl->cond);
+}
+
+/*
+ * Reader thread.  Reads records from the stream into the ring, up to and
+ * including the END record.
+ */
+static void *pipeline_reader(void *arg)
+{
+    struct xc_sr_restore_pipeline *pl = arg;
+    struct xc_sr_context *ctx = pl->ctx;
+    struct xc_sr_record rec;
+    bool done = false;
+    int rc;
+
+    /* Only permit cancellation while blocked reading from the stream. */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    while ( !done )
+    {
+        pthread_mutex_lock(&pl->lock);
+        while ( pl->ring_prod - pl->ring_cons == PIPELINE_RING_RECORDS &&
+                !pl->quit )
+            pthread_cond_wait(&pl->cond, &pl->lock);
+        done = pl->quit;
+        pthread_mutex_unlock(&pl->lock);
+
+        if ( done )
+            break;
+
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        rc = read_record(ctx, ctx->fd, &rec);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+        /* Whatever follows END belongs to the caller. */
+        done = rc || rec.type == REC_TYPE_END;
+
+        pthread_mutex_lock(&pl->lock);
+        if ( rc )
+        {
+            pl->reader_rc = rc;
+            pl->reader_errno = errno;
+        }
+        else
+            pl->ring[pl->ring_prod++ % PIPELINE_RING_RECORDS] = rec;
+        pl->reader_done = done;
+        pthread_cond_broadcast(&pl->cond);
+        pthread_mutex_unlock(&pl->lock);
+    }
+
+    return NULL;
+}
+
+/* Take the next record from the ring. */
+static int pipeline_read_record(struct xc_sr_context *ctx,
+                                struct xc_sr_record *rec)
+{
+    struct xc_sr_restore_pipeline *pl = ctx->restore.pipeline;
+    int rc = 0;
+
+    pthread_mutex_lock(&pl->lock);
+
+    while ( pl->ring_prod == pl->ring_cons && !pl->reader_done && !pl->quit )
+        pthread_cond_wait(&pl->cond, &pl->lock);
+
+    if ( pl->ring_prod != pl->ring_cons )
+    {
+        *rec = pl->ring[pl->ring_cons++ % PIPELINE_RING_RECORDS];
+        pthread_cond_broadcast(&pl->cond);
+    }
+    else if ( pl->reader_rc )
+    {
+        rc = pl->reader_rc;
+        errno = pl->reader_errno;
+    }
+    else
+        rc = pl->rc ?: -1;
+
+    pthread_mutex_unlock(&pl->lock);
+
+    return rc;
+}
+
+/*
+ * Queue a PAGE_DATA or COMPRESSED_PAGE_DATA record.  On success, the batch
+ * takes ownership of the record data.
+ */
+static int pipeline_queue_page_data(struct xc_sr_context *ctx,
+                                    struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_restore_pipeline *pl = ctx->restore.pipeline;
+    struct xc_sr_rec_page_data_header *pages = rec->data;
+    struct xc_sr_compressed_page *descs = NULL;
+    struct pipeline_batch *b;
+    const uint8_t *data;
+    unsigned int i, p, pages_of_data, nr_deltas;
+    int rc = -1;
+
+    b = calloc(1, sizeof(*b));
+    if ( !b )
+    {
+        ERROR("Unable to allocate page data batch");
+        return -1;
+    }
+
+    if ( parse_page_data(ctx, rec, &b->pfns, &b->types, &pages_of_data) )
+        goto err;
+
+    b->count = pages->count;
+
+    if ( rec->type == REC_TYPE_COMPRESSED_PAGE_DATA )
+    {
+        descs = compressed_page_descs(ctx, rec, b->count, pages_of_data,
+                                      &data, &nr_deltas);
+        if ( !descs )
+            goto err;
+    }
+    else
+        data = (const uint8_t *)&pages->pfn[b->count];
+
+    b->pages = calloc(b->count, sizeof(*b->pages));
+    if ( !b->pages )
+    {
+        ERROR("Unable to allocate memory for %u pages", b->count);
+        goto err;
+    }
+
+    for ( i = 0, p = 0; i < b->count; ++i )
+    {
+        if ( !page_type_has_stream_data(b->types[i]) )
+            continue;
+
+        b->pages[i].data = data;
+        if ( descs )
+        {
+            b->pages[i].encoding = descs[p].encoding;
+            b->pages[i].length = descs[p].length;
+        }
+        else
+        {
+            b->pages[i].encoding = PAGE_ENCODING_RAW;
+            b->pages[i].length = PAGE_SIZE;
+        }
+
+        data += b->pages[i].length;
+        ++p;
+    }
+
+    pthread_mutex_lock(&pl->lock);
+
+    while ( pl->nr_batches >= PIPELINE_MAX_BATCHES && !pl->quit )
+        pthread_cond_wait(&pl->cond, &pl->lock);
+
+    rc = pl->rc;
+    if ( !rc )
+    {
+        b->rec_data = rec->data;
+        rec->data = NULL;
+
+        pl->nr_batches++;
+        *pl->pop_tail = b;
+        pl->pop_tail = &b->next;
+        pthread_cond_broadcast(&pl->cond);
+    }
+
+    pthread_mutex_unlock(&pl->lock);
+
+    if ( !rc )
+        return 0;
+
+ err:
+    pipeline_free_batch(b);
+
+    return rc;
+}
+
+/* Wait for all queued page data to be completed. */
+static int pipeline_drain(struct xc_sr_context *ctx)
+{
+    struct xc_sr_restore_pipeline *pl = ctx->restore.pipeline;
+    int rc;
+
+    pthread_mutex_lock(&pl->lock);
+    while ( pl->nr_batches && !pl->quit )
+        pthread_cond_wait(&pl->cond, &pl->lock);
+    rc = pl->rc;
+    pthread_mutex_unlock(&pl->lock);
+
+    return rc;
+}
+
+static int compare_pfns(const void *l, const void *r)
+{
+    xen_pfn_t lhs = *(const xen_pfn_t *)l, rhs = *(const xen_pfn_t *)r;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/*
+ * Populate a sorted list of distinct pfns.  For HVM guests, aligned runs are
+ * populated as 1G or 2M extents where possible, falling back to smaller
+ * extents for whatever Xen cannot find contiguous memory for.  Superpages
+ * are not used for PV guests, whose physmap needs an mfn per pfn.
+ */
+static int pipeline_populate_pfns(struct xc_sr_context *ctx,
+                                  const xen_pfn_t *pfns, unsigned long nr)
+{
+    static const unsigned int orders[] = {
+        SUPERPAGE_1GB_SHIFT, SUPERPAGE_2MB_SHIFT, 0,
+    };
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_restore_pipeline *pl = ctx->restore.pipeline;
+    xen_pfn_t *ext[ARRAY_SIZE(orders)] = { NULL }, *mfns = NULL;
+    unsigned long nr_ext[ARRAY_SIZE(orders)] = { 0 }, i, j, size = 0;
+    unsigned int o;
+    int done, rc = -1;
+
+    for ( o = 0; o < ARRAY_SIZE(orders); ++o )
+    {
+        ext[o] = malloc(nr * sizeof(*ext[o]));
+        if ( !ext[o] )
+        {
+            ERROR("Unable to allocate memory to populate %lu pfns", nr);
+            goto err;
+        }
+    }
+
+    /* Carve the list into the largest aligned extents which it covers. */
+    for ( i = 0; i < nr; i += size )
+    {
+        for ( o = 0; o < ARRAY_SIZE(orders) - 1; ++o )
+        {
+            size = 1UL << orders[o];
+            if ( ctx->dominfo.hvm && !(pfns[i] & (size - 1)) &&
+                 i + size <= nr && pfns[i + size - 1] == pfns[i] + size - 1 )
+                break;
+        }
+
+        size = 1UL << orders[o];
+        ext[o][nr_ext[o]++] = pfns[i];
+    }
+
+    /*
+     * Superpages.  The extent list isn't written back for HVM guests, and
+     * set_gfn() is a no-op for them.
+     */
+    for ( o = 0; o < ARRAY_SIZE(orders) - 1; ++o )
+    {
+        if ( !nr_ext[o] )
+            continue;
+
+        done = xc_domain_populate_physmap(xch, ctx->domid, nr_ext[o],
+                                          orders[o], 0, ext[o]);
+        if ( done < 0 )
+            done = 0;
+
+        if ( orders[o] == SUPERPAGE_1GB_SHIFT )
+            pl->nr_1g += done;
+        else
+            pl->nr_2m += done;
+
+        for ( i = done; i < nr_ext[o]; ++i )
+            for ( j = 0; j < (1UL << (orders[o] - orders[o + 1])); ++j )
+                ext[o + 1][nr_ext[o + 1]++] = ext[o][i] + (j << orders[o + 1]);
+    }
+
+    /* Single pages, as populate_pfns() does. */
+    if ( nr_ext[o] )
+    {
+        mfns = malloc(nr_ext[o] * sizeof(*mfns));
+        if ( !mfns )
+        {
+            ERROR("Unable to allocate memory to populate %lu pfns", nr);
+            goto err;
+        }
+        memcpy(mfns, ext[o], nr_ext[o] * sizeof(*mfns));
+
+        if ( xc_domain_populate_physmap_exact(xch, ctx->domid, nr_ext[o],
+                                              0, 0, mfns) )
+        {
+            PERROR("Failed to populate physmap");
+            goto err;
+        }
+
+        for ( i = 0; i < nr_ext[o]; ++i )
+        {
+            if ( mfns[i] == INVALID_MFN )
+            {
+                ERROR("Populate physmap failed for pfn %#"PRIpfn, ext[o][i]);
+                goto err;
+            }
+
+            ctx->restore.ops.set_gfn(ctx, ext[o][i], mfns[i]);
+        }
+    }
+
+    rc = 0;
+
+ err:
+    free(mfns);
+    for ( o = 0; o < ARRAY_SIZE(orders); ++o )
+        free(ext[o]);
+
+    return rc;
+}
+
+/*
+ * Populate the unpopulated pfns of a list of batches, and record the types
+ * of all their pfns.
+ */
+static int pipeline_populate(struct xc_sr_context *ctx,
+                             struct pipeline_batch *list)
+{
+    xc_interface *xch = ctx->xch;
+    struct pipeline_batch *b;
+    xen_pfn_t *pfns;
+    unsigned long nr = 0, total = 0;
+    unsigned int i;
+    int rc = -1;
+
+    for ( b = list; b; b = b->next )
+        total += b->count;
+
+    pfns = malloc(total * sizeof(*pfns));
+    if ( !pfns )
+    {
+        ERROR("Unable to allocate memory to populate %lu pfns", total);
+        return -1;
+    }
+
+    pthread_mutex_lock(&ctx->restore.lock);
+
+    for ( b = list; b; b = b->next )
+    {
+        for ( i = 0; i < b->count; ++i )
+        {
+            if ( !page_type_to_populate(b->types[i]) ||
+                 pfn_is_populated(ctx, b->pfns[i]) )
+                continue;
+
+            b->pages[i].fresh = true;
+
+            switch ( populate_superpage(ctx, b->pfns[i]) )
+            {
+            case 0:
+                break;
+            case 1:
+                continue;
+            default:
+                goto err;
+            }
+
+            if ( pfn_set_populated(ctx, b->pfns[i]) )
+                goto err;
+
+            pfns[nr++] = b->pfns[i];
+        }
+    }
+
+    if ( nr )
+    {
+        qsort(pfns, nr, sizeof(*pfns), compare_pfns);
+
+        if ( pipeline_populate_pfns(ctx, pfns, nr) )
+            goto err;
+    }
+
+    for ( b = list; b; b = b->next )
+        for ( i = 0; i < b->count; ++i )
+            ctx->restore.ops.set_page_type(ctx, b->pfns[i], b->types[i]);
+
+    rc = 0;
+
+ err:
+    pthread_mutex_unlock(&ctx->restore.lock);
+    free(pfns);
+
+    return rc;
+}
+
+/* Split a populated batch between the copy workers. */
+static int pipeline_distribute(struct xc_sr_restore_pipeline *pl,
+                               struct pipeline_batch *b)
+{
+    xc_interface *xch = pl->ctx->xch;
+    struct pipeline_part *parts[PIPELINE_MAX_WORKERS] = { NULL };
+    unsigned int nr[PIPELINE_MAX_WORKERS] = { 0 };
+    struct pipeline_worker *w;
+    unsigned int i, n;
+
+    for ( i = 0; i < b->count; ++i )
+        if ( page_type_has_stream_data(b->types[i]) )
+            nr[(b->pfns[i] >> PIPELINE_CHUNK_SHIFT) % pl->nr_workers]++;
+
+    for ( n = 0; n < pl->nr_workers; ++n )
+    {
+        if ( !nr[n] )
+            continue;
+
+        parts[n] = malloc(sizeof(*parts[n]) + nr[n] * sizeof(*parts[n]->idx));
+        if ( !parts[n] )
+        {
+            ERROR("Unable to allocate memory for %u pages", nr[n]);
+            while ( n-- )
+                free(parts[n]);
+            return -1;
+        }
+
+        parts[n]->next = NULL;
+        parts[n]->batch = b;
+        parts[n]->nr = 0;
+    }
+
+    for ( i = 0; i < b->count; ++i )
+    {
+        if ( !page_type_has_stream_data(b->types[i]) )
+            continue;
+
+        n = (b->pfns[i] >> PIPELINE_CHUNK_SHIFT) % pl->nr_workers;
+        parts[n]->idx[parts[n]->nr++] = i;
+    }
+
+    pthread_mutex_lock(&pl->lock);
+
+    /* Hold a reference while queueing, in case there are no parts. */
+    b->pending = 1;
+
+    for ( n = 0; n < pl->nr_workers; ++n )
+    {
+        if ( !parts[n] )
+            continue;
+
+        w = &pl->workers[n];
+        b->pending++;
+        *w->tail = parts[n];
+        w->tail = &parts[n]->next;
+    }
+
+    pipeline_put_batch(pl, b);
+    pthread_cond_broadcast(&pl->cond);
+    pthread_mutex_unlock(&pl->lock);
+
+    return 0;
+}
+
+/* Populate thread. */
+static void *pipeline_populater(void *arg)
+{
+    struct xc_sr_restore_pipeline *pl = arg;
+    struct pipeline_batch *list, *b;
+    int rc = 0;
+
+    while ( !rc )
+    {
+        pthread_mutex_lock(&pl->lock);
+        while ( !pl->pop_head && !pl->quit )
+            pthread_cond_wait(&pl->cond, &pl->lock);
+        if ( pl->quit )
+        {
+            pthread_mutex_unlock(&pl->lock);
+            break;
+        }
+        list = pl->pop_head;
+        pl->pop_head = NULL;
+        pl->pop_tail = &pl->pop_head;
+        pthread_mutex_unlock(&pl->lock);
+
+        rc = pipeline_populate(pl->ctx, list);
+
+        while ( (b = list) )
+        {
+            list = b->next;
+            b->next = NULL;
+
+            if ( !rc )
+                rc = pipeline_distribute(pl, b);
+
+            if ( rc )
+            {
+                pthread_mutex_lock(&pl->lock);
+                b->pending = 1;
+                pipeline_put_batch(pl, b);
+                pthread_mutex_unlock(&pl->lock);
+            }
+        }
+    }
+
+    if ( rc )
+    {
+        pthread_mutex_lock(&pl->lock);
+        pipeline_fail(pl, rc);
+        pthread_mutex_unlock(&pl->lock);
+    }
+
+    return NULL;
+}
+
+/*
+ * Map the pages of a part, and decode or copy their data into place.  As in
+ * process_page_data(), pagetables are localised under the restore lock, as
+ * they may refer to other pfns.
+ */
+static int pipeline_copy_part(struct xc_sr_context *ctx,
+                              struct pipeline_part *part, uint8_t *buf)
+{
+    xc_interface *xch = ctx->xch;
+    struct pipeline_batch *b = part->batch;
+    struct pipeline_page *page;
+    xen_pfn_t *gfns = malloc(part->nr * sizeof(*gfns)), pfn;
+    int *map_errs = malloc(part->nr * sizeof(*map_errs));
+    uint8_t *mapping = NULL, *guest_page;
+    uint32_t type;
+    unsigned int i, k;
+    int rc = -1;
+
+    if ( !gfns || !map_errs )
+    {
+        ERROR("Failed to allocate memory to copy %u pages", part->nr);
+        goto err;
+    }
+
+    pthread_mutex_lock(&ctx->restore.lock);
+    for ( k = 0; k < part->nr; ++k )
+        gfns[k] = ctx->restore.ops.pfn_to_gfn(ctx, b->pfns[part->idx[k]]);
+    pthread_mutex_unlock(&ctx->restore.lock);
+
+    mapping = xenforeignmemory_map(xch->fmem, ctx->domid,
+                                   PROT_READ | PROT_WRITE,
+                                   part->nr, gfns, map_errs);
+    if ( !mapping )
+    {
+        PERROR("Unable to map %u pages of data", part->nr);
+        goto err;
+    }
+
+    for ( k = 0, guest_page = mapping; k < part->nr;
+          ++k, guest_page += PAGE_SIZE )
+    {
+        i = part->idx[k];
+        pfn = b->pfns[i];
+        type = b->types[i];
+        page = &b->pages[i];
+
+        if ( map_errs[k] )
+        {
+            rc = -1;
+            ERROR("Mapping pfn %#"PRIpfn" (mfn %#"PRIpfn", type %#"PRIx32") failed with %d",
+                  pfn, gfns[k], type, map_errs[k]);
+            goto err;
+        }
+
+        /* Plain data pages need no decoding or localising. */
+        if ( page->encoding == PAGE_ENCODING_RAW &&
+             type == XEN_DOMCTL_PFINFO_NOTAB && !ctx->restore.verify )
+        {
+            memcpy(guest_page, page->data, PAGE_SIZE);
+            continue;
+        }
+
+        if ( page->encoding == PAGE_ENCODING_XBZRLE )
+        {
+            if ( type != XEN_DOMCTL_PFINFO_NOTAB || page->fresh )
+            {
+                rc = -1;
+                ERROR("XBZRLE delta for pfn %#"PRIpfn" with no previous page",
+                      pfn);
+                goto err;
+            }
+            memcpy(buf, guest_page, PAGE_SIZE);
+        }
+
+        if ( decode_page(ctx, page->encoding, page->data, page->length, buf) )
+        {
+            rc = -1;
+            ERROR("Failed to decode pfn %#"PRIpfn, pfn);
+            goto err;
+        }
+
+        if ( type != XEN_DOMCTL_PFINFO_NOTAB )
+        {
+            pthread_mutex_lock(&ctx->restore.lock);
+            rc = ctx->restore.ops.localise_page(ctx, type, buf);
+            pthread_mutex_unlock(&ctx->restore.lock);
+            if ( rc )
+            {
+                ERROR("Failed to localise pfn %#"PRIpfn" (type %#"PRIx32")",
+                      pfn, type >> XEN_DOMCTL_PFINFO_LTAB_SHIFT);
+                goto err;
+            }
+        }
+
+        if ( ctx->restore.verify )
+        {
+            /* Verify mode - compare incoming data to what we already have. */
+            if ( memcmp(guest_page, buf, PAGE_SIZE) )
+                ERROR("verify pfn %#"PRIpfn" failed (type %#"PRIx32")",
+                      pfn, type >> XEN_DOMCTL_PFINFO_LTAB_SHIFT);
+        }
+        else
+            memcpy(guest_page, buf, PAGE_SIZE);
+    }
+
+    rc = 0;
+
+ err:
+    if ( mapping )
+        xenforeignmemory_unmap(xch->fmem, mapping, part->nr);
+    free(map_errs);
+    free(gfns);
+
+    return rc;
+}
+
+/* Copy worker. */
+static void *pipeline_worker(void *arg)
+{
+    struct pipeline_worker *w = arg;
+    struct xc_sr_restore_pipeline *pl = w->pl;
+    struct xc_sr_context *ctx = pl->ctx;
+    xc_interface *xch = ctx->xch;
+    struct pipeline_part *part;
+    uint8_t *buf = malloc(PAGE_SIZE);
+    int rc = 0;
+
+    if ( !buf )
+    {
+        ERROR("Unable to allocate page buffer");
+        rc = -1;
+    }
+
+    while ( !rc )
+    {
+        pthread_mutex_lock(&pl->lock);
+        while ( !w->head && !pl->quit )
+            pthread_cond_wait(&pl->cond, &pl->lock);
+        if ( pl->quit )
+        {
+            pthread_mutex_unlock(&pl->lock);
+            break;
+        }
+        part = w->head;
+        w->head = part->next;
+        if ( !w->head )
+            w->tail = &w->head;
+        pthread_mutex_unlock(&pl->lock);
+
+        rc = pipeline_copy_part(ctx, part, buf);
+
+        pthread_mutex_lock(&pl->lock);
+        pipeline_put_batch(pl, part->batch);
+        pthread_mutex_unlock(&pl->lock);
+
+        free(part);
+    }
+
+    if ( rc )
+    {
+        pthread_mutex_lock(&pl->lock);
+        pipeline_fail(pl, rc);
+        pthread_mutex_unlock(&pl->lock);
+    }
+
+    free(buf);
+
+    return NULL;
+}
+
+static int start_pipeline(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_restore_pipeline *pl;
+    struct pipeline_worker *w;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int i;
+    int rc;
+
+    pl = calloc(1, sizeof(*pl));
+    if ( !pl )
+    {
+        ERROR("Unable to allocate restore pipeline");
+        return -1;
+    }
+
+    pl->ctx = ctx;
+    pl->pop_tail = &pl->pop_head;
+    pl->nr_workers = cpus < 1 ? 1 : MIN(cpus, PIPELINE_MAX_WORKERS);
+    pthread_mutex_init(&pl->lock, NULL);
+    pthread_cond_init(&pl->cond, NULL);
+    ctx->restore.pipeline = pl;
+
+    for ( i = 0; i < pl->nr_workers; ++i )
+    {
+        w = &pl->workers[i];
+        w->pl = pl;
+        w->tail = &w->head;
+
+        rc = pthread_create(&w->thread, NULL, pipeline_worker, w);
+        if ( rc )
+            goto err;
+        w->started = true;
+    }
+
+    rc = pthread_create(&pl->populater, NULL, pipeline_populater, pl);
+    if ( rc )
+        goto err;
+    pl->populater_started = true;
+
+    rc = pthread_create(&pl->reader, NULL, pipeline_reader, pl);
+    if ( rc )
+        goto err;
+    pl->reader_started = true;
+
+    DPRINTF("Restore pipeline started with %u copy workers", pl->nr_workers);
+
+    return 0;
+
+ err:
+    errno = rc;
+    PERROR("Unable to start restore pipeline");
+
+    return -1;
+}
+
+/*
+ * Stop the restore pipeline.  On success, all page data is expected to have
+ * been completed.  Otherwise, the reader is cancelled in case it is blocked
+ * reading from the stream, and outstanding work is discarded.
+ */
+static int stop_pipeline(struct xc_sr_context *ctx, bool abort)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_restore_pipeline *pl = ctx->restore.pipeline;
+    struct pipeline_worker *w;
+    struct pipeline_batch *b;
+    struct pipeline_part *part;
+    unsigned int i;
+    int rc;
+
+    if ( !pl )
+        return 0;
+
+    pthread_mutex_lock(&pl->lock);
+    pl->quit = true;
+    pthread_cond_broadcast(&pl->cond);
+    pthread_mutex_unlock(&pl->lock);
+
+    if ( pl->reader_started )
+    {
+        if ( abort )
+            pthread_cancel(pl->reader);
+        pthread_join(pl->reader, NULL);
+    }
+
+    if ( pl->populater_started )
+        pthread_join(pl->populater, NULL);
+
+    for ( i = 0; i < pl->nr_workers; ++i )
+        if ( pl->workers[i].started )
+            pthread_join(pl->workers[i].thread, NULL);
+
+    while ( pl->ring_cons != pl->ring_prod )
+        free(pl->ring[pl->ring_cons++ % PIPELINE_RING_RECORDS].data);
+
+    while ( (b = pl->pop_head) )
+    {
+        pl->pop_head = b->next;
+        pipeline_free_batch(b);
+    }
+
+    for ( i = 0; i < pl->nr_workers; ++i )
+    {
+        w = &pl->workers[i];
+
+        while ( (part = w->head) )
+        {
+            w->head = part->next;
+            if ( !--part->batch->pending )
+                pipeline_free_batch(part->batch);
+            free(part);
+        }
+    }
+
+    rc = pl->rc;
+
+    DPRINTF("Restore pipeline populated %lu 1G and %lu 2M extents",
+            pl->nr_1g, pl->nr_2m);
+
+    pthread_cond_destroy(&pl->cond);
+    pthread_mutex_destroy(&pl->lock);
+    free(pl);
+    ctx->restore.pipeline = NULL;
+
+    return rc;
+}
+
+/*
+ * Send checkpoint dirty pfn list to primary.
+ */
+static int send_checkpoint_dirty_pfn_list(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    int rc = -1;
+    unsigned int count, written;
+    uint64_t i, *pfns = NULL;
+    struct iovec *iov = NULL;
+    xc_shadow_op_stats_t stats = { 0, ctx->restore.p2m_size };
+    struct xc_sr_record rec = {
+        .type = REC_TYPE_CHECKPOINT_DIRTY_PFN_LIST,
+    };
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->restore.dirty_bitmap_hbuf);
+
+    if ( xc_logdirty_control(
+             xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
+             HYPERCALL_BUFFER(dirty_bitmap), ctx->restore.p2m_size,
+             0, &stats) != ctx->restore.p2m_size )
+    {
+        PERROR("Failed to retrieve logdirty bitmap");
+        goto err;
+    }
+
+    for ( i = 0, count = 0; i < ctx->restore.p2m_size; i++ )
+    {
+        if ( test_bit(i, dirty_bitmap) )
+            count++;
+    }
+
+
+    pfns = malloc(count * sizeof(*pfns));
+    if ( !pfns )
+    {
+        ERROR("Unable to allocate %zu bytes of memory for dirty pfn list",
+              count * sizeof(*pfns));
+        goto err;
+    }
+
+    for ( i = 0, written = 0; i < ctx->restore.p2m_size; ++i )
+    {
+        if ( !test_bit(i, dirty_bitmap) )
+            continue;
+
+        if ( written > count )
+        {
+            ERROR("Dirty pfn list exceed");
+            goto err;
+        }
+
+        pfns[written++] = i;
+    }
+
+    /* iovec[] for writev(). */
+    iov = malloc(3 * sizeof(*iov));
+    if ( !iov )
+    {
+        ERROR("Unable to allocate memory for sending dirty bitmap");
+        goto err;
+    }
+
+    rec.length = count * sizeof(*pfns);
+
+    iov[0].iov_base = &rec.type;
+    iov[0].iov_len = sizeof(rec.type);
+
+    iov[1].iov_base = &rec.length;
+    iov[1].iov_len = sizeof(rec.length);
+
+    iov[2].iov_base = pfns;
+    iov[2].iov_len = count * sizeof(*pfns);
+
+    if ( writev_exact(ctx->restore.send_back_fd, iov, 3) )
+    {
+        PERROR("Failed to write dirty bitmap to stream");
+        goto err;
+    }
+
+    rc = 0;
+ err:
+    free(pfns);
+    free(iov);
+    return rc;
+}
+
+static int process_record(struct xc_sr_context *ctx, struct xc_sr_record *rec);
+static int handle_checkpoint(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    int rc = 0, ret;
+    unsigned int i;
+
+    if ( ctx->stream_type == XC_STREAM_PLAIN )
+    {
+        ERROR("Found checkpoint in non-checkpointed stream");
+        rc = -1;
+        goto err;
+    }
+
+    ret = ctx->restore.callbacks->checkpoint(ctx->restore.callbacks->data);
+    switch ( ret )
+    {
+    case XGR_CHECKPOINT_SUCCESS:
+        break;
+
+    case XGR_CHECKPOINT_FAILOVER:
+        if ( ctx->restore.buffer_all_records )
+            rc = BROKEN_CHANNEL;
+        else
+            /* We don't have a consistent state */
+            rc = -1;
+        goto err;
+
+    default: /* Other fatal error */
+        rc = -1;
+        goto err;
+    }
+
+    if ( ctx->restore.buffer_all_records )
+    {
+        IPRINTF("All records buffered");
+
+        for ( i = 0; i < ctx->restore.buffered_rec_num; i++ )
+        {
+            rc = process_record(ctx, &ctx->restore.buffered_records[i]);
+            if ( rc )
+                goto err;
+        }
+        ctx->restore.buffered_rec_num = 0;
+        IPRINTF("All records processed");
+    }
+    else
+        ctx->restore.buffer_all_records = true;
+
+    if ( ctx->stream_type == XC_STREAM_COLO )
+    {
+#define HANDLE_CALLBACK_RETURN_VALUE(ret)                   \
+    do {                                                    \
+        if ( ret == 1 )                                     \
+            rc = 0; /* Success */                           \
+        else                                                \
+        {                                                   \
+            if ( ret == 2 )                                 \
+                rc = BROKEN_CHANNEL;                        \
+            else                                            \
+                rc = -1; /* Some unspecified error */       \
+            goto err;                                       \
+        }                                                   \
+    } while (0)
+
+        /* COLO */
+
+        /* We need to resume guest */
+        rc = ctx->restore.ops.stream_complete(ctx);
+        if ( rc )
+            goto err;
+
+        ctx->restore.callbacks->restore_results(ctx->restore.xenstore_gfn,
+                                                ctx->restore.console_gfn,
+                                                ctx->restore.callbacks->data);
+
+        /* Resume secondary vm */
+        ret = ctx->restore.callbacks->postcopy(ctx->restore.callbacks->data);
+        HANDLE_CALLBACK_RETURN_VALUE(ret);
+
+        /* Wait for a new checkpoint */
+        ret = ctx->restore.callbacks->wait_checkpoint(
+            ctx->restore.callbacks->data);
+        HANDLE_CALLBACK_RETURN_VALUE(ret);
+
+        /* suspend secondary vm */
+        ret = ctx->restore.callbacks->suspend(ctx->restore.callbacks->data);
+        HANDLE_CALLBACK_RETURN_VALUE(ret);
+
+#undef HANDLE_CALLBACK_RETURN_VALUE
+
+        rc = send_checkpoint_dirty_pfn_list(ctx);
+        if ( rc )
+            goto err;
+    }
+
+ err:
+    return rc;
+}
+
+static int buffer_record(struct xc_sr_context *ctx, struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned int new_alloc_num;
+    struct xc_sr_record *p;
+
+    if ( ctx->restore.buffered_rec_num >= ctx->restore.allocated_rec_num )
+    {
+        new_alloc_num = ctx->restore.allocated_rec_num + DEFAULT_BUF_RECORDS;
+        p = realloc(ctx->restore.buffered_records,
+                    new_alloc_num * sizeof(struct xc_sr_record));
+        if ( !p )
+        {
+            ERROR("Failed to realloc memory for buffered records");
+            return -1;
+        }
+
+        ctx->restore.buffered_records = p;
+        ctx->restore.allocated_rec_num = new_alloc_num;
+    }
+
+    memcpy(&ctx->restore.buffered_records[ctx->restore.buffered_rec_num++],
+           rec, sizeof(*rec));
+
+    return 0;
+}
+
+int handle_static_data_end(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned int missing = 0;
+    int rc = 0;
+
+    if ( ctx->restore.seen_static_data_end )
+    {
+        ERROR("Multiple STATIC_DATA_END records found");
+        return -1;
+    }
+
+    ctx->restore.seen_static_data_end = true;
+
+    rc = ctx->restore.ops.static_data_complete(ctx, &missing);
+    if ( rc )
+        return rc;
+
+    if ( ctx->restore.callbacks->static_data_done &&
+         (rc = ctx->restore.callbacks->static_data_done(
+             missing, ctx->restore.callbacks->data) != 0) )
+        ERROR("static_data_done() callback failed: %d\n", rc);
 
-static int process_record(struct xc_sr_context *ctx, struct xc_sr_record *rec);
-static int handle_checkpoint(struct xc_sr_context *ctx)
+    return rc;
+}
+
+static int process_record(struct xc_sr_context *ctx, struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    int rc = 0;
+
+    /* Everything else is ordered against the page data ahead of it. */
+    if ( ctx->restore.pipeline &&
+         rec->type != REC_TYPE_PAGE_DATA &&
+         rec->type != REC_TYPE_COMPRESSED_PAGE_DATA )
+    {
+        rc = pipeline_drain(ctx);
+        if ( rc )
+            goto out;
+    }
+
+    switch ( rec->type )
+    {
+    case REC_TYPE_END:
+        break;
+
+    case REC_TYPE_PAGE_DATA:
+    case REC_TYPE_COMPRESSED_PAGE_DATA:
+        if ( ctx->restore.pipeline )
+            rc = pipeline_queue_page_data(ctx, rec);
+        else
+            rc = handle_page_data(ctx, rec);
+        break;
+
+    case REC_TYPE_VERIFY:
+        DPRINTF("Verify mode enabled");
+        ctx->restore.verify = true;
+        break;
+
+    case REC_TYPE_CHECKPOINT:
+        rc = handle_checkpoint(ctx);
+        break;
+
+    case REC_TYPE_STATIC_DATA_END:
+        rc = handle_static_data_end(ctx);
+        break;
+
+    case REC_TYPE_PAGE_STREAMS:
+        rc = handle_page_streams(ctx, rec);
+        break;
+
+    case REC_TYPE_PAGE_STREAMS_SYNC:
+        rc = handle_page_streams_sync(ctx, rec);
+        break;
+
+    case REC_TYPE_SUPERPAGES:
+        rc = handle_superpages(ctx, rec);
+        break;
+
+    default:
+        /* Arch records may update the physmap, e.g. X86_PV_P2M_FRAMES. */
+        pthread_mutex_lock(&ctx->restore.lock);
+        rc = ctx->restore.ops.process_record(ctx, rec);
+        pthread_mutex_unlock(&ctx->restore.lock);
+        break;
+    }
+
+ out:
+    free(rec->data);
+    rec->data = NULL;
+
+    return rc;
+}
+
+static int setup(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    int rc;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->restore.dirty_bitmap_hbuf);
+
+    pthread_mutex_init(&ctx->restore.lock, NULL);
+    pthread_cond_init(&ctx->restore.cond, NULL);
+
+    if ( ctx->stream_type == XC_STREAM_COLO )
+    {
+        dirty_bitmap = xc_hypercall_buffer_alloc_pages(
+            xch, dirty_bitmap, NRPAGES(bitmap_size(ctx->restore.p2m_size)));
+
+        if ( !dirty_bitmap )
+        {
+            ERROR("Unable to allocate memory for dirty bitmap");
+            rc = -1;
+            goto err;
+        }
+    }
+
+    rc = ctx->restore.ops.setup(ctx);
+    if ( rc )
+        goto err;
+
+    ctx->restore.max_populated_pfn = (32 * 1024 / 4) - 1;
+    ctx->restore.populated_pfns = bitmap_alloc(
+        ctx->restore.max_populated_pfn + 1);
+    if ( !ctx->restore.populated_pfns )
+    {
+        ERROR("Unable to allocate memory for populated_pfns bitmap");
+        rc = -1;
+        goto err;
+    }
+
+    ctx->restore.buffered_records = malloc(
+        DEFAULT_BUF_RECORDS * sizeof(struct xc_sr_record));
+    if ( !ctx->restore.buffered_records )
+    {
+        ERROR("Unable to allocate memory for buffered records");
+        rc = -1;
+        goto err;
+    }
+    ctx->restore.allocated_rec_num = DEFAULT_BUF_RECORDS;
+
+    if ( ctx->stream_type == XC_STREAM_PLAIN )
+        rc = start_pipeline(ctx);
+
+ err:
+    return rc;
+}
+
+static void cleanup(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned int i;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->restore.dirty_bitmap_hbuf);
+
+    stop_pipeline(ctx, true);
+    stop_page_streams(ctx, true);
+
+    for ( i = 0; i < ctx->restore.buffered_rec_num; i++ )
+        free(ctx->restore.buffered_records[i].data);
+
+    if ( ctx->stream_type == XC_STREAM_COLO )
+        xc_hypercall_buffer_free_pages(
+            xch, dirty_bitmap, NRPAGES(bitmap_size(ctx->restore.p2m_size)));
+
+    free(ctx->restore.buffered_records);
+    free(ctx->restore.populated_pfns);
+    free(ctx->restore.superpages_1g);
+    free(ctx->restore.superpages_2m);
+    free(ctx->restore.streams);
+
+    if ( ctx->restore.ops.cleanup(ctx) )
+        PERROR("Failed to clean up");
+
+    pthread_cond_destroy(&ctx->restore.cond);
+    pthread_mutex_destroy(&ctx->restore.lock);
+}
+
+/*
+ * Restore a domain.
+ */
+static int restore(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_record rec;
+    int rc, saved_rc = 0, saved_errno = 0;
+
+    IPRINTF("Restoring domain");
+
+    rc = setup(ctx);
+    if ( rc )
+        goto err;
+
+    do
+    {
+        if ( ctx->restore.pipeline )
+            rc = pipeline_read_record(ctx, &rec);
+        else
+            rc = read_record(ctx, ctx->fd, &rec);
+        if ( rc )
+        {
+            if ( ctx->restore.buffer_all_records )
+                goto remus_failover;
+            else
+                goto err;
+        }
+
+        if ( ctx->restore.buffer_all_records &&
+             rec.type != REC_TYPE_END &&
+             rec.type != REC_TYPE_CHECKPOINT )
+        {
+            rc = buffer_record(ctx, &rec);
+            if ( rc )
+                goto err;
+        }
+        else
+        {
+            rc = process_record(ctx, &rec);
+            if ( rc == RECORD_NOT_PROCESSED )
+            {
+                if ( rec.type & REC_TYPE_OPTIONAL )
+                    DPRINTF("Ignoring optional record %#x (%s)",
+                            rec.type, rec_type_to_str(rec.type));
+                else
+                {
+                    ERROR("Mandatory record %#x (%s) not handled",
+                          rec.type, rec_type_to_str(rec.type));
+                    rc = -1;
+                    goto err;
+                }
+            }
+            else if ( rc == BROKEN_CHANNEL )
+                goto remus_failover;
+            else if ( rc )
+                goto err;
+        }
+
+    } while ( rec.type != REC_TYPE_END );
+
+    rc = stop_pipeline(ctx, false);
+    if ( rc )
+        goto err;
+
+    rc = stop_page_streams(ctx, false);
+    if ( rc )
+        goto err;
+
+ remus_failover:
+    if ( ctx->stream_type == XC_STREAM_COLO )
+    {
+        /* With COLO, we have already called stream_complete */
+        rc = 0;
+        IPRINTF("COLO Failover");
+        goto done;
+    }
+
+    /*
+     * With Remus, if we reach here, there must be some error on primary,
+     * failover from the last checkpoint state.
+     */
+    rc = ctx->restore.ops.stream_complete(ctx);
+    if ( rc )
+        goto err;
+
+    IPRINTF("Restore successful");
+    goto done;
+
+ err:
+    saved_errno = errno;
+    saved_rc = rc;
+    PERROR("Restore failed");
+
+ done:
+    cleanup(ctx);
+
+    if ( saved_rc )
+    {
+        rc = saved_rc;
+        errno = saved_errno;
+    }
+
+    return rc;
+}
+
+/*
+ * Post-copy receive state.  Outstanding pages are those the sender has not
+ * sent yet.  Of these, the evicted ones have been paged out of the guest, and
+ * the remainder are resident with stale contents, so must arrive before the
+ * guest is resumed.
+ */
+struct xc_sr_postcopy
+{
+    unsigned long *outstanding;
+    unsigned long *evicted;
+    unsigned long nr_outstanding, nr_resident;
+
+    /* Paging ring.  NULL if paging could not be enabled. */
+    void *ring_page;
+    vm_event_back_ring_t back_ring;
+    xenevtchn_handle *xce;
+    evtchn_port_t local_port;
+
+    /* Guest requests waiting for evicted pages to arrive. */
+    vm_event_request_t *waiting;
+    unsigned int nr_waiting, max_waiting;
+
+    /*
+     * Pfns to ask the sender for, and the POSTCOPY_REQUEST record being
+     * written, of which out_done bytes out of out_len have been sent.
+     */
+    uint64_t *requests;
+    unsigned int nr_requests, max_requests;
+    uint8_t *out;
+    size_t out_len, out_done;
+
+    bool notify;
+};
+
+static void postcopy_respond(struct xc_sr_context *ctx,
+                             const vm_event_request_t *req)
+{
+    struct xc_sr_postcopy *pc = ctx->restore.postcopy;
+    vm_event_back_ring_t *back_ring = &pc->back_ring;
+    vm_event_response_t rsp = {
+        .version = VM_EVENT_INTERFACE_VERSION,
+        .vcpu_id = req->vcpu_id,
+        .flags = req->flags & VM_EVENT_FLAG_VCPU_PAUSED,
+        .reason = req->reason,
+        .u.mem_paging.gfn = req->u.mem_paging.gfn,
+        .u.mem_paging.flags = req->u.mem_paging.flags,
+    };
+
+    memcpy(RING_GET_RESPONSE(back_ring, back_ring->rsp_prod_pvt), &rsp,
+           sizeof(rsp));
+    back_ring->rsp_prod_pvt++;
+    RING_PUSH_RESPONSES(back_ring);
+    pc->notify = true;
+}
+
+static int postcopy_notify(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_postcopy *pc = ctx->restore.postcopy;
+
+    if ( !pc->notify )
+        return 0;
+
+    pc->notify = false;
+    if ( xenevtchn_notify(pc->xce, pc->local_port) < 0 )
+    {
+        PERROR("Failed to notify paging event channel");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * A page is no longer outstanding, having arrived or been dropped by the
+ * guest.  Let any vcpus waiting for it continue.
+ */
+static void postcopy_page_done(struct xc_sr_context *ctx, xen_pfn_t pfn)
 {
-    xc_interface *xch = ctx->xch;
-    int rc = 0, ret;
+    struct xc_sr_postcopy *pc = ctx->restore.postcopy;
     unsigned int i;
 
-    if ( ctx->stream_type == XC_STREAM_PLAIN )
+    if ( !test_and_clear_bit(pfn, pc->outstanding) )
+        return;
+
+    --pc->nr_outstanding;
+    if ( !test_and_clear_bit(pfn, pc->evicted) )
     {
-        ERROR("Found checkpoint in non-checkpointed stream");
-        rc = -1;
-        goto err;
+        --pc->nr_resident;
+        return;
     }
 
-    ret = ctx->restore.callbacks->checkpoint(ctx->restore.callbacks->data);
-    switch ( ret )
+    for ( i = 0; i < pc->nr_waiting; )
     {
-    case XGR_CHECKPOINT_SUCCESS:
-        break;
+        if ( pc->waiting[i].u.mem_paging.gfn != pfn )
+        {
+            ++i;
+            continue;
+        }
 
-    case XGR_CHECKPOINT_FAILOVER:
-        if ( ctx->restore.buffer_all_records )
-            rc = BROKEN_CHANNEL;
-        else
-            /* We don't have a consistent state */
-            rc = -1;
-        goto err;
+        postcopy_respond(ctx, &pc->waiting[i]);
+        pc->waiting[i] = pc->waiting[--pc->nr_waiting];
+    }
+}
 
-    default: /* Other fatal error */
-        rc = -1;
-        goto err;
+static bool postcopy_requests_pending(const struct xc_sr_postcopy *pc)
+{
+    return pc->nr_requests || pc->out_done < pc->out_len;
+}
+
+/*
+ * Send the accumulated requests to the sender, for as long as send_back_fd
+ * takes them without blocking.  The sender may itself be blocked writing
+ * page data, which is only read by postcopy_service(), so blocking here can
+ * deadlock the two.  Whatever is left is written by postcopy_service() once
+ * send_back_fd becomes writeable again.
+ *
+ * send_back_fd may be the same file as the stream, so is not made
+ * non-blocking.  Instead, no more than PIPE_BUF is written at a time, once
+ * poll() reports room.
+ */
+static int postcopy_flush_requests(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_postcopy *pc = ctx->restore.postcopy;
+    struct xc_sr_rhdr *rhdr = (struct xc_sr_rhdr *)pc->out;
+    struct pollfd pfd = { .fd = ctx->restore.send_back_fd, .events = POLLOUT };
+    unsigned int nr;
+    ssize_t len;
+    int rc;
+
+    for ( ;; )
+    {
+        if ( pc->out_done == pc->out_len )
+        {
+            if ( !pc->nr_requests )
+                return 0;
+
+            nr = min(pc->nr_requests, POSTCOPY_MAX_PFNS);
+            rhdr->type = REC_TYPE_POSTCOPY_REQUEST;
+            rhdr->length = nr * sizeof(*pc->requests);
+            memcpy(rhdr + 1, pc->requests, rhdr->length);
+
+            pc->nr_requests -= nr;
+            memmove(pc->requests, pc->requests + nr,
+                    pc->nr_requests * sizeof(*pc->requests));
+            pc->out_len = sizeof(*rhdr) + rhdr->length;
+            pc->out_done = 0;
+        }
+
+        rc = poll(&pfd, 1, 0);
+        if ( rc < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            PERROR("Failed to poll the post-copy request stream");
+            return -1;
+        }
+
+        if ( !rc )
+            return 0;
+
+        len = write(ctx->restore.send_back_fd, pc->out + pc->out_done,
+                    min_t(size_t, pc->out_len - pc->out_done, PIPE_BUF));
+        if ( len < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            PERROR("Failed to write post-copy requests");
+            return -1;
+        }
+
+        pc->out_done += len;
     }
+}
 
-    if ( ctx->restore.buffer_all_records )
+/*
+ * Having failed before resuming the guest, tell the sender with a
+ * POSTCOPY_ABORT record, so it may resume the guest at its end instead.  The
+ * rest of any partly written request goes first, to keep the record
+ * boundaries, and the stream is drained meanwhile, as the sender may be
+ * blocked writing page data, until the sender acknowledges with an END
+ * record.  Errors are only logged, as the migration is failing anyway.
+ */
+static void postcopy_abort(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_postcopy *pc = ctx->restore.postcopy;
+    struct xc_sr_rhdr rhdr = { .type = REC_TYPE_POSTCOPY_ABORT };
+    struct pollfd pfd[2] = {
+        { .fd = ctx->fd, .events = POLLIN },
+        { .fd = ctx->restore.send_back_fd, .events = POLLOUT },
+    };
+    const uint8_t *buf = pc ? pc->out + pc->out_done : NULL;
+    size_t len = pc ? pc->out_len - pc->out_done : 0;
+    struct xc_sr_record rec;
+    bool queued = false;
+    int saved_errno = errno;
+    ssize_t ret;
+
+    for ( ;; )
     {
-        IPRINTF("All records buffered");
+        if ( !len && !queued )
+        {
+            buf = (const uint8_t *)&rhdr;
+            len = sizeof(rhdr);
+            queued = true;
+        }
+        pfd[1].fd = len ? ctx->restore.send_back_fd : -1;
 
-        for ( i = 0; i < ctx->restore.buffered_rec_num; i++ )
+        if ( poll(pfd, ARRAY_SIZE(pfd), -1) < 0 )
         {
-            rc = process_record(ctx, &ctx->restore.buffered_records[i]);
-            if ( rc )
-                goto err;
+            if ( errno == EINTR )
+                continue;
+            PERROR("Failed to poll for the post-copy abort");
+            break;
+        }
+
+        if ( pfd[1].revents )
+        {
+            ret = write(ctx->restore.send_back_fd, buf,
+                        min_t(size_t, len, PIPE_BUF));
+            if ( ret < 0 && errno != EINTR )
+            {
+                PERROR("Failed to write post-copy abort");
+                break;
+            }
+            if ( ret > 0 )
+            {
+                buf += ret;
+                len -= ret;
+            }
+        }
+
+        /* The sender completes any record it starts without reading. */
+        if ( pfd[0].revents )
+        {
+            if ( read_record(ctx, ctx->fd, &rec) )
+                break;
+            free(rec.data);
+            if ( rec.type == REC_TYPE_END )
+            {
+                if ( len )
+                    ERROR("Post-copy ended before the abort was sent");
+                break;
+            }
         }
-        ctx->restore.buffered_rec_num = 0;
-        IPRINTF("All records processed");
     }
-    else
-        ctx->restore.buffer_all_records = true;
 
-    if ( ctx->stream_type == XC_STREAM_COLO )
+    errno = saved_errno;
+}
+
+static int postcopy_add_request(struct xc_sr_context *ctx, xen_pfn_t pfn)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_postcopy *pc = ctx->restore.postcopy;
+    uint64_t *requests;
+
+    if ( pc->nr_requests == pc->max_requests )
     {
-#define HANDLE_CALLBACK_RETURN_VALUE(ret)                   \
-    do {                                                    \
-        if ( ret == 1 )                                     \
-            rc = 0; /* Success */                           \
-        else                                                \
-        {                                                   \
-            if ( ret == 2 )                                 \
-                rc = BROKEN_CHANNEL;                        \
-            else                                            \
-                rc = -1; /* Some unspecified error */       \
-            goto err;                                       \
-        }                                                   \
-    } while (0)
+        requests = realloc(pc->requests, (pc->max_requests * 2 + 16) *
+                           sizeof(*requests));
+        if ( !requests )
+        {
+            ERROR("Unable to allocate memory for post-copy requests");
+            return -1;
+        }
+        pc->requests = requests;
+        pc->max_requests = pc->max_requests * 2 + 16;
+    }
 
-        /* COLO */
+    pc->requests[pc->nr_requests++] = pfn;
 
-        /* We need to resume guest */
-        rc = ctx->restore.ops.stream_complete(ctx);
-        if ( rc )
+    return 0;
+}
+
+/*
+ * Process the requests on the paging ring.  Faults on evicted pages wait for
+ * the page to arrive, having asked the sender for it.  Anything else (a page
+ * which raced with its arrival, or a nominated page which failed to be
+ * evicted) can be made accessible again right away.
+ */
+static int postcopy_service_ring(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_postcopy *pc = ctx->restore.postcopy;
+    vm_event_back_ring_t *back_ring = &pc->back_ring;
+    vm_event_request_t req, *waiting;
+    xen_pfn_t gfn;
+    unsigned int i;
+
+    while ( RING_HAS_UNCONSUMED_REQUESTS(back_ring) )
+    {
+        memcpy(&req, RING_GET_REQUEST(back_ring, back_ring->req_cons),
+               sizeof(req));
+        back_ring->req_cons++;
+        back_ring->sring->req_event = back_ring->req_cons + 1;
+
+        gfn = req.u.mem_paging.gfn;
+        if ( gfn >= ctx->restore.p2m_size )
+        {
+            ERROR("Paging request for gfn %#"PRIpfn" beyond the p2m", gfn);
+            return -1;
+        }
+
+        if ( req.u.mem_paging.flags & MEM_PAGING_DROP_PAGE )
+        {
+            /* Ballooned out by the guest.  Nothing to wait for. */
+            postcopy_page_done(ctx, gfn);
+            postcopy_respond(ctx, &req);
+            continue;
+        }
+
+        if ( !test_bit(gfn, pc->evicted) )
+        {
+            if ( xc_mem_paging_prep(xch, ctx->domid, gfn) && errno != ENOENT )
+            {
+                PERROR("Failed to page in gfn %#"PRIpfn, gfn);
+                return -1;
+            }
+            postcopy_respond(ctx, &req);
+            continue;
+        }
+
+        for ( i = 0; i < pc->nr_waiting; ++i )
+            if ( pc->waiting[i].u.mem_paging.gfn == gfn )
+                break;
+
+        if ( i == pc->nr_waiting && postcopy_add_request(ctx, gfn) )
+            return -1;
+
+        if ( pc->nr_waiting == pc->max_waiting )
+        {
+            waiting = realloc(pc->waiting, (pc->max_waiting * 2 + 16) *
+                              sizeof(*waiting));
+            if ( !waiting )
+            {
+                ERROR("Unable to allocate memory for paging requests");
+                return -1;
+            }
+            pc->waiting = waiting;
+            pc->max_waiting = pc->max_waiting * 2 + 16;
+        }
+        pc->waiting[pc->nr_waiting++] = req;
+    }
+
+    if ( postcopy_flush_requests(ctx) )
+        return -1;
+
+    return postcopy_notify(ctx);
+}
+
+/*
+ * Copy data into resident pages.  Mapping may fail on a page which was
+ * nominated but failed to be evicted, until the resulting paging request has
+ * been serviced, or on a page which is not populated on this side yet.
+ */
+static int postcopy_write_resident(struct xc_sr_context *ctx,
+                                   unsigned int nr, xen_pfn_t *gfns,
+                                   void **pages)
+{
+    xc_interface *xch = ctx->xch;
+    int *map_errs = malloc(nr * sizeof(*map_errs));
+    unsigned int i, retry, tries;
+    void *mapping;
+    int rc = -1;
+
+    if ( !map_errs )
+    {
+        ERROR("Unable to allocate memory for %u pages", nr);
+        return -1;
+    }
+
+    for ( tries = 0; nr; ++tries )
+    {
+        mapping = xenforeignmemory_map(xch->fmem, ctx->domid,
+                                       PROT_READ | PROT_WRITE,
+                                       nr, gfns, map_errs);
+        if ( !mapping )
+        {
+            PERROR("Unable to map %u resident pages", nr);
             goto err;
+        }
 
-        ctx->restore.callbacks->restore_results(ctx->restore.xenstore_gfn,
-                                                ctx->restore.console_gfn,
-                                                ctx->restore.callbacks->data);
+        for ( i = 0, retry = 0; i < nr; ++i )
+        {
+            if ( !map_errs[i] )
+            {
+                memcpy(mapping + ((size_t)i * PAGE_SIZE), pages[i], PAGE_SIZE);
+                continue;
+            }
 
-        /* Resume secondary vm */
-        ret = ctx->restore.callbacks->postcopy(ctx->restore.callbacks->data);
-        HANDLE_CALLBACK_RETURN_VALUE(ret);
+            if ( tries == 8 )
+            {
+                ERROR("Mapping gfn %#"PRIpfn" failed with %d",
+                      gfns[i], map_errs[i]);
+                xenforeignmemory_unmap(xch->fmem, mapping, nr);
+                goto err;
+            }
 
-        /* Wait for a new checkpoint */
-        ret = ctx->restore.callbacks->wait_checkpoint(
-            ctx->restore.callbacks->data);
-        HANDLE_CALLBACK_RETURN_VALUE(ret);
+            if ( map_errs[i] != -ENOENT &&
+                 xc_domain_populate_physmap_exact(xch, ctx->domid, 1, 0, 0,
+                                                  &gfns[i]) )
+            {
+                PERROR("Failed to populate gfn %#"PRIpfn, gfns[i]);
+                xenforeignmemory_unmap(xch->fmem, mapping, nr);
+                goto err;
+            }
 
-        /* suspend secondary vm */
-        ret = ctx->restore.callbacks->suspend(ctx->restore.callbacks->data);
-        HANDLE_CALLBACK_RETURN_VALUE(ret);
+            gfns[retry] = gfns[i];
+            pages[retry] = pages[i];
+            ++retry;
+        }
 
-#undef HANDLE_CALLBACK_RETURN_VALUE
+        xenforeignmemory_unmap(xch->fmem, mapping, nr);
+        nr = retry;
 
-        rc = send_checkpoint_dirty_pfn_list(ctx);
-        if ( rc )
+        if ( nr && ctx->restore.postcopy->ring_page &&
+             postcopy_service_ring(ctx) )
             goto err;
     }
 
+    rc = 0;
+
  err:
+    free(map_errs);
     return rc;
 }
 
-static int buffer_record(struct xc_sr_context *ctx, struct xc_sr_record *rec)
+/*
+ * Load page data which arrived from the sender.  Pages may arrive more than
+ * once, if requested while already in flight.
+ */
+static int postcopy_load_pages(struct xc_sr_context *ctx, unsigned int count,
+                               const xen_pfn_t *pfns, const uint32_t *types,
+                               void *page_data)
 {
+    static uint8_t zero_page[PAGE_SIZE];
     xc_interface *xch = ctx->xch;
-    unsigned int new_alloc_num;
-    struct xc_sr_record *p;
+    struct xc_sr_postcopy *pc = ctx->restore.postcopy;
+    xen_pfn_t *gfns = malloc(count * sizeof(*gfns));
+    void **pages = malloc(count * sizeof(*pages));
+    unsigned int i, nr = 0;
+    void *page;
+    int rc = -1;
 
-    if ( ctx->restore.buffered_rec_num >= ctx->restore.allocated_rec_num )
+    if ( !gfns || !pages )
     {
-        new_alloc_num = ctx->restore.allocated_rec_num + DEFAULT_BUF_RECORDS;
-        p = realloc(ctx->restore.buffered_records,
-                    new_alloc_num * sizeof(struct xc_sr_record));
-        if ( !p )
+        ERROR("Unable to allocate memory for %u pages", count);
+        goto err;
+    }
+
+    for ( i = 0; i < count; ++i )
+    {
+        page = NULL;
+        if ( page_type_has_stream_data(types[i]) )
         {
-            ERROR("Failed to realloc memory for buffered records");
-            return -1;
+            page = page_data;
+            page_data += PAGE_SIZE;
         }
 
-        ctx->restore.buffered_records = p;
-        ctx->restore.allocated_rec_num = new_alloc_num;
+        if ( pfns[i] >= ctx->restore.p2m_size )
+        {
+            ERROR("Post-copy page data for pfn %#"PRIpfn" beyond the p2m",
+                  pfns[i]);
+            goto err;
+        }
+
+        if ( !test_bit(pfns[i], pc->outstanding) )
+            continue;
+
+        if ( test_bit(pfns[i], pc->evicted) )
+        {
+            /*
+             * A page the sender no longer has reads as zeroes.  ENOENT means
+             * the guest has dropped the page in the meantime.
+             */
+            if ( xc_mem_paging_load(xch, ctx->domid, pfns[i],
+                                    page ?: zero_page) && errno != ENOENT )
+            {
+                PERROR("Failed to load gfn %#"PRIpfn, pfns[i]);
+                goto err;
+            }
+        }
+        else if ( page )
+        {
+            gfns[nr] = pfns[i];
+            pages[nr++] = page;
+        }
+
+        postcopy_page_done(ctx, pfns[i]);
     }
 
-    memcpy(&ctx->restore.buffered_records[ctx->restore.buffered_rec_num++],
-           rec, sizeof(*rec));
+    if ( nr && postcopy_write_resident(ctx, nr, gfns, pages) )
+        goto err;
 
-    return 0;
+    rc = pc->ring_page ? postcopy_notify(ctx) : 0;
+
+ err:
+    free(pages);
+    free(gfns);
+
+    return rc;
 }
 
-int handle_static_data_end(struct xc_sr_context *ctx)
+/*
+ * Read the POSTCOPY_PFNS records from the sender, up to the empty record
+ * terminating the list.
+ */
+static int postcopy_read_pfns(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
-    unsigned int missing = 0;
-    int rc = 0;
+    struct xc_sr_postcopy *pc = ctx->restore.postcopy;
+    struct xc_sr_record rec;
+    const uint64_t *pfns;
+    unsigned int i;
+    int rc = -1;
 
-    if ( ctx->restore.seen_static_data_end )
+    for ( ;; )
     {
-        ERROR("Multiple STATIC_DATA_END records found");
-        return -1;
-    }
+        if ( read_record(ctx, ctx->fd, &rec) )
+            return -1;
+
+        if ( rec.type != REC_TYPE_POSTCOPY_PFNS )
+        {
+            ERROR("Expected POSTCOPY_PFNS record, got %#x (%s)",
+                  rec.type, rec_type_to_str(rec.type));
+            goto err;
+        }
+
+        if ( rec.length % sizeof(*pfns) )
+        {
+            ERROR("Invalid POSTCOPY_PFNS record length %u", rec.length);
+            goto err;
+        }
+
+        if ( rec.length == 0 )
+            break;
+
+        for ( i = 0, pfns = rec.data; i < rec.length / sizeof(*pfns); ++i )
+        {
+            if ( pfns[i] >= ctx->restore.p2m_size )
+            {
+                ERROR("Post-copy pfn %#"PRIx64" beyond the p2m", pfns[i]);
+                goto err;
+            }
 
-    ctx->restore.seen_static_data_end = true;
+            if ( !test_and_set_bit(pfns[i], pc->outstanding) )
+                ++pc->nr_outstanding;
+        }
 
-    rc = ctx->restore.ops.static_data_complete(ctx, &missing);
-    if ( rc )
-        return rc;
+        free(rec.data);
+    }
 
-    if ( ctx->restore.callbacks->static_data_done &&
-         (rc = ctx->restore.callbacks->static_data_done(
-             missing, ctx->restore.callbacks->data) != 0) )
-        ERROR("static_data_done() callback failed: %d\n", rc);
+    pc->nr_resident = pc->nr_outstanding;
+    rc = 0;
 
+ err:
+    free(rec.data);
     return rc;
 }
 
-static int process_record(struct xc_sr_context *ctx, struct xc_sr_record *rec)
+static void postcopy_disable_paging(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
-    int rc = 0;
+    struct xc_sr_postcopy *pc = ctx->restore.postcopy;
 
-    switch ( rec->type )
+    if ( pc->ring_page )
     {
-    case REC_TYPE_END:
-        break;
-
-    case REC_TYPE_PAGE_DATA:
-        rc = handle_page_data(ctx, rec);
-        break;
-
-    case REC_TYPE_VERIFY:
-        DPRINTF("Verify mode enabled");
-        ctx->restore.verify = true;
-        break;
-
-    case REC_TYPE_CHECKPOINT:
-        rc = handle_checkpoint(ctx);
-        break;
-
-    case REC_TYPE_STATIC_DATA_END:
-        rc = handle_static_data_end(ctx);
-        break;
-
-    default:
-        rc = ctx->restore.ops.process_record(ctx, rec);
-        break;
+        if ( xc_mem_paging_disable(xch, ctx->domid) )
+            PERROR("Failed to disable paging");
+        xenforeignmemory_unmap(xch->fmem, pc->ring_page, 1);
+        pc->ring_page = NULL;
     }
 
-    free(rec->data);
-    rec->data = NULL;
-
-    return rc;
+    if ( pc->xce )
+    {
+        if ( pc->local_port )
+            xenevtchn_unbind(pc->xce, pc->local_port);
+        xenevtchn_close(pc->xce);
+        pc->xce = NULL;
+    }
 }
 
-static int setup(struct xc_sr_context *ctx)
+static int postcopy_enable_paging(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
+    struct xc_sr_postcopy *pc = ctx->restore.postcopy;
+    uint32_t port;
     int rc;
-    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
-                                    &ctx->restore.dirty_bitmap_hbuf);
 
-    if ( ctx->stream_type == XC_STREAM_COLO )
+    pc->ring_page = xc_vm_event_enable(xch, ctx->domid,
+                                       HVM_PARAM_PAGING_RING_PFN, &port);
+    if ( !pc->ring_page )
     {
-        dirty_bitmap = xc_hypercall_buffer_alloc_pages(
-            xch, dirty_bitmap, NRPAGES(bitmap_size(ctx->restore.p2m_size)));
-
-        if ( !dirty_bitmap )
-        {
-            ERROR("Unable to allocate memory for dirty bitmap");
-            rc = -1;
-            goto err;
-        }
+        PERROR("Failed to enable paging");
+        return -1;
     }
 
-    rc = ctx->restore.ops.setup(ctx);
-    if ( rc )
-        goto err;
-
-    ctx->restore.max_populated_pfn = (32 * 1024 / 4) - 1;
-    ctx->restore.populated_pfns = bitmap_alloc(
-        ctx->restore.max_populated_pfn + 1);
-    if ( !ctx->restore.populated_pfns )
+    pc->xce = xenevtchn_open(NULL, 0);
+    if ( !pc->xce )
     {
-        ERROR("Unable to allocate memory for populated_pfns bitmap");
-        rc = -1;
+        PERROR("Failed to open event channel");
         goto err;
     }
 
-    ctx->restore.buffered_records = malloc(
-        DEFAULT_BUF_RECORDS * sizeof(struct xc_sr_record));
-    if ( !ctx->restore.buffered_records )
+    rc = xenevtchn_bind_interdomain(pc->xce, ctx->domid, port);
+    if ( rc < 0 )
     {
-        ERROR("Unable to allocate memory for buffered records");
-        rc = -1;
+        PERROR("Failed to bind event channel");
         goto err;
     }
-    ctx->restore.allocated_rec_num = DEFAULT_BUF_RECORDS;
+    pc->local_port = rc;
+
+    SHARED_RING_INIT((vm_event_sring_t *)pc->ring_page);
+    BACK_RING_INIT(&pc->back_ring, (vm_event_sring_t *)pc->ring_page,
+                   XC_PAGE_SIZE);
+
+    return 0;
 
  err:
-    return rc;
+    postcopy_disable_paging(ctx);
+    return -1;
 }
 
-static void cleanup(struct xc_sr_context *ctx)
+/*
+ * Page out as many of the outstanding pages as possible.  Pages which are
+ * mapped, e.g. by the device model, can not be paged out and stay resident.
+ */
+static void postcopy_evict_pages(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
-    unsigned int i;
-    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
-                                    &ctx->restore.dirty_bitmap_hbuf);
-
-    for ( i = 0; i < ctx->restore.buffered_rec_num; i++ )
-        free(ctx->restore.buffered_records[i].data);
+    struct xc_sr_postcopy *pc = ctx->restore.postcopy;
+    xen_pfn_t pfn;
 
-    if ( ctx->stream_type == XC_STREAM_COLO )
-        xc_hypercall_buffer_free_pages(
-            xch, dirty_bitmap, NRPAGES(bitmap_size(ctx->restore.p2m_size)));
+    for ( pfn = 0; pfn < ctx->restore.p2m_size; ++pfn )
+    {
+        if ( !test_bit(pfn, pc->outstanding) ||
+             xc_mem_paging_nominate(xch, ctx->domid, pfn) ||
+             xc_mem_paging_evict(xch, ctx->domid, pfn) )
+            continue;
 
-    free(ctx->restore.buffered_records);
-    free(ctx->restore.populated_pfns);
+        set_bit(pfn, pc->evicted);
+        --pc->nr_resident;
+    }
 
-    if ( ctx->restore.ops.cleanup(ctx) )
-        PERROR("Failed to clean up");
+    IPRINTF("Post-copy: %lu pages paged out, %lu resident",
+            pc->nr_outstanding - pc->nr_resident, pc->nr_resident);
 }
 
 /*
- * Restore a domain.
+ * Process page data from the sender and requests from the paging ring until
+ * no pages remain outstanding, or with 'resident', until no resident pages
+ * remain outstanding.
  */
-static int restore(struct xc_sr_context *ctx)
+static int postcopy_service(struct xc_sr_context *ctx, bool resident)
 {
     xc_interface *xch = ctx->xch;
+    struct xc_sr_postcopy *pc = ctx->restore.postcopy;
+    struct pollfd pfd[3] = {
+        { .fd = ctx->fd, .events = POLLIN },
+        { .fd = -1, .events = POLLIN },
+        { .fd = -1, .events = POLLOUT },
+    };
     struct xc_sr_record rec;
-    int rc, saved_rc = 0, saved_errno = 0;
+    xenevtchn_port_or_error_t port;
+    int rc;
 
-    IPRINTF("Restoring domain");
+    if ( pc->ring_page )
+    {
+        pfd[1].fd = xenevtchn_fd(pc->xce);
 
-    rc = setup(ctx);
-    if ( rc )
-        goto err;
+        rc = postcopy_service_ring(ctx);
+        if ( rc )
+            return rc;
+    }
 
-    do
+    while ( resident ? pc->nr_resident : pc->nr_outstanding )
     {
-        rc = read_record(ctx, ctx->fd, &rec);
-        if ( rc )
+        pfd[2].fd = postcopy_requests_pending(pc)
+            ? ctx->restore.send_back_fd : -1;
+
+        rc = poll(pfd, ARRAY_SIZE(pfd), -1);
+        if ( rc < 0 )
         {
-            if ( ctx->restore.buffer_all_records )
-                goto remus_failover;
-            else
-                goto err;
+            if ( errno == EINTR )
+                continue;
+            PERROR("Failed to poll for post-copy data");
+            return -1;
         }
 
-        if ( ctx->restore.buffer_all_records &&
-             rec.type != REC_TYPE_END &&
-             rec.type != REC_TYPE_CHECKPOINT )
+        if ( pfd[1].revents )
         {
-            rc = buffer_record(ctx, &rec);
+            port = xenevtchn_pending(pc->xce);
+            if ( port < 0 || xenevtchn_unmask(pc->xce, port) < 0 )
+            {
+                PERROR("Failed to handle paging event channel");
+                return -1;
+            }
+
+            rc = postcopy_service_ring(ctx);
             if ( rc )
-                goto err;
+                return rc;
         }
-        else
+
+        if ( pfd[2].revents )
         {
-            rc = process_record(ctx, &rec);
-            if ( rc == RECORD_NOT_PROCESSED )
+            rc = postcopy_flush_requests(ctx);
+            if ( rc )
+                return rc;
+        }
+
+        if ( pfd[0].revents )
+        {
+            rc = read_record(ctx, ctx->fd, &rec);
+            if ( rc )
+                return rc;
+
+            switch ( rec.type )
             {
-                if ( rec.type & REC_TYPE_OPTIONAL )
-                    DPRINTF("Ignoring optional record %#x (%s)",
-                            rec.type, rec_type_to_str(rec.type));
-                else
-                {
-                    ERROR("Mandatory record %#x (%s) not handled",
-                          rec.type, rec_type_to_str(rec.type));
-                    rc = -1;
-                    goto err;
-                }
+            case REC_TYPE_PAGE_DATA:
+            case REC_TYPE_COMPRESSED_PAGE_DATA:
+                rc = handle_page_data(ctx, &rec);
+                break;
+
+            default:
+                ERROR("Unexpected post-copy record %#x (%s)",
+                      rec.type, rec_type_to_str(rec.type));
+                rc = -1;
+                break;
             }
-            else if ( rc == BROKEN_CHANNEL )
-                goto remus_failover;
-            else if ( rc )
-                goto err;
+
+            free(rec.data);
+            if ( rc )
+                return rc;
         }
+    }
 
-    } while ( rec.type != REC_TYPE_END );
+    return 0;
+}
 
- remus_failover:
-    if ( ctx->stream_type == XC_STREAM_COLO )
+static int postcopy_receive(struct xc_sr_context *ctx,
+                            int (*resume)(uint32_t domid, void *data),
+                            void *data)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_postcopy pc = { 0 };
+    struct xc_sr_record end = { .type = REC_TYPE_END };
+    xen_pfn_t pfn;
+    bool resumed = false;
+    int rc = -1;
+
+    ctx->restore.postcopy = &pc;
+
+    pc.outstanding = bitmap_alloc(ctx->restore.p2m_size);
+    pc.evicted = bitmap_alloc(ctx->restore.p2m_size);
+    pc.out = malloc(sizeof(struct xc_sr_rhdr) +
+                    POSTCOPY_MAX_PFNS * sizeof(*pc.requests));
+    if ( !pc.outstanding || !pc.evicted || !pc.out )
     {
-        /* With COLO, we have already called stream_complete */
-        rc = 0;
-        IPRINTF("COLO Failover");
-        goto done;
+        ERROR("Unable to allocate memory for post-copy bitmaps");
+        goto err;
+    }
+
+    if ( postcopy_read_pfns(ctx) )
+        goto err;
+
+    IPRINTF("Post-copy: %lu pages outstanding", pc.nr_outstanding);
+
+    if ( pc.nr_outstanding )
+    {
+        if ( postcopy_enable_paging(ctx) == 0 )
+            postcopy_evict_pages(ctx);
+        else
+            IPRINTF("Fetching all pages before resuming");
+    }
+
+    /* Resident pages have stale contents, so must arrive first. */
+    for ( pfn = 0; pfn < ctx->restore.p2m_size; ++pfn )
+    {
+        if ( test_bit(pfn, pc.outstanding) && !test_bit(pfn, pc.evicted) &&
+             postcopy_add_request(ctx, pfn) )
+            goto err;
+    }
+
+    if ( postcopy_flush_requests(ctx) || postcopy_service(ctx, true) )
+        goto err;
+
+    resumed = true;
+    if ( resume(ctx->domid, data) )
+    {
+        ERROR("Failed to resume domain");
+        goto err;
     }
 
+    if ( postcopy_service(ctx, false) )
+        goto err;
+
     /*
-     * With Remus, if we reach here, there must be some error on primary,
-     * failover from the last checkpoint state.
+     * Every page has arrived, so any requests not sent yet are stale.  The
+     * sender has nothing left to write, and is waiting for the rest of any
+     * partly written record, then for the END record.
      */
-    rc = ctx->restore.ops.stream_complete(ctx);
+    pc.nr_requests = 0;
+    if ( write_exact(ctx->restore.send_back_fd, pc.out + pc.out_done,
+                     pc.out_len - pc.out_done) )
+    {
+        PERROR("Failed to write post-copy requests");
+        goto err;
+    }
+
+    rc = write_split_record_fd(ctx, ctx->restore.send_back_fd, &end, NULL, 0);
     if ( rc )
         goto err;
 
-    IPRINTF("Restore successful");
-    goto done;
+    IPRINTF("Post-copy complete");
 
  err:
-    saved_errno = errno;
-    saved_rc = rc;
-    PERROR("Restore failed");
-
- done:
-    cleanup(ctx);
+    if ( rc && !resumed )
+        postcopy_abort(ctx);
 
-    if ( saved_rc )
-    {
-        rc = saved_rc;
-        errno = saved_errno;
-    }
+    postcopy_disable_paging(ctx);
+    free(pc.waiting);
+    free(pc.out);
+    free(pc.requests);
+    free(pc.evicted);
+    free(pc.outstanding);
+    ctx->restore.postcopy = NULL;
 
     return rc;
 }
@@ -864,6 +3363,23 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
                       unsigned long *console_gfn, uint32_t console_domid,
                       xc_stream_type_t stream_type,
                       struct restore_callbacks *callbacks, int send_back_fd)
+{
+    return xc_domain_restore_streams(xch, io_fd, dom, store_evtchn, store_mfn,
+                                     store_domid, console_evtchn, console_gfn,
+                                     console_domid, stream_type, callbacks,
+                                     send_back_fd, NULL, 0);
+}
+
+int xc_domain_restore_streams(xc_interface *xch, int io_fd, uint32_t dom,
+                              unsigned int store_evtchn,
+                              unsigned long *store_mfn, uint32_t store_domid,
+                              unsigned int console_evtchn,
+                              unsigned long *console_gfn,
+                              uint32_t console_domid,
+                              xc_stream_type_t stream_type,
+                              struct restore_callbacks *callbacks,
+                              int send_back_fd,
+                              const int *page_fds, unsigned int nr_page_fds)
 {
     xen_pfn_t nr_pfns;
     struct xc_sr_context ctx = {
@@ -871,6 +3387,7 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
         .fd = io_fd,
         .stream_type = stream_type,
     };
+    unsigned int i;
 
     /* GCC 4.4 (of CentOS 6.x vintage) can' t initialise anonymous unions. */
     ctx.restore.console_evtchn = console_evtchn;
@@ -912,8 +3429,15 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
         return -1;
     }
 
-    DPRINTF("fd %d, dom %u, hvm %u, stream_type %d",
-            io_fd, dom, ctx.dominfo.hvm, stream_type);
+    if ( nr_page_fds && stream_type != XC_STREAM_PLAIN )
+    {
+        ERROR("Page streams are not supported for checkpointed streams");
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    DPRINTF("fd %d, dom %u, hvm %u, stream_type %d, page streams %u",
+            io_fd, dom, ctx.dominfo.hvm, stream_type, nr_page_fds);
 
     ctx.domid = dom;
 
@@ -930,6 +3454,26 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
     ctx.restore.ops = ctx.dominfo.hvm
         ? restore_ops_x86_hvm : restore_ops_x86_pv;
 
+    if ( nr_page_fds )
+    {
+        ctx.restore.streams = calloc(nr_page_fds,
+                                     sizeof(*ctx.restore.streams));
+        if ( !ctx.restore.streams )
+        {
+            ERROR("Unable to allocate memory for %u page streams",
+                  nr_page_fds);
+            return -1;
+        }
+
+        for ( i = 0; i < nr_page_fds; ++i )
+        {
+            ctx.restore.streams[i].ctx = &ctx;
+            ctx.restore.streams[i].id = i;
+            ctx.restore.streams[i].fd = page_fds[i];
+        }
+        ctx.restore.nr_streams = nr_page_fds;
+    }
+
     if ( restore(&ctx) )
         return -1;
 
@@ -949,6 +3493,56 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
     return 0;
 }
 
+int xc_domain_postcopy_receive(xc_interface *xch, int io_fd, uint32_t dom,
+                               int send_fd,
+                               int (*resume)(uint32_t domid, void *data),
+                               void *data)
+{
+    xen_pfn_t nr_pfns;
+    struct xc_sr_context ctx = {
+        .xch = xch,
+        .fd = io_fd,
+        .domid = dom,
+        .stream_type = XC_STREAM_PLAIN,
+    };
+
+    ctx.restore.send_back_fd = send_fd;
+
+    if ( xc_domain_getinfo(xch, dom, 1, &ctx.dominfo) != 1 ||
+         ctx.dominfo.domid != dom )
+    {
+        PERROR("Failed to get domain info");
+        goto err;
+    }
+
+    if ( !ctx.dominfo.hvm )
+    {
+        ERROR("Post-copy is only supported for HVM guests");
+        errno = EOPNOTSUPP;
+        goto err;
+    }
+
+    if ( xc_domain_nr_gpfns(xch, dom, &nr_pfns) < 0 )
+    {
+        PERROR("Unable to obtain the guest p2m size");
+        goto err;
+    }
+
+    DPRINTF("fd %d, dom %u, send_fd %d", io_fd, dom, send_fd);
+
+    /* The page data follows a complete v3 stream. */
+    ctx.restore.p2m_size = nr_pfns;
+    ctx.restore.ops = restore_ops_x86_hvm;
+    ctx.restore.format_version = 3;
+    ctx.restore.seen_static_data_end = true;
+
+    return postcopy_receive(&ctx, resume, data);
+
+ err:
+    postcopy_abort(&ctx);
+    return -1;
+}
+
 /*
  * Local variables:
  * mode: C
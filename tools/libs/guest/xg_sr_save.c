@@ -1,4 +1,6 @@
 #include <assert.h>
+#include <poll.h>
+#include <time.h>
 #include <arpa/inet.h>
 
 #include "xg_sr_common.h"
@@ -75,16 +77,116 @@ static int write_checkpoint_record(struct xc_sr_context *ctx)
 }
 
 /*
- * Writes a batch of memory as a PAGE_DATA record into the stream.  The batch
- * is constructed in ctx->save.batch_pfns.
+ * Mark a pfn as deferred, to be sent again in the final iteration.  May be
+ * called concurrently by page stream workers.
+ */
+static void defer_page(struct xc_sr_context *ctx, xen_pfn_t pfn)
+{
+    pthread_mutex_lock(&ctx->save.lock);
+    set_bit(pfn, ctx->save.deferred_pages);
+    ++ctx->save.nr_deferred_pages;
+    pthread_mutex_unlock(&ctx->save.lock);
+}
+
+/*
+ * Size of the XBZRLE page cache (64MiB), and the largest delta worth sending
+ * in place of a normally encoded page.
+ */
+#define XBZRLE_CACHE_PAGES 16384
+#define XBZRLE_MAX_LEN     (PAGE_SIZE / 2)
+
+struct xbzrle_stats
+{
+    uint64_t hits, misses, bytes_saved;
+};
+
+/*
+ * Cache slot for a pfn.  Pfns are split into regions in the same way as they
+ * are split into page streams.
+ */
+static unsigned int xbzrle_slot(const struct xc_sr_context *ctx, xen_pfn_t pfn)
+{
+    const struct xc_sr_xbzrle_cache *c = &ctx->save.xbzrle;
+    xen_pfn_t chunk = pfn >> PAGE_STREAM_SHIFT;
+    xen_pfn_t idx = ((chunk / c->nr_regions) << PAGE_STREAM_SHIFT) |
+        (pfn & ((1UL << PAGE_STREAM_SHIFT) - 1));
+
+    return (chunk % c->nr_regions) * c->region_slots + idx % c->region_slots;
+}
+
+/*
+ * Encode a page for a COMPRESSED_PAGE_DATA record.  A normal page which has
+ * been sent before in the precopy phase is sent as an XBZRLE delta against
+ * the cached copy if that is small enough, and the cache updated with exactly
+ * the contents sent.  Any other page is dropped from the cache.
+ */
+static uint32_t encode_cached_page(struct xc_sr_context *ctx, xen_pfn_t pfn,
+                                   xen_pfn_t type, const void *page,
+                                   void *buf, uint16_t *encoding,
+                                   struct xbzrle_stats *stats)
+{
+    struct xc_sr_xbzrle_cache *c = &ctx->save.xbzrle;
+    unsigned int slot;
+    uint8_t *cached, snap[PAGE_SIZE];
+    int len;
+
+    if ( !c->enabled )
+        return page ? encode_page(page, buf, encoding) : 0;
+
+    slot = xbzrle_slot(ctx, pfn);
+
+    /*
+     * Pages first sent in the initial pass aren't cached.  It is only worth
+     * spending the cache on pages which are dirtied again.
+     */
+    if ( !page || type != XEN_DOMCTL_PFINFO_NOTAB ||
+         ctx->save.stats.iteration == 0 )
+    {
+        if ( c->tags[slot] == pfn )
+            c->tags[slot] = INVALID_PFN;
+
+        return page ? encode_page(page, buf, encoding) : 0;
+    }
+
+    /* The guest may still be writing to the page.  Work from a snapshot. */
+    memcpy(snap, page, PAGE_SIZE);
+    cached = c->pages + ((size_t)slot * PAGE_SIZE);
+
+    if ( c->tags[slot] == pfn )
+    {
+        len = xbzrle_encode_page(cached, snap, buf, XBZRLE_MAX_LEN);
+        if ( len >= 0 )
+        {
+            memcpy(cached, snap, PAGE_SIZE);
+            stats->hits++;
+            stats->bytes_saved += PAGE_SIZE - len;
+            *encoding = PAGE_ENCODING_XBZRLE;
+            return len;
+        }
+    }
+
+    stats->misses++;
+    c->tags[slot] = pfn;
+    memcpy(cached, snap, PAGE_SIZE);
+
+    return encode_page(snap, buf, encoding);
+}
+
+/*
+ * Writes a batch of memory as a PAGE_DATA record into the stream 'fd'.  The
+ * batch is constructed in 'batch_pfns'.
  *
  * This function:
  * - gets the types for each pfn in the batch.
  * - for each pfn with real data:
  *   - maps and attempts to localise the pages.
- * - construct and writes a PAGE_DATA record into the stream.
+ * - construct and writes a PAGE_DATA record into the stream, or a
+ *   COMPRESSED_PAGE_DATA record if compression was requested.
+ *
+ * It may be called concurrently for disjoint batches on different streams.
  */
-static int write_batch(struct xc_sr_context *ctx)
+static int write_batch(struct xc_sr_context *ctx, int fd,
+                       const xen_pfn_t *batch_pfns, unsigned int nr_pfns)
 {
     xc_interface *xch = ctx->xch;
     xen_pfn_t *mfns = NULL, *types = NULL;
@@ -93,13 +195,19 @@ static int write_batch(struct xc_sr_context *ctx)
     void **local_pages = NULL;
     int *errors = NULL, rc = -1;
     unsigned int i, p, nr_pages = 0, nr_pages_mapped = 0;
-    unsigned int nr_pfns = ctx->save.nr_batch_pfns;
+    uint32_t enc;
     void *page, *orig_page;
     uint64_t *rec_pfns = NULL;
+    struct xc_sr_compressed_page *descs = NULL;
+    uint8_t *enc_data = NULL;
+    size_t enc_len = 0;
+    struct xbzrle_stats xbzrle = { 0 };
+    static const uint8_t zeroes[(1u << REC_ALIGN_ORDER) - 1] = { 0 };
     struct iovec *iov = NULL; int iovcnt = 0;
     struct xc_sr_rec_page_data_header hdr = { 0 };
     struct xc_sr_record rec = {
-        .type = REC_TYPE_PAGE_DATA,
+        .type = ctx->save.compress ? REC_TYPE_COMPRESSED_PAGE_DATA
+                                   : REC_TYPE_PAGE_DATA,
     };
 
     assert(nr_pfns != 0);
@@ -115,7 +223,7 @@ static int write_batch(struct xc_sr_context *ctx)
     /* Pointers to locally allocated pages.  Need freeing. */
     local_pages = calloc(nr_pfns, sizeof(*local_pages));
     /* iovec[] for writev(). */
-    iov = malloc((nr_pfns + 4) * sizeof(*iov));
+    iov = malloc((nr_pfns + 7) * sizeof(*iov));
 
     if ( !mfns || !types || !errors || !guest_data || !local_pages || !iov )
     {
@@ -126,15 +234,11 @@ static int write_batch(struct xc_sr_context *ctx)
 
     for ( i = 0; i < nr_pfns; ++i )
     {
-        types[i] = mfns[i] = ctx->save.ops.pfn_to_gfn(ctx,
-                                                      ctx->save.batch_pfns[i]);
+        types[i] = mfns[i] = ctx->save.ops.pfn_to_gfn(ctx, batch_pfns[i]);
 
         /* Likely a ballooned page. */
         if ( mfns[i] == INVALID_MFN )
-        {
-            set_bit(ctx->save.batch_pfns[i], ctx->save.deferred_pages);
-            ++ctx->save.nr_deferred_pages;
-        }
+            defer_page(ctx, batch_pfns[i]);
     }
 
     rc = xc_get_pfn_type_batch(xch, ctx->domid, nr_pfns, types);
@@ -178,7 +282,7 @@ static int write_batch(struct xc_sr_context *ctx)
             if ( errors[p] )
             {
                 ERROR("Mapping of pfn %#"PRIpfn" (mfn %#"PRIpfn") failed %d",
-                      ctx->save.batch_pfns[i], mfns[p], errors[p]);
+                      batch_pfns[i], mfns[p], errors[p]);
                 goto err;
             }
 
@@ -192,8 +296,7 @@ static int write_batch(struct xc_sr_context *ctx)
             {
                 if ( rc == -1 && errno == EAGAIN )
                 {
-                    set_bit(ctx->save.batch_pfns[i], ctx->save.deferred_pages);
-                    ++ctx->save.nr_deferred_pages;
+                    defer_page(ctx, batch_pfns[i]);
                     types[i] = XEN_DOMCTL_PFINFO_XTAB;
                     --nr_pages;
                 }
@@ -223,7 +326,7 @@ static int write_batch(struct xc_sr_context *ctx)
     rec.length += nr_pages * PAGE_SIZE;
 
     for ( i = 0; i < nr_pfns; ++i )
-        rec_pfns[i] = ((uint64_t)(types[i]) << 32) | ctx->save.batch_pfns[i];
+        rec_pfns[i] = ((uint64_t)(types[i]) << 32) | batch_pfns[i];
 
     iov[0].iov_base = &rec.type;
     iov[0].iov_len = sizeof(rec.type);
@@ -239,7 +342,62 @@ static int write_batch(struct xc_sr_context *ctx)
 
     iovcnt = 4;
 
-    if ( nr_pages )
+    if ( nr_pages && ctx->save.compress )
+    {
+        descs = calloc(nr_pages, sizeof(*descs));
+        enc_data = malloc((size_t)nr_pages * PAGE_SIZE);
+        if ( !descs || !enc_data )
+        {
+            ERROR("Unable to allocate compression buffers for %u pages",
+                  nr_pages);
+            goto err;
+        }
+
+        for ( i = 0, p = 0; i < nr_pfns; ++i )
+        {
+            enc = encode_cached_page(ctx, batch_pfns[i], types[i],
+                                     guest_data[i], enc_data + enc_len,
+                                     &descs[p].encoding, &xbzrle);
+            if ( !guest_data[i] )
+                continue;
+
+            descs[p].length = enc;
+            enc_len += enc;
+            ++p;
+        }
+
+        if ( xbzrle.hits || xbzrle.misses )
+        {
+            pthread_mutex_lock(&ctx->save.lock);
+            ctx->save.xbzrle.hits += xbzrle.hits;
+            ctx->save.xbzrle.misses += xbzrle.misses;
+            ctx->save.xbzrle.bytes_saved += xbzrle.bytes_saved;
+            pthread_mutex_unlock(&ctx->save.lock);
+        }
+
+        rec.length -= nr_pages * PAGE_SIZE;
+        rec.length += nr_pages * sizeof(*descs) + enc_len;
+
+        iov[iovcnt].iov_base = descs;
+        iov[iovcnt].iov_len = nr_pages * sizeof(*descs);
+        iovcnt++;
+
+        iov[iovcnt].iov_base = enc_data;
+        iov[iovcnt].iov_len = enc_len;
+        iovcnt++;
+
+        /* Unlike PAGE_DATA, the encoded data need not be a multiple of 8. */
+        if ( ROUNDUP(rec.length, REC_ALIGN_ORDER) != rec.length )
+        {
+            iov[iovcnt].iov_base = (void *)zeroes;
+            iov[iovcnt].iov_len = ROUNDUP(rec.length, REC_ALIGN_ORDER) -
+                rec.length;
+            iovcnt++;
+        }
+
+        nr_pages -= p;
+    }
+    else if ( nr_pages )
     {
         for ( i = 0; i < nr_pfns; ++i )
         {
@@ -253,7 +411,7 @@ static int write_batch(struct xc_sr_context *ctx)
         }
     }
 
-    if ( writev_exact(ctx->fd, iov, iovcnt) )
+    if ( writev_exact(fd, iov, iovcnt) )
     {
         PERROR("Failed to write page data to stream");
         goto err;
@@ -261,9 +419,11 @@ static int write_batch(struct xc_sr_context *ctx)
 
     /* Sanity check we have sent all the pages we expected to. */
     assert(nr_pages == 0);
-    rc = ctx->save.nr_batch_pfns = 0;
+    rc = 0;
 
  err:
+    free(enc_data);
+    free(descs);
     free(rec_pfns);
     if ( guest_mapping )
         xenforeignmemory_unmap(xch->fmem, guest_mapping, nr_pages_mapped);
@@ -289,10 +449,12 @@ static int flush_batch(struct xc_sr_context *ctx)
     if ( ctx->save.nr_batch_pfns == 0 )
         return rc;
 
-    rc = write_batch(ctx);
+    rc = write_batch(ctx, ctx->fd, ctx->save.batch_pfns,
+                     ctx->save.nr_batch_pfns);
 
     if ( !rc )
     {
+        ctx->save.nr_batch_pfns = 0;
         VALGRIND_MAKE_MEM_UNDEFINED(ctx->save.batch_pfns,
                                     MAX_BATCH_SIZE *
                                     sizeof(*ctx->save.batch_pfns));
@@ -301,6 +463,165 @@ static int flush_batch(struct xc_sr_context *ctx)
     return rc;
 }
 
+/*
+ * Page stream worker.  Writes batches handed over by the main thread into its
+ * auxiliary stream until told to quit.
+ */
+static void *page_stream_worker(void *arg)
+{
+    struct xc_sr_page_stream *s = arg;
+    struct xc_sr_context *ctx = s->ctx;
+    int rc;
+
+    /* Only permit cancellation while blocked writing to the stream. */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    pthread_mutex_lock(&ctx->save.lock);
+    for ( ; ; )
+    {
+        while ( !s->save.busy && !s->save.quit )
+            pthread_cond_wait(&ctx->save.cond, &ctx->save.lock);
+
+        if ( !s->save.busy )
+            break;
+
+        pthread_mutex_unlock(&ctx->save.lock);
+
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        rc = write_batch(ctx, s->fd, s->save.work_pfns, s->save.nr_work_pfns);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+        pthread_mutex_lock(&ctx->save.lock);
+        if ( rc && !s->rc )
+            s->rc = rc;
+        s->save.busy = false;
+        pthread_cond_broadcast(&ctx->save.cond);
+    }
+    pthread_mutex_unlock(&ctx->save.lock);
+
+    return NULL;
+}
+
+/*
+ * Hand the stream's current batch to its worker, waiting for the previous
+ * one to complete first.
+ */
+static int submit_stream_batch(struct xc_sr_context *ctx,
+                               struct xc_sr_page_stream *s)
+{
+    xc_interface *xch = ctx->xch;
+    xen_pfn_t *pfns;
+    int rc;
+
+    pthread_mutex_lock(&ctx->save.lock);
+
+    while ( s->save.busy )
+        pthread_cond_wait(&ctx->save.cond, &ctx->save.lock);
+
+    rc = s->rc;
+    if ( !rc )
+    {
+        pfns = s->save.work_pfns;
+        s->save.work_pfns = s->save.batch_pfns;
+        s->save.nr_work_pfns = s->save.nr_batch_pfns;
+        s->save.batch_pfns = pfns;
+        s->save.nr_batch_pfns = 0;
+        s->save.busy = true;
+        pthread_cond_broadcast(&ctx->save.cond);
+    }
+
+    pthread_mutex_unlock(&ctx->save.lock);
+
+    if ( rc )
+        ERROR("Page stream %u failed", s->id);
+
+    return rc;
+}
+
+/*
+ * Flush all page stream batches, wait for the workers to go idle, and write a
+ * PAGE_STREAMS_SYNC record into every stream, the main one last.  The
+ * receiver will not process page data following a sync point on any stream
+ * before it has reached the same sync point on the main stream.
+ */
+static int sync_page_streams(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_page_streams_sync sync;
+    struct xc_sr_record rec = {
+        .type   = REC_TYPE_PAGE_STREAMS_SYNC,
+        .length = sizeof(sync),
+        .data   = &sync,
+    };
+    struct xc_sr_page_stream *s;
+    unsigned int i;
+    int rc = 0;
+
+    if ( !ctx->save.nr_streams )
+        return 0;
+
+    for ( i = 0; i < ctx->save.nr_streams; ++i )
+    {
+        s = &ctx->save.streams[i];
+
+        if ( s->save.nr_batch_pfns )
+        {
+            rc = submit_stream_batch(ctx, s);
+            if ( rc )
+                return rc;
+        }
+    }
+
+    pthread_mutex_lock(&ctx->save.lock);
+    for ( i = 0; i < ctx->save.nr_streams; ++i )
+    {
+        s = &ctx->save.streams[i];
+
+        while ( s->save.busy )
+            pthread_cond_wait(&ctx->save.cond, &ctx->save.lock);
+
+        if ( s->rc && !rc )
+        {
+            ERROR("Page stream %u failed", s->id);
+            rc = s->rc;
+        }
+    }
+    pthread_mutex_unlock(&ctx->save.lock);
+
+    if ( rc )
+        return rc;
+
+    sync = (struct xc_sr_rec_page_streams_sync){ .seq = ++ctx->save.sync_seq };
+
+    for ( i = 0; i < ctx->save.nr_streams; ++i )
+    {
+        rc = write_split_record_fd(ctx, ctx->save.streams[i].fd, &rec, NULL, 0);
+        if ( rc )
+            return rc;
+    }
+
+    return write_record(ctx, &rec);
+}
+
+/*
+ * Add a single pfn to the batch of the page stream responsible for it,
+ * handing the batch to the stream's worker if full.
+ */
+static int add_to_stream_batch(struct xc_sr_context *ctx, xen_pfn_t pfn)
+{
+    struct xc_sr_page_stream *s =
+        &ctx->save.streams[(pfn >> PAGE_STREAM_SHIFT) % ctx->save.nr_streams];
+    int rc = 0;
+
+    if ( s->save.nr_batch_pfns == MAX_BATCH_SIZE )
+        rc = submit_stream_batch(ctx, s);
+
+    if ( rc == 0 )
+        s->save.batch_pfns[s->save.nr_batch_pfns++] = pfn;
+
+    return rc;
+}
+
 /*
  * Add a single pfn to the batch, flushing the batch if full.
  */
@@ -308,6 +629,9 @@ static int add_to_batch(struct xc_sr_context *ctx, xen_pfn_t pfn)
 {
     int rc = 0;
 
+    if ( ctx->save.nr_streams )
+        return add_to_stream_batch(ctx, pfn);
+
     if ( ctx->save.nr_batch_pfns == MAX_BATCH_SIZE )
         rc = flush_batch(ctx);
 
@@ -357,38 +681,67 @@ static int suspend_domain(struct xc_sr_context *ctx)
     return 0;
 }
 
+#define SUMMARY_PAGES (1UL << XEN_DOMCTL_SHADOW_SUMMARY_ORDER)
+
+/* Number of bits in the dirty summary. */
+static unsigned long summary_bits(struct xc_sr_context *ctx)
+{
+    return (ctx->save.p2m_size + SUMMARY_PAGES - 1) / SUMMARY_PAGES;
+}
+
 /*
  * Send a subset of pages in the guests p2m, according to the dirty bitmap.
  * Used for each subsequent iteration of the live migration loop.
  *
- * Bitmap is bounded by p2m_size.
+ * Bitmap is bounded by p2m_size, and is left clear.
  */
 static int send_dirty_pages(struct xc_sr_context *ctx,
                             unsigned long entries)
 {
     xc_interface *xch = ctx->xch;
-    xen_pfn_t p;
+    xen_pfn_t p, start, end;
     unsigned long written;
     int rc;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
-
-    for ( p = 0, written = 0; p < ctx->save.p2m_size; ++p )
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_summary,
+                                    &ctx->save.dirty_summary_hbuf);
+
+    /*
+     * Walk the bitmap a summary region at a time, skipping clean regions if
+     * the summary is valid, and clearing the bitmap behind us.
+     */
+    for ( start = 0, written = 0; start < ctx->save.p2m_size; start = end )
     {
-        if ( !test_bit(p, dirty_bitmap) )
+        end = min(start + SUMMARY_PAGES, ctx->save.p2m_size);
+
+        if ( ctx->save.summary_valid &&
+             !test_bit(start >> XEN_DOMCTL_SHADOW_SUMMARY_ORDER,
+                       dirty_summary) )
             continue;
 
-        rc = add_to_batch(ctx, p);
-        if ( rc )
-            return rc;
+        for ( p = start; p < end; ++p )
+        {
+            if ( !test_bit(p, dirty_bitmap) )
+                continue;
+
+            rc = add_to_batch(ctx, p);
+            if ( rc )
+                return rc;
+
+            /* Update progress every 4MB worth of memory sent. */
+            if ( (written & ((1U << (22 - 12)) - 1)) == 0 )
+                xc_report_progress_step(xch, written, entries);
 
-        /* Update progress every 4MB worth of memory sent. */
-        if ( (written & ((1U << (22 - 12)) - 1)) == 0 )
-            xc_report_progress_step(xch, written, entries);
+            ++written;
+        }
 
-        ++written;
+        memset((uint8_t *)dirty_bitmap + start / 8, 0,
+               bitmap_size(end) - start / 8);
     }
 
+    ctx->save.summary_valid = false;
+
     rc = flush_batch(ctx);
     if ( rc )
         return rc;
@@ -398,7 +751,15 @@ static int send_dirty_pages(struct xc_sr_context *ctx,
 
     xc_report_progress_step(xch, entries, entries);
 
-    return ctx->save.ops.check_vm_state(ctx);
+    rc = ctx->save.ops.check_vm_state(ctx);
+    if ( rc )
+        return rc;
+
+    /*
+     * check_vm_state() may have updated state which the page data of the
+     * next iteration depends on.  Sync after it, not before.
+     */
+    return sync_page_streams(ctx);
 }
 
 /*
@@ -411,10 +772,34 @@ static int send_all_pages(struct xc_sr_context *ctx)
                                     &ctx->save.dirty_bitmap_hbuf);
 
     bitmap_set(dirty_bitmap, ctx->save.p2m_size);
+    ctx->save.summary_valid = false;
 
     return send_dirty_pages(ctx, ctx->save.p2m_size);
 }
 
+/*
+ * Retrieve the log-dirty state into the (clear) dirty bitmap.  Only the dirty
+ * parts of the bitmap are copied, so the cost of an iteration scales with the
+ * memory dirtied rather than the size of the guest.
+ */
+static int get_dirty_bitmap(struct xc_sr_context *ctx, unsigned int sop,
+                            unsigned int mode, xc_shadow_op_stats_t *stats)
+{
+    xc_interface *xch = ctx->xch;
+
+    if ( xc_logdirty_control_summary(
+             xch, ctx->domid, sop, &ctx->save.dirty_bitmap_hbuf,
+             &ctx->save.dirty_summary_hbuf, ctx->save.p2m_size,
+             mode, stats) != ctx->save.p2m_size )
+    {
+        PERROR("Failed to retrieve logdirty bitmap");
+        return -1;
+    }
+
+    ctx->save.summary_valid = true;
+    return 0;
+}
+
 static int enable_logdirty(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
@@ -454,8 +839,25 @@ static int update_progress_string(struct xc_sr_context *ctx, char **str)
     xc_interface *xch = ctx->xch;
     char *new_str = NULL;
     unsigned int iter = ctx->save.stats.iteration;
+    struct xbzrle_stats xbzrle;
+    int ret;
+
+    pthread_mutex_lock(&ctx->save.lock);
+    xbzrle = (struct xbzrle_stats){
+        .hits        = ctx->save.xbzrle.hits,
+        .misses      = ctx->save.xbzrle.misses,
+        .bytes_saved = ctx->save.xbzrle.bytes_saved,
+    };
+    pthread_mutex_unlock(&ctx->save.lock);
+
+    if ( ctx->save.xbzrle.enabled )
+        ret = asprintf(&new_str, "Frames iteration %u (xbzrle: %"PRIu64" hit,"
+                       " %"PRIu64" miss, %"PRIu64"k saved)", iter,
+                       xbzrle.hits, xbzrle.misses, xbzrle.bytes_saved >> 10);
+    else
+        ret = asprintf(&new_str, "Frames iteration %u", iter);
 
-    if ( asprintf(&new_str, "Frames iteration %u", iter) == -1 )
+    if ( ret == -1 )
     {
         PERROR("Unable to allocate new progress string");
         return -1;
@@ -490,6 +892,162 @@ static int simple_precopy_policy(struct precopy_stats stats, void *user)
         : XGS_POLICY_CONTINUE_PRECOPY;
 }
 
+int xc_precopy_policy_adaptive(struct precopy_stats stats, void *data)
+{
+    const struct xc_precopy_adaptive *params = data;
+    unsigned long remaining;
+    unsigned int i;
+
+    if ( stats.iteration >= params->max_iterations )
+        return XGS_POLICY_STOP_AND_COPY;
+
+    /* Deciding whether to start another iteration, or nothing measured. */
+    if ( stats.dirty_count < 0 || !stats.bandwidth )
+        return XGS_POLICY_CONTINUE_PRECOPY;
+
+    /*
+     * Each iteration takes dirty_count / bandwidth seconds, during which the
+     * guest dirties dirty_rate pages per second, ready for the next one.
+     * Predict whether the downtime target can be met in the iterations left.
+     */
+    remaining = stats.dirty_count;
+    for ( i = stats.iteration; i < params->max_iterations; ++i )
+    {
+        if ( remaining * 1000ULL <=
+             (unsigned long long)stats.bandwidth * params->max_downtime_ms )
+            return i == stats.iteration ? XGS_POLICY_STOP_AND_COPY
+                                        : XGS_POLICY_CONTINUE_PRECOPY;
+
+        remaining = (unsigned long long)remaining * stats.dirty_rate /
+                    stats.bandwidth;
+    }
+
+    return params->throttle ? XGS_POLICY_THROTTLE
+                            : XGS_POLICY_CONTINUE_PRECOPY;
+}
+
+/*
+ * Throttle the guest, to help the precopy phase converge, by capping its CPU
+ * time with the scheduler.  Each step halves the guest's share, down to
+ * 1/2^THROTTLE_MAX_LEVEL of what it was allowed originally.
+ */
+#define THROTTLE_MAX_LEVEL 4
+
+static int throttle_domain(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    typeof(ctx->save.throttle) *t = &ctx->save.throttle;
+    struct xen_domctl_sched_credit2 credit2;
+    struct xen_domctl_sched_credit credit;
+    unsigned int cap;
+    int rc;
+
+    if ( t->level == THROTTLE_MAX_LEVEL )
+        return 0;
+
+    if ( !t->sched_id )
+    {
+        if ( !xc_sched_credit2_domain_get(xch, ctx->domid, &credit2) )
+        {
+            t->sched_id = XEN_SCHEDULER_CREDIT2;
+            t->orig_cap = credit2.cap;
+        }
+        else if ( !xc_sched_credit_domain_get(xch, ctx->domid, &credit) )
+        {
+            t->sched_id = XEN_SCHEDULER_CREDIT;
+            t->orig_cap = credit.cap;
+        }
+        else
+        {
+            ERROR("Unable to throttle d%u: scheduler has no cap", ctx->domid);
+            t->level = THROTTLE_MAX_LEVEL;
+            return -1;
+        }
+    }
+
+    /* A cap is in percent of one pcpu, 0 meaning uncapped. */
+    cap = t->orig_cap ?: (ctx->dominfo.max_vcpu_id + 1) * 100;
+    cap = max(cap >> (t->level + 1), 1U);
+
+    if ( t->sched_id == XEN_SCHEDULER_CREDIT2 )
+    {
+        credit2 = (struct xen_domctl_sched_credit2){ .cap = cap };
+        rc = xc_sched_credit2_domain_set(xch, ctx->domid, &credit2);
+    }
+    else
+    {
+        credit = (struct xen_domctl_sched_credit){ .cap = cap };
+        rc = xc_sched_credit_domain_set(xch, ctx->domid, &credit);
+    }
+
+    if ( rc )
+    {
+        PERROR("Failed to set d%u cap to %u", ctx->domid, cap);
+        return -1;
+    }
+
+    t->level++;
+    ctx->save.stats.throttle = 100 >> t->level;
+    DPRINTF("Throttled d%u to cap %u", ctx->domid, cap);
+
+    return 0;
+}
+
+static void unthrottle_domain(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    typeof(ctx->save.throttle) *t = &ctx->save.throttle;
+    struct xen_domctl_sched_credit2 credit2 = { .cap = t->orig_cap };
+    struct xen_domctl_sched_credit credit = { .cap = t->orig_cap };
+    int rc;
+
+    if ( !t->sched_id || !t->level )
+        return;
+
+    if ( t->sched_id == XEN_SCHEDULER_CREDIT2 )
+        rc = xc_sched_credit2_domain_set(xch, ctx->domid, &credit2);
+    else
+        rc = xc_sched_credit_domain_set(xch, ctx->domid, &credit);
+
+    if ( rc )
+        PERROR("Failed to restore d%u cap to %u", ctx->domid, t->orig_cap);
+
+    t->level = 0;
+}
+
+/*
+ * Ask the precopy policy what to do next.  A throttling request is acted
+ * upon here, and is otherwise a request to continue.  Failure to throttle is
+ * not fatal, as the policy will eventually give up on convergence.
+ */
+static int precopy_decision(struct xc_sr_context *ctx,
+                            precopy_policy_t precopy_policy, void *data)
+{
+    int decision = precopy_policy(ctx->save.stats, data);
+
+    if ( decision == XGS_POLICY_THROTTLE )
+    {
+        throttle_domain(ctx);
+        decision = XGS_POLICY_CONTINUE_PRECOPY;
+    }
+
+    return decision;
+}
+
+static uint64_t monotonic_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* Pages per second, 0 if the interval is too short to tell. */
+static unsigned long per_second(unsigned long pages, uint64_t us)
+{
+    return us ? pages * 1000000ULL / us : 0;
+}
+
 /*
  * Send memory while guest is running.
  */
@@ -499,6 +1057,7 @@ static int send_memory_live(struct xc_sr_context *ctx)
     xc_shadow_op_stats_t stats = { 0, ctx->save.p2m_size };
     char *progress_str = NULL;
     unsigned int x = 0;
+    uint64_t start, last_clean;
     int rc;
     int policy_decision;
 
@@ -516,6 +1075,7 @@ static int send_memory_live(struct xc_sr_context *ctx)
 
     ctx->save.stats = (struct precopy_stats){
         .dirty_count = ctx->save.p2m_size,
+        .throttle = 100,
     };
     policy_stats = &ctx->save.stats;
 
@@ -523,10 +1083,12 @@ static int send_memory_live(struct xc_sr_context *ctx)
         precopy_policy = simple_precopy_policy;
 
     bitmap_set(dirty_bitmap, ctx->save.p2m_size);
+    ctx->save.summary_valid = false;
+    last_clean = monotonic_us();
 
     for ( ; ; )
     {
-        policy_decision = precopy_policy(*policy_stats, data);
+        policy_decision = precopy_decision(ctx, precopy_policy, data);
         x++;
 
         if ( stats.dirty_count > 0 && policy_decision != XGS_POLICY_ABORT )
@@ -535,9 +1097,13 @@ static int send_memory_live(struct xc_sr_context *ctx)
             if ( rc )
                 goto out;
 
+            start = monotonic_us();
             rc = send_dirty_pages(ctx, stats.dirty_count);
             if ( rc )
                 goto out;
+
+            policy_stats->bandwidth =
+                per_second(stats.dirty_count, monotonic_us() - start);
         }
 
         if ( policy_decision != XGS_POLICY_CONTINUE_PRECOPY )
@@ -547,22 +1113,20 @@ static int send_memory_live(struct xc_sr_context *ctx)
         policy_stats->total_written += policy_stats->dirty_count;
         policy_stats->dirty_count   = -1;
 
-        policy_decision = precopy_policy(*policy_stats, data);
+        policy_decision = precopy_decision(ctx, precopy_policy, data);
 
         if ( policy_decision != XGS_POLICY_CONTINUE_PRECOPY )
             break;
 
-        if ( xc_logdirty_control(
-                 xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
-                 &ctx->save.dirty_bitmap_hbuf, ctx->save.p2m_size,
-                 0, &stats) != ctx->save.p2m_size )
-        {
-            PERROR("Failed to retrieve logdirty bitmap");
-            rc = -1;
+        rc = get_dirty_bitmap(ctx, XEN_DOMCTL_SHADOW_OP_CLEAN, 0, &stats);
+        if ( rc )
             goto out;
-        }
 
+        start = monotonic_us();
         policy_stats->dirty_count = stats.dirty_count;
+        policy_stats->dirty_rate = per_second(stats.dirty_count,
+                                              start - last_clean);
+        last_clean = start;
 
     }
 
@@ -622,6 +1186,7 @@ static int colo_merge_secondary_dirty_bitmap(struct xc_sr_context *ctx)
         }
 
         set_bit(pfn, dirty_bitmap);
+        ctx->save.summary_valid = false;
     }
 
     rc = 0;
@@ -649,18 +1214,31 @@ static int suspend_and_send_dirty(struct xc_sr_context *ctx)
     if ( rc )
         goto out;
 
-    if ( xc_logdirty_control(
-             xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
-             HYPERCALL_BUFFER(dirty_bitmap), ctx->save.p2m_size,
-             XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL, &stats) !=
-         ctx->save.p2m_size )
+    /*
+     * With post-copy, the final dirty pages stay recorded in Xen for
+     * xc_domain_postcopy_send(), and only the deferred pages are sent now.
+     */
+    if ( ctx->save.postcopy )
     {
-        PERROR("Failed to retrieve logdirty bitmap");
-        rc = -1;
-        goto out;
-    }
-
-    if ( ctx->save.live )
+        if ( xc_logdirty_control(
+                 xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_PEEK, NULL,
+                 ctx->save.p2m_size, XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL,
+                 &stats) != ctx->save.p2m_size )
+        {
+            PERROR("Failed to retrieve logdirty stats");
+            rc = -1;
+            goto out;
+        }
+    }
+    else
+    {
+        rc = get_dirty_bitmap(ctx, XEN_DOMCTL_SHADOW_OP_CLEAN,
+                              XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL, &stats);
+        if ( rc )
+            goto out;
+    }
+
+    if ( ctx->save.live )
     {
         rc = update_progress_string(ctx, &progress_str);
         if ( rc )
@@ -669,7 +1247,18 @@ static int suspend_and_send_dirty(struct xc_sr_context *ctx)
     else
         xc_set_progress_prefix(xch, "Checkpointed save");
 
-    bitmap_or(dirty_bitmap, ctx->save.deferred_pages, ctx->save.p2m_size);
+    if ( ctx->save.postcopy )
+    {
+        DPRINTF("Leaving %u dirty pages for post-copy", stats.dirty_count);
+        stats.dirty_count = 0;
+        ctx->save.summary_valid = false;
+    }
+
+    if ( ctx->save.nr_deferred_pages )
+    {
+        bitmap_or(dirty_bitmap, ctx->save.deferred_pages, ctx->save.p2m_size);
+        ctx->save.summary_valid = false;
+    }
 
     if ( !ctx->save.live && ctx->stream_type == XC_STREAM_COLO )
     {
@@ -707,6 +1296,14 @@ static int verify_frames(struct xc_sr_context *ctx)
     if ( rc )
         goto out;
 
+    /* Page streams must not run ahead of the VERIFY record. */
+    rc = sync_page_streams(ctx);
+    if ( rc )
+        goto out;
+
+    /* Deltas would only verify the bytes which changed. */
+    ctx->save.xbzrle.enabled = false;
+
     xc_set_progress_prefix(xch, "Frames verify");
     rc = send_all_pages(ctx);
     if ( rc )
@@ -748,7 +1345,9 @@ static int send_domain_memory_live(struct xc_sr_context *ctx)
     if ( rc )
         goto out;
 
-    if ( ctx->save.debug && ctx->stream_type == XC_STREAM_PLAIN )
+    /* Post-copy pages are still missing on the receiving side. */
+    if ( ctx->save.debug && ctx->stream_type == XC_STREAM_PLAIN &&
+         !ctx->save.postcopy )
     {
         rc = verify_frames(ctx);
         if ( rc )
@@ -790,12 +1389,126 @@ static int send_domain_memory_nonlive(struct xc_sr_context *ctx)
     return rc;
 }
 
+/*
+ * Announce the auxiliary page streams to the receiver and start a worker for
+ * each of them.
+ */
+static int start_page_streams(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_page_streams info = { .count = ctx->save.nr_streams };
+    struct xc_sr_record rec = {
+        .type   = REC_TYPE_PAGE_STREAMS,
+        .length = sizeof(info),
+        .data   = &info,
+    };
+    struct xc_sr_page_stream *s;
+    unsigned int i;
+    int rc;
+
+    rc = write_record(ctx, &rec);
+    if ( rc )
+        return rc;
+
+    for ( i = 0; i < ctx->save.nr_streams; ++i )
+    {
+        s = &ctx->save.streams[i];
+
+        rc = pthread_create(&s->thread, NULL, page_stream_worker, s);
+        if ( rc )
+        {
+            errno = rc;
+            PERROR("Unable to start worker for page stream %u", i);
+            return -1;
+        }
+        s->started = true;
+    }
+
+    DPRINTF("Started %u page streams", ctx->save.nr_streams);
+
+    return 0;
+}
+
+/*
+ * Stop the page stream workers.  In the case of an error, workers are
+ * cancelled rather than waited upon, as they may be blocked on a stream which
+ * the receiver is no longer reading.
+ */
+static void stop_page_streams(struct xc_sr_context *ctx, bool cancel)
+{
+    struct xc_sr_page_stream *s;
+    unsigned int i;
+
+    pthread_mutex_lock(&ctx->save.lock);
+    for ( i = 0; i < ctx->save.nr_streams; ++i )
+        ctx->save.streams[i].save.quit = true;
+    pthread_cond_broadcast(&ctx->save.cond);
+    pthread_mutex_unlock(&ctx->save.lock);
+
+    for ( i = 0; i < ctx->save.nr_streams; ++i )
+    {
+        s = &ctx->save.streams[i];
+
+        if ( !s->started )
+            continue;
+
+        if ( cancel )
+            pthread_cancel(s->thread);
+        pthread_join(s->thread, NULL);
+        s->started = false;
+    }
+}
+
+/*
+ * Write an END record into each auxiliary stream, once all their page data
+ * has been synced.
+ */
+static int write_page_streams_end(struct xc_sr_context *ctx)
+{
+    struct xc_sr_record end = { .type = REC_TYPE_END };
+    unsigned int i;
+    int rc;
+
+    stop_page_streams(ctx, false);
+
+    for ( i = 0; i < ctx->save.nr_streams; ++i )
+    {
+        rc = write_split_record_fd(ctx, ctx->save.streams[i].fd, &end, NULL, 0);
+        if ( rc )
+            return rc;
+    }
+
+    return 0;
+}
+
 static int setup(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
+    struct xc_sr_page_stream *s;
+    unsigned int i;
     int rc;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_summary,
+                                    &ctx->save.dirty_summary_hbuf);
+
+    pthread_mutex_init(&ctx->save.lock, NULL);
+    pthread_cond_init(&ctx->save.cond, NULL);
+
+    for ( i = 0; i < ctx->save.nr_streams; ++i )
+    {
+        s = &ctx->save.streams[i];
+
+        s->save.batch_pfns = malloc(MAX_BATCH_SIZE * sizeof(xen_pfn_t));
+        s->save.work_pfns = malloc(MAX_BATCH_SIZE * sizeof(xen_pfn_t));
+        if ( !s->save.batch_pfns || !s->save.work_pfns )
+        {
+            ERROR("Unable to allocate memory for page stream batches");
+            rc = -1;
+            errno = ENOMEM;
+            goto err;
+        }
+    }
 
     rc = ctx->save.ops.setup(ctx);
     if ( rc )
@@ -803,11 +1516,14 @@ static int setup(struct xc_sr_context *ctx)
 
     dirty_bitmap = xc_hypercall_buffer_alloc_pages(
         xch, dirty_bitmap, NRPAGES(bitmap_size(ctx->save.p2m_size)));
+    dirty_summary = xc_hypercall_buffer_alloc_pages(
+        xch, dirty_summary, NRPAGES(bitmap_size(summary_bits(ctx))));
     ctx->save.batch_pfns = malloc(MAX_BATCH_SIZE *
                                   sizeof(*ctx->save.batch_pfns));
     ctx->save.deferred_pages = bitmap_alloc(ctx->save.p2m_size);
 
-    if ( !ctx->save.batch_pfns || !dirty_bitmap || !ctx->save.deferred_pages )
+    if ( !ctx->save.batch_pfns || !dirty_bitmap || !dirty_summary ||
+         !ctx->save.deferred_pages )
     {
         ERROR("Unable to allocate memory for dirty bitmaps, batch pfns and"
               " deferred pages");
@@ -816,6 +1532,36 @@ static int setup(struct xc_sr_context *ctx)
         goto err;
     }
 
+    /*
+     * Deltas are only useful when pages are resent, and rely on the receiver
+     * not changing the pages in between, so not with checkpointed streams.
+     */
+    if ( ctx->save.compress && ctx->save.live &&
+         ctx->stream_type == XC_STREAM_PLAIN )
+    {
+        struct xc_sr_xbzrle_cache *c = &ctx->save.xbzrle;
+        unsigned int nr_slots = min(ctx->save.p2m_size,
+                                    (unsigned long)XBZRLE_CACHE_PAGES);
+
+        c->nr_regions = ctx->save.nr_streams ?: 1;
+        c->region_slots = max(nr_slots / c->nr_regions, 1U);
+        nr_slots = c->region_slots * c->nr_regions;
+
+        c->tags = malloc(nr_slots * sizeof(*c->tags));
+        c->pages = malloc((size_t)nr_slots * PAGE_SIZE);
+        if ( !c->tags || !c->pages )
+        {
+            ERROR("Unable to allocate %u pages for the XBZRLE cache", nr_slots);
+            rc = -1;
+            errno = ENOMEM;
+            goto err;
+        }
+
+        for ( i = 0; i < nr_slots; ++i )
+            c->tags[i] = INVALID_PFN;
+        c->enabled = true;
+    }
+
     rc = 0;
 
  err:
@@ -825,20 +1571,41 @@ static int setup(struct xc_sr_context *ctx)
 static void cleanup(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
+    unsigned int i;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_summary,
+                                    &ctx->save.dirty_summary_hbuf);
 
+    stop_page_streams(ctx, true);
+    unthrottle_domain(ctx);
 
-    xc_shadow_control(xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_OFF,
-                      NULL, 0);
+    /* Log-dirty mode is turned off by xc_domain_postcopy_send(). */
+    if ( !ctx->save.postcopy )
+        xc_shadow_control(xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_OFF,
+                          NULL, 0);
 
     if ( ctx->save.ops.cleanup(ctx) )
         PERROR("Failed to clean up");
 
     xc_hypercall_buffer_free_pages(xch, dirty_bitmap,
                                    NRPAGES(bitmap_size(ctx->save.p2m_size)));
+    xc_hypercall_buffer_free_pages(xch, dirty_summary,
+                                   NRPAGES(bitmap_size(summary_bits(ctx))));
     free(ctx->save.deferred_pages);
     free(ctx->save.batch_pfns);
+    free(ctx->save.xbzrle.tags);
+    free(ctx->save.xbzrle.pages);
+
+    for ( i = 0; i < ctx->save.nr_streams; ++i )
+    {
+        free(ctx->save.streams[i].save.batch_pfns);
+        free(ctx->save.streams[i].save.work_pfns);
+    }
+    free(ctx->save.streams);
+
+    pthread_cond_destroy(&ctx->save.cond);
+    pthread_mutex_destroy(&ctx->save.lock);
 }
 
 /*
@@ -883,6 +1650,13 @@ static int save(struct xc_sr_context *ctx, uint16_t guest_type)
         if ( rc )
             goto err;
 
+        if ( ctx->save.nr_streams && !ctx->save.streams[0].started )
+        {
+            rc = start_page_streams(ctx);
+            if ( rc )
+                goto err;
+        }
+
         if ( ctx->save.live )
             rc = send_domain_memory_live(ctx);
         else if ( ctx->stream_type != XC_STREAM_PLAIN )
@@ -956,6 +1730,10 @@ static int save(struct xc_sr_context *ctx, uint16_t guest_type)
 
     xc_report_progress_single(xch, "End of stream");
 
+    rc = write_page_streams_end(ctx);
+    if ( rc )
+        goto err;
+
     rc = write_end_record(ctx);
     if ( rc )
         goto err;
@@ -968,6 +1746,9 @@ static int save(struct xc_sr_context *ctx, uint16_t guest_type)
     saved_rc = rc;
     PERROR("Save failed");
 
+    /* Nothing will follow up with the post-copy phase. */
+    ctx->save.postcopy = false;
+
  done:
     cleanup(ctx);
 
@@ -980,22 +1761,298 @@ static int save(struct xc_sr_context *ctx, uint16_t guest_type)
     return rc;
 };
 
+/*
+ * Send the pfns set in the outstanding bitmap as POSTCOPY_PFNS records,
+ * terminated by an empty one.
+ */
+static int write_postcopy_pfns(struct xc_sr_context *ctx,
+                               const unsigned long *outstanding,
+                               unsigned long *nr_outstanding)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_record rec = { .type = REC_TYPE_POSTCOPY_PFNS };
+    uint64_t *pfns = malloc(POSTCOPY_MAX_PFNS * sizeof(*pfns));
+    unsigned int nr = 0;
+    xen_pfn_t p;
+    int rc = -1;
+
+    if ( !pfns )
+    {
+        ERROR("Unable to allocate memory for post-copy pfn list");
+        goto err;
+    }
+
+    *nr_outstanding = 0;
+    for ( p = 0; p < ctx->save.p2m_size; ++p )
+    {
+        if ( !test_bit(p, outstanding) )
+            continue;
+
+        pfns[nr++] = p;
+        ++*nr_outstanding;
+
+        if ( nr == POSTCOPY_MAX_PFNS )
+        {
+            if ( write_split_record(ctx, &rec, pfns, nr * sizeof(*pfns)) )
+                goto err;
+            nr = 0;
+        }
+    }
+
+    if ( nr && write_split_record(ctx, &rec, pfns, nr * sizeof(*pfns)) )
+        goto err;
+
+    rc = write_record(ctx, &rec);
+
+ err:
+    free(pfns);
+    return rc;
+}
+
+/*
+ * Handle a POSTCOPY_REQUEST record, sending any of the requested pages which
+ * are still outstanding ahead of the background push.
+ */
+static int handle_postcopy_request(struct xc_sr_context *ctx,
+                                   struct xc_sr_record *rec,
+                                   unsigned long *outstanding,
+                                   unsigned long *nr_sent)
+{
+    xc_interface *xch = ctx->xch;
+    const uint64_t *pfns = rec->data;
+    unsigned int i, count = rec->length / sizeof(*pfns);
+    int rc;
+
+    if ( rec->length % sizeof(*pfns) )
+    {
+        ERROR("Invalid POSTCOPY_REQUEST record length %u", rec->length);
+        return -1;
+    }
+
+    for ( i = 0; i < count; ++i )
+    {
+        if ( pfns[i] >= ctx->save.p2m_size )
+        {
+            ERROR("Post-copy request for invalid pfn %#"PRIx64, pfns[i]);
+            return -1;
+        }
+
+        /* Already sent, and presumably in flight. */
+        if ( !test_and_clear_bit(pfns[i], outstanding) )
+            continue;
+
+        rc = add_to_batch(ctx, pfns[i]);
+        if ( rc )
+            return rc;
+        ++*nr_sent;
+    }
+
+    return flush_batch(ctx);
+}
+
+/*
+ * Post-copy phase of a live migration.  Pages the receiver asks for are
+ * served as soon as the request arrives, and otherwise the outstanding pages
+ * are pushed in order, a batch at a time.  Finishes when the receiver reports
+ * having every page with an END record, or fails with ECANCELED when the
+ * receiver gave up before resuming the guest with a POSTCOPY_ABORT record.
+ */
+static int postcopy_send(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    xc_shadow_op_stats_t stats = { 0, 0 };
+    struct pollfd pfd = { .fd = ctx->save.recv_fd, .events = POLLIN };
+    struct xc_sr_record rec, end = { .type = REC_TYPE_END };
+    unsigned long nr_outstanding = 0, nr_sent = 0;
+    xen_pfn_t p, next = 0;
+    bool aborted = false;
+    int rc = -1;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, outstanding,
+                                    &ctx->save.dirty_bitmap_hbuf);
+
+    pthread_mutex_init(&ctx->save.lock, NULL);
+    pthread_cond_init(&ctx->save.cond, NULL);
+
+    if ( xc_domain_nr_gpfns(xch, ctx->domid, &p) < 0 )
+    {
+        PERROR("Unable to obtain the guest p2m size");
+        goto out;
+    }
+    ctx->save.p2m_size = p;
+    stats.dirty_count = p;
+
+    outstanding = xc_hypercall_buffer_alloc_pages(
+        xch, outstanding, NRPAGES(bitmap_size(ctx->save.p2m_size)));
+    ctx->save.batch_pfns = malloc(MAX_BATCH_SIZE *
+                                  sizeof(*ctx->save.batch_pfns));
+    ctx->save.deferred_pages = bitmap_alloc(ctx->save.p2m_size);
+
+    if ( !outstanding || !ctx->save.batch_pfns || !ctx->save.deferred_pages )
+    {
+        ERROR("Unable to allocate memory for post-copy bitmaps");
+        errno = ENOMEM;
+        goto out;
+    }
+
+    /* The pages left behind by xc_domain_save(). */
+    if ( xc_logdirty_control(
+             xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_PEEK,
+             HYPERCALL_BUFFER(outstanding), ctx->save.p2m_size,
+             0, &stats) != ctx->save.p2m_size )
+    {
+        PERROR("Failed to retrieve logdirty bitmap");
+        goto out;
+    }
+
+    if ( write_postcopy_pfns(ctx, outstanding, &nr_outstanding) )
+        goto out;
+
+    IPRINTF("Post-copy: %lu pages outstanding", nr_outstanding);
+    xc_set_progress_prefix(xch, "Post-copy");
+
+    for ( ;; )
+    {
+        rc = poll(&pfd, 1, next < ctx->save.p2m_size ? 0 : -1);
+        if ( rc < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            PERROR("Failed to poll for post-copy requests");
+            goto out;
+        }
+
+        if ( rc )
+        {
+            rc = read_record(ctx, ctx->save.recv_fd, &rec);
+            if ( rc )
+                goto out;
+
+            if ( rec.type == REC_TYPE_END )
+            {
+                free(rec.data);
+                break;
+            }
+
+            if ( rec.type == REC_TYPE_POSTCOPY_ABORT )
+            {
+                free(rec.data);
+                ERROR("Receiver aborted before resuming the guest");
+                aborted = true;
+
+                /* Let the receiver stop draining the stream. */
+                write_record(ctx, &end);
+                rc = -1;
+                goto out;
+            }
+
+            if ( rec.type != REC_TYPE_POSTCOPY_REQUEST )
+            {
+                ERROR("Unexpected record %#x (%s) from the receiver",
+                      rec.type, rec_type_to_str(rec.type));
+                free(rec.data);
+                rc = -1;
+                goto out;
+            }
+
+            rc = handle_postcopy_request(ctx, &rec, outstanding, &nr_sent);
+            free(rec.data);
+            if ( rc )
+                goto out;
+            continue;
+        }
+
+        /* Nothing asked for.  Push the next batch. */
+        for ( ; next < ctx->save.p2m_size &&
+                ctx->save.nr_batch_pfns < MAX_BATCH_SIZE; ++next )
+        {
+            if ( !test_and_clear_bit(next, outstanding) )
+                continue;
+
+            ctx->save.batch_pfns[ctx->save.nr_batch_pfns++] = next;
+            ++nr_sent;
+        }
+
+        rc = flush_batch(ctx);
+        if ( rc )
+            goto out;
+
+        /* Retry anything which could not be sent yet. */
+        if ( ctx->save.nr_deferred_pages )
+        {
+            bitmap_or(outstanding, ctx->save.deferred_pages,
+                      ctx->save.p2m_size);
+            bitmap_clear(ctx->save.deferred_pages, ctx->save.p2m_size);
+            nr_sent -= ctx->save.nr_deferred_pages;
+            ctx->save.nr_deferred_pages = 0;
+            next = 0;
+        }
+
+        xc_report_progress_step(xch, nr_sent, nr_outstanding);
+    }
+
+    xc_report_progress_step(xch, nr_outstanding, nr_outstanding);
+    IPRINTF("Post-copy complete");
+    rc = 0;
+
+ out:
+    xc_set_progress_prefix(xch, NULL);
+
+    if ( xc_shadow_control(xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_OFF,
+                           NULL, 0) && !rc )
+    {
+        PERROR("Failed to disable log-dirty mode");
+        rc = -1;
+    }
+
+    xc_hypercall_buffer_free_pages(xch, outstanding,
+                                   NRPAGES(bitmap_size(ctx->save.p2m_size)));
+    free(ctx->save.deferred_pages);
+    free(ctx->save.batch_pfns);
+
+    pthread_cond_destroy(&ctx->save.cond);
+    pthread_mutex_destroy(&ctx->save.lock);
+
+    if ( aborted )
+        errno = ECANCELED;
+
+    return rc;
+}
+
 int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
                    uint32_t flags, struct save_callbacks *callbacks,
                    xc_stream_type_t stream_type, int recv_fd)
+{
+    return xc_domain_save_streams(xch, io_fd, dom, flags, callbacks,
+                                  stream_type, recv_fd, NULL, 0);
+}
+
+int xc_domain_save_streams(xc_interface *xch, int io_fd, uint32_t dom,
+                           uint32_t flags, struct save_callbacks *callbacks,
+                           xc_stream_type_t stream_type, int recv_fd,
+                           const int *page_fds, unsigned int nr_page_fds)
 {
     struct xc_sr_context ctx = {
         .xch = xch,
         .fd = io_fd,
         .stream_type = stream_type,
     };
+    unsigned int i;
 
     /* GCC 4.4 (of CentOS 6.x vintage) can' t initialise anonymous unions. */
     ctx.save.callbacks = callbacks;
     ctx.save.live  = !!(flags & XCFLAGS_LIVE);
     ctx.save.debug = !!(flags & XCFLAGS_DEBUG);
+    ctx.save.compress = !!(flags & XCFLAGS_COMPRESS);
+    ctx.save.postcopy = !!(flags & XCFLAGS_POSTCOPY);
     ctx.save.recv_fd = recv_fd;
 
+    if ( nr_page_fds && stream_type != XC_STREAM_PLAIN )
+    {
+        ERROR("Page streams are not supported for checkpointed streams");
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
     if ( xc_domain_getinfo(xch, dom, 1, &ctx.dominfo) != 1 )
     {
         PERROR("Failed to get domain info");
@@ -1008,6 +2065,15 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
         return -1;
     }
 
+    if ( ctx.save.postcopy &&
+         (!ctx.save.live || !ctx.dominfo.hvm ||
+          stream_type != XC_STREAM_PLAIN) )
+    {
+        ERROR("Post-copy is only supported for live migration of HVM guests");
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
     /* Sanity check stream_type-related parameters */
     switch ( stream_type )
     {
@@ -1027,11 +2093,30 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
         break;
     }
 
-    DPRINTF("fd %d, dom %u, flags %u, hvm %d",
-            io_fd, dom, flags, ctx.dominfo.hvm);
+    DPRINTF("fd %d, dom %u, flags %u, hvm %d, page streams %u",
+            io_fd, dom, flags, ctx.dominfo.hvm, nr_page_fds);
 
     ctx.domid = dom;
 
+    if ( nr_page_fds )
+    {
+        ctx.save.streams = calloc(nr_page_fds, sizeof(*ctx.save.streams));
+        if ( !ctx.save.streams )
+        {
+            ERROR("Unable to allocate memory for %u page streams",
+                  nr_page_fds);
+            return -1;
+        }
+
+        for ( i = 0; i < nr_page_fds; ++i )
+        {
+            ctx.save.streams[i].ctx = &ctx;
+            ctx.save.streams[i].id = i;
+            ctx.save.streams[i].fd = page_fds[i];
+        }
+        ctx.save.nr_streams = nr_page_fds;
+    }
+
     if ( ctx.dominfo.hvm )
     {
         ctx.save.ops = save_ops_x86_hvm;
@@ -1044,6 +2129,39 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
     }
 }
 
+int xc_domain_postcopy_send(xc_interface *xch, int io_fd, uint32_t dom,
+                            uint32_t flags, int recv_fd)
+{
+    struct xc_sr_context ctx = {
+        .xch = xch,
+        .fd = io_fd,
+        .domid = dom,
+        .stream_type = XC_STREAM_PLAIN,
+    };
+
+    ctx.save.compress = !!(flags & XCFLAGS_COMPRESS);
+    ctx.save.recv_fd = recv_fd;
+
+    if ( xc_domain_getinfo(xch, dom, 1, &ctx.dominfo) != 1 ||
+         ctx.dominfo.domid != dom )
+    {
+        PERROR("Failed to get domain info");
+        return -1;
+    }
+
+    if ( !ctx.dominfo.hvm )
+    {
+        ERROR("Post-copy is only supported for HVM guests");
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    DPRINTF("fd %d, dom %u, flags %u, recv_fd %d", io_fd, dom, flags, recv_fd);
+
+    ctx.save.ops = save_ops_x86_hvm;
+    return postcopy_send(&ctx);
+}
+
 /*
  * Local variables:
  * mode: C
@@ -174,9 +174,103 @@ static int x86_hvm_static_data(struct xc_sr_context *ctx)
     return write_x86_cpu_policy_records(ctx);
 }
 
+/* Number of gfns whose p2m orders are queried at a time. */
+#define SUPERPAGES_CHUNK (1UL << SUPERPAGE_1GB_SHIFT)
+
+/*
+ * Write SUPERPAGES records for the ranges of the guest mapped by 1G and 2M
+ * p2m entries, so the restorer can map them with superpages too.  This is
+ * only an optimisation, so a Xen unable to report the p2m orders means no
+ * records are sent.
+ */
+static int write_superpages(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    static const unsigned int orders[] = {
+        SUPERPAGE_1GB_SHIFT, SUPERPAGE_2MB_SHIFT,
+    };
+    struct xc_sr_rec_superpages hdr = { 0 };
+    struct xc_sr_record rec = {
+        .type = REC_TYPE_SUPERPAGES,
+        .length = sizeof(hdr),
+        .data = &hdr,
+    };
+    unsigned long p2m_size = ctx->save.p2m_size, base, nr, i;
+    unsigned long count[ARRAY_SIZE(orders)] = { 0 };
+    uint64_t *pfns[ARRAY_SIZE(orders)] = { NULL };
+    uint8_t *p2m_orders = malloc(SUPERPAGES_CHUNK);
+    unsigned int o;
+    int rc = -1;
+
+    for ( o = 0; o < ARRAY_SIZE(orders); ++o )
+        pfns[o] = malloc(((p2m_size >> orders[o]) + 1) * sizeof(*pfns[o]));
+
+    if ( !p2m_orders || !pfns[0] || !pfns[1] )
+    {
+        ERROR("Unable to allocate memory for superpage ranges");
+        goto out;
+    }
+
+    for ( base = 0; base < p2m_size; base += SUPERPAGES_CHUNK )
+    {
+        nr = min_t(unsigned long, SUPERPAGES_CHUNK, p2m_size - base);
+
+        if ( xc_domain_get_p2m_orders(xch, ctx->domid, base, nr, p2m_orders) )
+        {
+            DPRINTF("Unable to query p2m orders (%d = %s), not sending "
+                    "superpages", errno, strerror(errno));
+            rc = 0;
+            goto out;
+        }
+
+        /*
+         * Chunks are 1G aligned, and an entry of an order always starts on a
+         * boundary of that order, so the first gfn of each aligned range
+         * says whether the whole range is a superpage.
+         */
+        for ( i = 0; i < nr; i += 1UL << SUPERPAGE_2MB_SHIFT )
+        {
+            if ( p2m_orders[i] == XEN_DOMCTL_P2M_ORDER_NONE )
+                continue;
+
+            if ( !i && p2m_orders[i] >= SUPERPAGE_1GB_SHIFT )
+            {
+                pfns[0][count[0]++] = base;
+                break;
+            }
+
+            if ( p2m_orders[i] >= SUPERPAGE_2MB_SHIFT )
+                pfns[1][count[1]++] = base + i;
+        }
+    }
+
+    DPRINTF("Sending %lu 1G and %lu 2M superpages", count[0], count[1]);
+
+    for ( o = 0; o < ARRAY_SIZE(orders); ++o )
+    {
+        if ( !count[o] )
+            continue;
+
+        hdr.order = orders[o];
+        rc = write_split_record(ctx, &rec, pfns[o],
+                                count[o] * sizeof(*pfns[o]));
+        if ( rc )
+            goto out;
+    }
+
+    rc = 0;
+
+ out:
+    for ( o = 0; o < ARRAY_SIZE(orders); ++o )
+        free(pfns[o]);
+    free(p2m_orders);
+
+    return rc;
+}
+
 static int x86_hvm_start_of_stream(struct xc_sr_context *ctx)
 {
-    return 0;
+    return write_superpages(ctx);
 }
 
 static int x86_hvm_start_of_checkpoint(struct xc_sr_context *ctx)
@@ -76,9 +76,17 @@ struct xc_sr_rhdr
 #define REC_TYPE_STATIC_DATA_END            0x00000010U
 #define REC_TYPE_X86_CPUID_POLICY           0x00000011U
 #define REC_TYPE_X86_MSR_POLICY             0x00000012U
+#define REC_TYPE_PAGE_STREAMS               0x00000013U
+#define REC_TYPE_PAGE_STREAMS_SYNC          0x00000014U
+#define REC_TYPE_COMPRESSED_PAGE_DATA       0x00000015U
+#define REC_TYPE_POSTCOPY_PFNS              0x00000016U
+#define REC_TYPE_POSTCOPY_REQUEST           0x00000017U
+#define REC_TYPE_POSTCOPY_ABORT             0x00000018U
 
 #define REC_TYPE_OPTIONAL             0x80000000U
 
+#define REC_TYPE_SUPERPAGES                 0x80000000U
+
 /* PAGE_DATA */
 struct xc_sr_rec_page_data_header
 {
@@ -90,6 +98,45 @@ struct xc_sr_rec_page_data_header
 #define PAGE_DATA_PFN_MASK  0x000fffffffffffffULL
 #define PAGE_DATA_TYPE_MASK 0xf000000000000000ULL
 
+/*
+ * COMPRESSED_PAGE_DATA: A xc_sr_rec_page_data_header, followed by a
+ * xc_sr_compressed_page descriptor for each page with data, followed by the
+ * encoded data of each page.
+ */
+struct xc_sr_compressed_page
+{
+    uint16_t encoding;
+    uint16_t _res1;
+    uint32_t length;
+};
+
+#define PAGE_ENCODING_RAW    0x0000U
+#define PAGE_ENCODING_ZERO   0x0001U
+#define PAGE_ENCODING_LZ4    0x0002U
+#define PAGE_ENCODING_XBZRLE 0x0003U
+
+/* SUPERPAGES */
+struct xc_sr_rec_superpages
+{
+    uint32_t order;
+    uint32_t _res1;
+    uint64_t pfn[0];
+};
+
+/* PAGE_STREAMS */
+struct xc_sr_rec_page_streams
+{
+    uint32_t count;
+    uint32_t _res1;
+};
+
+/* PAGE_STREAMS_SYNC */
+struct xc_sr_rec_page_streams_sync
+{
+    uint32_t seq;
+    uint32_t _res1;
+};
+
 /* X86_PV_INFO */
 struct xc_sr_rec_x86_pv_info
 {
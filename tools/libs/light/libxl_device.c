@@ -155,6 +155,7 @@ int libxl__device_generic_add(libxl__gc *gc, xs_transaction_t t,
     struct xs_permissions backend_perms[2];
     int create_transaction = t == XBT_NULL;
     int libxl_only = device->backend_kind == LIBXL__DEVICE_KIND_NONE;
+    libxl__xs_batch *b;
     int rc;
 
     if (libxl_only) {
@@ -185,21 +186,25 @@ retry_transaction:
     rc = libxl__xs_rm_checked(gc, t, libxl_path);
     if (rc) goto out;
 
-    if (!libxl_only) {
-        rc = libxl__xs_write_checked(gc, t, GCSPRINTF("%s/frontend",libxl_path),
-                                     frontend_path);
-        if (rc) goto out;
+    /* xxx much of this function lacks error checks! */
 
-        rc = libxl__xs_write_checked(gc, t, GCSPRINTF("%s/backend",libxl_path),
-                                     backend_path);
-        if (rc) goto out;
-    }
+    if (fents || ro_fents)
+        xs_rm(ctx->xsh, t, frontend_path);
+    if (bents && !libxl_only)
+        xs_rm(ctx->xsh, t, backend_path);
 
-    /* xxx much of this function lacks error checks! */
+    /* Everything else is sent to xenstored in as few requests as possible. */
+    b = libxl__xs_batch_new(gc, t);
+
+    if (!libxl_only) {
+        libxl__xs_batch_write(gc, b, GCSPRINTF("%s/frontend", libxl_path),
+                              frontend_path);
+        libxl__xs_batch_write(gc, b, GCSPRINTF("%s/backend", libxl_path),
+                              backend_path);
+    }
 
     if (fents || ro_fents) {
-        xs_rm(ctx->xsh, t, frontend_path);
-        xs_mkdir(ctx->xsh, t, frontend_path);
+        libxl__xs_batch_mkdir(gc, b, frontend_path);
         /* Console 0 is a special case. It doesn't use the regular PV
          * state machine but also the frontend directory has
          * historically contained other information, such as the
@@ -207,30 +212,31 @@ retry_transaction:
          */
         if ((device->kind == LIBXL__DEVICE_KIND_CONSOLE && device->devid == 0) ||
             (device->kind == LIBXL__DEVICE_KIND_VUART))
-            xs_set_permissions(ctx->xsh, t, frontend_path,
-                               ro_frontend_perms, ARRAY_SIZE(ro_frontend_perms));
+            libxl__xs_batch_set_perms(gc, b, frontend_path, ro_frontend_perms,
+                                      ARRAY_SIZE(ro_frontend_perms));
         else
-            xs_set_permissions(ctx->xsh, t, frontend_path,
-                               frontend_perms, ARRAY_SIZE(frontend_perms));
-        xs_write(ctx->xsh, t, GCSPRINTF("%s/backend", frontend_path),
-                 backend_path, strlen(backend_path));
-        if (fents)
-            libxl__xs_writev_perms(gc, t, frontend_path, fents,
-                                   frontend_perms, ARRAY_SIZE(frontend_perms));
-        if (ro_fents)
-            libxl__xs_writev_perms(gc, t, frontend_path, ro_fents,
-                                   ro_frontend_perms, ARRAY_SIZE(ro_frontend_perms));
+            libxl__xs_batch_set_perms(gc, b, frontend_path, frontend_perms,
+                                      ARRAY_SIZE(frontend_perms));
+        libxl__xs_batch_write(gc, b, GCSPRINTF("%s/backend", frontend_path),
+                              backend_path);
+        libxl__xs_batch_writev_perms(gc, b, frontend_path, fents,
+                                     frontend_perms,
+                                     ARRAY_SIZE(frontend_perms));
+        libxl__xs_batch_writev_perms(gc, b, frontend_path, ro_fents,
+                                     ro_frontend_perms,
+                                     ARRAY_SIZE(ro_frontend_perms));
     }
 
     if (bents) {
         if (!libxl_only) {
-            xs_rm(ctx->xsh, t, backend_path);
-            xs_mkdir(ctx->xsh, t, backend_path);
-            xs_set_permissions(ctx->xsh, t, backend_path, backend_perms,
-                               ARRAY_SIZE(backend_perms));
-            xs_write(ctx->xsh, t, GCSPRINTF("%s/frontend", backend_path),
-                     frontend_path, strlen(frontend_path));
-            libxl__xs_writev(gc, t, backend_path, bents);
+            libxl__xs_batch_mkdir(gc, b, backend_path);
+            libxl__xs_batch_set_perms(gc, b, backend_path, backend_perms,
+                                      ARRAY_SIZE(backend_perms));
+            libxl__xs_batch_write(gc, b,
+                                  GCSPRINTF("%s/frontend", backend_path),
+                                  frontend_path);
+            libxl__xs_batch_writev_perms(gc, b, backend_path, bents,
+                                         NULL, 0);
         }
 
         /*
@@ -256,10 +262,12 @@ retry_transaction:
          * This duplication is superfluous and messy but as discussed
          * the proper fix is more intrusive than we want to do now.
          */
-        rc = libxl__xs_writev(gc, t, libxl_path, bents);
-        if (rc) goto out;
+        libxl__xs_batch_writev_perms(gc, b, libxl_path, bents, NULL, 0);
     }
 
+    rc = libxl__xs_batch_flush(gc, b);
+    if (rc) goto out;
+
     if (!create_transaction)
         return 0;
 
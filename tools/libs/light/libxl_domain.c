@@ -506,8 +506,9 @@ static void domain_suspend_cb(libxl__egc *egc,
 
 }
 
-int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd, int flags,
-                         const libxl_asyncop_how *ao_how)
+static int domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd, int flags,
+                          unsigned int max_downtime_ms,
+                          const libxl_asyncop_how *ao_how)
 {
     AO_CREATE(ctx, domid, ao_how);
     int rc;
@@ -529,6 +530,10 @@ int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd, int flags,
     dss->type = type;
     dss->live = flags & LIBXL_SUSPEND_LIVE;
     dss->debug = flags & LIBXL_SUSPEND_DEBUG;
+    dss->compress = flags & LIBXL_SUSPEND_COMPRESS;
+    dss->postcopy = flags & LIBXL_SUSPEND_POSTCOPY;
+    dss->max_downtime_ms = max_downtime_ms;
+    dss->throttle = flags & LIBXL_SUSPEND_THROTTLE;
     dss->checkpointed_stream = LIBXL_CHECKPOINTED_STREAM_NONE;
 
     rc = libxl__fd_flags_modify_save(gc, dss->fd,
@@ -543,6 +548,171 @@ int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd, int flags,
     return AO_CREATE_FAIL(rc);
 }
 
+int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd, int flags,
+                         const libxl_asyncop_how *ao_how)
+{
+    return domain_suspend(ctx, domid, fd, flags, 0, ao_how);
+}
+
+int libxl_domain_suspend_adaptive(libxl_ctx *ctx, uint32_t domid, int fd,
+                                  int flags, unsigned int max_downtime_ms,
+                                  const libxl_asyncop_how *ao_how)
+{
+    return domain_suspend(ctx, domid, fd, flags, max_downtime_ms, ao_how);
+}
+
+/*
+ * The post-copy phase runs in the save/restore helper, as it blocks until
+ * every outstanding page has been sent or received.
+ */
+static int postcopy_init(libxl__gc *gc, libxl__postcopy_state *pcs)
+{
+    int rc;
+
+    rc = libxl__fd_flags_modify_save(gc, pcs->fd, ~(O_NONBLOCK|O_NDELAY), 0,
+                                     &pcs->fdfl);
+    if (rc) return rc;
+
+    rc = libxl__fd_flags_modify_save(gc, pcs->back_fd,
+                                     ~(O_NONBLOCK|O_NDELAY), 0,
+                                     &pcs->back_fdfl);
+    if (rc) libxl__fd_flags_restore(gc, pcs->fd, pcs->fdfl);
+
+    return rc;
+}
+
+static void postcopy_done(libxl__egc *egc, libxl__postcopy_state *pcs,
+                          int rc)
+{
+    STATE_AO_GC(pcs->ao);
+    int flrc;
+
+    flrc = libxl__fd_flags_restore(gc, pcs->back_fd, pcs->back_fdfl);
+    if (flrc && !rc) rc = flrc;
+    flrc = libxl__fd_flags_restore(gc, pcs->fd, pcs->fdfl);
+    if (flrc && !rc) rc = flrc;
+
+    libxl__ao_complete(egc, ao, rc);
+}
+
+int libxl_domain_postcopy_send(libxl_ctx *ctx, uint32_t domid,
+                               int send_fd, int recv_fd, int flags,
+                               const libxl_asyncop_how *ao_how)
+{
+    AO_CREATE(ctx, domid, ao_how);
+    libxl__postcopy_state *pcs;
+    int rc;
+
+    GCNEW(pcs);
+    pcs->ao = ao;
+    pcs->domid = domid;
+    pcs->fd = send_fd;
+    pcs->back_fd = recv_fd;
+    pcs->xcflags = (flags & LIBXL_SUSPEND_COMPRESS) ? XCFLAGS_COMPRESS : 0;
+
+    rc = postcopy_init(gc, pcs);
+    if (rc) goto out_err;
+
+    libxl__xc_domain_postcopy_send(egc, pcs, &pcs->shs);
+    return AO_INPROGRESS;
+
+ out_err:
+    return AO_CREATE_FAIL(rc);
+}
+
+void libxl__xc_domain_postcopy_send_done(libxl__egc *egc, void *pcs_void,
+                                         int rc, int retval, int errnoval)
+{
+    libxl__postcopy_state *pcs = pcs_void;
+    STATE_AO_GC(pcs->ao);
+
+    if (rc) goto out;
+
+    if (retval && errnoval == ECANCELED) {
+        LOGD(ERROR, pcs->domid, "Post-copy migration aborted by the receiver");
+        rc = ERROR_ABORTED;
+    } else if (retval) {
+        LOGEVD(ERROR, errnoval, pcs->domid, "Post-copy migration failed");
+        rc = ERROR_FAIL;
+    }
+
+ out:
+    postcopy_done(egc, pcs, rc);
+}
+
+static void postcopy_resume(void *data);
+static void postcopy_resumed(libxl__egc *egc, libxl__dm_resume_state *dmrs,
+                             int rc);
+
+int libxl_domain_postcopy_receive(libxl_ctx *ctx, uint32_t domid,
+                                  int recv_fd, int send_fd, int unpause,
+                                  const libxl_asyncop_how *ao_how)
+{
+    AO_CREATE(ctx, domid, ao_how);
+    libxl__postcopy_state *pcs;
+    int rc;
+
+    GCNEW(pcs);
+    pcs->ao = ao;
+    pcs->domid = domid;
+    pcs->fd = recv_fd;
+    pcs->back_fd = send_fd;
+    pcs->unpause = unpause;
+
+    rc = postcopy_init(gc, pcs);
+    if (rc) goto out_err;
+
+    pcs->shs.callbacks.restore.a.postcopy = postcopy_resume;
+    libxl__xc_domain_postcopy_receive(egc, pcs, &pcs->shs);
+    return AO_INPROGRESS;
+
+ out_err:
+    return AO_CREATE_FAIL(rc);
+}
+
+/* Called by the helper once the pages which stay resident have arrived. */
+static void postcopy_resume(void *data)
+{
+    libxl__save_helper_state *shs = data;
+    libxl__egc *egc = shs->egc;
+    libxl__postcopy_state *pcs = shs->caller_state;
+
+    if (!pcs->unpause) {
+        libxl__xc_domain_saverestore_async_callback_done(egc, shs, 1);
+        return;
+    }
+
+    pcs->dmrs.ao = pcs->ao;
+    pcs->dmrs.domid = pcs->domid;
+    pcs->dmrs.callback = postcopy_resumed;
+    libxl__domain_unpause(egc, &pcs->dmrs); /* must be last */
+}
+
+static void postcopy_resumed(libxl__egc *egc, libxl__dm_resume_state *dmrs,
+                             int rc)
+{
+    libxl__postcopy_state *pcs = CONTAINER_OF(dmrs, *pcs, dmrs);
+
+    libxl__xc_domain_saverestore_async_callback_done(egc, &pcs->shs, !rc);
+}
+
+void libxl__xc_domain_postcopy_receive_done(libxl__egc *egc, void *pcs_void,
+                                            int rc, int retval, int errnoval)
+{
+    libxl__postcopy_state *pcs = pcs_void;
+    STATE_AO_GC(pcs->ao);
+
+    if (rc) goto out;
+
+    if (retval) {
+        LOGEVD(ERROR, errnoval, pcs->domid, "Post-copy migration failed");
+        rc = ERROR_FAIL;
+    }
+
+ out:
+    postcopy_done(egc, pcs, rc);
+}
+
 static void domain_suspend_empty_cb(libxl__egc *egc,
                               libxl__domain_suspend_state *dss, int rc)
 {
@@ -1078,6 +1078,36 @@ int libxl__xs_transaction_start(libxl__gc *gc, xs_transaction_t *t);
 int libxl__xs_transaction_commit(libxl__gc *gc, xs_transaction_t *t);
 void libxl__xs_transaction_abort(libxl__gc *gc, xs_transaction_t *t);
 
+/* Batched xenstore updates.
+ * Updates queued by the libxl__xs_batch_* functions are sent to xenstored
+ * in as few requests as possible (see xs_batch_commit).  When a batch is
+ * full the updates queued so far are sent right away, so the updates are
+ * atomic only if done within a transaction t.
+ *
+ * The first failing update is logged, and all later ones are dropped.
+ * libxl__xs_batch_flush must be called to send any remaining updates and
+ * to release the batch, also on error.  It returns 0 on success or
+ * ERROR_FAIL if any update failed.
+ */
+typedef struct libxl__xs_batch libxl__xs_batch;
+
+_hidden libxl__xs_batch *libxl__xs_batch_new(libxl__gc *gc,
+                                             xs_transaction_t t);
+_hidden void libxl__xs_batch_write(libxl__gc *gc, libxl__xs_batch *b,
+                                   const char *path, const char *string);
+_hidden void libxl__xs_batch_mkdir(libxl__gc *gc, libxl__xs_batch *b,
+                                   const char *path);
+_hidden void libxl__xs_batch_set_perms(libxl__gc *gc, libxl__xs_batch *b,
+                                       const char *path,
+                                       struct xs_permissions *perms,
+                                       unsigned int num_perms);
+/* Same as libxl__xs_writev_perms. */
+_hidden void libxl__xs_batch_writev_perms(libxl__gc *gc, libxl__xs_batch *b,
+                                          const char *dir, char *kvs[],
+                                          struct xs_permissions *perms,
+                                          unsigned int num_perms);
+_hidden int libxl__xs_batch_flush(libxl__gc *gc, libxl__xs_batch *b);
+
 
 
 /*
@@ -3657,6 +3687,10 @@ struct libxl__domain_save_state {
     libxl_domain_type type;
     int live;
     int debug;
+    int compress;
+    int postcopy;
+    unsigned int max_downtime_ms; /* 0 for the default precopy policy */
+    int throttle;
     int checkpointed_stream;
     const libxl_domain_remus_info *remus;
     /* private */
@@ -3675,6 +3709,25 @@ struct libxl__domain_save_state {
 };
 
 
+/*----- post-copy phase of a live migration -----*/
+
+typedef struct libxl__postcopy_state libxl__postcopy_state;
+
+struct libxl__postcopy_state {
+    /* set by caller of libxl__xc_domain_postcopy_{send,receive} */
+    libxl__ao *ao;
+    uint32_t domid;
+    int fd;      /* page data, towards the receiver */
+    int back_fd; /* page requests, towards the sender */
+    int fdfl, back_fdfl; /* original flags on fd and back_fd */
+    int xcflags; /* sender only */
+    int unpause; /* receiver only */
+    /* private */
+    libxl__save_helper_state shs;
+    libxl__dm_resume_state dmrs;
+};
+
+
 /*----- openpty -----*/
 
 /*
@@ -4286,6 +4339,25 @@ _hidden void libxl__xc_domain_restore(libxl__egc *egc,
 _hidden void libxl__xc_domain_restore_done(libxl__egc *egc, void *dcs_void,
                                            int rc, int retval, int errnoval);
 
+/* calls libxl__xc_domain_postcopy_send_done when done */
+_hidden void libxl__xc_domain_postcopy_send(libxl__egc *egc,
+                                            libxl__postcopy_state *pcs,
+                                            libxl__save_helper_state *shs);
+/* calls libxl__xc_domain_postcopy_receive_done when done, and
+ * shs->callbacks.restore.a.postcopy to resume the domain */
+_hidden void libxl__xc_domain_postcopy_receive(libxl__egc *egc,
+                                               libxl__postcopy_state *pcs,
+                                               libxl__save_helper_state *shs);
+/* If rc==0 then retval is the return value from
+ * xc_domain_postcopy_{send,receive} and errnoval is the errno value it
+ * provided.  If rc!=0, retval and errnoval are undefined. */
+_hidden void libxl__xc_domain_postcopy_send_done(libxl__egc *egc,
+                                                 void *pcs_void, int rc,
+                                                 int retval, int errnoval);
+_hidden void libxl__xc_domain_postcopy_receive_done(libxl__egc *egc,
+                                                    void *pcs_void, int rc,
+                                                    int retval, int errnoval);
+
 _hidden void libxl__save_helper_init(libxl__save_helper_state *shs);
 _hidden void libxl__save_helper_abort(libxl__egc *egc,
                                       libxl__save_helper_state *shs);
@@ -89,6 +89,7 @@ void libxl__xc_domain_save(libxl__egc *egc, libxl__domain_save_state *dss,
     const unsigned long argnums[] = {
         dss->domid, dss->xcflags, cbflags,
         dss->checkpointed_stream,
+        dss->max_downtime_ms, dss->throttle,
     };
 
     shs->ao = ao;
@@ -104,6 +105,47 @@ void libxl__xc_domain_save(libxl__egc *egc, libxl__domain_save_state *dss,
     return;
 }
 
+void libxl__xc_domain_postcopy_send(libxl__egc *egc,
+                                    libxl__postcopy_state *pcs,
+                                    libxl__save_helper_state *shs)
+{
+    STATE_AO_GC(pcs->ao);
+
+    const unsigned long argnums[] = { pcs->domid, pcs->xcflags };
+
+    shs->ao = ao;
+    shs->domid = pcs->domid;
+    shs->recv_callback = libxl__srm_callout_received_save;
+    shs->completion_callback = libxl__xc_domain_postcopy_send_done;
+    shs->caller_state = pcs;
+    shs->need_results = 0;
+
+    run_helper(egc, shs, "--postcopy-send", pcs->fd, pcs->back_fd, NULL, 0,
+               argnums, ARRAY_SIZE(argnums));
+}
+
+void libxl__xc_domain_postcopy_receive(libxl__egc *egc,
+                                       libxl__postcopy_state *pcs,
+                                       libxl__save_helper_state *shs)
+{
+    STATE_AO_GC(pcs->ao);
+
+    unsigned cbflags =
+        libxl__srm_callout_enumcallbacks_restore(&shs->callbacks.restore.a);
+
+    const unsigned long argnums[] = { pcs->domid, cbflags };
+
+    shs->ao = ao;
+    shs->domid = pcs->domid;
+    shs->recv_callback = libxl__srm_callout_received_restore;
+    shs->completion_callback = libxl__xc_domain_postcopy_receive_done;
+    shs->caller_state = pcs;
+    shs->need_results = 0;
+
+    run_helper(egc, shs, "--postcopy-receive", pcs->fd, pcs->back_fd,
+               NULL, 0, argnums, ARRAY_SIZE(argnums));
+}
+
 
 void libxl__xc_domain_saverestore_async_callback_done(libxl__egc *egc,
                            libxl__save_helper_state *shs, int return_value)
@@ -142,7 +184,7 @@ static int dup_cloexec(libxl__gc *gc, int fd, const char *what)
 /*
  * Both save and restore share four parameters:
  * 1) Path to libxl-save-helper.
- * 2) --[restore|save]-domain.
+ * 2) --[restore|save]-domain or --postcopy-[send|receive].
  * 3) stream file descriptor.
  * 4) back channel file descriptor.
  * n) save/restore specific parameters.
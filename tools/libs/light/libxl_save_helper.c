@@ -50,6 +50,13 @@
 #include "xenguest.h"
 #include "_libxl_save_msgs_helper.h"
 
+/*
+ * Precopy iterations allowed to the adaptive policy.  More than the default
+ * policy's 5, as each one throttling the guest halves the rate it dirties
+ * memory at.
+ */
+#define ADAPTIVE_MAX_ITERATIONS 10
+
 /*----- logger -----*/
 
 __attribute__((format(printf, 5, 0)))
@@ -158,6 +165,24 @@ static void save_signal_handler(int num)
     errno = esave;
 }
 
+static int postcopy_recv_fd;
+
+static void postcopy_send_signal_handler(int num)
+{
+    /*
+     * As for save, but the sender may be waiting for the receiver rather
+     * than writing, so the back channel is made to read as EOF too.
+     */
+    int esave = errno;
+
+    int r = dup2(unwriteable_fd, postcopy_recv_fd);
+    if (r != postcopy_recv_fd)
+        abort();
+
+    errno = esave;
+    save_signal_handler(num);
+}
+
 static void setup_signals(void (*handler)(int))
 {
     struct sigaction sa;
@@ -224,6 +249,12 @@ static void startup(const char *op) {
     if (!xch) fail(errno,"xc_interface_open failed");
 }
 
+/* The restore postcopy callback returns 1 once the domain is resumed. */
+static int postcopy_resume(uint32_t domid, void *data) {
+    struct restore_callbacks *cb = data;
+    return cb->postcopy(cb->data) == 1 ? 0 : -1;
+}
+
 static void complete(int retval) {
     int errnoval = retval ? errno : 0; /* suppress irrelevant errnos */
     xtl_log(&logger,XTL_DEBUG,errnoval,program,"complete r=%d",retval);
@@ -244,6 +275,7 @@ int main(int argc, char **argv)
 
     if (!strcmp(mode,"--save-domain")) {
         static struct save_callbacks cb;
+        static struct xc_precopy_adaptive adaptive;
 
         io_fd =                             atoi(NEXTARG);
         recv_fd =                           atoi(NEXTARG);
@@ -251,10 +283,21 @@ int main(int argc, char **argv)
         uint32_t flags =                    strtoul(NEXTARG,0,10);
         unsigned cbflags =                  strtoul(NEXTARG,0,10);
         xc_stream_type_t stream_type =      strtoul(NEXTARG,0,10);
+        unsigned max_downtime_ms =          strtoul(NEXTARG,0,10);
+        bool throttle =                     strtoul(NEXTARG,0,10);
         assert(!*++argv);
 
         helper_setcallbacks_save(&cb, cbflags);
 
+        if (max_downtime_ms) {
+            /* The stubs ignore the callbacks' data, so the policy has it. */
+            adaptive.max_downtime_ms = max_downtime_ms;
+            adaptive.max_iterations = ADAPTIVE_MAX_ITERATIONS;
+            adaptive.throttle = throttle;
+            cb.precopy_policy = xc_precopy_policy_adaptive;
+            cb.data = &adaptive;
+        }
+
         startup("save");
         setup_signals(save_signal_handler);
 
@@ -289,6 +332,40 @@ int main(int argc, char **argv)
         helper_stub_restore_results(store_mfn,console_mfn,0);
         complete(r);
 
+    } else if (!strcmp(mode,"--postcopy-send")) {
+        io_fd =                             atoi(NEXTARG);
+        recv_fd =                           atoi(NEXTARG);
+        uint32_t dom =                      strtoul(NEXTARG,0,10);
+        uint32_t flags =                    strtoul(NEXTARG,0,10);
+        assert(!*++argv);
+
+        postcopy_recv_fd = recv_fd;
+
+        startup("post-copy send");
+        setup_signals(postcopy_send_signal_handler);
+
+        r = xc_domain_postcopy_send(xch, io_fd, dom, flags, recv_fd);
+        complete(r);
+
+    } else if (!strcmp(mode,"--postcopy-receive")) {
+        static struct restore_callbacks cb;
+
+        io_fd =                             atoi(NEXTARG);
+        send_back_fd =                      atoi(NEXTARG);
+        uint32_t dom =                      strtoul(NEXTARG,0,10);
+        unsigned cbflags =                  strtoul(NEXTARG,0,10);
+        assert(!*++argv);
+
+        helper_setcallbacks_restore(&cb, cbflags);
+        assert(cb.postcopy);
+
+        startup("post-copy receive");
+        setup_signals(SIG_DFL);
+
+        r = xc_domain_postcopy_receive(xch, io_fd, dom, send_back_fd,
+                                       postcopy_resume, &cb);
+        complete(r);
+
     } else {
         assert(!"unexpected mode argument");
     }
@@ -45,28 +45,151 @@ char **libxl__xs_kvs_of_flexarray(libxl__gc *gc, flexarray_t *array)
     return kvs;
 }
 
-int libxl__xs_writev_perms(libxl__gc *gc, xs_transaction_t t,
-                           const char *dir, char *kvs[],
-                           struct xs_permissions *perms,
-                           unsigned int num_perms)
+struct libxl__xs_batch {
+    xs_transaction_t t;
+    struct xs_batch *xsb;
+    unsigned int nr_updates;
+    int rc;
+};
+
+libxl__xs_batch *libxl__xs_batch_new(libxl__gc *gc, xs_transaction_t t)
+{
+    libxl__xs_batch *b;
+
+    GCNEW(b);
+    b->t = t;
+    return b;
+}
+
+/* Returns the xs_batch to add the next update to, or NULL after errors. */
+static struct xs_batch *batch_get(libxl__gc *gc, libxl__xs_batch *b)
+{
+    if (b->rc)
+        return NULL;
+
+    if (!b->xsb) {
+        b->xsb = xs_batch_start();
+        if (!b->xsb) {
+            LOGE(ERROR, "xenstore batch allocation failed");
+            b->rc = ERROR_FAIL;
+        }
+    }
+    return b->xsb;
+}
+
+static int batch_send(libxl__gc *gc, libxl__xs_batch *b)
+{
+    if (!xs_batch_commit(CTX->xsh, b->t, b->xsb)) {
+        LOGE(ERROR, "xenstore batch update failed");
+        return ERROR_FAIL;
+    }
+
+    xs_batch_free(b->xsb);
+    b->xsb = NULL;
+    b->nr_updates = 0;
+    return 0;
+}
+
+/* Returns false if the update is to be added again, as the batch was full
+ * and has been sent. */
+static bool batch_done(libxl__gc *gc, libxl__xs_batch *b, bool added,
+                       const char *what, const char *path)
+{
+    if (added) {
+        b->nr_updates++;
+        return true;
+    }
+
+    if (errno == E2BIG && b->nr_updates) {
+        b->rc = batch_send(gc, b);
+        return b->rc != 0;
+    }
+
+    LOGE(ERROR, "xenstore %s failed: `%s'", what, path);
+    b->rc = ERROR_FAIL;
+    return true;
+}
+
+void libxl__xs_batch_write(libxl__gc *gc, libxl__xs_batch *b,
+                           const char *path, const char *string)
+{
+    struct xs_batch *xsb;
+    size_t length = strlen(string);
+
+    while ((xsb = batch_get(gc, b)) &&
+           !batch_done(gc, b, xs_batch_write(xsb, path, string, length),
+                       "write", path))
+        continue;
+}
+
+void libxl__xs_batch_mkdir(libxl__gc *gc, libxl__xs_batch *b,
+                           const char *path)
+{
+    struct xs_batch *xsb;
+
+    while ((xsb = batch_get(gc, b)) &&
+           !batch_done(gc, b, xs_batch_mkdir(xsb, path), "mkdir", path))
+        continue;
+}
+
+void libxl__xs_batch_set_perms(libxl__gc *gc, libxl__xs_batch *b,
+                               const char *path,
+                               struct xs_permissions *perms,
+                               unsigned int num_perms)
+{
+    struct xs_batch *xsb;
+
+    while ((xsb = batch_get(gc, b)) &&
+           !batch_done(gc, b,
+                       xs_batch_set_permissions(xsb, path, perms, num_perms),
+                       "set_permissions", path))
+        continue;
+}
+
+void libxl__xs_batch_writev_perms(libxl__gc *gc, libxl__xs_batch *b,
+                                  const char *dir, char *kvs[],
+                                  struct xs_permissions *perms,
+                                  unsigned int num_perms)
 {
-    libxl_ctx *ctx = libxl__gc_owner(gc);
     char *path;
     int i;
 
     if (!kvs)
-        return 0;
+        return;
 
     for (i = 0; kvs[i] != NULL; i += 2) {
         path = GCSPRINTF("%s/%s", dir, kvs[i]);
         if (path && kvs[i + 1]) {
-            int length = strlen(kvs[i + 1]);
-            xs_write(ctx->xsh, t, path, kvs[i + 1], length);
+            libxl__xs_batch_write(gc, b, path, kvs[i + 1]);
             if (perms)
-                xs_set_permissions(ctx->xsh, t, path, perms, num_perms);
+                libxl__xs_batch_set_perms(gc, b, path, perms, num_perms);
         }
     }
-    return 0;
+}
+
+int libxl__xs_batch_flush(libxl__gc *gc, libxl__xs_batch *b)
+{
+    if (!b->rc && b->nr_updates)
+        b->rc = batch_send(gc, b);
+
+    xs_batch_free(b->xsb);
+    b->xsb = NULL;
+    return b->rc;
+}
+
+int libxl__xs_writev_perms(libxl__gc *gc, xs_transaction_t t,
+                           const char *dir, char *kvs[],
+                           struct xs_permissions *perms,
+                           unsigned int num_perms)
+{
+    libxl__xs_batch *b;
+
+    if (!kvs)
+        return 0;
+
+    b = libxl__xs_batch_new(gc, t);
+    libxl__xs_batch_writev_perms(gc, b, dir, kvs, perms, num_perms);
+    return libxl__xs_batch_flush(gc, b);
 }
 
 int libxl__xs_writev(libxl__gc *gc, xs_transaction_t t,
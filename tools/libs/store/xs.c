@@ -33,6 +33,11 @@
 #include <signal.h>
 #include <stdint.h>
 #include <errno.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#endif
 #include "xenstore.h"
 #include "xs_lib.h"
 #include "list.h"
@@ -59,6 +64,9 @@ struct xs_handle {
 	int fd;
 	Xentoolcore__Active_Handle tc_ah; /* for restrict */
 
+	/* Shared memory ring replacing fd for messages, if any. */
+	struct xs_ring *ring;
+
 	/*
          * A read thread which pulls messages off the comms channel and
          * signals waiters.
@@ -92,10 +100,11 @@ struct xs_handle {
 	pthread_mutex_t request_mutex;
 
 	/* Lock discipline:
-	 *  Only holder of the request lock may write to h->fd.
+	 *  Only holder of the request lock may write to h->fd or h->ring.
 	 *  Only holder of the request lock may access read_thr_exists.
 	 *  If read_thr_exists==0, only holder of request lock may read h->fd;
-	 *  If read_thr_exists==1, only the read thread may read h->fd.
+	 *  If read_thr_exists==1, only the read thread may read h->fd or
+	 *  h->ring.
 	 *  Only holder of the reply lock may access reply_list.
 	 *  Only holder of the watch lock may access watch_list.
 	 * Lock hierarchy:
@@ -133,6 +142,7 @@ static void *read_thread(void *arg);
 struct xs_handle {
 	int fd;
 	Xentoolcore__Active_Handle tc_ah; /* for restrict */
+	struct xs_ring *ring;
 	struct list_head reply_list;
 	struct list_head watch_list;
 	/* Clients can select() on this pipe to wait for a watch to fire. */
@@ -155,6 +165,8 @@ struct xs_handle {
 #endif
 
 static int read_message(struct xs_handle *h, int nonblocking);
+static void ring_setup(struct xs_handle *h);
+static void ring_free(struct xs_ring *ring);
 
 static bool setnonblock(int fd, int nonblock) {
 	int flags = fcntl(fd, F_GETFL);
@@ -323,6 +335,9 @@ struct xs_handle *xs_open(unsigned long flags)
 	if (xsh && (flags & XS_UNWATCH_FILTER))
 		xsh->unwatch_filter = true;
 
+	if (xsh && (flags & XS_OPEN_RING))
+		ring_setup(xsh);
+
 	return xsh;
 }
 
@@ -348,6 +363,8 @@ static void close_fds_free(struct xs_handle *h) {
 
 	xentoolcore__deregister_active_handle(&h->tc_ah);
         close(h->fd);
+	if (h->ring)
+		ring_free(h->ring);
         
 	free(h);
 }
@@ -433,6 +450,354 @@ out_false:
 #define xs_write_all write_all_choice
 #endif
 
+#ifdef __linux__
+/*
+ * With XS_OPEN_RING messages are exchanged with xenstored via a ring in
+ * shared memory instead of the socket, see the "ring" command in
+ * docs/misc/xenstore.txt.  The ring is laid out like the one of a domain.
+ * xenstored is kicked via req_evt only when it might be waiting for data or
+ * room, and kicks us via rsp_evt likewise, so most requests just need one
+ * write() and one poll() instead of several reads and writes on the socket.
+ */
+struct xs_ring {
+	struct xenstore_domain_interface *intf;
+
+	/* Signalled by us for xenstored, and by xenstored for us. */
+	int req_evt;
+	int rsp_evt;
+
+#ifdef USE_PTHREAD
+	/*
+	 * With a read thread only that one waits for kicks, and it wakes up
+	 * requesters waiting for room in the request ring.
+	 */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+#endif
+};
+
+#define RING_CMD "ring"
+
+/* libxenctrl's xen_mb() isn't available here. */
+#define xen_mb() __sync_synchronize()
+
+static void ring_free(struct xs_ring *ring)
+{
+	if (ring->intf)
+		munmap(ring->intf, sizeof(*ring->intf));
+	if (ring->req_evt >= 0)
+		close(ring->req_evt);
+	if (ring->rsp_evt >= 0)
+		close(ring->rsp_evt);
+	free(ring);
+}
+
+static void ring_kick(int evt)
+{
+	uint64_t one = 1;
+
+	while (write(evt, &one, sizeof(one)) < 0 && errno == EINTR)
+		continue;
+}
+
+static void ring_wake_writers(struct xs_handle *h)
+{
+#ifdef USE_PTHREAD
+	mutex_lock(&h->ring->mutex);
+	pthread_cond_broadcast(&h->ring->cond);
+	mutex_unlock(&h->ring->mutex);
+#endif
+}
+
+/*
+ * Wait for a kick from xenstored.  The first call just resets the kicks and
+ * returns, so the caller looks at the ring once more before *waited is set
+ * and the next call really waits.
+ */
+static bool ring_wait(struct xs_handle *h, bool *waited)
+{
+	struct pollfd fds[2] = {
+		{ .fd = h->ring->rsp_evt, .events = POLLIN },
+		{ .fd = h->fd, .events = POLLIN },
+	};
+	uint64_t cnt;
+
+	if (h->fd == -1) {
+		errno = EBADF;
+		return false;
+	}
+
+	if (!*waited) {
+		*waited = true;
+		if (read(h->ring->rsp_evt, &cnt, sizeof(cnt)) == sizeof(cnt)) /* Cancellation point */
+			ring_wake_writers(h);
+		return true;
+	}
+
+	while (poll(fds, ARRAY_SIZE(fds), -1) < 0) /* Cancellation point */
+		if (errno != EINTR)
+			return false;
+
+	/* Nothing is sent on the socket once the ring is used. */
+	if (fds[1].revents) {
+		errno = EBADF;
+		return false;
+	}
+
+	*waited = false;
+	return true;
+}
+
+/* Wait for xenstored to consume requests from the full ring. */
+static bool ring_wait_room(struct xs_handle *h, bool *waited)
+{
+#ifdef USE_PTHREAD
+	struct xenstore_domain_interface *intf = h->ring->intf;
+
+	if (read_thread_exists(h)) {
+		mutex_lock(&h->ring->mutex);
+		while (intf->req_prod - intf->req_cons == XENSTORE_RING_SIZE &&
+		       h->fd != -1)
+			condvar_wait(&h->ring->cond, &h->ring->mutex);
+		mutex_unlock(&h->ring->mutex);
+		if (h->fd == -1) {
+			errno = EBADF;
+			return false;
+		}
+		return true;
+	}
+#endif
+
+	return ring_wait(h, waited);
+}
+
+static bool ring_write_all(struct xs_handle *h, const void *data,
+			   unsigned int len)
+{
+	struct xenstore_domain_interface *intf = h->ring->intf;
+	XENSTORE_RING_IDX cons, prod;
+	bool waited = false;
+	uint32_t avail;
+
+	while (len) {
+		cons = intf->req_cons;
+		prod = intf->req_prod;
+		xen_mb();
+
+		if (prod - cons > XENSTORE_RING_SIZE) {
+			errno = EIO;
+			return false;
+		}
+
+		avail = XENSTORE_RING_SIZE - MASK_XENSTORE_IDX(prod);
+		if (XENSTORE_RING_SIZE - (prod - cons) < avail)
+			avail = XENSTORE_RING_SIZE - (prod - cons);
+		if (!avail) {
+			if (!ring_wait_room(h, &waited))
+				return false;
+			continue;
+		}
+		if (avail > len)
+			avail = len;
+
+		memcpy(intf->req + MASK_XENSTORE_IDX(prod), data, avail);
+		xen_mb();
+		intf->req_prod = prod + avail;
+		xen_mb();
+
+		/* xenstored might be waiting if it had consumed everything. */
+		if (intf->req_cons == prod)
+			ring_kick(h->ring->req_evt);
+
+		data += avail;
+		len -= avail;
+	}
+
+	return true;
+}
+
+/* Same semantics as read_all(). */
+static bool ring_read_all(struct xs_handle *h, void *data, unsigned int len,
+			  int nonblocking)
+{
+	struct xenstore_domain_interface *intf = h->ring->intf;
+	XENSTORE_RING_IDX cons, prod;
+	bool waited = false;
+	uint32_t avail;
+
+	while (len) {
+		cons = intf->rsp_cons;
+		prod = intf->rsp_prod;
+		xen_mb();
+
+		if (prod - cons > XENSTORE_RING_SIZE) {
+			errno = EIO;
+			return false;
+		}
+
+		if (prod == cons) {
+			if (nonblocking) {
+				errno = EAGAIN;
+				return false;
+			}
+			if (!ring_wait(h, &waited))
+				return false;
+			continue;
+		}
+		nonblocking = 0;
+
+		avail = XENSTORE_RING_SIZE - MASK_XENSTORE_IDX(cons);
+		if (prod - cons < avail)
+			avail = prod - cons;
+		if (avail > len)
+			avail = len;
+
+		memcpy(data, intf->rsp + MASK_XENSTORE_IDX(cons), avail);
+		xen_mb();
+		intf->rsp_cons = cons + avail;
+		xen_mb();
+
+		/* xenstored might be waiting for room if it found none. */
+		if (intf->rsp_prod - cons == XENSTORE_RING_SIZE)
+			ring_kick(h->ring->req_evt);
+
+		data += avail;
+		len -= avail;
+	}
+
+	return true;
+}
+
+/*
+ * Pass a ring to xenstored with the "ring" control command.  The reply comes
+ * via the ring if xenstored switched over to it, or via the socket if not,
+ * in which case the socket just continues to be used.
+ */
+static void ring_setup(struct xs_handle *h)
+{
+	struct xsd_sockmsg msg = {
+		.type = XS_CONTROL,
+		.len = sizeof(RING_CMD),
+	};
+	struct iovec iov[2] = {
+		{ .iov_base = &msg, .iov_len = sizeof(msg) },
+		{ .iov_base = RING_CMD, .iov_len = sizeof(RING_CMD) },
+	};
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+	} cmsg;
+	struct msghdr mh = {
+		.msg_iov = iov,
+		.msg_iovlen = ARRAY_SIZE(iov),
+		.msg_control = &cmsg,
+		.msg_controllen = sizeof(cmsg),
+	};
+	struct pollfd fds[2];
+	struct xs_ring *ring;
+	char buf[XENSTORE_PAYLOAD_MAX];
+	int fd[3], saved_errno = errno;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		goto out;
+	ring->req_evt = ring->rsp_evt = -1;
+
+	fd[0] = memfd_create("xenstore-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd[0] < 0)
+		goto out;
+	if (ftruncate(fd[0], sizeof(*ring->intf)) ||
+	    fcntl(fd[0], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL))
+		goto out_close;
+	ring->intf = mmap(NULL, sizeof(*ring->intf), PROT_READ | PROT_WRITE,
+			  MAP_SHARED, fd[0], 0);
+	if (ring->intf == MAP_FAILED) {
+		ring->intf = NULL;
+		goto out_close;
+	}
+
+	fd[1] = ring->req_evt = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	fd[2] = ring->rsp_evt = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd[1] < 0 || fd[2] < 0)
+		goto out_close;
+
+	cmsg.hdr.cmsg_level = SOL_SOCKET;
+	cmsg.hdr.cmsg_type = SCM_RIGHTS;
+	cmsg.hdr.cmsg_len = CMSG_LEN(sizeof(fd));
+	memcpy(CMSG_DATA(&cmsg.hdr), fd, sizeof(fd));
+
+	if (sendmsg(h->fd, &mh, MSG_NOSIGNAL) != sizeof(msg) + msg.len)
+		goto out_close;
+
+	fds[0].fd = ring->rsp_evt;
+	fds[0].events = POLLIN;
+	fds[1].fd = h->fd;
+	fds[1].events = POLLIN;
+	while (poll(fds, ARRAY_SIZE(fds), -1) < 0)
+		if (errno != EINTR)
+			goto out_close;
+
+	if (fds[1].revents) {
+		/* Most likely an error, read it and carry on with the socket. */
+		if (read_all(h->fd, &msg, sizeof(msg), 0) &&
+		    msg.len <= sizeof(buf))
+			read_all(h->fd, buf, msg.len, 0);
+		goto out_close;
+	}
+
+#ifdef USE_PTHREAD
+	pthread_mutex_init(&ring->mutex, NULL);
+	pthread_cond_init(&ring->cond, NULL);
+#endif
+	h->ring = ring;
+	ring = NULL;
+
+	if (!ring_read_all(h, &msg, sizeof(msg), 0) ||
+	    msg.len > sizeof(buf) || !ring_read_all(h, buf, msg.len, 0)) {
+		close(h->fd);
+		h->fd = -1;
+	}
+
+out_close:
+	close(fd[0]);
+out:
+	if (ring)
+		ring_free(ring);
+	errno = saved_errno;
+}
+#else
+static void ring_free(struct xs_ring *ring)
+{
+}
+
+static void ring_setup(struct xs_handle *h)
+{
+}
+
+static void ring_wake_writers(struct xs_handle *h)
+{
+}
+#endif
+
+static bool xs_send(struct xs_handle *h, const void *data, unsigned int len)
+{
+#ifdef __linux__
+	if (h->ring)
+		return ring_write_all(h, data, len);
+#endif
+	return xs_write_all(h->fd, data, len);
+}
+
+static bool xs_recv(struct xs_handle *h, void *data, unsigned int len,
+		    int nonblocking)
+{
+#ifdef __linux__
+	if (h->ring)
+		return ring_read_all(h, data, len, nonblocking);
+#endif
+	return read_all(h->fd, data, len, nonblocking);
+}
+
 static int get_error(const char *errorstring)
 {
 	unsigned int i;
@@ -507,18 +872,21 @@ static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
 		return 0;
 	}
 
-	ignorepipe.sa_handler = SIG_IGN;
-	sigemptyset(&ignorepipe.sa_mask);
-	ignorepipe.sa_flags = 0;
-	sigaction(SIGPIPE, &ignorepipe, &oldact);
+	/* Nothing is written to the socket with a ring. */
+	if (!h->ring) {
+		ignorepipe.sa_handler = SIG_IGN;
+		sigemptyset(&ignorepipe.sa_mask);
+		ignorepipe.sa_flags = 0;
+		sigaction(SIGPIPE, &ignorepipe, &oldact);
+	}
 
 	mutex_lock(&h->request_mutex);
 
-	if (!xs_write_all(h->fd, &msg, sizeof(msg)))
+	if (!xs_send(h, &msg, sizeof(msg)))
 		goto fail;
 
 	for (i = 0; i < num_vecs; i++)
-		if (!xs_write_all(h->fd, iovec[i].iov_base, iovec[i].iov_len))
+		if (!xs_send(h, iovec[i].iov_base, iovec[i].iov_len))
 			goto fail;
 
 	ret = read_reply(h, &msg.type, len);
@@ -527,7 +895,8 @@ static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
 
 	mutex_unlock(&h->request_mutex);
 
-	sigaction(SIGPIPE, &oldact, NULL);
+	if (!h->ring)
+		sigaction(SIGPIPE, &oldact, NULL);
 	if (msg.type == XS_ERROR) {
 		saved_errno = get_error(ret);
 		free(ret);
@@ -546,7 +915,8 @@ fail:
 	/* We're in a bad state, so close fd. */
 	saved_errno = errno;
 	mutex_unlock(&h->request_mutex);
-	sigaction(SIGPIPE, &oldact, NULL);
+	if (!h->ring)
+		sigaction(SIGPIPE, &oldact, NULL);
 close_fd:
 	close(h->fd);
 	h->fd = -1;
@@ -801,14 +1171,10 @@ bool xs_restrict(struct xs_handle *h, unsigned domid)
 	return false;
 }
 
-/* Watch a node for changes (poll on fd to detect, or call read_watch()).
- * When the node (or any child) changes, fd will become readable.
- * Token is returned when watch is read, to allow matching.
- * Returns false on failure.
- */
-bool xs_watch(struct xs_handle *h, const char *path, const char *token)
+/* Send XS_WATCH with the strings of iov, starting the reader thread first. */
+static bool xs_watch_iov(struct xs_handle *h, struct iovec *iov,
+			 unsigned int num_vecs)
 {
-	struct iovec iov[2];
 
 #ifdef USE_PTHREAD
 #define DEFAULT_THREAD_STACKSIZE (16 * 1024)
@@ -866,13 +1232,49 @@ bool xs_watch(struct xs_handle *h, const char *path, const char *token)
 	mutex_unlock(&h->request_mutex);
 #endif
 
+	return xs_bool(xs_talkv(h, XBT_NULL, XS_WATCH, iov, num_vecs, NULL));
+}
+
+/* Watch a node for changes (poll on fd to detect, or call read_watch()).
+ * When the node (or any child) changes, fd will become readable.
+ * Token is returned when watch is read, to allow matching.
+ * Returns false on failure.
+ */
+bool xs_watch(struct xs_handle *h, const char *path, const char *token)
+{
+	struct iovec iov[2];
+
 	iov[0].iov_base = (void *)path;
 	iov[0].iov_len = strlen(path) + 1;
 	iov[1].iov_base = (void *)token;
 	iov[1].iov_len = strlen(token) + 1;
 
-	return xs_bool(xs_talkv(h, XBT_NULL, XS_WATCH, iov,
-				ARRAY_SIZE(iov), NULL));
+	return xs_watch_iov(h, iov, ARRAY_SIZE(iov));
+}
+
+bool xs_watch_coalesce(struct xs_handle *h, const char *path,
+		       const char *token)
+{
+	struct iovec iov[4];
+
+	iov[0].iov_base = (void *)path;
+	iov[0].iov_len = strlen(path) + 1;
+	iov[1].iov_base = (void *)token;
+	iov[1].iov_len = strlen(token) + 1;
+	/* No depth limit. */
+	iov[2].iov_base = "";
+	iov[2].iov_len = 1;
+	iov[3].iov_base = "coalesce";
+	iov[3].iov_len = sizeof("coalesce");
+
+	if (xs_watch_iov(h, iov, ARRAY_SIZE(iov)))
+		return true;
+
+	/* Older daemons reject the additional parameters. */
+	if (errno != EINVAL)
+		return false;
+
+	return xs_watch_iov(h, iov, 2);
 }
 
 
@@ -1083,6 +1485,172 @@ bool xs_transaction_end(struct xs_handle *h, xs_transaction_t t,
 	return xs_bool(xs_single(h, t, XS_TRANSACTION_END, abortstr, NULL));
 }
 
+struct xs_batch {
+	unsigned int len;
+	char buf[XENSTORE_PAYLOAD_MAX];
+};
+
+struct xs_batch *xs_batch_start(void)
+{
+	return calloc(1, sizeof(struct xs_batch));
+}
+
+void xs_batch_free(struct xs_batch *b)
+{
+	free_no_errno(b);
+}
+
+/* Append an operation: type and payload length, followed by the payload. */
+static bool xs_batch_add(struct xs_batch *b, enum xsd_sockmsg_type type,
+			 const struct iovec *iovec, unsigned int num_vecs)
+{
+	char hdr[2 * (MAX_STRLEN(unsigned int) + 1)];
+	unsigned int i, len = 0, hdrlen;
+
+	for (i = 0; i < num_vecs; i++)
+		len += iovec[i].iov_len;
+
+	hdrlen = snprintf(hdr, sizeof(hdr), "%u", type) + 1;
+	hdrlen += snprintf(hdr + hdrlen, sizeof(hdr) - hdrlen, "%u", len) + 1;
+
+	if (hdrlen + len > sizeof(b->buf) - b->len) {
+		errno = E2BIG;
+		return false;
+	}
+
+	memcpy(b->buf + b->len, hdr, hdrlen);
+	b->len += hdrlen;
+	for (i = 0; i < num_vecs; i++) {
+		memcpy(b->buf + b->len, iovec[i].iov_base, iovec[i].iov_len);
+		b->len += iovec[i].iov_len;
+	}
+
+	return true;
+}
+
+bool xs_batch_write(struct xs_batch *b, const char *path,
+		    const void *data, unsigned int len)
+{
+	struct iovec iovec[2];
+
+	iovec[0].iov_base = (void *)path;
+	iovec[0].iov_len = strlen(path) + 1;
+	iovec[1].iov_base = (void *)data;
+	iovec[1].iov_len = len;
+
+	return xs_batch_add(b, XS_WRITE, iovec, ARRAY_SIZE(iovec));
+}
+
+bool xs_batch_mkdir(struct xs_batch *b, const char *path)
+{
+	struct iovec iovec;
+
+	iovec.iov_base = (void *)path;
+	iovec.iov_len = strlen(path) + 1;
+
+	return xs_batch_add(b, XS_MKDIR, &iovec, 1);
+}
+
+bool xs_batch_rm(struct xs_batch *b, const char *path)
+{
+	struct iovec iovec;
+
+	iovec.iov_base = (void *)path;
+	iovec.iov_len = strlen(path) + 1;
+
+	return xs_batch_add(b, XS_RM, &iovec, 1);
+}
+
+bool xs_batch_set_permissions(struct xs_batch *b, const char *path,
+			      struct xs_permissions *perms,
+			      unsigned int num_perms)
+{
+	char strings[num_perms * (MAX_STRLEN(unsigned int) + 1)];
+	struct iovec iovec[2];
+	unsigned int i;
+	char *p;
+
+	if (!num_perms) {
+		errno = EINVAL;
+		return false;
+	}
+
+	for (p = strings, i = 0; i < num_perms; i++) {
+		if (!xs_perm_to_string(&perms[i], p, strings + sizeof(strings) - p))
+			return false;
+		p += strlen(p) + 1;
+	}
+
+	iovec[0].iov_base = (void *)path;
+	iovec[0].iov_len = strlen(path) + 1;
+	iovec[1].iov_base = strings;
+	iovec[1].iov_len = p - strings;
+
+	return xs_batch_add(b, XS_SET_PERMS, iovec, ARRAY_SIZE(iovec));
+}
+
+/* Send the operations of a batch as single requests. */
+static bool xs_batch_send_ops(struct xs_handle *h, xs_transaction_t t,
+			      struct xs_batch *b)
+{
+	enum xsd_sockmsg_type type;
+	struct iovec iovec;
+	unsigned int off;
+	char *p;
+
+	for (off = 0; off < b->len; off += iovec.iov_len) {
+		p = b->buf + off;
+		type = strtoul(p, &p, 10);
+		iovec.iov_len = strtoul(p + 1, &p, 10);
+		iovec.iov_base = p + 1;
+		off = p + 1 - b->buf;
+
+		if (!xs_bool(xs_talkv(h, t, type, &iovec, 1, NULL)))
+			return false;
+	}
+
+	return true;
+}
+
+bool xs_batch_commit(struct xs_handle *h, xs_transaction_t t,
+		     struct xs_batch *b)
+{
+	struct iovec iovec;
+	int saved_errno;
+
+	iovec.iov_base = b->buf;
+	iovec.iov_len = b->len;
+
+	if (xs_bool(xs_talkv(h, t, XS_BATCH, &iovec, 1, NULL)))
+		return true;
+
+	/* If XS_BATCH isn't supported send the operations one by one. */
+	if (errno != ENOSYS)
+		return false;
+
+	if (t != XBT_NULL)
+		return xs_batch_send_ops(h, t, b);
+
+	/* Keep them atomic by using a transaction. */
+	for (;;) {
+		t = xs_transaction_start(h);
+		if (t == XBT_NULL)
+			return false;
+
+		if (!xs_batch_send_ops(h, t, b)) {
+			saved_errno = errno;
+			xs_transaction_end(h, t, true);
+			errno = saved_errno;
+			return false;
+		}
+
+		if (xs_transaction_end(h, t, false))
+			return true;
+		if (errno != EAGAIN)
+			return false;
+	}
+}
+
 /* Introduce a new domain.
  * This tells the store daemon about a shared memory page and event channel
  * associated with a domain: the domain uses these to communicate.
@@ -1262,7 +1830,7 @@ static int read_message(struct xs_handle *h, int nonblocking)
 	if (msg == NULL)
 		goto error;
 	cleanup_push_heap(msg);
-	if (!read_all(h->fd, &msg->hdr, sizeof(msg->hdr), nonblocking)) { /* Cancellation point */
+	if (!xs_recv(h, &msg->hdr, sizeof(msg->hdr), nonblocking)) { /* Cancellation point */
 		saved_errno = errno;
 		goto error_freemsg;
 	}
@@ -1278,7 +1846,7 @@ static int read_message(struct xs_handle *h, int nonblocking)
 	if (body == NULL)
 		goto error_freemsg;
 	cleanup_push_heap(body);
-	if (!read_all(h->fd, body, msg->hdr.len, 0)) { /* Cancellation point */
+	if (!xs_recv(h, body, msg->hdr.len, 0)) { /* Cancellation point */
 		saved_errno = errno;
 		goto error_freebody;
 	}
@@ -1355,6 +1923,9 @@ static void *read_thread(void *arg)
 	pthread_cond_broadcast(&h->watch_condvar);
 	pthread_mutex_unlock(&h->watch_mutex);
 
+	if (h->ring)
+		ring_wake_writers(h);
+
 	return NULL;
 }
 #endif
@@ -0,0 +1,104 @@
+/*
+ * xen-p2m-orders.c
+ *
+ * Report how much of an HVM guest's memory is mapped by 4k, 2M and 1G p2m
+ * entries, e.g. to check that a migrated guest kept its superpages.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xenctrl.h>
+#include <xen-tools/libs.h>
+
+/* Number of gfns queried at a time. */
+#define CHUNK (1UL << 18)
+
+int main(int argc, char **argv)
+{
+    xc_interface *xch;
+    xen_pfn_t max_gpfn, gfn;
+    unsigned long nr, i;
+    uint64_t pages[256] = { 0 }, entries[256] = { 0 }, total = 0;
+    uint8_t *orders;
+    unsigned int o;
+    char *end;
+    uint32_t domid;
+
+    if ( argc != 2 )
+    {
+        fprintf(stderr, "Usage: %s <domid>\n", argv[0]);
+        return 1;
+    }
+
+    domid = strtoul(argv[1], &end, 0);
+    if ( *end || !*argv[1] )
+        errx(1, "Invalid domid '%s'", argv[1]);
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+        err(1, "xc_interface_open");
+
+    if ( xc_domain_maximum_gpfn(xch, domid, &max_gpfn) )
+        err(1, "xc_domain_maximum_gpfn");
+
+    orders = malloc(CHUNK);
+    if ( !orders )
+        err(1, "malloc");
+
+    for ( gfn = 0; gfn <= max_gpfn; gfn += nr )
+    {
+        nr = min_t(unsigned long, CHUNK, max_gpfn + 1 - gfn);
+
+        if ( xc_domain_get_p2m_orders(xch, domid, gfn, nr, orders) )
+            err(1, "xc_domain_get_p2m_orders");
+
+        for ( i = 0; i < nr; ++i )
+        {
+            pages[orders[i]]++;
+
+            if ( orders[i] == XEN_DOMCTL_P2M_ORDER_NONE )
+                continue;
+
+            /* Count each entry at its first gfn in this chunk. */
+            if ( !i || orders[i] != orders[i - 1] ||
+                 !((gfn + i) & ((1UL << orders[i]) - 1)) )
+                entries[orders[i]]++;
+        }
+    }
+
+    printf("Domain %u, max gpfn %#"PRIx64"\n", domid, (uint64_t)max_gpfn);
+    printf("%-6s %12s %12s\n", "order", "entries", "pages");
+
+    for ( o = 0; o < ARRAY_SIZE(pages); ++o )
+    {
+        if ( o == XEN_DOMCTL_P2M_ORDER_NONE || !pages[o] )
+            continue;
+
+        printf("%-6u %12"PRIu64" %12"PRIu64"\n", o, entries[o], pages[o]);
+        total += pages[o];
+    }
+
+    printf("%-6s %12s %12"PRIu64"\n", "total", "", total);
+    printf("%-6s %12s %12"PRIu64"\n", "none", "",
+           pages[XEN_DOMCTL_P2M_ORDER_NONE]);
+
+    free(orders);
+    xc_interface_close(xch);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -20,7 +20,7 @@ type operation = Debug | Directory | Read | Getperms |
                  Getdomainpath | Write | Mkdir | Rm |
                  Setperms | Watchevent | Error | Isintroduced |
                  Resume | Set_target | Reset_watches |
-                 Invalid
+                 Batch | Invalid
 
 let operation_c_mapping =
   [| Debug; Directory; Read; Getperms;
@@ -28,7 +28,8 @@ let operation_c_mapping =
      Transaction_end; Introduce; Release;
      Getdomainpath; Write; Mkdir; Rm;
      Setperms; Watchevent; Error; Isintroduced;
-     Resume; Set_target; Invalid; Reset_watches |]
+     Resume; Set_target; Invalid; Reset_watches;
+     Invalid (* Directory_part *); Batch |]
 let size = Array.length operation_c_mapping
 
 let array_search el a =
@@ -69,4 +70,5 @@ let to_string ty =
   | Resume		-> "RESUME"
   | Set_target		-> "SET_TARGET"
   | Reset_watches         -> "RESET_WATCHES"
+  | Batch			-> "BATCH"
   | Invalid		-> "INVALID"
@@ -23,6 +23,7 @@ sig
     | Resume
     | Set_target
     | Reset_watches
+    | Batch
     | Invalid
   val operation_c_mapping : operation array
   val size : int
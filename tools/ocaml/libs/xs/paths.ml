@@ -0,0 +1 @@
+let xen_run_stored = "/var/run/xenstored"
@@ -245,6 +245,7 @@ let string_of_access_type = function
     | Xenbus.Xb.Op.Mkdir             -> "mkdir    "
     | Xenbus.Xb.Op.Rm                -> "rm       "
     | Xenbus.Xb.Op.Setperms          -> "setperms "
+    | Xenbus.Xb.Op.Batch             -> "batch    "
     | Xenbus.Xb.Op.Reset_watches     -> "reset watches"
     | Xenbus.Xb.Op.Set_target        -> "settarget"
 
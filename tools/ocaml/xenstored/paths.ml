@@ -0,0 +1,4 @@
+let xen_log_dir = "/var/log/xen"
+let xen_config_dir = "/etc/xen"
+let xen_run_dir = "/var/run/xen"
+let xen_run_stored = "/var/run/xenstored"
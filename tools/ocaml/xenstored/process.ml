@@ -315,6 +315,49 @@ let do_setperms con t _domains _cons data =
   in
   Transaction.setperms t (Connection.get_perm con) path perms
 
+(* A batch is a sequence of <type>\000<len>\000<payload> operations, each
+   with the payload of the respective single request. *)
+let batch_ops data =
+  let len = String.length data in
+  let field pos =
+    let nul = try String.index_from data pos '\000' with Not_found -> raise Invalid_Cmd_Args in
+    let v = try int_of_string (String.sub data pos (nul - pos)) with Failure _ -> raise Invalid_Cmd_Args in
+    v, nul + 1
+  in
+  let rec parse pos ops =
+    if pos >= len then List.rev ops
+    else begin
+      let ty, pos = field pos in
+      let n, pos = field pos in
+      if n < 0 || n > len - pos then raise Invalid_Cmd_Args;
+      let fct =
+        match Xenbus.Xb.Op.of_cval ty with
+        | Xenbus.Xb.Op.Write    -> do_write
+        | Xenbus.Xb.Op.Mkdir    -> do_mkdir
+        | Xenbus.Xb.Op.Rm       -> do_rm
+        | Xenbus.Xb.Op.Setperms -> do_setperms
+        | _                     -> raise Invalid_Cmd_Args
+      in
+      parse (pos + n) ((fct, String.sub data pos n) :: ops)
+    end
+  in
+  parse 0 []
+
+(* All operations of a batch take effect, or none does. *)
+let do_batch con t domains cons data =
+  let ops = batch_ops data in
+  let store = Transaction.get_store t in
+  let root = Store.get_root store in
+  let quota = Quota.copy (Store.get_quota store) in
+  let paths = Transaction.get_paths t in
+  try
+    List.iter (fun (fct, data) -> fct con t domains cons data) ops
+  with e ->
+    Store.set_root store root;
+    Store.set_quota store quota;
+    t.Transaction.paths <- paths;
+    raise e
+
 let do_error _con _t _domains _cons _data =
   raise Define.Unknown_operation
 
@@ -397,6 +440,7 @@ let function_of_type_simple_op ty =
   | Xenbus.Xb.Op.Mkdir             -> reply_ack do_mkdir
   | Xenbus.Xb.Op.Rm                -> reply_ack do_rm
   | Xenbus.Xb.Op.Setperms          -> reply_ack do_setperms
+  | Xenbus.Xb.Op.Batch             -> reply_ack do_batch
   | _                              -> reply_ack do_error
 
 let input_handle_error ~cons ~doms ~fct ~con ~t ~req =
@@ -636,7 +680,8 @@ let retain_op_in_history ty =
   | Xenbus.Xb.Op.Write
   | Xenbus.Xb.Op.Mkdir
   | Xenbus.Xb.Op.Rm
-  | Xenbus.Xb.Op.Setperms          -> true
+  | Xenbus.Xb.Op.Setperms
+  | Xenbus.Xb.Op.Batch             -> true
   | Xenbus.Xb.Op.Debug
   | Xenbus.Xb.Op.Directory
   | Xenbus.Xb.Op.Read
@@ -59,6 +59,13 @@ REC_TYPE_checkpoint_dirty_pfn_list  = 0x0000000f
 REC_TYPE_static_data_end            = 0x00000010
 REC_TYPE_x86_cpuid_policy           = 0x00000011
 REC_TYPE_x86_msr_policy             = 0x00000012
+REC_TYPE_page_streams               = 0x00000013
+REC_TYPE_page_streams_sync          = 0x00000014
+REC_TYPE_compressed_page_data       = 0x00000015
+REC_TYPE_postcopy_pfns              = 0x00000016
+REC_TYPE_postcopy_request           = 0x00000017
+
+REC_TYPE_superpages                 = 0x80000000
 
 rec_type_to_str = {
     REC_TYPE_end                        : "End",
@@ -80,6 +87,12 @@ rec_type_to_str = {
     REC_TYPE_static_data_end            : "Static data end",
     REC_TYPE_x86_cpuid_policy           : "x86 CPUID policy",
     REC_TYPE_x86_msr_policy             : "x86 MSR policy",
+    REC_TYPE_page_streams               : "Page streams",
+    REC_TYPE_page_streams_sync          : "Page streams sync",
+    REC_TYPE_compressed_page_data       : "Compressed page data",
+    REC_TYPE_postcopy_pfns              : "Post-copy pfns",
+    REC_TYPE_postcopy_request           : "Post-copy request",
+    REC_TYPE_superpages                 : "Superpages",
 }
 
 # page_data
@@ -123,6 +136,23 @@ X86_CPUID_POLICY_FORMAT   = "IIIIII"
 # x86_msr_policy => xen_msr_entry_t[]
 X86_MSR_POLICY_FORMAT     = "QII"
 
+# page_streams
+PAGE_STREAMS_FORMAT       = "II"
+
+# page_streams_sync
+PAGE_STREAMS_SYNC_FORMAT  = "II"
+
+# compressed_page_data => page_data, then per-page descriptors
+COMPRESSED_PAGE_FORMAT    = "HHI"
+
+PAGE_ENCODING_RAW         = 0x0000
+PAGE_ENCODING_ZERO        = 0x0001
+PAGE_ENCODING_LZ4         = 0x0002
+PAGE_ENCODING_XBZRLE      = 0x0003
+
+# superpages
+SUPERPAGES_FORMAT         = "II"
+
 class VerifyLibxc(VerifyBase):
     """ Verify a Libxc v2 (or later) stream """
 
@@ -252,24 +282,25 @@ class VerifyLibxc(VerifyBase):
             raise RecordError("End record with non-zero length")
 
 
-    def verify_record_page_data(self, content):
-        """ Page Data record """
+    def verify_page_data_pfns(self, content, name):
+        """ Common pfn array of (COMPRESSED_)PAGE_DATA records.  Returns the
+        header and pfn array sizes, and the number of pages with data. """
         minsz = calcsize(PAGE_DATA_FORMAT)
 
         if len(content) <= minsz:
             raise RecordError(
-                "PAGE_DATA record must be at least %d bytes long" % (minsz, ))
+                "%s record must be at least %d bytes long" % (name, minsz))
 
         count, res1 = unpack(PAGE_DATA_FORMAT, content[:minsz])
 
         if res1 != 0:
             raise StreamError(
-                "Reserved bits set in PAGE_DATA record 0x%04x" % (res1, ))
+                "Reserved bits set in %s record 0x%04x" % (name, res1))
 
         pfnsz = count * 8
         if (len(content) - minsz) < pfnsz:
             raise RecordError(
-                "PAGE_DATA record must contain a pfn record for each count")
+                "%s record must contain a pfn record for each count" % (name, ))
 
         pfns = list(unpack("=%dQ" % (count, ), content[minsz:minsz + pfnsz]))
 
@@ -289,12 +320,106 @@ class VerifyLibxc(VerifyBase):
                     <= PAGE_DATA_TYPE_L4TAB:
                 nr_pages += 1
 
+        return minsz, pfnsz, nr_pages
+
+
+    def verify_record_page_data(self, content):
+        """ Page Data record """
+        minsz, pfnsz, nr_pages = self.verify_page_data_pfns(content,
+                                                            "PAGE_DATA")
+
         pagesz = nr_pages * 4096
         if len(content) != minsz + pfnsz + pagesz:
             raise RecordError("Expected %u + %u + %u, got %u" %
                               (minsz, pfnsz, pagesz, len(content)))
 
 
+    def verify_record_compressed_page_data(self, content):
+        """ Compressed Page Data record """
+        minsz, pfnsz, nr_pages = self.verify_page_data_pfns(
+            content, "COMPRESSED_PAGE_DATA")
+
+        descsz = calcsize(COMPRESSED_PAGE_FORMAT)
+        off = minsz + pfnsz
+        if len(content) < off + nr_pages * descsz:
+            raise RecordError("COMPRESSED_PAGE_DATA record must contain a "
+                              "descriptor for each page with data")
+
+        datasz = 0
+        for idx in range(nr_pages):
+            enc, res1, length = unpack(COMPRESSED_PAGE_FORMAT,
+                                       content[off:off + descsz])
+            off += descsz
+
+            if res1 != 0:
+                raise StreamError("Reserved bits set in descriptor[%d] 0x%04x"
+                                  % (idx, res1))
+
+            if enc == PAGE_ENCODING_RAW:
+                valid = length == 4096
+            elif enc == PAGE_ENCODING_ZERO:
+                valid = length == 0
+            elif enc == PAGE_ENCODING_LZ4:
+                valid = 0 < length < 4096
+            elif enc == PAGE_ENCODING_XBZRLE:
+                valid = length < 4096
+            else:
+                raise RecordError("Unknown encoding %u in descriptor[%d]" %
+                                  (enc, idx))
+
+            if not valid:
+                raise RecordError("Invalid length %u for encoding %u in "
+                                  "descriptor[%d]" % (length, enc, idx))
+
+            datasz += length
+
+        if len(content) != off + datasz:
+            raise RecordError("Expected %u + %u, got %u" %
+                              (off, datasz, len(content)))
+
+
+    def verify_record_postcopy_pfns(self, content):
+        """ post-copy pfns record """
+
+        if len(content) % 8 != 0:
+            raise RecordError("Length expected to be a multiple of 8, not %d"
+                              % (len(content), ))
+
+
+    def verify_record_postcopy_request(self, content):
+        """ post-copy request record """
+        raise RecordError("Found post-copy request record in stream")
+
+
+    def verify_record_superpages(self, content):
+        """ superpages record """
+
+        minsz = calcsize(SUPERPAGES_FORMAT)
+
+        if len(content) < minsz:
+            raise RecordError("Length must be at least %d bytes, got %d" %
+                              (minsz, len(content)))
+
+        order, res1 = unpack(SUPERPAGES_FORMAT, content[:minsz])
+
+        if order not in (9, 18):
+            raise RecordError("Unexpected superpage order %u" % (order, ))
+
+        if res1 != 0:
+            raise StreamError("Reserved bits set in SUPERPAGES record 0x%04x"
+                              % (res1, ))
+
+        if (len(content) - minsz) % 8 != 0:
+            raise RecordError("Length expected to be a multiple of 8, not %d"
+                              % (len(content) - minsz, ))
+
+        for pfn in unpack("=%dQ" % ((len(content) - minsz) // 8),
+                          content[minsz:]):
+            if pfn & ((1 << order) - 1):
+                raise RecordError("Superpage pfn 0x%x not aligned to order %u"
+                                  % (pfn, order))
+
+
     def verify_record_x86_pv_info(self, content):
         """ x86 PV Info record """
 
@@ -477,6 +602,44 @@ class VerifyLibxc(VerifyBase):
                               (contentsz, sz))
 
 
+    def verify_record_page_streams(self, content):
+        """ page streams record """
+
+        if self.version < 3:
+            raise RecordError("Page streams record found in v2 stream")
+
+        sz = calcsize(PAGE_STREAMS_FORMAT)
+
+        if len(content) != sz:
+            raise RecordError("Length expected %u, actual %u" %
+                              (sz, len(content)))
+
+        count, res1 = unpack(PAGE_STREAMS_FORMAT, content)
+
+        if res1 != 0:
+            raise StreamError(
+                "Reserved bits set in PAGE_STREAMS record 0x%04x" % (res1, ))
+
+        self.info("  Page streams: %u" % (count, ))
+
+
+    def verify_record_page_streams_sync(self, content):
+        """ page streams sync record """
+
+        sz = calcsize(PAGE_STREAMS_SYNC_FORMAT)
+
+        if len(content) != sz:
+            raise RecordError("Length expected %u, actual %u" %
+                              (sz, len(content)))
+
+        _, res1 = unpack(PAGE_STREAMS_SYNC_FORMAT, content)
+
+        if res1 != 0:
+            raise StreamError(
+                "Reserved bits set in PAGE_STREAMS_SYNC record 0x%04x" %
+                (res1, ))
+
+
 record_verifiers = {
     REC_TYPE_end:
         VerifyLibxc.verify_record_end,
@@ -526,4 +689,20 @@ record_verifiers = {
         VerifyLibxc.verify_record_x86_cpuid_policy,
     REC_TYPE_x86_msr_policy:
         VerifyLibxc.verify_record_x86_msr_policy,
+
+    REC_TYPE_page_streams:
+        VerifyLibxc.verify_record_page_streams,
+    REC_TYPE_page_streams_sync:
+        VerifyLibxc.verify_record_page_streams_sync,
+
+    REC_TYPE_compressed_page_data:
+        VerifyLibxc.verify_record_compressed_page_data,
+
+    REC_TYPE_postcopy_pfns:
+        VerifyLibxc.verify_record_postcopy_pfns,
+    REC_TYPE_postcopy_request:
+        VerifyLibxc.verify_record_postcopy_request,
+
+    REC_TYPE_superpages:
+        VerifyLibxc.verify_record_superpages,
     }
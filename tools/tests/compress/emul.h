@@ -0,0 +1,87 @@
+/*
+ * Environment for building the page encodings of the migration stream as
+ * part of a user space test harness.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEST_COMPRESS_
+#define _TEST_COMPRESS_
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(*(a)))
+
+#define PAGE_SIZE 4096
+
+/* From xg_sr_stream_format.h */
+#define PAGE_ENCODING_RAW    0x0000U
+#define PAGE_ENCODING_ZERO   0x0001U
+#define PAGE_ENCODING_LZ4    0x0002U
+#define PAGE_ENCODING_XBZRLE 0x0003U
+
+typedef struct xc_interface_core xc_interface;
+
+struct xc_sr_context {
+    xc_interface *xch;
+};
+
+extern bool verbose;
+
+#define ERROR(fmt, args...) do {                        \
+    (void)xch;                                          \
+    if ( verbose )                                      \
+        fprintf(stderr, "ERROR: " fmt "\n", ## args);   \
+} while ( 0 )
+
+uint32_t encode_page(const void *page, void *buf, uint16_t *encoding);
+int xbzrle_encode_page(const void *old_page, const void *new_page,
+                       void *buf, uint32_t buf_size);
+int decode_page(struct xc_sr_context *ctx, uint16_t encoding,
+                const void *data, uint32_t length, void *page);
+
+/* For the LZ4 decompressor, as in xg_dom_decompress_lz4.c. */
+#define CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define likely(a) a
+#define unlikely(a) a
+
+static inline uint_fast16_t le16_to_cpup(const unsigned char *buf)
+{
+    return buf[0] | (buf[1] << 8);
+}
+
+#include "../../../xen/include/xen/lz4.h"
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
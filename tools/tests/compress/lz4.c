@@ -0,0 +1,8 @@
+/*
+ * The LZ4 decompressor, built the same way as for libxenguest.
+ */
+
+#include "emul.h"
+
+#include "../../../xen/common/decompress.h"
+#include "../../../xen/common/lz4/decompress.c"
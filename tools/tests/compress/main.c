@@ -0,0 +1,491 @@
+/*
+ * Unit tests for the page encodings of the migration stream: round trips
+ * of pages of all kinds, and malformed data the decoder must reject.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "emul.h"
+
+bool verbose;
+
+static struct xc_sr_context ctx;
+
+/*
+ * Buffers ending right before an inaccessible page, so that the code under
+ * test faults on any access past their end.
+ */
+static void *guarded(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t len = (size + page - 1) & ~(page - 1);
+    uint8_t *p = mmap(NULL, len + page, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    assert(p != MAP_FAILED);
+    assert(!mprotect(p + len, page, PROT_NONE));
+
+    return p + len - size;
+}
+
+static uint8_t *page, *buf, *out, *data;
+
+static void random_bytes(uint8_t *p, size_t len)
+{
+    while ( len-- )
+        *p++ = rand();
+}
+
+/* Encode and decode a page, and check that it comes back unchanged. */
+static uint16_t round_trip(const uint8_t *p)
+{
+    uint16_t encoding;
+    uint32_t len = encode_page(p, buf, &encoding);
+
+    switch ( encoding )
+    {
+    case PAGE_ENCODING_ZERO:
+        assert(len == 0);
+        break;
+    case PAGE_ENCODING_LZ4:
+        assert(len && len <= PAGE_SIZE - PAGE_SIZE / 8);
+        break;
+    case PAGE_ENCODING_RAW:
+        assert(len == PAGE_SIZE);
+        break;
+    default:
+        assert(0);
+    }
+
+    /* The decoder must see exactly the encoded octets. */
+    memcpy(data + PAGE_SIZE - len, buf, len);
+    memset(out, 0xa5, PAGE_SIZE);
+    assert(!decode_page(&ctx, encoding, data + PAGE_SIZE - len, len, out));
+    assert(!memcmp(p, out, PAGE_SIZE));
+
+    return encoding;
+}
+
+/* Pages made of repeats at various distances, literals and zeros. */
+static void fill_mixed(uint8_t *p)
+{
+    unsigned int i = 0, n, dist;
+
+    while ( i < PAGE_SIZE )
+    {
+        n = 1 + rand() % (rand() % 4 ? 64 : PAGE_SIZE);
+        n = n < PAGE_SIZE - i ? n : PAGE_SIZE - i;
+
+        switch ( rand() % 4 )
+        {
+        case 0:
+            random_bytes(p + i, n);
+            break;
+        case 1:
+            memset(p + i, rand() % 4 ? 0 : rand(), n);
+            break;
+        default:
+            if ( !i )
+                continue;
+            /* Possibly overlapping copy, as for an LZ4 match. */
+            dist = 1 + rand() % i;
+            for ( ; n; n--, i++ )
+                p[i] = p[i - dist];
+            continue;
+        }
+        i += n;
+    }
+}
+
+static void test_zero(void)
+{
+    memset(page, 0, PAGE_SIZE);
+    assert(round_trip(page) == PAGE_ENCODING_ZERO);
+
+    /* Any single non-zero octet needs the page sent. */
+    page[PAGE_SIZE - 1] = 1;
+    assert(round_trip(page) == PAGE_ENCODING_LZ4);
+    page[PAGE_SIZE - 1] = 0;
+    page[0] = 0x80;
+    assert(round_trip(page) == PAGE_ENCODING_LZ4);
+}
+
+static void test_random(void)
+{
+    unsigned int i;
+
+    for ( i = 0; i < 100; i++ )
+    {
+        random_bytes(page, PAGE_SIZE);
+        assert(round_trip(page) == PAGE_ENCODING_RAW);
+    }
+}
+
+static void test_repetitive(void)
+{
+    static const unsigned int periods[] = {
+        1, 2, 3, 4, 5, 7, 8, 15, 16, 17, 64, 255, 256, 1000, 2048,
+    };
+    static const char text[] =
+        "The quick brown fox jumps over the lazy dog.\n";
+    unsigned int i, j;
+
+    for ( i = 0; i < ARRAY_SIZE(periods); i++ )
+    {
+        random_bytes(page, periods[i]);
+        page[0] |= 1;
+        for ( j = periods[i]; j < PAGE_SIZE; j++ )
+            page[j] = page[j - periods[i]];
+        assert(round_trip(page) == PAGE_ENCODING_LZ4);
+    }
+
+    for ( i = 0; i < PAGE_SIZE; i++ )
+        page[i] = text[i % (sizeof(text) - 1)];
+    assert(round_trip(page) == PAGE_ENCODING_LZ4);
+
+    /* Matches and literals of all lengths around the LZ4 field limits. */
+    for ( i = 0; i < 600; i++ )
+    {
+        memset(page, 0, PAGE_SIZE);
+        random_bytes(page, i);
+        random_bytes(page + PAGE_SIZE - 1 - i / 2, i / 2 + 1);
+        assert(round_trip(page) == PAGE_ENCODING_LZ4);
+    }
+
+    for ( i = 0; i < 20000; i++ )
+    {
+        fill_mixed(page);
+        round_trip(page);
+    }
+}
+
+static uint32_t encode_lz4(void)
+{
+    uint16_t encoding;
+    uint32_t len;
+
+    do {
+        fill_mixed(page);
+        len = encode_page(page, buf, &encoding);
+    } while ( encoding != PAGE_ENCODING_LZ4 );
+
+    return len;
+}
+
+/* Every prefix of LZ4 data is short of a page. */
+static void test_truncated(void)
+{
+    unsigned int i;
+    uint32_t len, n;
+
+    for ( i = 0; i < 200; i++ )
+    {
+        len = encode_lz4();
+        for ( n = 1; n < len; n++ )
+        {
+            memcpy(data + PAGE_SIZE - n, buf, n);
+            assert(decode_page(&ctx, PAGE_ENCODING_LZ4, data + PAGE_SIZE - n,
+                               n, out));
+        }
+    }
+}
+
+/*
+ * Corrupt LZ4 data may decode to anything, or fail, but must not be read or
+ * decoded beyond its bounds.
+ */
+static void test_corrupt(void)
+{
+    unsigned int i, j;
+    uint32_t len;
+    uint8_t *p;
+
+    for ( i = 0; i < 20000; i++ )
+    {
+        len = encode_lz4();
+        p = data + PAGE_SIZE - len;
+        memcpy(p, buf, len);
+
+        for ( j = 1 + rand() % 4; j; j-- )
+        {
+            if ( rand() % 2 )
+                p[rand() % len] ^= 1U << (rand() % 8);
+            else
+                p[rand() % len] = rand() % 2 ? 0xff : rand();
+        }
+
+        decode_page(&ctx, PAGE_ENCODING_LZ4, p, len, out);
+    }
+
+    for ( i = 0; i < 20000; i++ )
+    {
+        len = 1 + rand() % (PAGE_SIZE - 1);
+        p = data + PAGE_SIZE - len;
+        random_bytes(p, len);
+        decode_page(&ctx, PAGE_ENCODING_LZ4, p, len, out);
+    }
+
+    /* A single literal run claiming more than there is. */
+    p = data + PAGE_SIZE - 3;
+    p[0] = 0xf0;
+    p[1] = 0xff;
+    p[2] = 0xff;
+    assert(decode_page(&ctx, PAGE_ENCODING_LZ4, p, 3, out));
+
+    /* A match reaching back before the start of the page. */
+    p = data + PAGE_SIZE - 4;
+    p[0] = 0x1f;
+    p[1] = 'x';
+    p[2] = 2;
+    p[3] = 0;
+    assert(decode_page(&ctx, PAGE_ENCODING_LZ4, p, 4, out));
+}
+
+/* Change random runs of a page, as a guest writing to it would. */
+static void dirty(uint8_t *p, unsigned int runs)
+{
+    unsigned int i, n;
+
+    while ( runs-- )
+    {
+        i = rand() % PAGE_SIZE;
+        n = 1 + rand() % (rand() % 4 ? 8 : 256);
+        n = n < PAGE_SIZE - i ? n : PAGE_SIZE - i;
+        for ( ; n; n--, i++ )
+            p[i] ^= 1 + rand() % 255;
+    }
+}
+
+/* Delta encode and decode a page against its old contents. */
+static int xbzrle_round_trip(const uint8_t *old, const uint8_t *new,
+                             uint32_t buf_size)
+{
+    int len = xbzrle_encode_page(old, new, buf + PAGE_SIZE - buf_size,
+                                 buf_size);
+
+    if ( len < 0 )
+        return len;
+    assert(len <= buf_size);
+
+    memcpy(data + PAGE_SIZE - len, buf + PAGE_SIZE - buf_size, len);
+    memcpy(out, old, PAGE_SIZE);
+    assert(!decode_page(&ctx, PAGE_ENCODING_XBZRLE, data + PAGE_SIZE - len,
+                        len, out));
+    assert(!memcmp(new, out, PAGE_SIZE));
+
+    return len;
+}
+
+static void test_xbzrle(void)
+{
+    static uint8_t old[PAGE_SIZE], big[2 * PAGE_SIZE];
+    unsigned int i, j;
+    int len;
+
+    random_bytes(old, PAGE_SIZE);
+
+    /* Nothing changed. */
+    memcpy(page, old, PAGE_SIZE);
+    assert(xbzrle_round_trip(old, page, PAGE_SIZE - 1) == 0);
+
+    /* Single octets and words at either end, and in the middle. */
+    for ( i = 0; i < PAGE_SIZE; i += i < 16 || i > PAGE_SIZE - 16 ? 1 : 997 )
+    {
+        memcpy(page, old, PAGE_SIZE);
+        page[i] ^= 0x5a;
+        assert(xbzrle_round_trip(old, page, PAGE_SIZE - 1) > 0);
+        for ( j = i; j < PAGE_SIZE && j < i + 8; j++ )
+            page[j] ^= 0xff;
+        assert(xbzrle_round_trip(old, page, PAGE_SIZE - 1) > 0);
+    }
+
+    /*
+     * Single unchanged octets are sent as part of the runs, which for every
+     * other octet changed makes a delta larger than the page.
+     */
+    memcpy(page, old, PAGE_SIZE);
+    for ( i = 0; i < PAGE_SIZE; i += 2 )
+        page[i] ^= 1;
+    assert(xbzrle_round_trip(old, page, PAGE_SIZE - 1) < 0);
+    for ( i = 0; i < PAGE_SIZE; i += 2 )
+        page[i] ^= i % 4 ? 1 : 0;
+    assert(xbzrle_round_trip(old, page, PAGE_SIZE - 1) > 0);
+
+    /* Long skips. */
+    memcpy(page, old, PAGE_SIZE);
+    page[200] ^= 1;
+    page[PAGE_SIZE - 1] ^= 1;
+    assert(xbzrle_round_trip(old, page, PAGE_SIZE - 1) > 0);
+
+    for ( i = 0; i < 20000; i++ )
+    {
+        memcpy(page, old, PAGE_SIZE);
+        dirty(page, rand() % 64);
+        len = xbzrle_round_trip(old, page, PAGE_SIZE - 1);
+        if ( len < 0 )
+            /* Only a delta larger than the buffer may fail. */
+            assert(xbzrle_encode_page(old, page, big, sizeof(big)) >
+                   PAGE_SIZE - 1 - 4);
+        else if ( len > 16 )
+            /* A smaller buffer must fail, without writing beyond it. */
+            assert(xbzrle_round_trip(old, page, len - 1 - rand() % 16) < 0);
+        memcpy(old, page, PAGE_SIZE);
+    }
+
+    /* A page changed throughout does not fit. */
+    random_bytes(page, PAGE_SIZE);
+    for ( i = 0; i < PAGE_SIZE; i++ )
+        page[i] = old[i] + 1;
+    assert(xbzrle_round_trip(old, page, PAGE_SIZE - 1) < 0);
+}
+
+static int decode_xbzrle(const uint8_t *delta, uint32_t len)
+{
+    uint8_t *p = data + PAGE_SIZE - len;
+
+    memcpy(p, delta, len);
+    memset(out, 0xa5, PAGE_SIZE);
+
+    return decode_page(&ctx, PAGE_ENCODING_XBZRLE, p, len, out);
+}
+
+/* Corrupt deltas must be rejected without writing outside the page. */
+static void test_xbzrle_corrupt(void)
+{
+    static const struct {
+        uint8_t delta[8];
+        uint32_t len;
+        bool ok;
+        /* The octet written, if any. */
+        unsigned int at;
+    } tests[] = {
+        /* Valid runs at the start and at the end of the page. */
+        { { 0x00, 0x01, 0x11 }, 3, true, 0 },
+        { { 0xff, 0x1f, 0x01, 0x11 }, 4, true, PAGE_SIZE - 1 },
+        /* Nothing but a skip to the end of the page. */
+        { { 0x80, 0x20, 0x00 }, 3, true, PAGE_SIZE },
+        /* Skip or count past the end of the page. */
+        { { 0x81, 0x20, 0x00 }, 3 },
+        { { 0xff, 0x1f, 0x02, 0x11, 0x22 }, 5 },
+        { { 0x00, 0x81, 0x20 }, 3 },
+        /* Skip wrapping the page offset around. */
+        { { 0x00, 0x01, 0x11, 0xff, 0xff, 0xff, 0xff, 0x0f }, 8 },
+        { { 0xff, 0xff, 0xff, 0xff, 0x0f, 0x01, 0x11 }, 7 },
+        /* Count beyond the remaining data. */
+        { { 0x00, 0x02, 0x11 }, 3 },
+        { { 0x00, 0x07, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 }, 8 },
+        /* Unterminated or overlong ULEB128 values. */
+        { { 0x80 }, 1 },
+        { { 0x00 }, 1 },
+        { { 0x00, 0x80 }, 2 },
+        { { 0x80, 0x80, 0x80, 0x80, 0x80, 0x00, 0x00 }, 7 },
+    };
+    unsigned int i, j, n;
+    int len;
+
+    for ( i = 0; i < ARRAY_SIZE(tests); i++ )
+    {
+        assert(!decode_xbzrle(tests[i].delta, tests[i].len) == tests[i].ok);
+        if ( !tests[i].ok )
+            continue;
+        for ( j = 0; j < PAGE_SIZE && out[j] == 0xa5; j++ )
+            ;
+        assert(j == tests[i].at);
+    }
+
+    /* Lengths not allowed for a delta. */
+    assert(decode_page(&ctx, PAGE_ENCODING_XBZRLE, data, PAGE_SIZE, out));
+
+    /* Truncated deltas, and random damage to valid ones. */
+    for ( i = 0; i < 2000; i++ )
+    {
+        random_bytes(page, PAGE_SIZE);
+        memcpy(out, page, PAGE_SIZE);
+        dirty(out, 1 + rand() % 32);
+        len = xbzrle_encode_page(page, out, buf, PAGE_SIZE - 1);
+        if ( len <= 0 )
+            continue;
+
+        for ( n = 0; n < len; n++ )
+            decode_xbzrle(buf, n);
+
+        for ( j = 1 + rand() % 4; j; j-- )
+            buf[rand() % len] = rand() % 2 ? 0xff : rand();
+        decode_xbzrle(buf, len);
+    }
+
+    for ( i = 0; i < 20000; i++ )
+    {
+        n = rand() % 64;
+        random_bytes(buf, n);
+        decode_xbzrle(buf, n);
+    }
+}
+
+static void test_lengths(void)
+{
+    uint8_t *end = data + PAGE_SIZE;
+
+    assert(decode_page(&ctx, PAGE_ENCODING_RAW, end - 1, 1, out));
+    assert(decode_page(&ctx, PAGE_ENCODING_RAW, end, 0, out));
+    assert(decode_page(&ctx, PAGE_ENCODING_ZERO, end - 1, 1, out));
+    assert(decode_page(&ctx, PAGE_ENCODING_LZ4, end, 0, out));
+    assert(decode_page(&ctx, PAGE_ENCODING_LZ4, data, PAGE_SIZE, out));
+    assert(decode_page(&ctx, 0xffff, end, 0, out));
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "v")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    page = guarded(PAGE_SIZE);
+    buf = guarded(PAGE_SIZE);
+    out = guarded(PAGE_SIZE);
+    data = guarded(PAGE_SIZE);
+
+    test_zero();
+    test_random();
+    test_repetitive();
+    test_truncated();
+    test_corrupt();
+    test_lengths();
+    test_xbzrle();
+    test_xbzrle_corrupt();
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,339 @@
+/*
+ * Migration between two local domains over several page streams.
+ *
+ * A source domain is populated with a known pattern and saved with
+ * xc_domain_save_streams() to a destination domain restored with
+ * xc_domain_restore_streams(), over a socketpair for the main stream and one
+ * for each page stream.  The destination contents are then checked.  Live
+ * migrations rewrite part of the source memory between iterations, so that
+ * pages move through the streams more than once.
+ */
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <xenctrl.h>
+#include <xenguest.h>
+#include <xenforeignmemory.h>
+#include <xendevicemodel.h>
+#include <xen-tools/libs.h>
+
+/* Page streams get 2M of contiguous pfns at a time: use 16M. */
+#define NR_PAGES 4096
+#define MAX_STREAMS 4
+
+/* Live iterations, each rewriting an eighth of the memory. */
+#define NR_ITERATIONS 4
+
+static unsigned int nr_failures;
+#define fail(fmt, ...)                          \
+({                                              \
+    nr_failures++;                              \
+    (void)printf(fmt, ##__VA_ARGS__);           \
+})
+
+static xc_interface *xch;
+static xenforeignmemory_handle *fmem;
+static xendevicemodel_handle *dmod;
+
+static struct xen_domctl_createdomain create = {
+    .flags = XEN_DOMCTL_CDF_hvm | XEN_DOMCTL_CDF_hap,
+    .max_vcpus = 1,
+    .max_grant_frames = 1,
+    .grant_opts = XEN_DOMCTL_GRANT_version(1),
+
+    .arch = {
+        .emulation_flags = XEN_X86_EMU_LAPIC,
+    },
+};
+
+/* Generation of the pattern each page of the source holds. */
+static uint8_t generation[NR_PAGES];
+
+struct sender {
+    xc_interface *xch;
+    int fd, page_fds[MAX_STREAMS];
+    unsigned int nr_page_fds;
+    uint32_t domid;
+    uint32_t flags;
+    int rc, err;
+};
+
+/*
+ * Every fourth page is initially left zero, to exercise zero page elision.
+ * The rest get a pattern which is unique to the pfn and generation, and
+ * compresses well.
+ */
+static void fill_page(uint32_t *page, xen_pfn_t pfn, unsigned int gen)
+{
+    unsigned int i;
+
+    for ( i = 0; i < XC_PAGE_SIZE / sizeof(*page); ++i )
+        page[i] = (gen || (pfn % 4)) ? (pfn << 12) | (gen << 8) | (i & 0x3f)
+                                     : 0;
+}
+
+static void *map_domain(uint32_t domid, int prot, xen_pfn_t *pfns)
+{
+    unsigned int i;
+
+    for ( i = 0; i < NR_PAGES; ++i )
+        pfns[i] = i;
+
+    return xenforeignmemory_map(fmem, domid, prot, NR_PAGES, pfns, NULL);
+}
+
+/* Rewrite the pages of one eighth of the memory, as a running guest would. */
+static int dirty_memory(uint32_t domid, unsigned int iteration)
+{
+    static xen_pfn_t pfns[NR_PAGES];
+    uint8_t *mem = map_domain(domid, PROT_READ | PROT_WRITE, pfns);
+    unsigned int i;
+
+    if ( !mem )
+        return -1;
+
+    for ( i = 0; i < NR_PAGES; ++i )
+    {
+        if ( i % 8 != iteration % 8 )
+            continue;
+
+        generation[i] = iteration;
+        fill_page((uint32_t *)(mem + i * XC_PAGE_SIZE), i, iteration);
+
+        /* Writes through a foreign mapping are not logged by Xen. */
+        if ( xendevicemodel_modified_memory(dmod, domid, i, 1) )
+            break;
+    }
+
+    xenforeignmemory_unmap(fmem, mem, NR_PAGES);
+
+    return i == NR_PAGES ? 0 : -1;
+}
+
+static int precopy_policy(struct precopy_stats stats, void *data)
+{
+    struct sender *s = data;
+
+    if ( stats.iteration >= NR_ITERATIONS )
+        return XGS_POLICY_STOP_AND_COPY;
+
+    /* Between sending the dirty pages and collecting the next ones. */
+    if ( stats.dirty_count < 0 && dirty_memory(s->domid, stats.iteration) )
+        return XGS_POLICY_ABORT;
+
+    return XGS_POLICY_CONTINUE_PRECOPY;
+}
+
+static int suspend(void *data)
+{
+    struct sender *s = data;
+
+    return !xc_domain_shutdown(s->xch, s->domid, SHUTDOWN_suspend);
+}
+
+static int switch_qemu_logdirty(uint32_t domid, unsigned int enable,
+                                void *data)
+{
+    return 0;
+}
+
+static void *sender_thread(void *arg)
+{
+    struct sender *s = arg;
+    struct save_callbacks callbacks = {
+        .suspend = suspend,
+        .precopy_policy = precopy_policy,
+        .switch_qemu_logdirty = switch_qemu_logdirty,
+        .data = s,
+    };
+
+    s->rc = xc_domain_save_streams(s->xch, s->fd, s->domid, s->flags,
+                                   &callbacks, XC_STREAM_PLAIN, -1,
+                                   s->page_fds, s->nr_page_fds);
+    s->err = errno;
+
+    /* Unblock the receiver, should it be waiting for more. */
+    if ( s->rc )
+        shutdown(s->fd, SHUT_RDWR);
+
+    return NULL;
+}
+
+static int create_domain(uint32_t *domid, unsigned int nr_pages)
+{
+    static xen_pfn_t pfns[NR_PAGES];
+    unsigned int i;
+
+    if ( xc_domain_create(xch, domid, &create) )
+        return -1;
+
+    for ( i = 0; i < nr_pages; ++i )
+        pfns[i] = i;
+
+    if ( xc_domain_setmaxmem(xch, *domid, -1) ||
+         xc_domain_populate_physmap_exact(xch, *domid, nr_pages, 0, 0, pfns) )
+    {
+        fail("  Fail: populate d%u: %d - %s\n", *domid, errno, strerror(errno));
+        xc_domain_destroy(xch, *domid);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void run_test(const char *name, unsigned int nr_streams, uint32_t flags)
+{
+    static xen_pfn_t pfns[NR_PAGES];
+    struct restore_callbacks callbacks = {};
+    struct sender s = { .flags = flags, .nr_page_fds = nr_streams };
+    int fds[MAX_STREAMS + 1][2], recv_fds[MAX_STREAMS];
+    unsigned long store_gfn, console_gfn;
+    unsigned int i, nr_fds = 0, nr_bad = 0;
+    uint32_t expected[XC_PAGE_SIZE / sizeof(uint32_t)];
+    pthread_t thread;
+    uint32_t src, dst;
+    uint8_t *mem;
+    int rc;
+
+    printf("Test %s\n", name);
+
+    if ( create_domain(&src, NR_PAGES) )
+    {
+        if ( errno == EINVAL || errno == EOPNOTSUPP )
+            printf("  Skip: %d - %s\n", errno, strerror(errno));
+        else
+            fail("  Fail: create source: %d - %s\n", errno, strerror(errno));
+        return;
+    }
+
+    /* The restore populates the destination's memory. */
+    if ( xc_domain_create(xch, &dst, &create) ||
+         xc_domain_setmaxmem(xch, dst, -1) )
+    {
+        fail("  Fail: create destination: %d - %s\n", errno, strerror(errno));
+        goto out_src;
+    }
+
+    mem = map_domain(src, PROT_READ | PROT_WRITE, pfns);
+    if ( !mem )
+    {
+        fail("  Fail: map source: %d - %s\n", errno, strerror(errno));
+        goto out_dst;
+    }
+
+    memset(generation, 0, sizeof(generation));
+    for ( i = 0; i < NR_PAGES; ++i )
+        fill_page((uint32_t *)(mem + i * XC_PAGE_SIZE), i, 0);
+
+    xenforeignmemory_unmap(fmem, mem, NR_PAGES);
+
+    for ( ; nr_fds <= nr_streams; ++nr_fds )
+        if ( socketpair(AF_UNIX, SOCK_STREAM, 0, fds[nr_fds]) )
+        {
+            fail("  Fail: socketpair: %d - %s\n", errno, strerror(errno));
+            goto out_fds;
+        }
+
+    s.xch = xc_interface_open(NULL, NULL, 0);
+    s.fd = fds[0][0];
+    s.domid = src;
+    for ( i = 0; i < nr_streams; ++i )
+    {
+        s.page_fds[i] = fds[i + 1][0];
+        recv_fds[i] = fds[i + 1][1];
+    }
+    if ( !s.xch )
+    {
+        fail("  Fail: xc_interface_open: %d - %s\n", errno, strerror(errno));
+        goto out_fds;
+    }
+
+    if ( (rc = pthread_create(&thread, NULL, sender_thread, &s)) )
+    {
+        fail("  Fail: pthread_create: %d - %s\n", rc, strerror(rc));
+        goto out_xch;
+    }
+
+    rc = xc_domain_restore_streams(xch, fds[0][1], dst, 0, &store_gfn, 0,
+                                   0, &console_gfn, 0, XC_STREAM_PLAIN,
+                                   &callbacks, -1, recv_fds, nr_streams);
+    if ( rc )
+    {
+        fail("  Fail: restore: %d - %s\n", errno, strerror(errno));
+        /* Unblock the sender. */
+        for ( i = 0; i < nr_fds; ++i )
+            shutdown(fds[i][1], SHUT_RDWR);
+    }
+
+    pthread_join(thread, NULL);
+
+    if ( s.rc )
+        fail("  Fail: save: %d - %s\n", s.err, strerror(s.err));
+
+    if ( rc || s.rc )
+        goto out_xch;
+
+    mem = map_domain(dst, PROT_READ, pfns);
+    if ( !mem )
+    {
+        fail("  Fail: map destination: %d - %s\n", errno, strerror(errno));
+        goto out_xch;
+    }
+
+    for ( i = 0; i < NR_PAGES; ++i )
+    {
+        fill_page(expected, i, generation[i]);
+        if ( memcmp(mem + i * XC_PAGE_SIZE, expected, XC_PAGE_SIZE) &&
+             nr_bad++ < 8 )
+            fail("  Fail: pfn %#x differs\n", i);
+    }
+
+    xenforeignmemory_unmap(fmem, mem, NR_PAGES);
+
+    if ( !nr_bad )
+        printf("  Pass: %u pages\n", NR_PAGES);
+
+ out_xch:
+    xc_interface_close(s.xch);
+ out_fds:
+    while ( nr_fds-- )
+    {
+        close(fds[nr_fds][0]);
+        close(fds[nr_fds][1]);
+    }
+ out_dst:
+    if ( xc_domain_destroy(xch, dst) )
+        fail("  Failed to destroy d%u: %d - %s\n", dst, errno, strerror(errno));
+ out_src:
+    if ( xc_domain_destroy(xch, src) )
+        fail("  Failed to destroy d%u: %d - %s\n", src, errno, strerror(errno));
+}
+
+int main(int argc, char **argv)
+{
+    printf("Page stream migration tests\n");
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    fmem = xenforeignmemory_open(NULL, 0);
+    dmod = xendevicemodel_open(NULL, 0);
+
+    if ( !xch || !fmem || !dmod )
+        err(1, "Failed to open interfaces");
+
+    run_test("main stream only", 0, 0);
+    run_test("1 page stream", 1, 0);
+    run_test("4 page streams", 4, 0);
+    run_test("3 page streams, compressed", 3, XCFLAGS_COMPRESS);
+    run_test("live, 3 page streams", 3, XCFLAGS_LIVE);
+    run_test("live, 4 page streams, compressed", 4,
+             XCFLAGS_LIVE | XCFLAGS_COMPRESS);
+
+    return !!nr_failures;
+}
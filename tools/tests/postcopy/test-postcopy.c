@@ -0,0 +1,327 @@
+/*
+ * Post-copy migration between two local domains.
+ *
+ * A source domain is populated with a known pattern, and all of its memory
+ * is marked dirty, as if it had been left behind by the final iteration of a
+ * post-copy xc_domain_save().  xc_domain_postcopy_send() and
+ * xc_domain_postcopy_receive() then move it to a destination domain over a
+ * socketpair, and the destination contents are checked.
+ *
+ * Without a paging ring at the destination, the receiver falls back to
+ * asking for every page before resuming the guest.  With enough pages, the
+ * requests and the page data both overflow the socket buffers, which catches
+ * either side blocking on a write while the other is too.
+ *
+ * A receiver failing before it resumes the guest must make the sender fail
+ * with ECANCELED, so the source can be resumed instead.
+ */
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <xenctrl.h>
+#include <xenguest.h>
+#include <xenforeignmemory.h>
+#include <xendevicemodel.h>
+#include <xen-tools/libs.h>
+
+#define NR_PAGES       1024
+#define NR_PAGES_LARGE (1U << 16)
+
+/* No paging ring at the destination. */
+#define TEST_NO_PAGING (1U << 0)
+/* Receive into a domain which does not exist. */
+#define TEST_ABORT     (1U << 1)
+
+static unsigned int nr_failures;
+#define fail(fmt, ...)                          \
+({                                              \
+    nr_failures++;                              \
+    (void)printf(fmt, ##__VA_ARGS__);           \
+})
+
+static xc_interface *xch;
+static xenforeignmemory_handle *fmem;
+static xendevicemodel_handle *dmod;
+
+static struct xen_domctl_createdomain create = {
+    .flags = XEN_DOMCTL_CDF_hvm | XEN_DOMCTL_CDF_hap,
+    .max_vcpus = 1,
+    .max_grant_frames = 1,
+    .grant_opts = XEN_DOMCTL_GRANT_version(1),
+
+    .arch = {
+        .emulation_flags = XEN_X86_EMU_LAPIC,
+    },
+};
+
+struct sender {
+    xc_interface *xch;
+    int fd;
+    uint32_t domid;
+    uint32_t flags;
+    int rc, err;
+};
+
+static void *sender_thread(void *arg)
+{
+    struct sender *s = arg;
+
+    s->rc = xc_domain_postcopy_send(s->xch, s->fd, s->domid, s->flags, s->fd);
+    s->err = errno;
+
+    return NULL;
+}
+
+static int resume(uint32_t domid, void *data)
+{
+    unsigned int *resumed = data;
+
+    ++*resumed;
+    return 0;
+}
+
+/*
+ * Every fourth page is left zero, to exercise zero page elision.  The rest
+ * get a pattern which is unique to the pfn and compresses well.
+ */
+static void fill_page(uint32_t *page, xen_pfn_t pfn)
+{
+    unsigned int i;
+
+    for ( i = 0; i < XC_PAGE_SIZE / sizeof(*page); ++i )
+        page[i] = (pfn % 4) ? (pfn << 12) | (i & 0x3f) : 0;
+}
+
+static void *map_domain(uint32_t domid, int prot, xen_pfn_t *pfns,
+                        unsigned int nr_pages)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr_pages; ++i )
+        pfns[i] = i;
+
+    return xenforeignmemory_map(fmem, domid, prot, nr_pages, pfns, NULL);
+}
+
+/* pfns has room for nr_pages. */
+static int create_domain(uint32_t *domid, xen_pfn_t *pfns,
+                         unsigned int nr_pages)
+{
+    unsigned int i;
+
+    if ( xc_domain_create(xch, domid, &create) )
+        return -1;
+
+    for ( i = 0; i < nr_pages; ++i )
+        pfns[i] = i;
+
+    if ( xc_domain_setmaxmem(xch, *domid, -1) ||
+         xc_domain_populate_physmap_exact(xch, *domid, nr_pages, 0, 0, pfns) )
+    {
+        fail("  Fail: populate d%u: %d - %s\n", *domid, errno, strerror(errno));
+        xc_domain_destroy(xch, *domid);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void run_test(const char *name, uint32_t flags, unsigned int nr_pages,
+                     unsigned int test)
+{
+    bool paging = !(test & TEST_NO_PAGING);
+    xen_pfn_t *pfns = malloc((nr_pages + 1) * sizeof(*pfns));
+    struct sender s = { .flags = flags };
+    pthread_t thread;
+    uint32_t src, dst, dst_recv;
+    unsigned int i, resumed = 0, nr_bad = 0;
+    uint32_t expected[XC_PAGE_SIZE / sizeof(uint32_t)];
+    uint8_t *mem;
+    int fds[2], rc;
+
+    printf("Test %s\n", name);
+
+    if ( !pfns )
+    {
+        fail("  Fail: allocate %u pfns\n", nr_pages + 1);
+        return;
+    }
+
+    if ( create_domain(&src, pfns, nr_pages) )
+    {
+        if ( errno == EINVAL || errno == EOPNOTSUPP )
+            printf("  Skip: %d - %s\n", errno, strerror(errno));
+        else
+            fail("  Fail: create source: %d - %s\n", errno, strerror(errno));
+        goto out_pfns;
+    }
+
+    /* With paging, one extra page at the destination for the ring. */
+    if ( create_domain(&dst, pfns, nr_pages + paging) )
+    {
+        fail("  Fail: create destination: %d - %s\n", errno, strerror(errno));
+        goto out_src;
+    }
+    dst_recv = dst;
+
+    if ( paging &&
+         xc_hvm_param_set(xch, dst, HVM_PARAM_PAGING_RING_PFN, nr_pages) )
+    {
+        fail("  Fail: set paging ring: %d - %s\n", errno, strerror(errno));
+        goto out_dst;
+    }
+
+    mem = map_domain(src, PROT_READ | PROT_WRITE, pfns, nr_pages);
+    if ( !mem )
+    {
+        fail("  Fail: map source: %d - %s\n", errno, strerror(errno));
+        goto out_dst;
+    }
+
+    for ( i = 0; i < nr_pages; ++i )
+        fill_page((uint32_t *)(mem + i * XC_PAGE_SIZE), i);
+
+    xenforeignmemory_unmap(fmem, mem, nr_pages);
+
+    /* Leave every page outstanding, as a post-copy save would. */
+    if ( xc_shadow_control(xch, src, XEN_DOMCTL_SHADOW_OP_ENABLE_LOGDIRTY,
+                           NULL, 0) ||
+         xendevicemodel_modified_memory(dmod, src, 0, nr_pages) )
+    {
+        fail("  Fail: log-dirty: %d - %s\n", errno, strerror(errno));
+        goto out_dst;
+    }
+
+    if ( socketpair(AF_UNIX, SOCK_STREAM, 0, fds) )
+    {
+        fail("  Fail: socketpair: %d - %s\n", errno, strerror(errno));
+        goto out_dst;
+    }
+
+    s.xch = xc_interface_open(NULL, NULL, 0);
+    s.fd = fds[0];
+    s.domid = src;
+    if ( !s.xch )
+    {
+        fail("  Fail: xc_interface_open: %d - %s\n", errno, strerror(errno));
+        goto out_fds;
+    }
+
+    if ( (rc = pthread_create(&thread, NULL, sender_thread, &s)) )
+    {
+        fail("  Fail: pthread_create: %d - %s\n", rc, strerror(rc));
+        goto out_xch;
+    }
+
+    if ( test & TEST_ABORT )
+        dst_recv = DOMID_FIRST_RESERVED - 1;
+
+    rc = xc_domain_postcopy_receive(xch, fds[1], dst_recv, fds[1],
+                                    resume, &resumed);
+    if ( test & TEST_ABORT )
+    {
+        pthread_join(thread, NULL);
+
+        if ( !rc )
+            fail("  Fail: receive into d%u succeeded\n", dst_recv);
+        else if ( !s.rc || s.err != ECANCELED )
+            fail("  Fail: send: %d, expected ECANCELED: %d - %s\n",
+                 s.rc, s.err, strerror(s.err));
+        else if ( resumed )
+            fail("  Fail: resume callback called\n");
+        else
+            printf("  Pass: sender cancelled\n");
+
+        goto out_xch;
+    }
+
+    if ( rc )
+    {
+        fail("  Fail: receive: %d - %s\n", errno, strerror(errno));
+        /* Unblock the sender. */
+        shutdown(fds[1], SHUT_RDWR);
+    }
+
+    pthread_join(thread, NULL);
+
+    if ( s.rc )
+        fail("  Fail: send: %d - %s\n", s.err, strerror(s.err));
+
+    if ( rc || s.rc )
+        goto out_xch;
+
+    if ( resumed != 1 )
+        fail("  Fail: resume callback called %u times\n", resumed);
+
+    mem = map_domain(dst, PROT_READ, pfns, nr_pages);
+    if ( !mem )
+    {
+        fail("  Fail: map destination: %d - %s\n", errno, strerror(errno));
+        goto out_xch;
+    }
+
+    for ( i = 0; i < nr_pages; ++i )
+    {
+        fill_page(expected, i);
+        if ( memcmp(mem + i * XC_PAGE_SIZE, expected, XC_PAGE_SIZE) &&
+             nr_bad++ < 8 )
+            fail("  Fail: pfn %#x differs\n", i);
+    }
+
+    xenforeignmemory_unmap(fmem, mem, nr_pages);
+
+    if ( !nr_bad )
+        printf("  Pass: %u pages\n", nr_pages);
+
+ out_xch:
+    xc_interface_close(s.xch);
+ out_fds:
+    close(fds[0]);
+    close(fds[1]);
+ out_dst:
+    if ( xc_domain_destroy(xch, dst) )
+        fail("  Failed to destroy d%u: %d - %s\n", dst, errno, strerror(errno));
+ out_src:
+    if ( xc_domain_destroy(xch, src) )
+        fail("  Failed to destroy d%u: %d - %s\n", src, errno, strerror(errno));
+ out_pfns:
+    free(pfns);
+}
+
+int main(int argc, char **argv)
+{
+    printf("Post-copy migration tests\n");
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    fmem = xenforeignmemory_open(NULL, 0);
+    dmod = xendevicemodel_open(NULL, 0);
+
+    if ( !xch || !fmem || !dmod )
+        err(1, "Failed to open interfaces");
+
+    run_test("post-copy", 0, NR_PAGES, 0);
+    run_test("compressed post-copy", XCFLAGS_COMPRESS, NR_PAGES, 0);
+    run_test("post-copy without paging", 0, NR_PAGES_LARGE, TEST_NO_PAGING);
+    run_test("receiver abort", 0, NR_PAGES, TEST_ABORT);
+
+    return !!nr_failures;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,320 @@
+/*
+ * Decisions of the adaptive precopy policy of libxenguest.
+ *
+ * Single decisions are checked against stats for a migration which converges
+ * on the downtime target, one which does not, and stats not measured yet.
+ * Whole precopy phases are then simulated, with the policy called as
+ * xc_domain_save() does, for a guest dirtying memory at a given rate.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <xenctrl.h>
+#include <xenguest.h>
+#include <xen-tools/libs.h>
+
+static unsigned int nr_failures;
+#define fail(fmt, ...)                          \
+({                                              \
+    nr_failures++;                              \
+    (void)printf(fmt, ##__VA_ARGS__);           \
+})
+
+static const char *decision_name(int decision)
+{
+    switch ( decision )
+    {
+    case XGS_POLICY_ABORT:            return "abort";
+    case XGS_POLICY_CONTINUE_PRECOPY: return "continue";
+    case XGS_POLICY_STOP_AND_COPY:    return "stop";
+    case XGS_POLICY_THROTTLE:         return "throttle";
+    default:                          return "unknown";
+    }
+}
+
+static void test_decisions(void)
+{
+    static const struct test {
+        const char *name;
+        struct precopy_stats stats;
+        bool throttle;
+        int decision;
+    } tests[] = {
+        /* 100ms downtime target, 10 iterations at most. */
+        {
+            .name = "First iteration, no bandwidth measured",
+            .stats = { .dirty_count = 262144 },
+            .throttle = true,
+            .decision = XGS_POLICY_CONTINUE_PRECOPY,
+        },
+        {
+            .name = "Few dirty pages, no bandwidth measured",
+            .stats = { .iteration = 3, .dirty_count = 10, .dirty_rate = 100 },
+            .throttle = true,
+            .decision = XGS_POLICY_CONTINUE_PRECOPY,
+        },
+        {
+            .name = "Dirty pages not counted yet",
+            .stats = { .iteration = 3, .dirty_count = -1,
+                       .bandwidth = 100000, .dirty_rate = 200000 },
+            .throttle = true,
+            .decision = XGS_POLICY_CONTINUE_PRECOPY,
+        },
+        {
+            .name = "Last iteration, nothing measured",
+            .stats = { .iteration = 10, .dirty_count = -1 },
+            .decision = XGS_POLICY_STOP_AND_COPY,
+        },
+        {
+            .name = "Within the target",
+            .stats = { .iteration = 1, .dirty_count = 1000,
+                       .bandwidth = 100000, .dirty_rate = 200000 },
+            .throttle = true,
+            .decision = XGS_POLICY_STOP_AND_COPY,
+        },
+        {
+            .name = "Exactly on the target",
+            .stats = { .iteration = 1, .dirty_count = 10000,
+                       .bandwidth = 100000, .dirty_rate = 200000 },
+            .throttle = true,
+            .decision = XGS_POLICY_STOP_AND_COPY,
+        },
+        {
+            .name = "Converging, target met next iteration",
+            .stats = { .iteration = 1, .dirty_count = 10001,
+                       .bandwidth = 100000, .dirty_rate = 10000 },
+            .throttle = true,
+            .decision = XGS_POLICY_CONTINUE_PRECOPY,
+        },
+        {
+            .name = "Converging, idle guest",
+            .stats = { .iteration = 1, .dirty_count = 262144,
+                       .bandwidth = 100000 },
+            .throttle = true,
+            .decision = XGS_POLICY_CONTINUE_PRECOPY,
+        },
+        {
+            .name = "Converging, target met in the last iteration",
+            .stats = { .iteration = 8, .dirty_count = 1000000,
+                       .bandwidth = 100000, .dirty_rate = 1000 },
+            .throttle = true,
+            .decision = XGS_POLICY_CONTINUE_PRECOPY,
+        },
+        {
+            .name = "Converging too slowly",
+            .stats = { .iteration = 8, .dirty_count = 1000000,
+                       .bandwidth = 100000, .dirty_rate = 10000 },
+            .throttle = true,
+            .decision = XGS_POLICY_THROTTLE,
+        },
+        {
+            .name = "Converging too slowly, no throttling",
+            .stats = { .iteration = 8, .dirty_count = 1000000,
+                       .bandwidth = 100000, .dirty_rate = 10000 },
+            .decision = XGS_POLICY_CONTINUE_PRECOPY,
+        },
+        {
+            .name = "Not converging",
+            .stats = { .iteration = 2, .dirty_count = 65536,
+                       .bandwidth = 100000, .dirty_rate = 100000 },
+            .throttle = true,
+            .decision = XGS_POLICY_THROTTLE,
+        },
+        {
+            .name = "Diverging",
+            .stats = { .iteration = 2, .dirty_count = 65536,
+                       .bandwidth = 100000, .dirty_rate = 300000 },
+            .throttle = true,
+            .decision = XGS_POLICY_THROTTLE,
+        },
+        {
+            .name = "Not converging, no throttling",
+            .stats = { .iteration = 2, .dirty_count = 65536,
+                       .bandwidth = 100000, .dirty_rate = 300000 },
+            .decision = XGS_POLICY_CONTINUE_PRECOPY,
+        },
+        {
+            .name = "Not converging, last iteration",
+            .stats = { .iteration = 10, .dirty_count = 65536,
+                       .bandwidth = 100000, .dirty_rate = 300000 },
+            .throttle = true,
+            .decision = XGS_POLICY_STOP_AND_COPY,
+        },
+    };
+    unsigned int i;
+
+    printf("Testing policy decisions:\n");
+
+    for ( i = 0; i < ARRAY_SIZE(tests); ++i )
+    {
+        const struct test *t = &tests[i];
+        struct xc_precopy_adaptive params = {
+            .max_downtime_ms = 100,
+            .max_iterations = 10,
+            .throttle = t->throttle,
+        };
+        int decision = xc_precopy_policy_adaptive(t->stats, &params);
+
+        if ( decision != t->decision )
+            fail("  Test '%s' expected %s, got %s\n", t->name,
+                 decision_name(t->decision), decision_name(decision));
+    }
+}
+
+struct guest {
+    unsigned long pages;
+    /* Pages written to, and how fast when running unthrottled. */
+    unsigned long working_set;
+    unsigned long dirty_rate;
+    /* Rate pages are sent at. */
+    unsigned long bandwidth;
+};
+
+struct outcome {
+    unsigned int iterations;
+    unsigned int throttled;
+    unsigned int downtime_ms;
+};
+
+/* The precopy phase of xc_domain_save(), as seen by its policy. */
+static struct outcome simulate(const struct guest *g,
+                               struct xc_precopy_adaptive *params)
+{
+    struct precopy_stats stats = {
+        .dirty_count = g->pages,
+        .throttle = 100,
+    };
+    struct outcome o = { 0 };
+    double secs = 0, dirtied;
+    int decision;
+
+    for ( ; ; )
+    {
+        decision = xc_precopy_policy_adaptive(stats, params);
+        if ( decision == XGS_POLICY_THROTTLE )
+        {
+            /* As throttle_domain(), up to 1/16 of the guest's share. */
+            if ( stats.throttle > 100 >> 4 )
+            {
+                stats.throttle /= 2;
+                o.throttled++;
+            }
+            decision = XGS_POLICY_CONTINUE_PRECOPY;
+        }
+
+        if ( stats.dirty_count > 0 )
+        {
+            secs = (double)stats.dirty_count / g->bandwidth;
+            stats.bandwidth = g->bandwidth;
+        }
+
+        if ( decision != XGS_POLICY_CONTINUE_PRECOPY )
+            break;
+
+        stats.iteration = ++o.iterations;
+        stats.total_written += stats.dirty_count;
+        stats.dirty_count = -1;
+
+        decision = xc_precopy_policy_adaptive(stats, params);
+        if ( decision != XGS_POLICY_CONTINUE_PRECOPY )
+            break;
+
+        dirtied = (double)g->dirty_rate * stats.throttle / 100 * secs;
+        stats.dirty_count = MIN(dirtied, (double)g->working_set);
+        stats.dirty_rate = stats.dirty_count / secs;
+    }
+
+    if ( decision != XGS_POLICY_STOP_AND_COPY )
+        fail("  Precopy phase ended with %s\n", decision_name(decision));
+
+    /* What was dirtied while the last pages were sent is sent paused. */
+    dirtied = (double)g->dirty_rate * stats.throttle / 100 * secs;
+    o.downtime_ms = MIN(dirtied, (double)g->working_set) * 1000 /
+                    g->bandwidth;
+
+    return o;
+}
+
+static void test_simulated(void)
+{
+    /* A 1GiB guest over a link sending 100000 pages a second. */
+    static const struct test {
+        const char *name;
+        struct guest guest;
+        bool throttle;
+        bool converges;
+    } tests[] = {
+        {
+            .name = "Idle guest",
+            .guest = { 262144, 0, 0, 100000 },
+            .throttle = true,
+            .converges = true,
+        },
+        {
+            .name = "Guest dirtying memory slowly",
+            .guest = { 262144, 262144, 20000, 100000 },
+            .throttle = true,
+            .converges = true,
+        },
+        {
+            .name = "Guest dirtying memory faster than it is sent",
+            .guest = { 262144, 65536, 200000, 100000 },
+            .throttle = true,
+            .converges = true,
+        },
+        {
+            .name = "Same, no throttling",
+            .guest = { 262144, 65536, 200000, 100000 },
+        },
+        {
+            .name = "Guest dirtying memory far too fast to throttle",
+            .guest = { 262144, 262144, 10000000, 100000 },
+            .throttle = true,
+        },
+    };
+    unsigned int i;
+
+    printf("Testing simulated migrations:\n");
+
+    for ( i = 0; i < ARRAY_SIZE(tests); ++i )
+    {
+        const struct test *t = &tests[i];
+        struct xc_precopy_adaptive params = {
+            .max_downtime_ms = 300,
+            .max_iterations = 10,
+            .throttle = t->throttle,
+        };
+        struct outcome o = simulate(&t->guest, &params);
+
+        if ( o.iterations > params.max_iterations )
+            fail("  Test '%s' ran %u iterations\n", t->name, o.iterations);
+        else if ( t->converges &&
+                  (o.iterations == params.max_iterations ||
+                   o.downtime_ms > params.max_downtime_ms) )
+            fail("  Test '%s' did not converge: %u iterations, %ums\n",
+                 t->name, o.iterations, o.downtime_ms);
+        else if ( !t->converges && o.iterations != params.max_iterations )
+            fail("  Test '%s' stopped after %u iterations, %ums\n",
+                 t->name, o.iterations, o.downtime_ms);
+        else if ( !t->throttle && o.throttled )
+            fail("  Test '%s' throttled the guest\n", t->name);
+        else if ( t->throttle && t->guest.dirty_rate > t->guest.bandwidth &&
+                  !o.throttled )
+            fail("  Test '%s' did not throttle the guest\n", t->name);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    printf("Adaptive precopy policy tests\n");
+
+    test_decisions();
+    test_simulated();
+
+    if ( nr_failures )
+        printf("Done: %u failures\n", nr_failures);
+    else
+        printf("Done: all ok\n");
+
+    return !!nr_failures;
+}
@@ -0,0 +1,328 @@
+/*
+ * Unit tests and lookup benchmark for the rangeset code.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+#include <unistd.h>
+
+#include "emul.h"
+
+/* Ranges reported by rangeset_report_ranges(). */
+struct report {
+    unsigned int nr;
+    unsigned long s[16], e[16];
+};
+
+static int cf_check report_range(unsigned long s, unsigned long e, void *data)
+{
+    struct report *rep = data;
+
+    assert(rep->nr < ARRAY_SIZE(rep->s));
+    rep->s[rep->nr] = s;
+    rep->e[rep->nr] = e;
+    rep->nr++;
+
+    return 0;
+}
+
+#define CHECK_RANGES(r, from, to, ...) ({                               \
+    const unsigned long exp_[] = { __VA_ARGS__ };                       \
+    struct report rep_ = { };                                           \
+    unsigned int i_;                                                    \
+                                                                        \
+    assert(!rangeset_report_ranges(r, from, to, report_range, &rep_));  \
+    assert(rep_.nr * 2 == ARRAY_SIZE(exp_));                            \
+    for ( i_ = 0; i_ < rep_.nr; i_++ )                                  \
+        assert(rep_.s[i_] == exp_[i_ * 2] &&                            \
+               rep_.e[i_] == exp_[i_ * 2 + 1]);                         \
+})
+
+#define CHECK_EMPTY(r) assert(rangeset_is_empty(r))
+
+static int cf_check consume_two(unsigned long s, unsigned long e, void *data,
+                                unsigned long *c)
+{
+    unsigned int *calls = data;
+
+    (*calls)++;
+    *c = min(e - s + 1, 2UL);
+
+    return 0;
+}
+
+static void test_basic(void)
+{
+    struct rangeset *r = rangeset_new(NULL, "test", 0);
+    struct rangeset *r2 = rangeset_new(NULL, "test2", 0);
+    unsigned long s;
+    unsigned int calls = 0;
+
+    assert(r && r2);
+    CHECK_EMPTY(r);
+
+    /* Adding merges overlapping and adjacent ranges. */
+    assert(!rangeset_add_range(r, 10, 19));
+    assert(!rangeset_add_range(r, 30, 39));
+    assert(!rangeset_add_range(r, 50, 59));
+    CHECK_RANGES(r, 0, ~0UL, 10, 19, 30, 39, 50, 59);
+    assert(!rangeset_add_range(r, 20, 25));
+    CHECK_RANGES(r, 0, ~0UL, 10, 25, 30, 39, 50, 59);
+    assert(!rangeset_add_range(r, 26, 29));
+    CHECK_RANGES(r, 0, ~0UL, 10, 39, 50, 59);
+    assert(!rangeset_add_range(r, 0, 5));
+    assert(!rangeset_add_range(r, 70, 70));
+    CHECK_RANGES(r, 0, ~0UL, 0, 5, 10, 39, 50, 59, 70, 70);
+    assert(!rangeset_add_range(r, 8, 60));
+    CHECK_RANGES(r, 0, ~0UL, 0, 5, 8, 60, 70, 70);
+    assert(!rangeset_add_range(r, 3, 100));
+    CHECK_RANGES(r, 0, ~0UL, 0, 100);
+
+    /* Removing splits and trims ranges. */
+    assert(!rangeset_remove_range(r, 40, 49));
+    CHECK_RANGES(r, 0, ~0UL, 0, 39, 50, 100);
+    assert(!rangeset_remove_range(r, 0, 9));
+    assert(!rangeset_remove_range(r, 91, 200));
+    CHECK_RANGES(r, 0, ~0UL, 10, 39, 50, 90);
+    assert(!rangeset_remove_range(r, 35, 55));
+    CHECK_RANGES(r, 0, ~0UL, 10, 34, 56, 90);
+    assert(!rangeset_remove_range(r, 0, 5));
+    assert(!rangeset_remove_singleton(r, 56));
+    CHECK_RANGES(r, 0, ~0UL, 10, 34, 57, 90);
+
+    /* Lookups. */
+    assert(rangeset_contains_range(r, 10, 34));
+    assert(!rangeset_contains_range(r, 10, 35));
+    assert(!rangeset_contains_range(r, 9, 10));
+    assert(rangeset_contains_singleton(r, 60));
+    assert(!rangeset_contains_singleton(r, 40));
+    assert(!rangeset_contains_singleton(r, 0));
+    assert(!rangeset_contains_singleton(r, ~0UL));
+    assert(rangeset_overlaps_range(r, 0, 10));
+    assert(rangeset_overlaps_range(r, 30, 60));
+    assert(!rangeset_overlaps_range(r, 35, 56));
+    assert(!rangeset_overlaps_range(r, 91, ~0UL));
+
+    /* Reporting clips to the window asked for. */
+    CHECK_RANGES(r, 20, 60, 20, 34, 57, 60);
+    CHECK_RANGES(r, 35, 56);
+    CHECK_RANGES(r, 90, 90, 90, 90);
+
+    /* The limits of the address space. */
+    assert(!rangeset_add_range(r, ~0UL - 1, ~0UL));
+    assert(rangeset_contains_singleton(r, ~0UL));
+    assert(!rangeset_add_singleton(r, 0));
+    CHECK_RANGES(r, 0, ~0UL, 0, 0, 10, 34, 57, 90, ~0UL - 1, ~0UL);
+    assert(!rangeset_remove_range(r, 0, ~0UL));
+    CHECK_EMPTY(r);
+
+    /* Claiming finds the lowest free gap of the size asked for. */
+    assert(!rangeset_add_range(r, 0, 9));
+    assert(!rangeset_add_range(r, 15, 19));
+    assert(!rangeset_claim_range(r, 5, &s) && s == 10);
+    assert(!rangeset_claim_range(r, 3, &s) && s == 20);
+    /* The claimed space is appended to the range below, without merging. */
+    CHECK_RANGES(r, 0, ~0UL, 0, 14, 15, 22);
+    assert(!rangeset_add_range(r, 23, ~0UL));
+    assert(rangeset_claim_range(r, 1, &s) == -ENOSPC);
+    assert(!rangeset_remove_range(r, 0, ~0UL));
+
+    /* Consuming goes from the lowest range upwards. */
+    assert(!rangeset_add_range(r, 10, 12));
+    assert(!rangeset_add_range(r, 20, 20));
+    assert(!rangeset_consume_ranges(r, consume_two, &calls));
+    assert(calls == 3);
+    CHECK_EMPTY(r);
+
+    /* Merging and swapping. */
+    assert(!rangeset_add_range(r, 10, 19));
+    assert(!rangeset_add_range(r2, 20, 29));
+    assert(!rangeset_add_range(r2, 40, 49));
+    assert(!rangeset_merge(r, r2));
+    CHECK_RANGES(r, 0, ~0UL, 10, 29, 40, 49);
+    assert(!rangeset_remove_range(r2, 0, ~0UL));
+    assert(!rangeset_add_range(r2, 100, 109));
+    rangeset_swap(r, r2);
+    CHECK_RANGES(r, 0, ~0UL, 100, 109);
+    CHECK_RANGES(r2, 0, ~0UL, 10, 29, 40, 49);
+
+    /* Limiting the number of ranges. */
+    assert(!rangeset_remove_range(r, 0, ~0UL));
+    rangeset_limit(r, 2);
+    assert(!rangeset_add_range(r, 10, 19));
+    assert(!rangeset_add_range(r, 30, 39));
+    assert(rangeset_add_range(r, 50, 59) == -ENOMEM);
+    assert(rangeset_remove_range(r, 12, 13) == -ENOMEM);
+    assert(!rangeset_add_range(r, 20, 29));
+    assert(!rangeset_add_range(r, 50, 59));
+    CHECK_RANGES(r, 0, ~0UL, 10, 39, 50, 59);
+
+    rangeset_destroy(r);
+    rangeset_destroy(r2);
+}
+
+/* Compare random updates against a bitmap. */
+#define MODEL_SIZE 1024
+
+static bool model[MODEL_SIZE];
+
+struct model_check {
+    unsigned long next;
+};
+
+static int cf_check model_range(unsigned long s, unsigned long e, void *data)
+{
+    struct model_check *mc = data;
+    unsigned long i;
+
+    /* Ranges are reported in order, maximal and disjoint. */
+    assert(s >= mc->next && e < MODEL_SIZE);
+    for ( i = mc->next; i < s; i++ )
+        assert(!model[i]);
+    assert(s == 0 || !model[s - 1]);
+    for ( i = s; i <= e; i++ )
+        assert(model[i]);
+    assert(e + 1 == MODEL_SIZE || !model[e + 1]);
+    mc->next = e + 1;
+
+    return 0;
+}
+
+static void test_random(unsigned int iterations)
+{
+    struct rangeset *r = rangeset_new(NULL, "random", 0);
+    unsigned int i, j;
+    unsigned long s, e, k;
+    bool add;
+
+    assert(r);
+    memset(model, 0, sizeof(model));
+
+    for ( i = 0; i < iterations; i++ )
+    {
+        struct model_check mc = { };
+
+        s = rand() % MODEL_SIZE;
+        e = s + rand() % min(MODEL_SIZE - s, 64UL);
+        add = rand() % 2;
+        if ( add )
+            assert(!rangeset_add_range(r, s, e));
+        else
+            assert(!rangeset_remove_range(r, s, e));
+        for ( k = s; k <= e; k++ )
+            model[k] = add;
+
+        for ( j = 0; j < 8; j++ )
+        {
+            bool all = true, any = false;
+
+            s = rand() % MODEL_SIZE;
+            e = s + rand() % min(MODEL_SIZE - s, 16UL);
+            for ( k = s; k <= e; k++ )
+            {
+                all &= model[k];
+                any |= model[k];
+            }
+            assert(rangeset_contains_range(r, s, e) == all);
+            assert(rangeset_overlaps_range(r, s, e) == any);
+        }
+
+        assert(!rangeset_report_ranges(r, 0, ~0UL, model_range, &mc));
+        for ( k = mc.next; k < MODEL_SIZE; k++ )
+            assert(!model[k]);
+    }
+
+    rangeset_destroy(r);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Lookups in a set of nr ranges of 8 addresses each, 16 apart, as done by
+ * ioreq_server_select() or the I/O permission checks: half of them hit.
+ */
+static void bench_lookup(unsigned int nr, unsigned int lookups)
+{
+    struct rangeset *r = rangeset_new(NULL, "bench", 0);
+    unsigned long *addr = malloc(lookups * sizeof(*addr));
+    unsigned int i, hits = 0;
+    uint64_t start, lookup_ns, update_ns;
+
+    assert(r && addr);
+
+    start = now_ns();
+    for ( i = 0; i < nr; i++ )
+        assert(!rangeset_add_range(r, i * 16UL, i * 16UL + 7));
+    update_ns = now_ns() - start;
+
+    for ( i = 0; i < lookups; i++ )
+        addr[i] = rand() % (nr * 16UL);
+
+    start = now_ns();
+    for ( i = 0; i < lookups; i++ )
+        hits += rangeset_contains_range(r, addr[i], addr[i]);
+    lookup_ns = now_ns() - start;
+
+    printf("%6u ranges: %8.1f ns per lookup, %8.1f ns per add, %u%% hits\n",
+           nr, (double)lookup_ns / lookups, (double)update_ns / nr,
+           hits * 100 / lookups);
+
+    rangeset_destroy(r);
+    free(addr);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int nr;
+    int opt;
+    bool bench = false;
+
+    while ( (opt = getopt(argc, argv, "b")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'b':
+            bench = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-b]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    test_basic();
+    test_random(20000);
+
+    if ( bench )
+        for ( nr = 16; nr <= 16384; nr *= 4 )
+            bench_lookup(nr, 1000000);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
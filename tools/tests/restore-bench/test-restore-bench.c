@@ -0,0 +1,282 @@
+/*
+ * Restore throughput benchmark.
+ *
+ * "save" builds an HVM domain of the requested size, fills its memory with a
+ * known pattern, and saves it to an image file with xc_domain_save().
+ * "restore" then repeatedly restores the image into a fresh domain with
+ * xc_domain_restore(), reports the throughput of each run, and checks the
+ * restored contents.  The best run is reported at the end, as the first also
+ * pulls the image into the page cache.
+ *
+ * Images are raw libxc migration streams, not xl save files.
+ */
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <xenctrl.h>
+#include <xenguest.h>
+#include <xenforeignmemory.h>
+#include <xen-tools/libs.h>
+
+/* Pages mapped at a time when filling and checking guest memory. */
+#define CHUNK_PAGES 512
+
+static xc_interface *xch;
+static xenforeignmemory_handle *fmem;
+
+static struct xen_domctl_createdomain create = {
+    .flags = XEN_DOMCTL_CDF_hvm | XEN_DOMCTL_CDF_hap,
+    .max_vcpus = 1,
+    .max_grant_frames = 4,
+    .grant_opts = XEN_DOMCTL_GRANT_version(1),
+
+    .arch = {
+        .emulation_flags = XEN_X86_EMU_LAPIC,
+    },
+};
+
+/*
+ * One page in eight is left zero, and the rest get a pattern which is unique
+ * to the pfn, so the image is representative with and without compression.
+ */
+static void fill_page(uint32_t *page, xen_pfn_t pfn)
+{
+    unsigned int i;
+
+    for ( i = 0; i < XC_PAGE_SIZE / sizeof(*page); ++i )
+        page[i] = (pfn % 8) ? (pfn * 2654435761U) ^ (i * 40503U) : 0;
+}
+
+/*
+ * Fill, or check, the memory of a domain.  Returns the number of pages which
+ * differ from the pattern.
+ */
+static unsigned long walk_memory(uint32_t domid, unsigned long nr_pages,
+                                 bool fill)
+{
+    static xen_pfn_t pfns[CHUNK_PAGES];
+    uint32_t expected[XC_PAGE_SIZE / sizeof(uint32_t)];
+    unsigned long base, nr_bad = 0;
+    unsigned int i, nr;
+    uint8_t *mem;
+
+    for ( base = 0; base < nr_pages; base += nr )
+    {
+        nr = MIN(nr_pages - base, CHUNK_PAGES);
+        for ( i = 0; i < nr; ++i )
+            pfns[i] = base + i;
+
+        mem = xenforeignmemory_map(fmem, domid, PROT_READ | PROT_WRITE,
+                                   nr, pfns, NULL);
+        if ( !mem )
+            err(1, "Failed to map d%u pfn %#lx", domid, base);
+
+        for ( i = 0; i < nr; ++i )
+        {
+            if ( fill )
+                fill_page((uint32_t *)(mem + i * XC_PAGE_SIZE), base + i);
+            else
+            {
+                fill_page(expected, base + i);
+                if ( memcmp(mem + i * XC_PAGE_SIZE, expected, XC_PAGE_SIZE) &&
+                     nr_bad++ < 8 )
+                    printf("  pfn %#lx differs\n", base + i);
+            }
+        }
+
+        xenforeignmemory_unmap(fmem, mem, nr);
+    }
+
+    return nr_bad;
+}
+
+static uint32_t create_domain(unsigned long nr_pages, bool populate)
+{
+    xen_pfn_t *pfns;
+    unsigned long i;
+    uint32_t domid = DOMID_INVALID;
+
+    if ( xc_domain_create(xch, &domid, &create) )
+        err(1, "Failed to create domain");
+
+    if ( xc_domain_setmaxmem(xch, domid, -1) )
+        err(1, "Failed to set d%u maxmem", domid);
+
+    if ( !populate )
+        return domid;
+
+    pfns = malloc(nr_pages * sizeof(*pfns));
+    if ( !pfns )
+        err(1, "malloc");
+
+    for ( i = 0; i < nr_pages; ++i )
+        pfns[i] = i;
+
+    if ( xc_domain_populate_physmap_exact(xch, domid, nr_pages, 0, 0, pfns) )
+        err(1, "Failed to populate d%u", domid);
+
+    free(pfns);
+
+    return domid;
+}
+
+static int suspend(void *data)
+{
+    uint32_t *domid = data;
+
+    return xc_domain_pause(xch, *domid) ? 0 : 1;
+}
+
+static int switch_qemu_logdirty(uint32_t domid, unsigned int enable,
+                                void *data)
+{
+    return 0;
+}
+
+static int do_save(unsigned long nr_pages, const char *image)
+{
+    uint32_t domid = create_domain(nr_pages, true);
+    struct save_callbacks cb = {
+        .suspend = suspend,
+        .switch_qemu_logdirty = switch_qemu_logdirty,
+        .data = &domid,
+    };
+    int fd, rc;
+
+    walk_memory(domid, nr_pages, true);
+
+    fd = open(image, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if ( fd < 0 )
+        err(1, "Failed to open %s", image);
+
+    rc = xc_domain_save(xch, fd, domid, 0, &cb, XC_STREAM_PLAIN, -1);
+    if ( rc )
+        printf("Save of d%u failed: %d - %s\n", domid, errno, strerror(errno));
+    else
+        printf("Saved %lu MiB to %s\n", nr_pages >> 8, image);
+
+    close(fd);
+    xc_domain_destroy(xch, domid);
+
+    return rc;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int do_restore(unsigned long nr_pages, const char *image,
+                      unsigned int iterations)
+{
+    struct restore_callbacks cb = { 0 };
+    unsigned long store_gfn, console_gfn, nr_bad;
+    unsigned int i;
+    uint32_t domid;
+    double start, elapsed, best = 0;
+    struct stat st;
+    int fd, rc = 0;
+
+    for ( i = 0; i < iterations && !rc; ++i )
+    {
+        fd = open(image, O_RDONLY);
+        if ( fd < 0 || fstat(fd, &st) )
+            err(1, "Failed to open %s", image);
+
+        domid = create_domain(nr_pages, false);
+
+        start = now();
+        rc = xc_domain_restore(xch, fd, domid, 0, &store_gfn, 0,
+                               0, &console_gfn, 0, XC_STREAM_PLAIN, &cb, -1);
+        elapsed = now() - start;
+
+        if ( rc )
+            printf("Restore %u failed: %d - %s\n", i, errno, strerror(errno));
+        else
+        {
+            printf("Restore %u: %lu MiB in %.3fs: %.2f GB/s guest, "
+                   "%.2f GB/s stream\n", i, nr_pages >> 8, elapsed,
+                   nr_pages * XC_PAGE_SIZE / elapsed / 1e9,
+                   st.st_size / elapsed / 1e9);
+
+            if ( best == 0 || elapsed < best )
+                best = elapsed;
+
+            nr_bad = walk_memory(domid, nr_pages, false);
+            if ( nr_bad )
+            {
+                printf("  %lu pages differ\n", nr_bad);
+                rc = -1;
+            }
+        }
+
+        close(fd);
+        xc_domain_destroy(xch, domid);
+    }
+
+    if ( !rc )
+        printf("Best: %.2f GB/s\n", nr_pages * XC_PAGE_SIZE / best / 1e9);
+
+    return rc;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s save <MiB> <image>\n"
+            "       %s restore <MiB> <image> [iterations]\n",
+            prog, prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long nr_pages;
+    unsigned int iterations = 5;
+
+    if ( argc < 4 )
+        usage(argv[0]);
+
+    nr_pages = strtoul(argv[2], NULL, 0) << 8;
+    if ( !nr_pages )
+        usage(argv[0]);
+
+    if ( argc > 4 )
+        iterations = strtoul(argv[4], NULL, 0);
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    fmem = xenforeignmemory_open(NULL, 0);
+
+    if ( !xch || !fmem )
+        err(1, "Failed to open interfaces");
+
+    if ( !strcmp(argv[1], "save") && argc == 4 )
+        return !!do_save(nr_pages, argv[3]);
+    if ( !strcmp(argv[1], "restore") && iterations )
+        return !!do_restore(nr_pages, argv[3], iterations);
+
+    usage(argv[0]);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
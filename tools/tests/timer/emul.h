@@ -0,0 +1,169 @@
+/*
+ * Environment for building the timer code of the hypervisor as part of a
+ * user space test harness, with a single CPU and a clock under the control
+ * of the tests.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEST_TIMER_
+#define _TEST_TIMER_
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define container_of(ptr, type, member) ({                      \
+        typeof(((type *)0)->member) *mptr = (ptr);              \
+                                                                \
+        (type *)((char *)mptr - offsetof(type, member));        \
+})
+
+#define smp_wmb()
+#define prefetch(x) __builtin_prefetch(x)
+#define ASSERT(x) assert(x)
+#define ASSERT_UNREACHABLE() assert(0)
+#define BUG() abort()
+#define BUG_ON(x) assert(!(x))
+#define cf_check
+#define __init
+#define __read_mostly
+#define __cacheline_aligned
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define cpu_relax()
+#define read_atomic(p) (*(p))
+#define write_atomic(p, v) (*(p) = (v))
+#define ffs64(x) __builtin_ffsll(x)
+#define BUILD_BUG_ON(cond) ((void)sizeof(char[1 - 2 * !!(cond)]))
+
+typedef bool bool_t;
+
+#include "list.h"
+
+typedef int64_t s_time_t;
+#define PRI_stime PRId64
+#define STIME_MAX ((s_time_t)((uint64_t)~0ull >> 1))
+#define MILLISECS(ms) ((s_time_t)((ms) * 1000000ULL))
+#define SECONDS(s) ((s_time_t)((s) * 1000000000ULL))
+
+/* The time the tests set, or the monotonic clock for benchmarking. */
+extern s_time_t emul_time;
+extern bool emul_real_time;
+s_time_t NOW(void);
+
+/* Single CPU and nothing running concurrently: locks only need to be there. */
+typedef bool spinlock_t;
+#define spin_lock_init(l) (*(l) = false)
+#define spin_lock(l) ({ assert(!*(l)); *(l) = true; })
+#define spin_unlock(l) ({ assert(*(l)); *(l) = false; })
+#define spin_lock_irq(l) spin_lock(l)
+#define spin_unlock_irq(l) spin_unlock(l)
+#define spin_lock_irqsave(l, f) ({ (f) = 0; spin_lock(l); })
+#define spin_unlock_irqrestore(l, f) ({ (void)(f); spin_unlock(l); })
+#define local_irq_save(f) ((f) = 0)
+#define local_irq_restore(f) ((void)(f))
+
+#define DEFINE_RCU_READ_LOCK(x) int x
+#define rcu_read_lock(x) ((void)(x))
+#define rcu_read_unlock(x) ((void)(x))
+
+#define DECLARE_PER_CPU(type, name) extern typeof(type) per_cpu__##name
+#define DEFINE_PER_CPU(type, name) typeof(type) per_cpu__##name
+#define per_cpu(var, cpu) (*((void)(cpu), &per_cpu__##var))
+#define this_cpu(var) per_cpu__##var
+
+#define smp_processor_id() 0U
+#define cpu_online(cpu) ((cpu) == 0)
+#define cpumask_any(mask) ((void)(mask), 0U)
+#define for_each_online_cpu(cpu) for ( (cpu) = 0; (cpu) < 1; (cpu)++ )
+static const int cpu_online_map;
+
+#define park_offline_cpus false
+#define system_state 0
+#define SYS_STATE_suspend 1
+
+struct notifier_block {
+    int (*notifier_call)(struct notifier_block *nfb, unsigned long action,
+                         void *hcpu);
+    int priority;
+};
+
+#define CPU_UP_PREPARE    1
+#define CPU_UP_CANCELED   2
+#define CPU_DEAD          3
+#define CPU_RESUME_FAILED 4
+#define CPU_REMOVE        5
+#define NOTIFY_DONE       0
+#define register_cpu_notifier(nfb) ((void)(nfb))
+
+#include "timer.h"
+
+/* Parameters are left for the tests to set, as <variable>_param. */
+#define integer_param(name, var) typeof(var) *const var##_param = &(var)
+#define boolean_param(name, var) typeof(var) *const var##_param = &(var)
+
+#define xmalloc_array(type, nr) ((type *)malloc(sizeof(type) * (nr)))
+#define xzalloc(type) ((type *)calloc(1, sizeof(type)))
+#define xfree(p) free(p)
+#define XFREE(p) ({ free(p); (p) = NULL; })
+
+#define XENLOG_WARNING
+#define printk printf
+#define printk_once printf
+
+#define TIMER_SOFTIRQ 0
+void open_softirq(int nr, void (*handler)(void));
+void raise_softirq(unsigned int nr);
+void cpu_raise_softirq(unsigned int cpu, unsigned int nr);
+void process_pending_softirqs(void);
+
+typedef void keyhandler_fn_t(unsigned char key);
+void register_keyhandler(unsigned char key, keyhandler_fn_t *fn,
+                         const char *desc, bool diagnostic);
+
+#define min(x, y) ({                    \
+        const typeof(x) tx = (x);       \
+        const typeof(y) ty = (y);       \
+                                        \
+        (void) (&tx == &ty);            \
+        tx < ty ? tx : ty;              \
+})
+
+#define max(x, y) ({                    \
+        const typeof(x) tx = (x);       \
+        const typeof(y) ty = (y);       \
+                                        \
+        (void) (&tx == &ty);            \
+        tx > ty ? tx : ty;              \
+})
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
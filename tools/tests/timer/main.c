@@ -0,0 +1,401 @@
+/*
+ * Unit tests for the timer code, using the heap and the timer wheel.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+#include <unistd.h>
+
+#include "emul.h"
+
+extern bool *const opt_timer_wheel_param;
+extern unsigned int *const timer_slop_param;
+
+s_time_t emul_time;
+bool emul_real_time;
+
+s_time_t NOW(void)
+{
+    struct timespec ts;
+
+    if ( !emul_real_time )
+        return emul_time;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void (*timer_softirq)(void);
+static bool softirq_pending;
+
+void open_softirq(int nr, void (*handler)(void))
+{
+    assert(nr == TIMER_SOFTIRQ);
+    timer_softirq = handler;
+}
+
+void raise_softirq(unsigned int nr)
+{
+    assert(nr == TIMER_SOFTIRQ);
+    softirq_pending = true;
+}
+
+void cpu_raise_softirq(unsigned int cpu, unsigned int nr)
+{
+    assert(cpu == 0);
+    raise_softirq(nr);
+}
+
+/* Time the softirq started at, and the deadline it programmed when. */
+static s_time_t softirq_time, programmed, programmed_time;
+
+void process_pending_softirqs(void)
+{
+    while ( softirq_pending )
+    {
+        softirq_pending = false;
+        softirq_time = NOW();
+        timer_softirq();
+    }
+}
+
+int reprogram_timer(s_time_t timeout)
+{
+    programmed = timeout;
+    programmed_time = NOW();
+
+    return 1;
+}
+
+static keyhandler_fn_t *bench_key;
+
+void register_keyhandler(unsigned char key, keyhandler_fn_t *fn,
+                         const char *desc, bool diagnostic)
+{
+    if ( key == 'b' )
+        bench_key = fn;
+}
+
+#define NR_TIMERS 512
+
+struct test_timer {
+    struct timer timer;
+    s_time_t expires;
+    bool armed;
+    unsigned int fired;
+    /* Latest a timer fired after its expiry. */
+    s_time_t late;
+    /* Re-arm from the handler this much after the expiry. */
+    s_time_t period;
+    /* Let time pass in the handler, and arm other timers meanwhile. */
+    s_time_t slow;
+};
+
+static struct test_timer timers[NR_TIMERS];
+
+static void arm(struct test_timer *t, s_time_t expires)
+{
+    t->expires = expires;
+    t->armed = true;
+    set_timer(&t->timer, expires);
+}
+
+static void disarm(struct test_timer *t)
+{
+    t->armed = false;
+    stop_timer(&t->timer);
+}
+
+static void test_timer_fn(void *data)
+{
+    struct test_timer *t = data;
+    s_time_t now = NOW();
+    unsigned int i;
+
+    assert(t->armed && now > t->expires);
+    t->armed = false;
+    t->fired++;
+    t->late = max(t->late, now - t->expires);
+
+    if ( t->period )
+        arm(t, t->expires + t->period);
+
+    if ( t->slow )
+    {
+        emul_time += t->slow;
+        /* One timer already due, and a burst spread over the next 5ms. */
+        arm(&timers[1], emul_time - t->slow / 2);
+        for ( i = 2; i < NR_TIMERS; i++ )
+            arm(&timers[i], emul_time + i * 10000);
+    }
+}
+
+static void init_timers(void)
+{
+    unsigned int i;
+
+    for ( i = 0; i < NR_TIMERS; i++ )
+    {
+        memset(&timers[i], 0, sizeof(timers[i]));
+        init_timer(&timers[i].timer, test_timer_fn, &timers[i], 0);
+    }
+}
+
+static void kill_timers(void)
+{
+    unsigned int i;
+
+    for ( i = 0; i < NR_TIMERS; i++ )
+        kill_timer(&timers[i].timer);
+}
+
+/*
+ * The timer interrupt, if the time has come, and checks that all timers due
+ * have run and the deadline programmed is early enough for the others.
+ */
+static void step(s_time_t now)
+{
+    s_time_t first = STIME_MAX;
+    unsigned int i;
+
+    assert(now >= emul_time);
+    emul_time = now;
+    if ( programmed && now >= programmed )
+        raise_softirq(TIMER_SOFTIRQ);
+    process_pending_softirqs();
+
+    for ( i = 0; i < NR_TIMERS; i++ )
+        if ( timers[i].armed )
+        {
+            assert(timers[i].expires >= softirq_time);
+            first = min(first, timers[i].expires);
+        }
+
+    if ( first != STIME_MAX )
+        assert(programmed &&
+               programmed <= max(first, programmed_time + *timer_slop_param));
+}
+
+/* Let time pass from one timer interrupt to the next, as on an idle CPU. */
+static void run_idle(void)
+{
+    do {
+        step(max(programmed, emul_time));
+    } while ( programmed );
+}
+
+static void test_basic(void)
+{
+    static const s_time_t expiries[] = {
+        /* Due already, and in the same and next few 65us ticks. */
+        -1, 0, 1, 10000, 65535, 65536, 100000, 200000,
+        /* Further away, for each level of the wheel and for the heap. */
+        MILLISECS(1), MILLISECS(3), MILLISECS(4) + 1, MILLISECS(10),
+        MILLISECS(300), MILLISECS(268) + 1, SECONDS(1), SECONDS(17) - 1,
+        SECONDS(17) + 1, SECONDS(100), SECONDS(1000),
+    };
+    s_time_t start = emul_time;
+    unsigned int i;
+
+    init_timers();
+
+    for ( i = 0; i < ARRAY_SIZE(expiries); i++ )
+        arm(&timers[i], start + expiries[i]);
+    /* Several timers in a single slot. */
+    for ( ; i < 64; i++ )
+        arm(&timers[i], start + MILLISECS(2) + i * 997);
+    /* Stopped and moved ones must not fire at their old expiry. */
+    disarm(&timers[8]);
+    disarm(&timers[16]);
+    arm(&timers[13], start + MILLISECS(5));
+    arm(&timers[17], start + MILLISECS(1));
+
+    step(start);
+    run_idle();
+
+    for ( i = 0; i < 64; i++ )
+    {
+        assert(timers[i].fired == (i != 8 && i != 16));
+        assert(timers[i].late <= *timer_slop_param);
+    }
+
+    kill_timers();
+}
+
+/* Timers set again from their handlers, and handlers taking long. */
+static void test_handlers(void)
+{
+    s_time_t start = emul_time;
+    unsigned int i;
+
+    init_timers();
+
+    /* Periodic timers, some catching up when late. */
+    for ( i = 64; i < 96; i++ )
+    {
+        timers[i].period = (i - 63) * 50000;
+        arm(&timers[i], start + i * 1000);
+    }
+    for ( i = 0; i < 40; i++ )
+        step(start + i * 777777);
+    for ( i = 64; i < 96; i++ )
+    {
+        assert(timers[i].fired);
+        timers[i].period = 0;
+    }
+    run_idle();
+    for ( i = 64; i < 96; i++ )
+        timers[i].late = 0;
+
+    /*
+     * A slow handler, with timers in its slot still to run, during which
+     * the timers are set again and time moves on by more than the wheel
+     * covers at its lowest level, or at all.
+     */
+    for ( i = 0; i < 2; i++ )
+    {
+        s_time_t slow = i ? SECONDS(20) : MILLISECS(7);
+        unsigned int j;
+
+        start = emul_time;
+        timers[0].slow = slow;
+        arm(&timers[0], start + 1000);
+        for ( j = 2; j < 64; j++ )
+            arm(&timers[j], start + 1000 + j);
+        step(start + 2000);
+        timers[0].slow = 0;
+
+        run_idle();
+        for ( j = 1; j < NR_TIMERS; j++ )
+        {
+            assert(!timers[j].armed);
+            assert(timers[j].late <= *timer_slop_param + (j < 64 ? slow : 0));
+            timers[j].late = 0;
+        }
+    }
+
+    kill_timers();
+}
+
+/* Random timer operations, and time moving on by random amounts. */
+static void test_random(unsigned int iterations)
+{
+    unsigned int i, j, fired = 0;
+
+    init_timers();
+
+    for ( i = 0; i < iterations; i++ )
+    {
+        for ( j = 0; j < 16; j++ )
+        {
+            struct test_timer *t = &timers[rand() % NR_TIMERS];
+            s_time_t delta;
+
+            switch ( rand() % 8 )
+            {
+            case 0:
+                delta = rand() % SECONDS(40);
+                break;
+            case 1:
+                delta = -(rand() % MILLISECS(1));
+                break;
+            default:
+                delta = rand() % MILLISECS(20);
+                break;
+            }
+
+            if ( t->armed && !(rand() % 4) )
+                disarm(t);
+            else
+                arm(t, emul_time + delta);
+        }
+
+        switch ( rand() % 4 )
+        {
+        case 0:
+            if ( programmed )
+                step(max(programmed, emul_time));
+            break;
+        case 1:
+            step(emul_time + rand() % SECONDS(5));
+            break;
+        default:
+            step(emul_time + rand() % MILLISECS(2));
+            break;
+        }
+    }
+
+    run_idle();
+    for ( i = 0; i < NR_TIMERS; i++ )
+    {
+        assert(!timers[i].armed);
+        fired += timers[i].fired;
+    }
+    assert(fired);
+
+    kill_timers();
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int wheel;
+    int opt;
+    bool bench = false;
+
+    while ( (opt = getopt(argc, argv, "b")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'b':
+            bench = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-b]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    emul_time = SECONDS(1000);
+
+    /* The heap first: CPUs get a wheel if there is none yet. */
+    for ( wheel = 0; wheel < 2; wheel++ )
+    {
+        *opt_timer_wheel_param = wheel;
+        timer_init();
+
+        test_basic();
+        test_handlers();
+        test_random(20000);
+
+        if ( bench )
+        {
+            emul_real_time = true;
+            bench_key('b');
+            emul_time = NOW();
+            emul_real_time = false;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
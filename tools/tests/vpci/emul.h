@@ -26,6 +26,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define container_of(ptr, type, member) ({                      \
         typeof(((type *)0)->member) *mptr = (ptr);              \
@@ -90,6 +91,9 @@ typedef union {
 
 #define xzalloc(type) ((type *)calloc(1, sizeof(type)))
 #define xmalloc(type) ((type *)malloc(sizeof(type)))
+#define xmalloc_array(type, num) ((type *)malloc(sizeof(type) * (num)))
+#define xrealloc_array(ptr, num) \
+    ((typeof(ptr))realloc(ptr, sizeof(*(ptr)) * (num)))
 #define xfree(p) free(p)
 
 #define pci_get_pdev(...) (&test_pdev)
@@ -107,6 +111,8 @@ typedef union {
 
 #define PCI_CFG_SPACE_EXP_SIZE 4096
 
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
 #define BUG() assert(0)
 #define ASSERT_UNREACHABLE() assert(0)
 
@@ -1,5 +1,5 @@
 /*
- * Unit tests for the generic vPCI handler code.
+ * Unit tests and access benchmark for the generic vPCI handler code.
  *
  * Copyright (C) 2017 Citrix Systems R&D
  *
@@ -16,6 +16,9 @@
  * License along with this program; If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <time.h>
+#include <unistd.h>
+
 #include "emul.h"
 
 /* Single vcpu (current), and single domain with a single PCI device. */
@@ -141,6 +144,63 @@ void multiwrite4_check(unsigned int reg)
     multiread4_check(reg, val);
 }
 
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Accesses to nr 32b registers in the extended config space, 8 bytes apart,
+ * with hardware in between.  MSI-X mask and unmask writes look like this.
+ */
+#define BENCH_BASE 0x100
+
+static void bench_access(unsigned int nr, unsigned int accesses)
+{
+    uint32_t *store = calloc(nr, sizeof(*store));
+    unsigned int *reg = malloc(accesses * sizeof(*reg));
+    unsigned int i;
+    uint64_t start, read_ns, write_ns;
+    uint32_t sum = 0;
+
+    assert(store && reg);
+
+    for ( i = 0; i < nr; i++ )
+        VPCI_ADD_REG(vpci_read32, vpci_write32, BENCH_BASE + i * 8, 4,
+                     store[i]);
+
+    for ( i = 0; i < accesses; i++ )
+        reg[i] = BENCH_BASE + (rand() % nr) * 8;
+
+    start = now_ns();
+    for ( i = 0; i < accesses; i++ )
+        VPCI_WRITE(reg[i], 4, i);
+    write_ns = now_ns() - start;
+
+    start = now_ns();
+    for ( i = 0; i < accesses; i++ )
+    {
+        uint32_t val;
+
+        VPCI_READ(reg[i], 4, val);
+        sum += val;
+    }
+    read_ns = now_ns() - start;
+
+    printf("%4u registers: %6.1f ns per read, %6.1f ns per write (%x)\n",
+           nr, (double)read_ns / accesses, (double)write_ns / accesses, sum);
+
+    for ( i = 0; i < nr; i++ )
+        VPCI_REMOVE_REG(BENCH_BASE + i * 8, 4);
+
+    free(store);
+    free(reg);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -154,10 +214,24 @@ main(int argc, char **argv)
     uint16_t r20[2] = { };
     uint32_t r24 = 0;
     uint8_t r28, r30;
+    uint8_t r256[64];
     unsigned int i;
-    int rc;
+    int rc, opt;
+    bool bench = false;
+
+    while ( (opt = getopt(argc, argv, "b")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'b':
+            bench = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-b]\n", argv[0]);
+            return 1;
+        }
+    }
 
-    INIT_LIST_HEAD(&vpci.handlers);
     spin_lock_init(&vpci.lock);
 
     VPCI_ADD_REG(vpci_read32, vpci_write32, 0, 4, r0);
@@ -296,6 +370,23 @@ main(int argc, char **argv)
     VPCI_REMOVE_INVALID_REG(16, 2);
     VPCI_REMOVE_INVALID_REG(30, 2);
 
+    /* Add enough registers to have to grow the array, in reverse order. */
+    for ( i = ARRAY_SIZE(r256); i--; )
+    {
+        r256[i] = i;
+        VPCI_ADD_REG(vpci_read8, vpci_write8, 256 + i * 2, 1, r256[i]);
+    }
+    for ( i = 0; i < ARRAY_SIZE(r256); i += 2 )
+        VPCI_READ_CHECK(256 + i * 2, 4, 0xff000000 | ((i + 1) << 16) |
+                                        0xff00 | i);
+    for ( i = 0; i < ARRAY_SIZE(r256); i++ )
+        VPCI_REMOVE_REG(256 + i * 2, 1);
+    VPCI_READ_CHECK(256, 4, 0xffffffff);
+
+    if ( bench )
+        for ( i = 8; i <= 256; i *= 2 )
+            bench_access(i, 1000000);
+
     return 0;
 }
 
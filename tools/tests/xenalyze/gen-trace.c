@@ -0,0 +1,165 @@
+/*
+ * Generate a synthetic trace for xenalyze.
+ *
+ * Each pcpu runs a different HVM vcpu in each time slice, taking a stream
+ * of VMEXIT/VMENTRY pairs for it, so that domains move between pcpus the
+ * way they would on a real host.  The output is deterministic for a given
+ * set of parameters.
+ *
+ * Usage: gen-trace <file> [slices]
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xen/trace.h>
+
+#define NR_PCPUS     4
+#define NR_DOMAINS   6
+#define NR_VCPUS     2          /* Per domain */
+#define SLICE_TSC    2400000    /* 1ms at xenalyze's default 2.4GHz */
+
+#define VMX_EXIT_CPUID   10
+#define VMX_EXIT_IO      30
+
+#define IDLE_DOMAIN        32767
+
+#define RUNSTATE_running   0
+#define RUNSTATE_runnable  1
+
+static uint32_t buf[1 << 16];
+static unsigned int len;
+
+static uint32_t rand_state = 1;
+
+/* Trivial LCG, to keep the output independent of the libc. */
+static uint32_t next_rand(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 8;
+}
+
+static void record(uint32_t event, uint64_t tsc, unsigned int nr,
+                   const uint32_t *extra)
+{
+    if ( len + 3 + nr > sizeof(buf) / sizeof(*buf) )
+    {
+        fprintf(stderr, "Window too large\n");
+        exit(1);
+    }
+
+    buf[len++] = event | (nr << 28) | TRC_HD_CYCLE_FLAG;
+    buf[len++] = tsc;
+    buf[len++] = tsc >> 32;
+    memcpy(&buf[len], extra, nr * sizeof(*extra));
+    len += nr;
+}
+
+static void runstate(uint64_t tsc, unsigned int dom, unsigned int vcpu,
+                     unsigned int old, unsigned int new)
+{
+    uint32_t d = (dom << 16) | vcpu;
+
+    record(TRC_SCHED_RUNSTATE_CHANGE | (old << 8) | (new << 4), tsc, 1, &d);
+}
+
+static void flush_window(FILE *f, unsigned int cpu)
+{
+    uint32_t hdr[3] = {
+        TRC_TRACE_CPU_CHANGE | (2 << 28),
+        cpu,
+        len * sizeof(*buf),
+    };
+
+    if ( fwrite(hdr, sizeof(hdr), 1, f) != 1 ||
+         fwrite(buf, sizeof(*buf), len, f) != len )
+    {
+        perror("fwrite");
+        exit(1);
+    }
+
+    len = 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int slices = argc > 2 ? strtoul(argv[2], NULL, 0) : 200;
+    unsigned int s, cpu, i, n, v, dom, vcpu;
+    uint64_t tsc, end;
+    uint32_t d[2];
+    FILE *f;
+
+    if ( argc < 2 )
+    {
+        fprintf(stderr, "Usage: %s <file> [slices]\n", argv[0]);
+        return 1;
+    }
+
+    f = fopen(argv[1], "wb");
+    if ( !f )
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    for ( s = 0; s < slices; s++ )
+    {
+        for ( cpu = 0; cpu < NR_PCPUS; cpu++ )
+        {
+            /* Distinct vcpus on each pcpu within a slice. */
+            v = (s + cpu * (NR_DOMAINS * NR_VCPUS / NR_PCPUS)) %
+                (NR_DOMAINS * NR_VCPUS);
+            dom = v / NR_VCPUS + 1;
+            vcpu = v % NR_VCPUS;
+
+            tsc = (uint64_t)s * SLICE_TSC + cpu * 7 + 1000;
+            end = tsc + SLICE_TSC - 20000;
+
+            /* Each pcpu starts out running its idle vcpu. */
+            if ( s == 0 )
+                runstate(tsc - 100, IDLE_DOMAIN, cpu, RUNSTATE_running,
+                         RUNSTATE_runnable);
+
+            runstate(tsc, dom, vcpu, RUNSTATE_runnable, RUNSTATE_running);
+
+            n = 5 + next_rand() % (10 * dom);
+            for ( i = 0; i < n; i++ )
+            {
+                tsc += 1000 + next_rand() % 20000;
+                if ( tsc >= end )
+                    break;
+
+                d[0] = (next_rand() & 1) ? VMX_EXIT_CPUID : VMX_EXIT_IO;
+                d[1] = 0xffffffff81000000U + (next_rand() & 0xfff0);
+                record(TRC_HVM_VMEXIT, tsc, 2, d);
+
+                tsc += 500 + next_rand() % 2000;
+                record(TRC_HVM_VMENTRY, tsc, 0, NULL);
+            }
+
+            runstate(end, dom, vcpu, RUNSTATE_running, RUNSTATE_runnable);
+
+            flush_window(f, cpu);
+        }
+    }
+
+    if ( fclose(f) )
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -37,6 +37,7 @@
 #define WRITE_BUFFERS_N    10
 #define WRITE_BUFFERS_SIZE 4000
 #define MAX_TA_LOOPS       100
+#define LATENCY_N          5000
 
 struct test {
     char *name;
@@ -52,6 +53,8 @@ static char *path;
 static char *paths[WRITE_BUFFERS_N];
 static char write_buffers[WRITE_BUFFERS_N][WRITE_BUFFERS_SIZE];
 static int ta_loops;
+static unsigned int watches_n;
+static struct xs_handle *lat_xsh[2];
 
 static struct option options[] = {
     { "list-tests", 0, NULL, 'l' },
@@ -59,6 +62,7 @@ static struct option options[] = {
     { "random", 1, NULL, 'r' },
     { "help", 0, NULL, 'h' },
     { "iterations", 1, NULL, 'i' },
+    { "ring", 0, NULL, 'R' },
     { NULL, 0, NULL, 0 }
 };
 
@@ -137,6 +141,7 @@ static void usage(int ret)
     fprintf(out, "  -i|--iterations <i>  perform each test <i> times (default 1)\n");
     fprintf(out, "  -l|--list-tests      list available tests\n");
     fprintf(out, "  -r|--random <time>   perform random tests for <time> seconds\n");
+    fprintf(out, "  -R|--ring            use a shared ring instead of the socket\n");
     fprintf(out, "  -t|--test <test>     run <test> (default is all tests)\n");
     fprintf(out, "  -h|--help            print this usage information\n");
     exit(ret);
@@ -405,6 +410,243 @@ static int test_ta3_deinit(uintptr_t par)
     return verify_node(paths[0], "b", 1);
 }
 
+/* Set <n> watches on nodes not touched by any test. */
+static int set_watches(unsigned int n)
+{
+    char node[64], token[16];
+    char **vec;
+
+    for ( ; watches_n < n; watches_n++ )
+    {
+        snprintf(node, sizeof(node), "%s-w/%u", path, watches_n);
+        snprintf(token, sizeof(token), "%u", watches_n);
+        if ( !xs_watch(xsh, node, token) )
+            return errno;
+    }
+
+    for ( ; watches_n > n; watches_n-- )
+    {
+        snprintf(node, sizeof(node), "%s-w/%u", path, watches_n - 1);
+        snprintf(token, sizeof(token), "%u", watches_n - 1);
+        if ( !xs_unwatch(xsh, node, token) )
+            return errno;
+    }
+
+    /* Drop the initial events of new watches. */
+    while ( (vec = xs_check_watch(xsh)) )
+        free(vec);
+
+    return 0;
+}
+
+static int test_watch_init(uintptr_t par)
+{
+    return set_watches(par);
+}
+
+static int test_watch(uintptr_t par)
+{
+    return xs_write(xsh, XBT_NULL, paths[0], write_buffers[0], 1) ? 0 : errno;
+}
+
+static int test_watch_deinit(uintptr_t par)
+{
+    return verify_node(paths[0], write_buffers[0], 1);
+}
+
+static int test_coalesce_init(uintptr_t par)
+{
+    char **vec;
+    unsigned int num;
+    bool found;
+
+    if ( !xs_watch_coalesce(xsh, path, "coalesce") )
+        return errno;
+
+    /*
+     * Drop the initial event, which is sent after the reply, and any events
+     * of the watches of earlier tests queued before it.
+     */
+    do {
+        vec = xs_read_watch(xsh, &num);
+        if ( !vec )
+            return errno;
+        found = !strcmp(vec[XS_WATCH_TOKEN], "coalesce");
+        free(vec);
+    } while ( !found );
+
+    return 0;
+}
+
+/*
+ * Write all nodes in one batch: the events of the coalescing watch on their
+ * parent are all queued before the reply, so they must have been merged into
+ * a single one for the parent.
+ */
+static int test_coalesce(uintptr_t par)
+{
+    struct xs_batch *b;
+    unsigned int i, n = 0;
+    char **vec;
+    int ret = 0;
+
+    b = xs_batch_start();
+    if ( !b )
+        return errno;
+
+    for ( i = 0; i < WRITE_BUFFERS_N && !ret; i++ )
+        if ( !xs_batch_write(b, paths[i], write_buffers[i], 1) )
+            ret = errno;
+    if ( !ret && !xs_batch_commit(xsh, XBT_NULL, b) )
+        ret = errno;
+    xs_batch_free(b);
+
+    while ( (vec = xs_check_watch(xsh)) )
+    {
+        if ( strcmp(vec[XS_WATCH_PATH], path) )
+            ret = ret ? : EINVAL;
+        free(vec);
+        n++;
+    }
+
+    return ret ? : (n == 1 ? 0 : E2BIG);
+}
+
+static int test_coalesce_deinit(uintptr_t par)
+{
+    if ( !xs_unwatch(xsh, path, "coalesce") )
+        return errno;
+
+    return test_dir_deinit(par);
+}
+
+#define test_batch_init ret0
+
+/*
+ * Write all nodes and set their permissions in one batch.  With <par> set
+ * the batch is made to fail by its last operation, so it mustn't have any
+ * effect.
+ */
+static int test_batch(uintptr_t par)
+{
+    struct xs_permissions perms[2] = {
+        { .id = 0, .perms = XS_PERM_NONE },
+        { .id = 1, .perms = XS_PERM_READ },
+    };
+    struct xs_batch *b;
+    unsigned int i;
+    int ret = 0;
+
+    b = xs_batch_start();
+    if ( !b )
+        return errno;
+
+    for ( i = 0; i < WRITE_BUFFERS_N && !ret; i++ )
+        if ( !xs_batch_write(b, paths[i], write_buffers[i], 1) ||
+             !xs_batch_set_permissions(b, paths[i], perms,
+                                       ARRAY_SIZE(perms)) )
+            ret = errno;
+    if ( !ret && par && !xs_batch_mkdir(b, "/invalid//path") )
+        ret = errno;
+
+    if ( !ret && !xs_batch_commit(xsh, XBT_NULL, b) )
+        ret = errno;
+    xs_batch_free(b);
+
+    if ( par )
+        return (ret == EINVAL) ? 0 : (ret ? : EEXIST);
+
+    return ret;
+}
+
+static int test_batch_deinit(uintptr_t par)
+{
+    char **dir;
+    unsigned int num;
+
+    if ( !par )
+        return test_dir_deinit(par);
+
+    dir = xs_directory(xsh, XBT_NULL, path, &num);
+    if ( !dir )
+        return errno;
+    free(dir);
+
+    return num ? EEXIST : 0;
+}
+
+static uint64_t get_nsec(void)
+{
+    struct timespec tp;
+
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    const uint64_t *x = a, *y = b;
+
+    return (*x > *y) - (*x < *y);
+}
+
+/* Open a connection via the socket and one via a shared ring. */
+static int test_latency_init(uintptr_t par)
+{
+    if ( !xs_write(xsh, XBT_NULL, paths[0], write_buffers[0], 1) )
+        return errno;
+
+    lat_xsh[0] = xs_open(0);
+    lat_xsh[1] = xs_open(XS_OPEN_RING);
+    if ( !lat_xsh[0] || !lat_xsh[1] )
+        return errno;
+
+    return 0;
+}
+
+/* Time single reads via both connections. */
+static int test_latency(uintptr_t par)
+{
+    static const char *const via[] = { "socket", "ring" };
+    static uint64_t nsec[LATENCY_N];
+    char *buf;
+    unsigned int c, i, len;
+    uint64_t start;
+
+    for ( c = 0; c < ARRAY_SIZE(lat_xsh); c++ )
+    {
+        for ( i = 0; i < LATENCY_N; i++ )
+        {
+            start = get_nsec();
+            buf = xs_read(lat_xsh[c], XBT_NULL, paths[0], &len);
+            nsec[i] = get_nsec() - start;
+            if ( !buf )
+                return errno;
+            free(buf);
+        }
+
+        qsort(nsec, LATENCY_N, sizeof(*nsec), cmp_u64);
+        printf("%-10s: %s read p50: %"PRIu64" ns, p99: %"PRIu64" ns\n",
+               "latency", via[c], nsec[LATENCY_N / 2],
+               nsec[LATENCY_N * 99 / 100]);
+    }
+
+    return 0;
+}
+
+static int test_latency_deinit(uintptr_t par)
+{
+    unsigned int c;
+
+    for ( c = 0; c < ARRAY_SIZE(lat_xsh); c++ )
+    {
+        xs_close(lat_xsh[c]);
+        lat_xsh[c] = NULL;
+    }
+
+    return verify_node(paths[0], write_buffers[0], 1);
+}
+
 #define TEST(s, f, p, l) { s, f ## _init, f, f ## _deinit, (uintptr_t)(p), l }
 struct test tests[] = {
 TEST("read 1", test_read, 1, "Read node with 1 byte data"),
@@ -414,11 +656,20 @@ TEST("write 3000", test_write, 3000, "Write node with 3000 bytes data"),
 TEST("dir", test_dir, 0, "List directory"),
 TEST("rm node", test_rm, 0, "Remove single node"),
 TEST("rm dir", test_rm, WRITE_BUFFERS_N, "Remove node with sub-nodes"),
+TEST("batch", test_batch, 0, "Write and set permissions of 10 nodes at once"),
+TEST("batch x", test_batch, 1, "Failing batch of 10 nodes"),
 TEST("ta empty", test_ta1, 0, "Empty transaction"),
 TEST("ta empty x", test_ta1, 1, "Empty transaction abort"),
 TEST("ta rmw", test_ta2, 0, "Read-modify-write transaction"),
 TEST("ta rmw x", test_ta2, 1, "Read-modify-write transaction abort"),
 TEST("ta err", test_ta3, 0, "Transaction with conflict"),
+TEST("watch 1", test_watch, 1, "Write node with 1 other watch set"),
+TEST("watch 100", test_watch, 100, "Write node with 100 other watches set"),
+TEST("watch 1000", test_watch, 1000, "Write node with 1000 other watches set"),
+TEST("watch 10000", test_watch, 10000,
+     "Write node with 10000 other watches set"),
+TEST("coalesce", test_coalesce, 0, "Batch write with a coalescing watch set"),
+TEST("latency", test_latency, 0, "Read node via the socket and via a ring"),
 };
 
 static void cleanup(void)
@@ -427,6 +678,7 @@ static void cleanup(void)
     char **dir;
     unsigned int num;
 
+    set_watches(0);
     xs_rm(xsh, XBT_NULL, path);
 
     while ( true )
@@ -448,11 +700,12 @@ static void cleanup(void)
 int main(int argc, char *argv[])
 {
     int opt, t, iters = 1, ret = 0, randtime = 0;
+    unsigned long flags = 0;
     char *test = NULL;
     bool list = false;
     time_t stop;
 
-    while ( (opt = getopt_long(argc, argv, "lr:t:hi:", options,
+    while ( (opt = getopt_long(argc, argv, "lr:Rt:hi:", options,
                                NULL)) != -1 )
     {
         switch ( opt )
@@ -466,6 +719,9 @@ int main(int argc, char *argv[])
         case 'r':
             randtime = atoi(optarg);
             break;
+        case 'R':
+            flags |= XS_OPEN_RING;
+            break;
         case 't':
             test = optarg;
             break;
@@ -494,7 +750,7 @@ int main(int argc, char *argv[])
             err(2, "asprintf() malloc failure\n");
     }
 
-    xsh = xs_open(0);
+    xsh = xs_open(flags);
     if ( !xsh )
     {
         fprintf(stderr, "could not connect to xenstore\n");
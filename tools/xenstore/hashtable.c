@@ -50,6 +50,26 @@ indexFor(unsigned int tablelength, unsigned int hashvalue) {
     return (hashvalue % tablelength);
 }
 
+/*****************************************************************************/
+/* The entries are malloc()-ed, saving the talloc header of each. */
+static int
+hashtable_free_entries(void *_h)
+{
+    struct hashtable *h = _h;
+    struct entry *e, *f;
+    unsigned int i;
+
+    for (i = 0; i < h->tablelength; i++)
+    {
+        for (e = h->table[i]; NULL != e; e = f)
+        {
+            f = e->next;
+            free(e);
+        }
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 struct hashtable *
 create_hashtable(const void *ctx, unsigned int minsize,
@@ -82,6 +102,7 @@ create_hashtable(const void *ctx, unsigned int minsize,
     h->hashfn       = hashf;
     h->eqfn         = eqf;
     h->loadlimit    = (unsigned int)(((uint64_t)size * max_load_factor) / 100);
+    talloc_set_destructor(h, hashtable_free_entries);
     return h;
 
 err1:
@@ -159,6 +180,13 @@ hashtable_count(const struct hashtable *h)
 /*****************************************************************************/
 int
 hashtable_insert(struct hashtable *h, void *k, void *v)
+{
+    return hashtable_insert_key(h, k, k, v);
+}
+
+/*****************************************************************************/
+int
+hashtable_insert_key(struct hashtable *h, const void *hk, void *k, void *v)
 {
     /* This method allows duplicate keys - but they shouldn't be used */
     unsigned int index;
@@ -171,16 +199,16 @@ hashtable_insert(struct hashtable *h, void *k, void *v)
          * element may be ok. Next time we insert, we'll try expanding again.*/
         hashtable_expand(h);
     }
-    e = talloc_zero(h, struct entry);
+    e = malloc(sizeof(*e));
     if (NULL == e) { --(h->entrycount); return 0; } /*oom*/
-    e->h = hash(h,k);
+    e->h = hash(h,hk);
     index = indexFor(h->tablelength,e->h);
     e->k = k;
     if (h->flags & HASHTABLE_FREE_KEY)
-        talloc_steal(e, k);
+        talloc_steal(h, k);
     e->v = v;
     if (h->flags & HASHTABLE_FREE_VALUE)
-        talloc_steal(e, v);
+        talloc_steal(h, v);
     e->next = h->table[index];
     h->table[index] = e;
     return -1;
@@ -204,6 +232,34 @@ hashtable_search(const struct hashtable *h, const void *k)
     return NULL;
 }
 
+/*****************************************************************************/
+int
+hashtable_replace(struct hashtable *h, const void *k, void *newk, void *v)
+{
+    struct entry *e;
+    unsigned int hashvalue, index;
+    hashvalue = hash(h,k);
+    index = indexFor(h->tablelength,hashvalue);
+    for (e = h->table[index]; NULL != e; e = e->next)
+    {
+        if ((hashvalue != e->h) || !h->eqfn(k, e->k)) continue;
+        if (e->k != newk && (h->flags & HASHTABLE_FREE_KEY))
+        {
+            talloc_free(e->k);
+            talloc_steal(h, newk);
+        }
+        e->k = newk;
+        if (e->v != v && (h->flags & HASHTABLE_FREE_VALUE))
+        {
+            talloc_free(e->v);
+            talloc_steal(h, v);
+        }
+        e->v = v;
+        return -1;
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 void
 hashtable_remove(struct hashtable *h, const void *k)
@@ -226,7 +282,11 @@ hashtable_remove(struct hashtable *h, const void *k)
         {
             *pE = e->next;
             h->entrycount--;
-            talloc_free(e);
+            if (h->flags & HASHTABLE_FREE_KEY)
+                talloc_free(e->k);
+            if (h->flags & HASHTABLE_FREE_VALUE)
+                talloc_free(e->v);
+            free(e);
             return;
         }
         pE = &(e->next);
@@ -51,6 +51,24 @@ create_hashtable(const void *ctx, unsigned int minsize,
 int 
 hashtable_insert(struct hashtable *h, void *k, void *v);
 
+/*****************************************************************************
+ * hashtable_insert_key
+   
+ * @name        hashtable_insert_key
+ * @param   h   the hashtable to insert into
+ * @param   hk  a key equal to k, used for hashing - does not claim ownership
+ * @param   k   the key - hashtable claims ownership and will free on removal
+ * @param   v   the value - does not claim ownership
+ * @return      non-zero for successful insertion
+ *
+ * Like hashtable_insert(), for tables whose stored keys have another
+ * representation than the keys searched for: the hash function and the
+ * first parameter of the key equality function only ever see the latter.
+ */
+
+int 
+hashtable_insert_key(struct hashtable *h, const void *hk, void *k, void *v);
+
 /*****************************************************************************
  * hashtable_search
    
@@ -63,6 +81,22 @@ hashtable_insert(struct hashtable *h, void *k, void *v);
 void *
 hashtable_search(const struct hashtable *h, const void *k);
 
+/*****************************************************************************
+ * hashtable_replace
+   
+ * @name        hashtable_replace
+ * @param   h   the hashtable
+ * @param   k   the key to search for - does not claim ownership
+ * @param   newk the key to store instead, which must be equal to k
+ * @param   v   the value to store instead
+ * @return      non-zero if an entry for k was found
+ *
+ * The old key and value are freed as hashtable_remove() would.
+ */
+
+int
+hashtable_replace(struct hashtable *h, const void *k, void *newk, void *v);
+
 /*****************************************************************************
  * hashtable_remove
    
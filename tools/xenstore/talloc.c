@@ -321,9 +321,6 @@ static int talloc_unreference(const void *context, const void *ptr)
 */
 int talloc_unlink(const void *context, void *ptr)
 {
-	struct talloc_chunk *tc_p, *new_p;
-	void *new_parent;
-
 	if (ptr == NULL) {
 		return -1;
 	}
@@ -346,6 +343,23 @@ int talloc_unlink(const void *context, void *ptr)
 		}
 	}
 	
+	return talloc_unlink_parent(ptr);
+}
+
+/*
+  remove the parent context of a pointer, as talloc_unlink() does for
+  its parent. Unlike talloc_unlink() this doesn't need to find the parent
+  among its siblings first, so the caller has to know that it is one.
+*/
+int talloc_unlink_parent(void *ptr)
+{
+	struct talloc_chunk *tc_p, *new_p;
+	void *new_parent;
+
+	if (ptr == NULL) {
+		return -1;
+	}
+
 	tc_p = talloc_chunk_from_ptr(ptr);
 
 	if (tc_p->refs == NULL) {
@@ -19,6 +19,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,6 +39,8 @@
 #include "xenstored_core.h"
 #include "xenstored_control.h"
 #include "xenstored_domain.h"
+#include "xenstored_ring.h"
+#include "xenstored_transaction.h"
 #include "xenstored_watch.h"
 
 /* Mini-OS only knows about MAP_ANON. */
@@ -70,8 +73,23 @@ struct live_update {
 	bool force;
 	unsigned int timeout;
 	time_t started_at;
+
+	/*
+	 * The state is dumped while requests are still being served, see
+	 * dump_state_nodes_start().  Only then the live update is pending.
+	 */
+	FILE *dump_fp;
+	struct dump_precopy *precopy;
+	bool precopy_done;
+	uint64_t precopy_start;
 };
 
+/* Nodes dumped in each pass of the main loop while precopying. */
+#define LU_PRECOPY_NODES 1000
+
+/* Passes the start of the final dump to the new binary. */
+#define LU_FREEZE_ENV "XENSTORED_LU_FREEZE_MSEC"
+
 static struct live_update *lu_status;
 
 struct lu_dump_state {
@@ -85,6 +103,8 @@ struct lu_dump_state {
 
 static int lu_destroy(void *data)
 {
+	if (lu_status->dump_fp)
+		fclose(lu_status->dump_fp);
 #ifdef __MINIOS__
 	if (lu_status->dump_state)
 		munmap(lu_status->dump_state, lu_status->dump_size);
@@ -132,7 +152,12 @@ unsigned int lu_write_response(FILE *fp)
 
 bool lu_is_pending(void)
 {
-	return lu_status != NULL;
+	return lu_status && (!lu_status->precopy || lu_status->precopy_done);
+}
+
+bool lu_is_precopying(void)
+{
+	return lu_status && lu_status->precopy && !lu_status->precopy_done;
 }
 
 #else
@@ -151,6 +176,11 @@ bool lu_is_pending(void)
 {
 	return false;
 }
+
+bool lu_is_precopying(void)
+{
+	return false;
+}
 #endif
 
 struct cmd_s {
@@ -330,6 +360,33 @@ static int do_control_quota_s(const void *ctx, struct connection *conn,
 	return EINVAL;
 }
 
+static int do_control_transactions(const void *ctx, struct connection *conn,
+				   char **vec, int num)
+{
+	if (num)
+		return EINVAL;
+
+	return transaction_get_stats(ctx, conn);
+}
+
+static int do_control_watches(const void *ctx, struct connection *conn,
+			      char **vec, int num)
+{
+	if (num)
+		return EINVAL;
+
+	return watch_get_stats(ctx, conn);
+}
+
+static int do_control_node_memory(const void *ctx, struct connection *conn,
+				  char **vec, int num)
+{
+	if (num)
+		return EINVAL;
+
+	return store_get_stats(ctx, conn);
+}
+
 #ifdef __MINIOS__
 static int do_control_memreport(const void *ctx, struct connection *conn,
 				char **vec, int num)
@@ -410,6 +467,25 @@ static int do_control_print(const void *ctx, struct connection *conn,
 	return 0;
 }
 
+#ifndef NO_SOCKETS
+static int do_control_ring(const void *ctx, struct connection *conn,
+			   char **vec, int num)
+{
+	int ret;
+
+	if (num)
+		return EINVAL;
+
+	ret = local_ring_attach(conn);
+	if (ret)
+		return ret;
+
+	/* This is the first reply sent via the ring. */
+	send_ack(conn, XS_CONTROL);
+	return 0;
+}
+#endif
+
 #ifndef NO_LIVE_UPDATE
 static const char *lu_abort(const void *ctx, struct connection *conn)
 {
@@ -678,24 +754,56 @@ static const char *lu_reject_reason(const void *ctx)
 	return ret ? (const char *)ret : "Overlapping transactions";
 }
 
-static const char *lu_dump_state(const void *ctx, struct connection *conn)
+static const char *lu_dump_start(void)
 {
-	FILE *fp;
-	const char *ret;
-	struct xs_state_record_header end;
 	struct xs_state_preamble pre;
 
-	fp = lu_dump_open(ctx);
-	if (!fp)
+	lu_status->dump_fp = lu_dump_open(lu_status);
+	if (!lu_status->dump_fp)
 		return "Dump state open error";
 
 	memcpy(pre.ident, XS_STATE_IDENT, sizeof(pre.ident));
 	pre.version = htobe32(XS_STATE_VERSION);
 	pre.flags = XS_STATE_FLAGS;
-	if (fwrite(&pre, sizeof(pre), 1, fp) != 1) {
-		ret = "Dump write error";
-		goto out;
-	}
+	if (fwrite(&pre, sizeof(pre), 1, lu_status->dump_fp) != 1)
+		return "Dump write error";
+
+	lu_status->precopy = dump_state_nodes_start(lu_status);
+	if (!lu_status->precopy)
+		return "Allocation failure.";
+	lu_status->precopy_start = get_now_msec();
+
+	return NULL;
+}
+
+static const char *lu_precopy(void)
+{
+	const char *ret;
+	bool done;
+
+	ret = dump_state_nodes_step(lu_status->dump_fp, lu_status->precopy,
+				    LU_PRECOPY_NODES, &done);
+	if (ret || !done)
+		return ret;
+
+	syslog(LOG_INFO, "live-update: dumped %u nodes in %"PRIu64" ms\n",
+	       lu_status->precopy->nodes,
+	       get_now_msec() - lu_status->precopy_start);
+
+	/* Waiting for transactions to end starts only now. */
+	lu_status->precopy_done = true;
+	lu_status->started_at = time(NULL);
+
+	return NULL;
+}
+
+static const char *lu_dump_state(const void *ctx, struct connection *conn)
+{
+	FILE *fp = lu_status->dump_fp;
+	const char *ret;
+	struct xs_state_record_header end;
+	uint64_t start = get_now_msec();
+	char *env;
 
 	ret = dump_state_global(fp);
 	if (ret)
@@ -703,7 +811,7 @@ static const char *lu_dump_state(const void *ctx, struct connection *conn)
 	ret = dump_state_connections(fp);
 	if (ret)
 		goto out;
-	ret = dump_state_nodes(fp, ctx);
+	ret = dump_state_nodes_end(fp, ctx, lu_status->precopy);
 	if (ret)
 		goto out;
 
@@ -713,9 +821,21 @@ static const char *lu_dump_state(const void *ctx, struct connection *conn)
 		ret = "Dump write error";
 
  out:
+	lu_status->dump_fp = NULL;
 	lu_dump_close(fp);
 
-	return ret;
+	if (ret)
+		return ret;
+
+	syslog(LOG_INFO, "live-update: dumped %u changed nodes and the "
+	       "remaining state in %"PRIu64" ms\n",
+	       lu_status->precopy->changed_nodes, get_now_msec() - start);
+
+	env = talloc_asprintf(ctx, "%"PRIu64, start);
+	if (env)
+		setenv(LU_FREEZE_ENV, env, 1);
+
+	return NULL;
 }
 
 void lu_read_state(void)
@@ -724,6 +844,9 @@ void lu_read_state(void)
 	struct xs_state_record_header *head;
 	void *ctx = talloc_new(NULL); /* Work context for subfunctions. */
 	struct xs_state_preamble *pre;
+	uint64_t start = get_now_msec(), freeze;
+	unsigned int pass;
+	char *env;
 
 	syslog(LOG_INFO, "live-update: read state\n");
 	lu_get_dump_state(&state);
@@ -735,30 +858,41 @@ void lu_read_state(void)
 	    pre->version != htobe32(XS_STATE_VERSION) ||
 	    pre->flags != XS_STATE_FLAGS)
 		barf("Unknown record identifier");
-	for (head = state.buf + sizeof(*pre);
-	     head->type != XS_STATE_TYPE_END &&
-		(void *)head - state.buf < state.size;
-	     head = (void *)head + sizeof(*head) + head->length) {
-		switch (head->type) {
-		case XS_STATE_TYPE_GLOBAL:
-			read_state_global(ctx, head + 1);
-			break;
-		case XS_STATE_TYPE_CONN:
-			read_state_connection(ctx, head + 1);
-			break;
-		case XS_STATE_TYPE_WATCH:
-			read_state_watch(ctx, head + 1);
-			break;
-		case XS_STATE_TYPE_TA:
-			xprintf("live-update: ignore transaction record\n");
-			break;
-		case XS_STATE_TYPE_NODE:
-			read_state_node(ctx, head + 1);
-			break;
-		default:
-			xprintf("live-update: unknown state record %08x\n",
-				head->type);
-			break;
+
+	/*
+	 * Most nodes have been dumped before the other records, but they
+	 * can only be restored after those (e.g. the domains are needed for
+	 * the accounting), so look at the nodes in a second pass.
+	 */
+	for (pass = 0; pass < 2; pass++) {
+		for (head = state.buf + sizeof(*pre);
+		     head->type != XS_STATE_TYPE_END &&
+			(void *)head - state.buf < state.size;
+		     head = (void *)head + sizeof(*head) + head->length) {
+			if (pass != (head->type == XS_STATE_TYPE_NODE))
+				continue;
+
+			switch (head->type) {
+			case XS_STATE_TYPE_GLOBAL:
+				read_state_global(ctx, head + 1);
+				break;
+			case XS_STATE_TYPE_CONN:
+				read_state_connection(ctx, head + 1);
+				break;
+			case XS_STATE_TYPE_WATCH:
+				read_state_watch(ctx, head + 1);
+				break;
+			case XS_STATE_TYPE_TA:
+				xprintf("live-update: ignore transaction record\n");
+				break;
+			case XS_STATE_TYPE_NODE:
+				read_state_node(ctx, head + 1);
+				break;
+			default:
+				xprintf("live-update: unknown state record %08x\n",
+					head->type);
+				break;
+			}
 		}
 	}
 
@@ -766,6 +900,13 @@ void lu_read_state(void)
 
 	talloc_free(ctx);
 
+	env = getenv(LU_FREEZE_ENV);
+	freeze = env ? strtoull(env, NULL, 10) : start;
+	syslog(LOG_INFO, "live-update: state read in %"PRIu64" ms, "
+	       "frozen for %"PRIu64" ms\n", get_now_msec() - start,
+	       get_now_msec() - freeze);
+	unsetenv(LU_FREEZE_ENV);
+
 	/*
 	 * We may have missed the VIRQ_DOM_EXC notification and a domain may
 	 * have died while we were live-updating. So check all the domains are
@@ -842,6 +983,14 @@ static bool do_lu_start(struct delayed_request *req)
 
 	assert(lu_status->conn == conn);
 
+	if (!lu_status->precopy_done) {
+		ret = lu_precopy();
+		if (ret)
+			goto out;
+		if (!lu_status->precopy_done)
+			return false;
+	}
+
 	if (!lu_check_lu_allowed()) {
 		if (now < lu_status->started_at + lu_status->timeout)
 			return false;
@@ -877,6 +1026,8 @@ static bool do_lu_start(struct delayed_request *req)
 static const char *lu_start(const void *ctx, struct connection *conn,
 			    bool force, unsigned int to)
 {
+	const char *ret;
+
 	syslog(LOG_INFO, "live-update: start, force=%d, to=%u\n", force, to);
 
 	if (!lu_status || lu_status->conn != conn)
@@ -887,11 +1038,18 @@ static const char *lu_start(const void *ctx, struct connection *conn,
 		return "Kernel not complete.";
 #endif
 
+	if (lu_status->precopy)
+		return "Live-update already started.";
+
 	lu_status->force = force;
 	lu_status->timeout = to;
 	lu_status->started_at = time(NULL);
 	lu_status->in = conn->in;
 
+	ret = lu_dump_start();
+	if (ret)
+		return ret;
+
 	errno = delay_request(conn, conn->in, do_lu_start, conn, false);
 
 	return NULL;
@@ -977,9 +1135,15 @@ static struct cmd_s cmds[] = {
 	{ "logfile", do_control_logfile, "<file>" },
 	{ "memreport", do_control_memreport, "[<file>]" },
 #endif
+	{ "node-memory", do_control_node_memory, "" },
 	{ "print", do_control_print, "<string>" },
 	{ "quota", do_control_quota, "[set <name> <val>|<domid>]" },
 	{ "quota-soft", do_control_quota_s, "[set <name> <val>]" },
+#ifndef NO_SOCKETS
+	{ "ring", do_control_ring, "" },
+#endif
+	{ "transactions", do_control_transactions, "" },
+	{ "watches", do_control_watches, "" },
 	{ "help", do_control_help, "" },
 };
 
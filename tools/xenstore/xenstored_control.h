@@ -26,3 +26,6 @@ struct connection *lu_get_connection(void);
 unsigned int lu_write_response(FILE *fp);
 
 bool lu_is_pending(void);
+
+/* The nodes are being dumped for a live update in the main loop. */
+bool lu_is_precopying(void);
@@ -20,6 +20,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 #ifndef NO_SOCKETS
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -39,6 +42,7 @@
 #include <getopt.h>
 #include <signal.h>
 #include <assert.h>
+#include <ctype.h>
 #include <setjmp.h>
 
 #include <xenevtchn.h>
@@ -52,6 +56,7 @@
 #include "xenstored_transaction.h"
 #include "xenstored_domain.h"
 #include "xenstored_control.h"
+#include "xenstored_ring.h"
 #include "tdb.h"
 
 #ifndef NO_SOCKETS
@@ -65,12 +70,14 @@
 #endif
 
 extern xenevtchn_handle *xce_handle; /* in xenstored_domain.c */
-static int xce_pollfd_idx = -1;
-static struct pollfd *fds;
-static unsigned int current_array_size;
-static unsigned int nr_fds;
+static struct poll_fd xce_pfd;
 static unsigned int delayed_requests;
 
+/* Connections which might be able to make progress. */
+static LIST_HEAD(ready_conns);
+/* Connections waiting for a timeout or for live update to finish. */
+static LIST_HEAD(timed_conns);
+
 static int sock = -1;
 
 int orig_argc;
@@ -82,7 +89,8 @@ int tracefd = -1;
 static bool recovery = true;
 bool keep_orphans = false;
 static int reopen_log_pipe[2];
-static int reopen_log_pipe0_pollfd_idx = -1;
+static struct poll_fd reopen_log_pfd;
+static struct poll_fd sock_pfd;
 char *tracefile = NULL;
 TDB_CONTEXT *tdb_ctx = NULL;
 unsigned int trace_flags = TRACE_OBJ | TRACE_IO;
@@ -203,7 +211,7 @@ void reopen_log(void)
 	}
 }
 
-static uint64_t get_now_msec(void)
+uint64_t get_now_msec(void)
 {
 	struct timespec now_ts;
 
@@ -213,6 +221,14 @@ static uint64_t get_now_msec(void)
 	return now_ts.tv_sec * 1000 + now_ts.tv_nsec / 1000000;
 }
 
+static void event_unref(struct buffered_data *out)
+{
+	if (out->event_ref) {
+		*out->event_ref = NULL;
+		out->event_ref = NULL;
+	}
+}
+
 /*
  * Remove a struct buffered_data from the list of outgoing data.
  * A struct buffered_data related to a request having caused watch events to be
@@ -231,6 +247,7 @@ static void free_buffered_data(struct buffered_data *out,
 
 	list_del(&out->list);
 	out->on_out_list = false;
+	event_unref(out);
 
 	/*
 	 * Update conn->timeout_msec with the next found timeout value in the
@@ -339,6 +356,7 @@ static bool write_messages(struct connection *conn)
 		return true;
 
 	if (out->inhdr) {
+		event_unref(out);
 		if (verbose)
 			xprintf("Writing msg %s (%.*s) out to %p\n",
 				sockmsg_string(out->hdr.msg.type),
@@ -357,7 +375,7 @@ static bool write_messages(struct connection *conn)
 		out->used = 0;
 
 		/* Second write might block if non-zero. */
-		if (out->hdr.msg.len && !conn->domain)
+		if (out->hdr.msg.len && !conn->domain && !conn->ring)
 			return true;
 	}
 
@@ -430,6 +448,169 @@ int delay_request(struct connection *conn, struct buffered_data *in,
 	return 0;
 }
 
+/*
+ * The main loop waits for file descriptors with epoll() on Linux and with
+ * poll() elsewhere.  In both cases the set of watched descriptors is kept
+ * up to date as connections come and go, instead of being rebuilt for each
+ * wait.  A connection with events on its descriptor is marked ready.
+ */
+#ifdef __linux__
+static int epoll_fd = -1;
+
+static void poll_fd_ctl(struct poll_fd *pfd, int op)
+{
+	/* The EPOLL* event bits match the POLL* ones on Linux. */
+	struct epoll_event ev = {
+		.events = pfd->events,
+		.data.ptr = pfd,
+	};
+
+	if (epoll_fd < 0) {
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0)
+			barf_perror("Could not create epoll instance");
+	}
+
+	if (epoll_ctl(epoll_fd, op, pfd->fd, &ev)) {
+		syslog(LOG_ERR, "epoll_ctl failed for fd %d: %m\n", pfd->fd);
+		if (op == EPOLL_CTL_ADD)
+			pfd->added = false;
+	}
+}
+
+void poll_fd_add(struct poll_fd *pfd, int fd, short events,
+		 struct connection *conn)
+{
+	pfd->fd = fd;
+	pfd->events = events;
+	pfd->revents = 0;
+	pfd->conn = conn;
+	pfd->added = true;
+	poll_fd_ctl(pfd, EPOLL_CTL_ADD);
+}
+
+void poll_fd_set_events(struct poll_fd *pfd, short events)
+{
+	if (pfd->events == events)
+		return;
+
+	pfd->events = events;
+	poll_fd_ctl(pfd, EPOLL_CTL_MOD);
+}
+
+void poll_fd_del(struct poll_fd *pfd)
+{
+	if (!pfd->added)
+		return;
+
+	poll_fd_ctl(pfd, EPOLL_CTL_DEL);
+	pfd->added = false;
+}
+
+static int poll_fds_wait(int timeout)
+{
+	struct epoll_event evs[64];
+	struct poll_fd *pfd;
+	int i, n;
+
+	n = epoll_wait(epoll_fd, evs, ARRAY_SIZE(evs), timeout);
+
+	for (i = 0; i < n; i++) {
+		pfd = evs[i].data.ptr;
+		pfd->revents = evs[i].events;
+		if (pfd->conn)
+			conn_set_ready(pfd->conn);
+	}
+
+	return n;
+}
+#else
+static struct pollfd *fds;
+static struct poll_fd **fd_owners;
+static unsigned int current_array_size;
+static unsigned int nr_fds;
+
+void poll_fd_add(struct poll_fd *pfd, int fd, short events,
+		 struct connection *conn)
+{
+	if (current_array_size < nr_fds + 1) {
+		struct pollfd *new_fds;
+		struct poll_fd **new_owners;
+		unsigned long newsize;
+
+		/* Round up to 2^8 boundary, in practice this just
+		 * make newsize larger than current_array_size.
+		 */
+		newsize = ROUNDUP(nr_fds + 1, 8);
+
+		new_fds = realloc(fds, sizeof(struct pollfd) * newsize);
+		if (!new_fds)
+			goto fail;
+		fds = new_fds;
+		new_owners = realloc(fd_owners, sizeof(*fd_owners) * newsize);
+		if (!new_owners)
+			goto fail;
+		fd_owners = new_owners;
+		current_array_size = newsize;
+	}
+
+	pfd->fd = fd;
+	pfd->events = events;
+	pfd->revents = 0;
+	pfd->conn = conn;
+	pfd->added = true;
+	pfd->idx = nr_fds++;
+
+	fds[pfd->idx].fd = fd;
+	fds[pfd->idx].events = events;
+	fds[pfd->idx].revents = 0;
+	fd_owners[pfd->idx] = pfd;
+
+	return;
+fail:
+	syslog(LOG_ERR, "realloc failed, ignoring fd %d\n", fd);
+}
+
+void poll_fd_set_events(struct poll_fd *pfd, short events)
+{
+	pfd->events = events;
+	fds[pfd->idx].events = events;
+}
+
+void poll_fd_del(struct poll_fd *pfd)
+{
+	if (!pfd->added)
+		return;
+
+	/* Move the last entry into the hole. */
+	nr_fds--;
+	if (pfd->idx != nr_fds) {
+		fds[pfd->idx] = fds[nr_fds];
+		fd_owners[pfd->idx] = fd_owners[nr_fds];
+		fd_owners[pfd->idx]->idx = pfd->idx;
+	}
+	pfd->added = false;
+}
+
+static int poll_fds_wait(int timeout)
+{
+	struct poll_fd *pfd;
+	unsigned int i;
+	int n;
+
+	n = poll(fds, nr_fds, timeout);
+
+	for (i = 0; n > 0 && i < nr_fds; i++) {
+		pfd = fd_owners[i];
+		pfd->revents = fds[i].revents;
+		if (pfd->revents && pfd->conn)
+			conn_set_ready(pfd->conn);
+	}
+
+	return n;
+}
+#endif
+
 static int destroy_conn(void *_conn)
 {
 	struct connection *conn = _conn;
@@ -441,10 +622,11 @@ static int destroy_conn(void *_conn)
 		pfd.fd = conn->fd;
 		pfd.events = POLLOUT;
 
-		while (!list_empty(&conn->out_list)
+		while (!conn->ring && !list_empty(&conn->out_list)
 		       && poll(&pfd, 1, 0) == 1)
 			if (!write_messages(conn))
 				break;
+		poll_fd_del(&conn->pfd);
 		close(conn->fd);
 	}
 
@@ -456,6 +638,8 @@ static int destroy_conn(void *_conn)
         if (conn->target)
                 talloc_unlink(conn, conn->target);
 	list_del(&conn->list);
+	list_del(&conn->ready_list);
+	list_del(&conn->timed_list);
 	trace_destroy(conn, "connection");
 	return 0;
 }
@@ -483,98 +667,418 @@ static bool conn_can_write(struct connection *conn)
 	return !conn->is_ignored && conn->funcs->can_write(conn);
 }
 
-/* This function returns index inside the array if succeed, -1 if fail */
-static int set_fd(int fd, short events)
+void set_tdb_key(const char *name, TDB_DATA *key)
 {
-	int ret;
-	if (current_array_size < nr_fds + 1) {
-		struct pollfd *new_fds = NULL;
-		unsigned long newsize;
+	/*
+	 * Dropping const is fine here, as the key will never be modified
+	 * by TDB.
+	 */
+	key->dptr = (char *)name;
+	key->dsize = strlen(name);
+}
 
-		/* Round up to 2^8 boundary, in practice this just
-		 * make newsize larger than current_array_size.
-		 */
-		newsize = ROUNDUP(nr_fds + 1, 8);
+/*
+ * The nodes are stored either in TDB, or natively in a hashtable of records
+ * in memory (--internal-db native).  Either way a record is a struct
+ * xs_tdb_record_hdr followed by the permissions, data and children of the
+ * node, keyed by the node's name (prefixed for transaction nodes).
+ *
+ * Native records are never modified once stored: a write replaces the
+ * record, and a fetch only takes a talloc reference to it.  So reading a
+ * node doesn't copy it, and nodes read earlier keep seeing the old record.
+ *
+ * A native record and its key share one allocation, with the record in
+ * front so it can be handed out as is.  Of the key only the part after the
+ * last '/' is kept there: the part in front of it is interned in
+ * native_prefixes, so siblings share their parent's name.  The table of
+ * records is searched with plain names, see native_keys_equal_fn().
+ */
+static struct hashtable *native_db;
+static struct hashtable *native_prefixes;
 
-		new_fds = realloc(fds, sizeof(struct pollfd)*newsize);
-		if (!new_fds)
-			goto fail;
-		fds = new_fds;
+struct native_key {
+	/* Interned name up to the last '/', NULL if there is none. */
+	const char *prefix;
+	/* Size of the record in front of the key. */
+	unsigned int size;
+	char base[];
+};
 
-		memset(&fds[0] + current_array_size, 0,
-		       sizeof(struct pollfd ) * (newsize-current_array_size));
-		current_array_size = newsize;
+static void *native_record(const struct native_key *nk)
+{
+	return (char *)nk - ROUNDUP(nk->size, 3);
+}
+
+static int native_keys_equal_fn(const void *key, const void *stored)
+{
+	const struct native_key *nk = stored;
+	const char *name = key;
+	size_t len;
+
+	if (nk->prefix) {
+		len = strlen(nk->prefix);
+		if (strncmp(name, nk->prefix, len) || name[len] != '/')
+			return 0;
+		name += len + 1;
+	}
+
+	return !strcmp(name, nk->base);
+}
+
+static struct native_key *native_find(TDB_DATA *key)
+{
+	/* Keys are always set up by set_tdb_key(), so they're terminated. */
+	assert(key->dptr[key->dsize] == 0);
+
+	return hashtable_search(native_db, key->dptr);
+}
+
+/*
+ * Intern the part of name in front of its last '/' in native_prefixes, and
+ * set base to the rest.  On allocation failure base is set to NULL.
+ */
+static const char *native_intern_prefix(const char *name, const char **base)
+{
+	const char *slash = strrchr(name, '/');
+	const char *prefix;
+	char *tmp;
+
+	*base = slash ? NULL : name;
+	if (!slash)
+		return NULL;
+
+	tmp = talloc_strndup(NULL, name, slash - name);
+	if (!tmp)
+		return NULL;
+	prefix = intern_string(native_prefixes, tmp);
+	talloc_free(tmp);
+	if (prefix)
+		*base = slash + 1;
+
+	return prefix;
+}
+
+static int native_store(TDB_DATA *key, TDB_DATA *data)
+{
+	struct native_key *old = native_find(key), *nk;
+	const char *prefix, *base;
+	size_t off = ROUNDUP(data->dsize, 3);
+	void *rec;
+	int ret = 0;
+
+	if (old) {
+		prefix = old->prefix;
+		base = old->base;
+	} else {
+		prefix = native_intern_prefix(key->dptr, &base);
+		if (!base)
+			return ENOMEM;
 	}
 
-	fds[nr_fds].fd = fd;
-	fds[nr_fds].events = events;
-	ret = nr_fds;
-	nr_fds++;
+	rec = talloc_size(native_db, off + sizeof(*nk) + strlen(base) + 1);
+	if (!rec) {
+		ret = ENOMEM;
+		goto out;
+	}
+	talloc_set_name_const(rec, "native record");
+	memcpy(rec, data->dptr, data->dsize);
+	nk = rec + off;
+	nk->prefix = prefix;
+	nk->size = data->dsize;
+	strcpy(nk->base, base);
+
+	if (old)
+		hashtable_replace(native_db, key->dptr, nk, nk);
+	else if (!hashtable_insert_key(native_db, key->dptr, nk, nk))
+		ret = ENOMEM;
+
+	/*
+	 * Readers of the old record keep it alive.  All records are children
+	 * of native_db, so don't let talloc_unlink() search for the parent.
+	 */
+	if (old)
+		talloc_unlink_parent(native_record(old));
+	if (!ret)
+		return 0;
 
+	talloc_free(rec);
+ out:
+	if (!old && prefix)
+		forget_string(native_prefixes, prefix);
 	return ret;
-fail:
-	syslog(LOG_ERR, "realloc failed, ignoring fd %d\n", fd);
-	return -1;
 }
 
-static void initialize_fds(int *p_sock_pollfd_idx, int *ptimeout)
+static int native_delete(TDB_DATA *key)
 {
-	struct connection *conn;
-	struct wrl_timestampt now;
-	uint64_t msecs;
+	struct native_key *nk = native_find(key);
 
-	if (fds)
-		memset(fds, 0, sizeof(struct pollfd) * current_array_size);
-	nr_fds = 0;
+	if (!nk)
+		return 0;
 
-	/* In case of delayed requests pause for max 1 second. */
-	*ptimeout = delayed_requests ? 1000 : -1;
+	hashtable_remove(native_db, key->dptr);
 
-	if (sock != -1)
-		*p_sock_pollfd_idx = set_fd(sock, POLLIN|POLLPRI);
-	if (reopen_log_pipe[0] != -1)
-		reopen_log_pipe0_pollfd_idx =
-			set_fd(reopen_log_pipe[0], POLLIN|POLLPRI);
+	/* If somebody still references the record, it is handed over. */
+	if (nk->prefix)
+		forget_string(native_prefixes, nk->prefix);
+	talloc_unlink_parent(native_record(nk));
 
-	if (xce_handle != NULL)
-		xce_pollfd_idx = set_fd(xenevtchn_fd(xce_handle),
-					POLLIN|POLLPRI);
+	return 0;
+}
 
-	wrl_gettime_now(&now);
-	wrl_log_periodic(now);
-	msecs = get_now_msec();
+/*
+ * Fetch the record of a node.  The record is allocated on, or referenced
+ * by, ctx, and must not be modified.  Release it with talloc_unlink(ctx, ...)
+ * or by freeing ctx.
+ * If it fails, returns a NULL record and sets errno to ENOENT or EIO.
+ */
+TDB_DATA do_tdb_fetch(const void *ctx, TDB_DATA *key)
+{
+	struct native_key *nk;
+	TDB_DATA data = { };
+
+	if (native_db) {
+		nk = native_find(key);
+		if (!nk) {
+			errno = ENOENT;
+			return data;
+		}
+		data.dptr = native_record(nk);
+		data.dsize = nk->size;
+		if (!talloc_reference(ctx, data.dptr)) {
+			errno = ENOMEM;
+			data.dptr = NULL;
+		}
+		return data;
+	}
 
-	list_for_each_entry(conn, &connections, list) {
-		if (conn->domain) {
-			wrl_check_timeout(conn->domain, now, ptimeout);
-			check_event_timeout(conn, msecs, ptimeout);
-			if (conn_can_read(conn) ||
-			    (conn_can_write(conn) &&
-			     !list_empty(&conn->out_list)))
-				*ptimeout = 0;
-		} else {
-			short events = POLLIN|POLLPRI;
-			if (!list_empty(&conn->out_list))
-				events |= POLLOUT;
-			conn->pollfd_idx = set_fd(conn->fd, events);
-			/*
-			 * For stalled connection, we want to process the
-			 * pending command as soon as live-update has aborted.
-			 */
-			if (conn->is_stalled && !lu_is_pending())
-				*ptimeout = 0;
+	data = tdb_fetch(tdb_ctx, *key);
+	if (!data.dptr) {
+		if (tdb_error(tdb_ctx) == TDB_ERR_NOEXIST)
+			errno = ENOENT;
+		else {
+			log("TDB error on read: %s", tdb_errorstr(tdb_ctx));
+			errno = EIO;
 		}
+		return data;
 	}
+
+	talloc_steal(ctx, data.dptr);
+
+	return data;
 }
 
-void set_tdb_key(const char *name, TDB_DATA *key)
+struct native_traverse_data {
+	int (*fn)(TDB_DATA *key, TDB_DATA *val, void *private);
+	void *private;
+};
+
+static int native_traverse_fn(const void *k, void *v, void *arg)
 {
-	/*
-	 * Dropping const is fine here, as the key will never be modified
-	 * by TDB.
-	 */
-	key->dptr = (char *)name;
-	key->dsize = strlen(name);
+	struct native_traverse_data *data = arg;
+	struct native_key *nk = v;
+	TDB_DATA key, val;
+	char *name;
+	int ret;
+
+	if (nk->prefix)
+		name = talloc_asprintf(NULL, "%s/%s", nk->prefix, nk->base);
+	else
+		name = talloc_strdup(NULL, nk->base);
+	if (!name)
+		barf("Allocation failure traversing the store");
+
+	set_tdb_key(name, &key);
+	val.dptr = native_record(nk);
+	val.dsize = nk->size;
+
+	ret = data->fn(&key, &val, data->private);
+	talloc_free(name);
+
+	return ret;
+}
+
+static int tdb_traverse_fn(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
+			   void *private)
+{
+	struct native_traverse_data *data = private;
+
+	return data->fn(&key, &val, data->private);
+}
+
+/*
+ * Call fn for each record in the store, until it returns non-zero.
+ * fn may delete the record it is called for, but no other.
+ */
+static void do_tdb_traverse(int (*fn)(TDB_DATA *key, TDB_DATA *val,
+				      void *private),
+			    void *private)
+{
+	struct native_traverse_data data = { .fn = fn, .private = private };
+
+	if (native_db)
+		hashtable_iterate(native_db, native_traverse_fn, &data);
+	else
+		tdb_traverse(tdb_ctx, tdb_traverse_fn, &data);
+}
+
+/*
+ * Memory used by the nodes, by classes of names: the first components of the
+ * name, with those looking like an id (e.g. a domid or a UUID) replaced by
+ * '*'.  Transaction nodes are a class of their own.
+ */
+#define NODE_CLASS_DEPTH 6
+
+struct node_class {
+	const char *name;
+	unsigned int nodes;
+	unsigned long bytes;
+};
+
+struct node_class_data {
+	struct hashtable *classes;
+	unsigned int nodes;
+	unsigned long bytes;
+	const void *ctx;
+};
+
+static bool is_id_component(const char *c, size_t len)
+{
+	bool digit = false;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (isdigit(c[i]))
+			digit = true;
+		else if (!isxdigit(c[i]) && c[i] != '-')
+			return false;
+	}
+
+	return digit;
+}
+
+static char *node_class_name(const void *ctx, const char *name)
+{
+	char *class = talloc_strdup(ctx, "");
+	unsigned int depth;
+	size_t len;
+
+	if (name[0] != '/')
+		return talloc_strdup(ctx, isdigit(name[0]) ? "(transactions)"
+							   : name);
+
+	for (depth = 0; class && *name && depth < NODE_CLASS_DEPTH; depth++) {
+		name++;
+		len = strcspn(name, "/");
+		if (is_id_component(name, len))
+			class = talloc_append_string(ctx, class, "/*");
+		else
+			class = talloc_asprintf_append(class, "/%.*s",
+						       (int)len, name);
+		name += len;
+	}
+
+	return class;
+}
+
+static int node_class_add(TDB_DATA *key, TDB_DATA *val, void *private)
+{
+	struct node_class_data *data = private;
+	struct node_class *nc;
+	unsigned long bytes;
+	char *name, *class;
+
+	/* TDB keys aren't terminated. */
+	name = talloc_strndup(data->ctx, key->dptr, key->dsize);
+	class = name ? node_class_name(data->ctx, name) : NULL;
+	talloc_free(name);
+	if (!class)
+		return 1;
+
+	nc = hashtable_search(data->classes, class);
+	if (!nc) {
+		nc = talloc_zero(data->classes, struct node_class);
+		if (!nc || !hashtable_insert(data->classes, class, nc))
+			return 1;
+		nc->name = class;
+	} else
+		talloc_free(class);
+
+	/* The native store keeps the key in the record's allocation. */
+	bytes = native_db ? talloc_get_size(val->dptr)
+			  : key->dsize + val->dsize;
+	nc->nodes++;
+	nc->bytes += bytes;
+	data->nodes++;
+	data->bytes += bytes;
+
+	return 0;
+}
+
+static int node_class_collect(const void *k, void *v, void *arg)
+{
+	struct node_class ***next = arg;
+
+	*(*next)++ = v;
+
+	return 0;
+}
+
+static int node_class_cmp(const void *a, const void *b)
+{
+	const struct node_class *nca = *(const struct node_class * const *)a;
+	const struct node_class *ncb = *(const struct node_class * const *)b;
+
+	if (nca->bytes != ncb->bytes)
+		return nca->bytes < ncb->bytes ? 1 : -1;
+	return strcmp(nca->name, ncb->name);
+}
+
+int store_get_stats(const void *ctx, struct connection *conn)
+{
+	struct node_class_data data = { .ctx = ctx };
+	struct node_class **classes, **next;
+	unsigned int i, num;
+	char *resp, *line;
+
+	data.classes = create_hashtable(ctx, 64, hash_from_key_fn,
+					keys_equal_fn, 0);
+	if (!data.classes)
+		return ENOMEM;
+
+	do_tdb_traverse(node_class_add, &data);
+
+	num = hashtable_count(data.classes);
+	classes = talloc_array(ctx, struct node_class *, num + 1);
+	if (!classes)
+		return ENOMEM;
+	next = classes;
+	hashtable_iterate(data.classes, node_class_collect, &next);
+	qsort(classes, num, sizeof(*classes), node_class_cmp);
+
+	resp = talloc_asprintf(ctx, "%-40s %8u nodes %10lu bytes\n", "total",
+			       data.nodes, data.bytes);
+	if (resp && native_prefixes)
+		resp = talloc_asprintf_append(resp,
+			"%-40s %8u names %10lu bytes\n", "interned prefixes",
+			hashtable_count(native_prefixes),
+			(unsigned long)talloc_total_size(native_prefixes));
+	/* The biggest classes come first, drop what doesn't fit. */
+	for (i = 0; resp && i < num; i++) {
+		line = talloc_asprintf(ctx, "%-40s %8u nodes %10lu bytes\n",
+				       classes[i]->name, classes[i]->nodes,
+				       classes[i]->bytes);
+		if (!line)
+			return ENOMEM;
+		if (strlen(resp) + strlen(line) >= XENSTORE_PAYLOAD_MAX)
+			break;
+		resp = talloc_append_string(ctx, resp, line);
+	}
+	if (!resp)
+		return ENOMEM;
+
+	send_reply(conn, XS_CONTROL, resp, strlen(resp) + 1);
+
+	return 0;
 }
 
 static void get_acc_data(TDB_DATA *key, struct node_account_data *acc)
@@ -583,7 +1087,7 @@ static void get_acc_data(TDB_DATA *key, struct node_account_data *acc)
 	struct xs_tdb_record_hdr *hdr;
 
 	if (acc->memory < 0) {
-		old_data = tdb_fetch(tdb_ctx, *key);
+		old_data = do_tdb_fetch(NULL, key);
 		/* No check for error, as the node might not exist. */
 		if (old_data.dptr == NULL) {
 			acc->memory = 0;
@@ -591,8 +1095,8 @@ static void get_acc_data(TDB_DATA *key, struct node_account_data *acc)
 			hdr = (void *)old_data.dptr;
 			acc->memory = old_data.dsize;
 			acc->domid = hdr->perms[0].id;
+			talloc_unlink(NULL, old_data.dptr);
 		}
-		talloc_free(old_data.dptr);
 	}
 }
 
@@ -609,6 +1113,35 @@ static unsigned int get_acc_domid(struct connection *conn, TDB_DATA *key,
 	       ? domid : conn->id;
 }
 
+/* Live update in progress, see dump_state_nodes_start(). */
+static struct dump_precopy *precopy;
+
+static void precopy_node_changed(const TDB_DATA *key)
+{
+	char *name;
+
+	/*
+	 * Nodes of transactions are not dumped, while the special nodes are
+	 * always dumped in the end.
+	 */
+	if (!precopy || key->dptr[0] != '/')
+		return;
+
+	name = talloc_strndup(precopy->changed, (char *)key->dptr, key->dsize);
+	if (!name)
+		goto nomem;
+	if (hashtable_search(precopy->changed, name)) {
+		talloc_free(name);
+		return;
+	}
+	if (hashtable_insert(precopy->changed, name, (void *)1))
+		return;
+	talloc_free(name);
+
+ nomem:
+	precopy->err = "Allocation failure noting changed node";
+}
+
 int do_tdb_write(struct connection *conn, TDB_DATA *key, TDB_DATA *data,
 		 struct node_account_data *acc, bool no_quota_check)
 {
@@ -644,7 +1177,8 @@ int do_tdb_write(struct connection *conn, TDB_DATA *key, TDB_DATA *data,
 	}
 
 	/* TDB should set errno, but doesn't even set ecode AFAICT. */
-	if (tdb_store(tdb_ctx, *key, *data, TDB_REPLACE) != 0) {
+	if (native_db ? native_store(key, data)
+		      : tdb_store(tdb_ctx, *key, *data, TDB_REPLACE) != 0) {
 		domain_memory_add_nochk(new_domid, -data->dsize - key->dsize);
 		/* Error path, so no quota check. */
 		if (old_acc.memory)
@@ -660,6 +1194,8 @@ int do_tdb_write(struct connection *conn, TDB_DATA *key, TDB_DATA *data,
 		acc->memory = data->dsize;
 	}
 
+	precopy_node_changed(key);
+
 	return 0;
 }
 
@@ -676,7 +1212,7 @@ int do_tdb_delete(struct connection *conn, TDB_DATA *key,
 
 	get_acc_data(key, acc);
 
-	if (tdb_delete(tdb_ctx, *key)) {
+	if (native_db ? native_delete(key) : tdb_delete(tdb_ctx, *key)) {
 		errno = EIO;
 		return errno;
 	}
@@ -686,6 +1222,8 @@ int do_tdb_delete(struct connection *conn, TDB_DATA *key,
 		domain_memory_add_nochk(domid, -acc->memory - key->dsize);
 	}
 
+	precopy_node_changed(key);
+
 	return 0;
 }
 
@@ -715,22 +1253,19 @@ struct node *read_node(struct connection *conn, const void *ctx,
 
 	transaction_prepend(conn, name, &key);
 
-	data = tdb_fetch(tdb_ctx, key);
+	/* The record is shared with the store: see do_tdb_fetch(). */
+	data = do_tdb_fetch(node, &key);
 
 	if (data.dptr == NULL) {
-		if (tdb_error(tdb_ctx) == TDB_ERR_NOEXIST) {
+		if (errno == ENOENT) {
 			node->generation = NO_GENERATION;
 			err = access_node(conn, node, NODE_ACCESS_READ, NULL);
 			errno = err ? : ENOENT;
-		} else {
-			log("TDB error on read: %s", tdb_errorstr(tdb_ctx));
-			errno = EIO;
 		}
 		goto error;
 	}
 
 	node->parent = NULL;
-	talloc_steal(node, data.dptr);
 
 	/* Datalen, childlen, number of permissions */
 	hdr = (void *)data.dptr;
@@ -1069,16 +1604,18 @@ void send_reply(struct connection *conn, enum xsd_sockmsg_type type,
 	/* Queue for later transmission. */
 	list_add_tail(&bdata->list, &conn->out_list);
 	bdata->on_out_list = true;
+	conn_set_ready(conn);
 	domain_outstanding_inc(conn);
 }
 
 /*
  * Send a watch event.
  * As this is not directly related to the current command, errors can't be
- * reported.
+ * reported.  Returns the queued event, or NULL if none was queued.
  */
-void send_event(struct buffered_data *req, struct connection *conn,
-		const char *path, const char *token)
+struct buffered_data *send_event(struct buffered_data *req,
+				 struct connection *conn,
+				 const char *path, const char *token)
 {
 	struct buffered_data *bdata, *bd;
 	unsigned int len;
@@ -1086,16 +1623,16 @@ void send_event(struct buffered_data *req, struct connection *conn,
 	len = strlen(path) + 1 + strlen(token) + 1;
 	/* Don't try to send over-long events. */
 	if (len > XENSTORE_PAYLOAD_MAX)
-		return;
+		return NULL;
 
 	bdata = new_buffer(conn);
 	if (!bdata)
-		return;
+		return NULL;
 
 	bdata->buffer = talloc_array(bdata, char, len);
 	if (!bdata->buffer) {
 		talloc_free(bdata);
-		return;
+		return NULL;
 	}
 	strcpy(bdata->buffer, path);
 	strcpy(bdata->buffer + strlen(path) + 1, token);
@@ -1113,14 +1650,14 @@ void send_event(struct buffered_data *req, struct connection *conn,
 				trace("dropping duplicate watch %s %s for domain %u\n",
 				      path, token, conn->id);
 				talloc_free(bdata);
-				return;
+				return NULL;
 			}
 		}
 	}
 
 	if (domain_memory_add_chk(conn->id, len + sizeof(bdata->hdr))) {
 		talloc_free(bdata);
-		return;
+		return NULL;
 	}
 
 	if (timeout_watch_event_msec && domain_is_unprivileged(conn)) {
@@ -1137,6 +1674,9 @@ void send_event(struct buffered_data *req, struct connection *conn,
 	/* Queue for later transmission. */
 	list_add_tail(&bdata->list, &conn->out_list);
 	bdata->on_out_list = true;
+	conn_set_ready(conn);
+
+	return bdata;
 }
 
 /* Some routines (write, mkdir, etc) just need a non-error return */
@@ -1561,7 +2101,6 @@ static int do_write(const void *ctx, struct connection *conn,
 	}
 
 	fire_watches(conn, ctx, name, node, false, NULL);
-	send_ack(conn, XS_WRITE);
 
 	return 0;
 }
@@ -1587,7 +2126,6 @@ static int do_mkdir(const void *ctx, struct connection *conn,
 			return errno;
 		fire_watches(conn, ctx, name, node, false, NULL);
 	}
-	send_ack(conn, XS_MKDIR);
 
 	return 0;
 }
@@ -1602,8 +2140,15 @@ static int remove_child_entry(struct connection *conn, struct node *node,
 			      size_t offset)
 {
 	size_t childlen = strlen(node->children + offset);
+	char *children;
+
+	/* The children might be shared with the store, so don't edit them. */
+	children = talloc_memdup(node, node->children, node->childlen);
+	if (!children)
+		return ENOMEM;
 
-	memdel(node->children, offset, childlen + 1, node->childlen);
+	memdel(children, offset, childlen + 1, node->childlen);
+	node->children = children;
 	node->childlen -= childlen + 1;
 
 	return write_node(conn, node, true);
@@ -1691,7 +2236,6 @@ static int do_rm(const void *ctx, struct connection *conn,
 		 struct buffered_data *in)
 {
 	struct node *node;
-	int ret;
 	char *name;
 	char *parentname;
 
@@ -1706,10 +2250,8 @@ static int do_rm(const void *ctx, struct connection *conn,
 			if (!parentname)
 				return errno;
 			node = read_node(conn, ctx, parentname);
-			if (node) {
-				send_ack(conn, XS_RM);
+			if (node)
 				return 0;
-			}
 			/* Restore errno, just in case. */
 			if (!read_node_can_propagate_errno())
 				errno = ENOENT;
@@ -1720,13 +2262,7 @@ static int do_rm(const void *ctx, struct connection *conn,
 	if (streq(name, "/"))
 		return EINVAL;
 
-	ret = rm_node(conn, ctx, name);
-	if (ret)
-		return ret;
-
-	send_ack(conn, XS_RM);
-
-	return 0;
+	return rm_node(conn, ctx, name);
 }
 
 
@@ -1816,7 +2352,6 @@ static int do_set_perms(const void *ctx, struct connection *conn,
 	}
 
 	fire_watches(conn, ctx, name, node, false, &old_perms);
-	send_ack(conn, XS_SET_PERMS);
 
 	return 0;
 }
@@ -1950,6 +2485,9 @@ int walk_node_tree(const void *ctx, struct connection *conn, const char *root,
 	return ret < 0 ? ret : WALK_TREE_OK;
 }
 
+static int do_batch(const void *ctx, struct connection *conn,
+		    struct buffered_data *in);
+
 static struct {
 	const char *str;
 	int (*func)(const void *ctx, struct connection *conn,
@@ -1957,6 +2495,7 @@ static struct {
 	unsigned int flags;
 #define XS_FLAG_NOTID		(1U << 0)	/* Ignore transaction id. */
 #define XS_FLAG_PRIV		(1U << 1)	/* Privileged domain only. */
+#define XS_FLAG_BATCH		(1U << 2)	/* Ack by caller, in XS_BATCH. */
 } const wire_funcs[XS_TYPE_COUNT] = {
 	[XS_CONTROL]           =
 	    { "CONTROL",       do_control,      XS_FLAG_PRIV },
@@ -1974,10 +2513,14 @@ static struct {
 	[XS_RELEASE]           =
 	    { "RELEASE",       do_release,      XS_FLAG_PRIV },
 	[XS_GET_DOMAIN_PATH]   = { "GET_DOMAIN_PATH",   do_get_domain_path },
-	[XS_WRITE]             = { "WRITE",             do_write },
-	[XS_MKDIR]             = { "MKDIR",             do_mkdir },
-	[XS_RM]                = { "RM",                do_rm },
-	[XS_SET_PERMS]         = { "SET_PERMS",         do_set_perms },
+	[XS_WRITE]             =
+	    { "WRITE",         do_write,        XS_FLAG_BATCH },
+	[XS_MKDIR]             =
+	    { "MKDIR",         do_mkdir,        XS_FLAG_BATCH },
+	[XS_RM]                =
+	    { "RM",            do_rm,           XS_FLAG_BATCH },
+	[XS_SET_PERMS]         =
+	    { "SET_PERMS",     do_set_perms,    XS_FLAG_BATCH },
 	[XS_WATCH_EVENT]       = { "WATCH_EVENT",       NULL },
 	[XS_ERROR]             = { "ERROR",             NULL },
 	[XS_IS_DOMAIN_INTRODUCED] =
@@ -1988,8 +2531,101 @@ static struct {
 	    { "SET_TARGET",    do_set_target,   XS_FLAG_PRIV },
 	[XS_RESET_WATCHES]     = { "RESET_WATCHES",     do_reset_watches },
 	[XS_DIRECTORY_PART]    = { "DIRECTORY_PART",    send_directory_part },
+	[XS_BATCH]             = { "BATCH",             do_batch },
 };
 
+/* Get a decimal number of an XS_BATCH operation header at *off. */
+static bool get_batch_num(struct buffered_data *in, unsigned int *off,
+			  unsigned int *val)
+{
+	unsigned int len = get_string(in, *off);
+	unsigned long num;
+	char *end;
+
+	if (len < 2 || !isdigit(in->buffer[*off]))
+		return false;
+
+	num = strtoul(in->buffer + *off, &end, 10);
+	if (end != in->buffer + *off + len - 1 || num > in->used)
+		return false;
+
+	*val = num;
+	*off += len;
+
+	return true;
+}
+
+/*
+ * Get the operation of an XS_BATCH request at *off, moving *off to its
+ * payload.  op is set up for passing it to the handler of the operation.
+ */
+static bool get_batch_op(struct buffered_data *in, unsigned int *off,
+			 struct buffered_data *op)
+{
+	unsigned int type, len;
+
+	if (!get_batch_num(in, off, &type) || !get_batch_num(in, off, &len))
+		return false;
+	if (type >= XS_TYPE_COUNT || !(wire_funcs[type].flags & XS_FLAG_BATCH))
+		return false;
+	if (len > in->used - *off)
+		return false;
+
+	memset(op, 0, sizeof(*op));
+	op->hdr.msg = in->hdr.msg;
+	op->hdr.msg.type = type;
+	op->hdr.msg.len = len;
+	op->buffer = in->buffer + *off;
+	op->used = len;
+
+	return true;
+}
+
+/* (<type>|<len>|<payload|>)* of WRITE, MKDIR, RM and SET_PERMS requests. */
+static int do_batch(const void *ctx, struct connection *conn,
+		    struct buffered_data *in)
+{
+	struct transaction *trans = NULL;
+	struct buffered_data op;
+	unsigned int off;
+	int ret = 0;
+
+	/* A malformed request mustn't have any effect. */
+	for (off = 0; off < in->used; off += op.used)
+		if (!get_batch_op(in, &off, &op))
+			return EINVAL;
+
+	/*
+	 * Outside of a transaction the operations are done in an internal
+	 * one, so they take effect all at once (including the watch events),
+	 * or not at all.  As the whole request is handled without any other
+	 * request in between, committing it can't fail due to a conflict.
+	 */
+	if (!conn->transaction) {
+		trans = transaction_start_internal(ctx, conn);
+		if (!trans)
+			return ENOMEM;
+		conn->transaction = trans;
+	}
+
+	for (off = 0; !ret && off < in->used; off += op.used) {
+		get_batch_op(in, &off, &op);
+		ret = wire_funcs[op.hdr.msg.type].func(ctx, conn, &op);
+	}
+
+	if (trans) {
+		conn->transaction = NULL;
+		if (!ret)
+			ret = transaction_commit_internal(conn, trans);
+		talloc_free(trans);
+	}
+
+	if (!ret)
+		send_ack(conn, XS_BATCH);
+
+	return ret;
+}
+
 static const char *sockmsg_string(enum xsd_sockmsg_type type)
 {
 	if ((unsigned int)type < ARRAY_SIZE(wire_funcs) && wire_funcs[type].str)
@@ -1998,6 +2634,32 @@ static const char *sockmsg_string(enum xsd_sockmsg_type type)
 	return "**UNKNOWN**";
 }
 
+/* Run the handler of a request, after all checks have been passed. */
+static void call_wire_func(struct connection *conn, struct buffered_data *in,
+			   struct transaction *trans)
+{
+	int ret;
+	void *ctx;
+
+	ctx = talloc_new(NULL);
+	if (!ctx) {
+		send_error(conn, ENOMEM);
+		return;
+	}
+
+	assert(conn->transaction == NULL);
+	conn->transaction = trans;
+
+	ret = wire_funcs[in->hdr.msg.type].func(ctx, conn, in);
+	talloc_free(ctx);
+	if (ret)
+		send_error(conn, ret);
+	else if (wire_funcs[in->hdr.msg.type].flags & XS_FLAG_BATCH)
+		send_ack(conn, in->hdr.msg.type);
+
+	conn->transaction = NULL;
+}
+
 /* Process "in" for conn: "in" will vanish after this conversation, so
  * we can talloc off it for temporary variables.  May free "conn".
  */
@@ -2005,8 +2667,6 @@ static void process_message(struct connection *conn, struct buffered_data *in)
 {
 	struct transaction *trans;
 	enum xsd_sockmsg_type type = in->hdr.msg.type;
-	int ret;
-	void *ctx;
 
 	/* At least send_error() and send_reply() expects conn->in == in */
 	assert(conn->in == in);
@@ -2031,21 +2691,7 @@ static void process_message(struct connection *conn, struct buffered_data *in)
 		return;
 	}
 
-	ctx = talloc_new(NULL);
-	if (!ctx) {
-		send_error(conn, ENOMEM);
-		return;
-	}
-
-	assert(conn->transaction == NULL);
-	conn->transaction = trans;
-
-	ret = wire_funcs[type].func(ctx, conn, in);
-	talloc_free(ctx);
-	if (ret)
-		send_error(conn, ret);
-
-	conn->transaction = NULL;
+	call_wire_func(conn, in, trans);
 }
 
 static bool process_delayed_message(struct delayed_request *req)
@@ -2180,6 +2826,131 @@ static void handle_output(struct connection *conn)
 		ignore_connection(conn, XENSTORE_ERROR_RINGIDX);
 }
 
+void conn_set_ready(struct connection *conn)
+{
+	if (list_empty(&conn->ready_list))
+		list_add_tail(&conn->ready_list, &ready_conns);
+}
+
+/*
+ * Update the state of a connection in the main loop after looking at it:
+ * a socket connection waits for its fd, while a domain connection or one
+ * using a local ring stays ready as long as it can make progress without a
+ * new event.
+ */
+static void conn_update_ready(struct connection *conn)
+{
+	short events = POLLIN|POLLPRI;
+
+	if (!conn->domain) {
+		conn->pfd.revents = 0;
+		/* With a ring the socket is watched for the client going away. */
+		if (conn->ring)
+			events = POLLIN;
+		else if (!list_empty(&conn->out_list))
+			events |= POLLOUT;
+		if (!conn->pfd.added)
+			poll_fd_add(&conn->pfd, conn->fd, events, conn);
+		else
+			poll_fd_set_events(&conn->pfd, events);
+	}
+
+	if (conn->ring)
+		local_ring_poll(conn, POLLIN);
+
+	if ((conn->domain || conn->ring) &&
+	    (conn_can_read(conn) ||
+	     (conn_can_write(conn) && !list_empty(&conn->out_list))))
+		conn_set_ready(conn);
+
+	if ((conn->timeout_msec || conn->is_stalled) &&
+	    list_empty(&conn->timed_list))
+		list_add_tail(&conn->timed_list, &timed_conns);
+}
+
+/* Returns the timeout for the next wait. */
+static int prepare_wait(void)
+{
+	struct connection *conn, *next;
+	struct wrl_timestampt now;
+	uint64_t msecs;
+	int timeout;
+
+	/*
+	 * In case of delayed requests pause for max 1 second, unless the
+	 * nodes are being dumped for a live update.
+	 */
+	timeout = delayed_requests ? 1000 : -1;
+	if (lu_is_precopying())
+		timeout = 0;
+
+	if (sock != -1 && !sock_pfd.added)
+		poll_fd_add(&sock_pfd, sock, POLLIN|POLLPRI, NULL);
+	if (reopen_log_pipe[0] != -1 && !reopen_log_pfd.added)
+		poll_fd_add(&reopen_log_pfd, reopen_log_pipe[0],
+			    POLLIN|POLLPRI, NULL);
+	if (xce_handle != NULL && !xce_pfd.added)
+		poll_fd_add(&xce_pfd, xenevtchn_fd(xce_handle),
+			    POLLIN|POLLPRI, NULL);
+
+	wrl_gettime_now(&now);
+	wrl_log_periodic(now);
+	wrl_check_timeouts(now, &timeout);
+	msecs = get_now_msec();
+
+	list_for_each_entry_safe(conn, next, &timed_conns, timed_list) {
+		check_event_timeout(conn, msecs, &timeout);
+		/*
+		 * For stalled connection, we want to process the
+		 * pending command as soon as live-update has aborted.
+		 */
+		if (conn->is_stalled && !lu_is_pending())
+			conn_set_ready(conn);
+		if (!conn->timeout_msec && !conn->is_stalled)
+			list_del_init(&conn->timed_list);
+	}
+
+	if (!list_empty(&ready_conns))
+		timeout = 0;
+
+	return timeout;
+}
+
+/* Handle input and output of all connections marked ready. */
+static void handle_ready_conns(void)
+{
+	LIST_HEAD(ready);
+	struct connection *conn;
+
+	/*
+	 * Connections marked ready while handling others are looked at in
+	 * the next round only.  Handling a connection may free others, which
+	 * removes them from the list.
+	 */
+	list_splice_init(&ready_conns, &ready);
+
+	while (!list_empty(&ready)) {
+		conn = list_entry(ready.next, struct connection, ready_list);
+		list_del_init(&conn->ready_list);
+
+		talloc_increase_ref_count(conn);
+
+		if (conn_can_read(conn))
+			handle_input(conn);
+		if (talloc_free(conn) == 0)
+			continue;
+
+		talloc_increase_ref_count(conn);
+
+		if (conn_can_write(conn))
+			handle_output(conn);
+		if (talloc_free(conn) == 0)
+			continue;
+
+		conn_update_ready(conn);
+	}
+}
+
 struct connection *new_connection(const struct interface_funcs *funcs)
 {
 	struct connection *new;
@@ -2189,7 +2960,6 @@ struct connection *new_connection(const struct interface_funcs *funcs)
 		return NULL;
 
 	new->fd = -1;
-	new->pollfd_idx = -1;
 	new->funcs = funcs;
 	new->is_ignored = false;
 	new->is_stalled = false;
@@ -2199,8 +2969,12 @@ struct connection *new_connection(const struct interface_funcs *funcs)
 	INIT_LIST_HEAD(&new->watches);
 	INIT_LIST_HEAD(&new->transaction_list);
 	INIT_LIST_HEAD(&new->delayed);
+	INIT_LIST_HEAD(&new->timed_list);
+	INIT_LIST_HEAD(&new->ready_list);
 
 	list_add_tail(&new->list, &connections);
+	/* Look at the new connection once, it might have pending data. */
+	conn_set_ready(new);
 	talloc_set_destructor(new, destroy_conn);
 	trace_create(new, "connection");
 	return new;
@@ -2242,7 +3016,7 @@ static int readfd(struct connection *conn, void *data, unsigned int len)
 {
 	int rc;
 
-	while ((rc = read(conn->fd, data, len)) < 0) {
+	while ((rc = recv_with_fds(conn, data, len)) < 0) {
 		if (errno == EAGAIN) {
 			rc = 0;
 			break;
@@ -2262,15 +3036,12 @@ static int readfd(struct connection *conn, void *data, unsigned int len)
 
 static bool socket_can_process(struct connection *conn, int mask)
 {
-	if (conn->pollfd_idx == -1)
-		return false;
-
-	if (fds[conn->pollfd_idx].revents & ~(POLLIN | POLLOUT)) {
+	if (conn->pfd.revents & ~(POLLIN | POLLOUT)) {
 		talloc_free(conn);
 		return false;
 	}
 
-	return (fds[conn->pollfd_idx].revents & mask);
+	return (conn->pfd.revents & mask);
 }
 
 static bool socket_can_write(struct connection *conn)
@@ -2309,6 +3080,7 @@ static void accept_connection(int sock)
 #endif
 
 static int tdb_flags = TDB_INTERNAL | TDB_NOLOCK;
+static bool native_store_enabled;
 
 /* We create initial nodes manually. */
 static void manual_node(const char *name, const char *child)
@@ -2357,10 +3129,24 @@ static void tdb_logger(TDB_CONTEXT *tdb, int level, const char * fmt, ...)
 	errno = saved_errno;
 }
 
+/* Generation count before restoring the nodes after a live update. */
+static uint64_t restore_generation;
+
 void setup_structure(bool live_update)
 {
 	char *tdbname;
 
+	if (native_store_enabled) {
+		native_db = create_hashtable(NULL, 1024, hash_from_key_fn,
+					     native_keys_equal_fn, 0);
+		native_prefixes = create_hashtable(NULL, 1024,
+						   hash_from_key_fn,
+						   keys_equal_fn, 0);
+		if (!native_db || !native_prefixes)
+			barf_perror("Could not create native store");
+		goto init;
+	}
+
 	tdbname = talloc_strdup(talloc_autofree_context(), xs_daemon_tdb());
 	if (!tdbname)
 		barf_perror("Could not create tdbname");
@@ -2374,9 +3160,11 @@ void setup_structure(bool live_update)
 	if (!tdb_ctx)
 		barf_perror("Could not create tdb file %s", tdbname);
 
-	if (live_update)
+ init:
+	if (live_update) {
 		manual_node("/", NULL);
-	else {
+		restore_generation = generation;
+	} else {
 		manual_node("/", "tool");
 		manual_node("/tool", "xenstored");
 		manual_node("/tool/xenstored", NULL);
@@ -2386,7 +3174,7 @@ void setup_structure(bool live_update)
 	}
 }
 
-static unsigned int hash_from_key_fn(const void *k)
+unsigned int hash_from_key_fn(const void *k)
 {
 	const char *str = k;
 	unsigned int hash = 5381;
@@ -2399,7 +3187,7 @@ static unsigned int hash_from_key_fn(const void *k)
 }
 
 
-static int keys_equal_fn(const void *key1, const void *key2)
+int keys_equal_fn(const void *key1, const void *key2)
 {
 	return 0 == strcmp(key1, key2);
 }
@@ -2413,6 +3201,49 @@ int remember_string(struct hashtable *hash, const char *str)
 	return hashtable_insert(hash, k, (void *)1);
 }
 
+/*
+ * Strings in a table of intern_string() are stored once and counted, the
+ * table being created with hash_from_key_fn(), keys_equal_fn() and no flags.
+ */
+struct interned_string {
+	unsigned int refs;
+	char str[];
+};
+
+const char *intern_string(struct hashtable *hash, const char *str)
+{
+	struct interned_string *is = hashtable_search(hash, str);
+
+	if (is) {
+		is->refs++;
+		return is->str;
+	}
+
+	is = talloc_size(hash, sizeof(*is) + strlen(str) + 1);
+	if (!is)
+		return NULL;
+	talloc_set_name_const(is, "interned string");
+	is->refs = 1;
+	strcpy(is->str, str);
+	if (!hashtable_insert(hash, is->str, is)) {
+		talloc_free(is);
+		return NULL;
+	}
+
+	return is->str;
+}
+
+void forget_string(struct hashtable *hash, const char *str)
+{
+	struct interned_string *is = hashtable_search(hash, str);
+
+	if (!is || --is->refs)
+		return;
+
+	hashtable_remove(hash, str);
+	talloc_free(is);
+}
+
 /**
  * A node has a children field that names the children of the node, separated
  * by NULs.  We check whether there are entries in there that are duplicated
@@ -2463,12 +3294,11 @@ static int check_store_enoent(const void *ctx, struct connection *conn,
 /**
  * Helper to clean_store below.
  */
-static int clean_store_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
-			void *private)
+static int clean_store_(TDB_DATA *key, TDB_DATA *val, void *private)
 {
 	struct hashtable *reachable = private;
 	char *slash;
-	char * name = talloc_strndup(NULL, key.dptr, key.dsize);
+	char * name = talloc_strndup(NULL, key->dptr, key->dsize);
 
 	if (!name) {
 		log("clean_store: ENOMEM");
@@ -2483,7 +3313,7 @@ static int clean_store_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
 	if (!hashtable_search(reachable, name)) {
 		log("clean_store: '%s' is orphaned!", name);
 		if (recovery) {
-			do_tdb_delete(NULL, &key, NULL);
+			do_tdb_delete(NULL, key, NULL);
 		}
 	}
 
@@ -2499,7 +3329,7 @@ static int clean_store_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
  */
 static void clean_store(struct check_store_data *data)
 {
-	tdb_traverse(tdb_ctx, &clean_store_, data->reachable);
+	do_tdb_traverse(&clean_store_, data->reachable);
 	domain_check_acc(data->domains);
 }
 
@@ -2657,8 +3487,10 @@ static void usage(void)
 "                          watch-event: time a watch-event is kept pending\n"
 "  -R, --no-recovery       to request that no recovery should be attempted when\n"
 "                          the store is corrupted (debug only),\n"
-"  -I, --internal-db [on|off] store database in memory, not on disk, default is\n"
-"                          memory, with \"--internal-db off\" it is on disk\n"
+"  -I, --internal-db [on|off|native] store database in memory, not on disk,\n"
+"                          default is memory, with \"--internal-db off\" it\n"
+"                          is on disk, with \"--internal-db native\" nodes are\n"
+"                          kept in memory without using TDB\n"
 "  -K, --keep-orphans      don't delete nodes owned by a domain when the\n"
 "                          domain is deleted (this is a security risk!)\n"
 "  -V, --verbose           to request verbose execution.\n");
@@ -2792,7 +3624,6 @@ int set_trace_switch(const char *arg)
 int main(int argc, char *argv[])
 {
 	int opt;
-	int sock_pollfd_idx = -1;
 	bool dofork = true;
 	bool outputpid = false;
 	bool no_domain_init = false;
@@ -2844,6 +3675,8 @@ int main(int argc, char *argv[])
 		case 'I':
 			if (optarg && !strcmp(optarg, "off"))
 				tdb_flags = 0;
+			if (optarg && !strcmp(optarg, "native"))
+				native_store_enabled = true;
 			break;
 		case 'K':
 			keep_orphans = true;
@@ -2953,7 +3786,7 @@ int main(int argc, char *argv[])
 	check_store();
 
 	/* Get ready to listen to the tools. */
-	initialize_fds(&sock_pollfd_idx, &timeout);
+	timeout = prepare_wait();
 
 #if defined(XEN_SYSTEMD_ENABLED)
 	if (!live_update) {
@@ -2964,82 +3797,50 @@ int main(int argc, char *argv[])
 
 	/* Main loop. */
 	for (;;) {
-		struct connection *conn, *next;
+		struct connection *conn;
 
-		if (poll(fds, nr_fds, timeout) < 0) {
+		if (poll_fds_wait(timeout) < 0) {
 			if (errno == EINTR)
 				continue;
 			barf_perror("Poll failed");
 		}
 
-		if (reopen_log_pipe0_pollfd_idx != -1) {
-			if (fds[reopen_log_pipe0_pollfd_idx].revents
-			    & ~POLLIN) {
+		if (reopen_log_pfd.revents) {
+			if (reopen_log_pfd.revents & ~POLLIN) {
+				poll_fd_del(&reopen_log_pfd);
 				close(reopen_log_pipe[0]);
 				close(reopen_log_pipe[1]);
 				init_pipe(reopen_log_pipe);
-			} else if (fds[reopen_log_pipe0_pollfd_idx].revents
-				   & POLLIN) {
+			} else if (reopen_log_pfd.revents & POLLIN) {
 				char c;
 				if (read(reopen_log_pipe[0], &c, 1) != 1)
 					barf_perror("read failed");
 				reopen_log();
 			}
-			reopen_log_pipe0_pollfd_idx = -1;
+			reopen_log_pfd.revents = 0;
 		}
 
-		if (sock_pollfd_idx != -1) {
-			if (fds[sock_pollfd_idx].revents & ~POLLIN) {
+		if (sock_pfd.revents) {
+			if (sock_pfd.revents & ~POLLIN) {
 				barf_perror("sock poll failed");
 				break;
-			} else if (fds[sock_pollfd_idx].revents & POLLIN) {
+			} else if (sock_pfd.revents & POLLIN) {
 				accept_connection(sock);
-				sock_pollfd_idx = -1;
 			}
+			sock_pfd.revents = 0;
 		}
 
-		if (xce_pollfd_idx != -1) {
-			if (fds[xce_pollfd_idx].revents & ~POLLIN) {
+		if (xce_pfd.revents) {
+			if (xce_pfd.revents & ~POLLIN) {
 				barf_perror("xce_handle poll failed");
 				break;
-			} else if (fds[xce_pollfd_idx].revents & POLLIN) {
+			} else if (xce_pfd.revents & POLLIN) {
 				handle_event();
-				xce_pollfd_idx = -1;
 			}
+			xce_pfd.revents = 0;
 		}
 
-		/*
-		 * list_for_each_entry_safe is not suitable here because
-		 * handle_input may delete entries besides the current one, but
-		 * those may be in the temporary next which would trigger a
-		 * use-after-free.  list_for_each_entry_safe is only safe for
-		 * deleting the current entry.
-		 */
-		next = list_entry(connections.next, typeof(*conn), list);
-		if (&next->list != &connections)
-			talloc_increase_ref_count(next);
-		while (&next->list != &connections) {
-			conn = next;
-
-			next = list_entry(conn->list.next,
-					  typeof(*conn), list);
-			if (&next->list != &connections)
-				talloc_increase_ref_count(next);
-
-			if (conn_can_read(conn))
-				handle_input(conn);
-			if (talloc_free(conn) == 0)
-				continue;
-
-			talloc_increase_ref_count(conn);
-
-			if (conn_can_write(conn))
-				handle_output(conn);
-			if (talloc_free(conn) == 0)
-				continue;
-
-			conn->pollfd_idx = -1;
-		}
+		handle_ready_conns();
 
 		if (delayed_requests) {
 			list_for_each_entry(conn, &connections, list) {
@@ -3051,7 +3852,7 @@ int main(int argc, char *argv[])
 			}
 		}
 
-		initialize_fds(&sock_pollfd_idx, &timeout);
+		timeout = prepare_wait();
 	}
 }
 
@@ -3207,47 +4008,58 @@ static int dump_state_node_err(struct dump_node_data *data, const char *err)
 	return WALK_TREE_ERROR_STOP;
 }
 
-static int dump_state_node(const void *ctx, struct connection *conn,
-			   struct node *node, void *arg)
+static const char *dump_state_node_record(FILE *fp, const char *name,
+					  const struct xs_permissions *perms,
+					  unsigned int n_perms,
+					  const void *data, unsigned int datalen)
 {
-	struct dump_node_data *data = arg;
-	FILE *fp = data->fp;
 	unsigned int pathlen;
 	struct xs_state_record_header head;
 	struct xs_state_node sn;
 	const char *ret;
 
-	pathlen = strlen(node->name) + 1;
+	pathlen = strlen(name) + 1;
 
 	head.type = XS_STATE_TYPE_NODE;
 	head.length = sizeof(sn);
 	sn.conn_id = 0;
 	sn.ta_id = 0;
 	sn.ta_access = 0;
-	sn.perm_n = node->perms.num;
+	sn.perm_n = n_perms;
 	sn.path_len = pathlen;
-	sn.data_len = node->datalen;
-	head.length += node->perms.num * sizeof(*sn.perms);
+	sn.data_len = datalen;
+	head.length += n_perms * sizeof(*sn.perms);
 	head.length += pathlen;
-	head.length += node->datalen;
+	head.length += datalen;
 	head.length = ROUNDUP(head.length, 3);
 
 	if (fwrite(&head, sizeof(head), 1, fp) != 1)
-		return dump_state_node_err(data, "Dump node head error");
+		return "Dump node head error";
 	if (fwrite(&sn, sizeof(sn), 1, fp) != 1)
-		return dump_state_node_err(data, "Dump node state error");
+		return "Dump node state error";
 
-	ret = dump_state_node_perms(fp, node->perms.p, node->perms.num);
+	ret = dump_state_node_perms(fp, perms, n_perms);
 	if (ret)
-		return dump_state_node_err(data, ret);
+		return ret;
+
+	if (fwrite(name, pathlen, 1, fp) != 1)
+		return "Dump node path error";
 
-	if (fwrite(node->name, pathlen, 1, fp) != 1)
-		return dump_state_node_err(data, "Dump node path error");
+	if (datalen && fwrite(data, datalen, 1, fp) != 1)
+		return "Dump node data error";
 
-	if (node->datalen && fwrite(node->data, node->datalen, 1, fp) != 1)
-		return dump_state_node_err(data, "Dump node data error");
+	return dump_state_align(fp);
+}
+
+static int dump_state_node(const void *ctx, struct connection *conn,
+			   struct node *node, void *arg)
+{
+	struct dump_node_data *data = arg;
+	const char *ret;
 
-	ret = dump_state_align(fp);
+	ret = dump_state_node_record(data->fp, node->name, node->perms.p,
+				     node->perms.num, node->data,
+				     node->datalen);
 	if (ret)
 		return dump_state_node_err(data, ret);
 
@@ -3271,16 +4083,168 @@ static int dump_state_special_node(FILE *fp, const void *ctx,
 	return ret;
 }
 
-const char *dump_state_nodes(FILE *fp, const void *ctx)
+/*
+ * The nodes are dumped while requests are still being served, so only the
+ * nodes changed meanwhile have to be dumped again with xenstored frozen:
+ * - dump_state_nodes_step() walks the tree a slice at a time.  It keeps its
+ *   own copies of the nodes on the path to the current one, so changes of
+ *   the store don't disturb it.  A child deleted before the walk reaches it
+ *   is skipped.
+ * - All nodes written or deleted after dump_state_nodes_start() are noted.
+ *   dump_state_nodes_end() dumps them again, or a record with no
+ *   permissions for a deleted one.  This is done in the order of the
+ *   names, so a parent comes before its children.
+ * When restoring, a later record of a node replaces an earlier one.
+ */
+static int precopy_destroy(void *_pc)
+{
+	precopy = NULL;
+
+	return 0;
+}
+
+struct dump_precopy *dump_state_nodes_start(const void *ctx)
+{
+	struct dump_precopy *pc;
+
+	pc = talloc_zero(ctx, struct dump_precopy);
+	if (!pc)
+		return NULL;
+
+	pc->changed = create_hashtable(pc, 64, hash_from_key_fn, keys_equal_fn,
+				       HASHTABLE_FREE_KEY);
+	if (!pc->changed) {
+		talloc_free(pc);
+		return NULL;
+	}
+
+	talloc_set_destructor(pc, precopy_destroy);
+	precopy = pc;
+
+	return pc;
+}
+
+/* Dump up to max nodes, continuing where the last call stopped. */
+const char *dump_state_nodes_step(FILE *fp, struct dump_precopy *pc,
+				  unsigned int max, bool *done)
+{
+	struct dump_node_data data = { .fp = fp };
+	struct node *node = pc->node, *child;
+	char *name;
+
+	*done = false;
+
+	if (!pc->started) {
+		node = read_node(NULL, pc, "/");
+		if (!node)
+			return "Dump node read node error";
+		node->parent = NULL;
+		node->childoff = 0;
+		if (dump_state_node(pc, NULL, node, &data))
+			return data.err;
+		pc->nodes++;
+		pc->started = true;
+	}
+
+	while (max) {
+		if (node->childoff >= node->childlen) {
+			child = node;
+			node = node->parent;
+			talloc_free(child);
+			if (!node) {
+				pc->node = NULL;
+				*done = true;
+				return NULL;
+			}
+			continue;
+		}
+
+		name = child_name(pc, node->name,
+				  node->children + node->childoff);
+		if (!name)
+			return "Dump node allocation error";
+		node->childoff += strlen(node->children + node->childoff) + 1;
+
+		child = read_node(NULL, pc, name);
+		talloc_free(name);
+		if (!child) {
+			/* Deleted after the start, so it has been noted. */
+			if (errno == ENOENT)
+				continue;
+			return "Dump node read node error";
+		}
+
+		child->parent = node;
+		child->childoff = 0;
+		node = child;
+		if (dump_state_node(pc, NULL, node, &data))
+			return data.err;
+		pc->nodes++;
+		max--;
+	}
+
+	pc->node = node;
+
+	return NULL;
+}
+
+struct changed_names {
+	const char **names;
+	unsigned int num;
+};
+
+static int precopy_collect(const void *k, void *v, void *arg)
+{
+	struct changed_names *changed = arg;
+
+	changed->names[changed->num++] = k;
+
+	return 0;
+}
+
+static int precopy_name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+const char *dump_state_nodes_end(FILE *fp, const void *ctx,
+				 struct dump_precopy *pc)
 {
 	struct dump_node_data data = {
 		.fp = fp,
-		.err = "Dump node walk error"
+		.err = "Dump node read node error"
 	};
-	struct walk_funcs walkfuncs = { .enter = dump_state_node };
+	struct changed_names changed = { };
+	struct node *node;
+	unsigned int i;
+	const char *ret;
 
-	if (walk_node_tree(ctx, NULL, "/", &walkfuncs, &data))
-		return data.err;
+	if (pc->err)
+		return pc->err;
+
+	pc->changed_nodes = hashtable_count(pc->changed);
+	changed.names = talloc_array(ctx, const char *,
+				     pc->changed_nodes + 1);
+	if (!changed.names)
+		return "Dump node allocation error";
+	hashtable_iterate(pc->changed, precopy_collect, &changed);
+	qsort(changed.names, changed.num, sizeof(*changed.names),
+	      precopy_name_cmp);
+
+	for (i = 0; i < changed.num; i++) {
+		node = read_node(NULL, ctx, changed.names[i]);
+		if (node) {
+			ret = dump_state_node(ctx, NULL, node, &data) ?
+			      data.err : NULL;
+			talloc_free(node);
+		} else if (errno == ENOENT)
+			ret = dump_state_node_record(fp, changed.names[i],
+						     NULL, 0, NULL, 0);
+		else
+			ret = data.err;
+		if (ret)
+			return ret;
+	}
 
 	if (dump_state_special_node(fp, ctx, &data, "@releaseDomain"))
 		return data.err;
@@ -3322,6 +4286,7 @@ static void add_buffered_data(struct buffered_data *bdata,
 	/* Queue for later transmission. */
 	list_add_tail(&bdata->list, &conn->out_list);
 	bdata->on_out_list = true;
+	conn_set_ready(conn);
 	/*
 	 * Watch events are never "outstanding", but the request causing them
 	 * are instead kept "outstanding" until all watch events caused by that
@@ -3414,16 +4379,61 @@ void read_state_buffered_data(const void *ctx, struct connection *conn,
 	}
 }
 
+/* A node dumped again after the precopy has been deleted meanwhile. */
+static void read_state_node_deleted(const void *ctx, const char *name)
+{
+	struct node *node, *parent;
+	struct connection conn = { .id = priv_domid };
+	char *parentname;
+	const char *base;
+	unsigned int off;
+	TDB_DATA key;
+
+	/* Its parent might have been removed already. */
+	node = read_node(NULL, ctx, name);
+	if (!node)
+		return;
+
+	set_tdb_key(name, &key);
+	if (do_tdb_delete(NULL, &key, &node->acc))
+		barf("delete node error restoring node");
+	if (domain_nbentry_dec(&conn, get_node_owner(node)))
+		barf("node accounting error restoring node");
+
+	parentname = get_parent(node, name);
+	if (!parentname)
+		barf("allocation error restoring node");
+	parent = read_node(NULL, node, parentname);
+	if (parent) {
+		base = basename(name);
+		for (off = 0; off < parent->childlen;
+		     off += strlen(parent->children + off) + 1) {
+			if (!streq(parent->children + off, base))
+				continue;
+			if (remove_child_entry(NULL, parent, off))
+				barf("write parent error restoring node");
+			break;
+		}
+	}
+
+	talloc_free(node);
+}
+
 void read_state_node(const void *ctx, const void *state)
 {
 	const struct xs_state_node *sn = state;
-	struct node *node, *parent;
+	struct node *node, *parent, *old;
 	TDB_DATA key;
 	char *name, *parentname;
 	unsigned int i;
 	struct connection conn = { .id = priv_domid };
 
 	name = (char *)(sn->perms + sn->perm_n);
+	if (!sn->perm_n) {
+		read_state_node_deleted(ctx, name);
+		return;
+	}
+
 	node = talloc(ctx, struct node);
 	if (!node)
 		barf("allocation error restoring node");
@@ -3460,6 +4470,29 @@ void read_state_node(const void *ctx, const void *state)
 		node->perms.p[i].id = sn->perms[i].domid;
 	}
 
+	/*
+	 * A node changed after having been dumped is dumped again.  Nodes
+	 * restored already are newer than those set up by setup_structure().
+	 */
+	old = read_node(NULL, node, name);
+	if (old && old->generation > restore_generation) {
+		node->acc = old->acc;
+		node->childlen = old->childlen;
+		node->children = old->children;
+
+		set_tdb_key(name, &key);
+		if (write_node_raw(NULL, &key, node, true))
+			barf("write node error restoring node");
+
+		if (get_node_owner(old) != get_node_owner(node) &&
+		    (domain_nbentry_dec(&conn, get_node_owner(old)) ||
+		     domain_nbentry_inc(&conn, get_node_owner(node))))
+			barf("node accounting error restoring node");
+
+		talloc_free(node);
+		return;
+	}
+
 	if (!strstarts(name, "@")) {
 		parentname = get_parent(node, name);
 		if (!parentname)
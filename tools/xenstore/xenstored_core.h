@@ -79,6 +79,12 @@ struct buffered_data
 		struct buffered_data *req;      /* request causing event. */
 	} pend;
 
+	/*
+	 * Watch event which may still be changed: reference to it, cleared
+	 * when the event is being sent or dropped.
+	 */
+	struct buffered_data **event_ref;
+
 	union {
 		struct xsd_sockmsg msg;
 		char raw[sizeof(struct xsd_sockmsg)];
@@ -114,14 +120,46 @@ struct interface_funcs {
 	bool (*can_read)(struct connection *);
 };
 
+/* A file descriptor watched by the main loop. */
+struct poll_fd {
+	int fd;
+
+	/* Events (POLLIN etc.) to wait for, and seen by the last wait. */
+	short events;
+	short revents;
+
+	/* Is fd being watched? */
+	bool added;
+	/* Index in the pollfd array, if poll() is used for waiting. */
+	unsigned int idx;
+
+	/* Connection to mark ready when fd has events, if any. */
+	struct connection *conn;
+};
+
+/* Start or stop watching fd in the main loop, or change the events. */
+void poll_fd_add(struct poll_fd *pfd, int fd, short events,
+		 struct connection *conn);
+void poll_fd_set_events(struct poll_fd *pfd, short events);
+void poll_fd_del(struct poll_fd *pfd);
+
 struct connection
 {
 	struct list_head list;
 
 	/* The file descriptor we came in on. */
 	int fd;
-	/* The index of pollfd in global pollfd array */
-	int pollfd_idx;
+	/* Its state in the main loop. */
+	struct poll_fd pfd;
+	/* File descriptors passed along with a request on fd, if any. */
+	struct passed_fds *passed_fds;
+	/* Shared memory ring used instead of fd, if any. */
+	struct local_ring *ring;
+
+	/* Entry in the list of connections to look at in the main loop. */
+	struct list_head ready_list;
+	/* Entry in the list of connections with pending timeouts. */
+	struct list_head timed_list;
 
 	/* Who am I? Domid of connection. */
 	unsigned int id;
@@ -219,8 +257,9 @@ unsigned int get_string(const struct buffered_data *data, unsigned int offset);
 
 void send_reply(struct connection *conn, enum xsd_sockmsg_type type,
 		const void *data, unsigned int len);
-void send_event(struct buffered_data *req, struct connection *conn,
-		const char *path, const char *token);
+struct buffered_data *send_event(struct buffered_data *req,
+				 struct connection *conn,
+				 const char *path, const char *token);
 
 /* Some routines (write, mkdir, etc) just need a non-error return */
 void send_ack(struct connection *conn, enum xsd_sockmsg_type type);
@@ -251,6 +290,7 @@ int rm_node(struct connection *conn, const void *ctx, const char *name);
 
 void setup_structure(bool live_update);
 struct connection *new_connection(const struct interface_funcs *funcs);
+void conn_set_ready(struct connection *conn);
 struct connection *get_connection_by_id(unsigned int conn_id);
 void check_store(void);
 void corrupt(struct connection *conn, const char *fmt, ...);
@@ -355,9 +395,22 @@ extern const struct interface_funcs socket_funcs;
 #endif
 extern xengnttab_handle **xgt_handle;
 
+/* Hash and compare functions for hashtables keyed by strings. */
+unsigned int hash_from_key_fn(const void *k);
+int keys_equal_fn(const void *key1, const void *key2);
+
 int remember_string(struct hashtable *hash, const char *str);
+/*
+ * Return the copy of str kept in hash, adding it if needed.  Each call must
+ * be paired with forget_string(), which drops the copy after the last one.
+ */
+const char *intern_string(struct hashtable *hash, const char *str);
+void forget_string(struct hashtable *hash, const char *str);
 
 void set_tdb_key(const char *name, TDB_DATA *key);
+TDB_DATA do_tdb_fetch(const void *ctx, TDB_DATA *key);
+/* Reply with the memory used by the nodes, by classes of node names. */
+int store_get_stats(const void *ctx, struct connection *conn);
 int do_tdb_write(struct connection *conn, TDB_DATA *key, TDB_DATA *data,
 		 struct node_account_data *acc, bool no_quota_check);
 int do_tdb_delete(struct connection *conn, TDB_DATA *key,
@@ -365,10 +418,35 @@ int do_tdb_delete(struct connection *conn, TDB_DATA *key,
 
 void conn_free_buffered_data(struct connection *conn);
 
+/* Milliseconds of the monotonic clock. */
+uint64_t get_now_msec(void);
+
 const char *dump_state_global(FILE *fp);
 const char *dump_state_buffered_data(FILE *fp, const struct connection *c,
 				     struct xs_state_connection *sc);
-const char *dump_state_nodes(FILE *fp, const void *ctx);
+
+/*
+ * State of dumping the nodes for a live update while requests are still
+ * being served, see dump_state_nodes_start().
+ */
+struct dump_precopy {
+	/* Node being walked, with its parents linked via node->parent. */
+	struct node *node;
+	bool started;
+	/* Nodes dumped by the walk, and changed ones dumped in the end. */
+	unsigned int nodes;
+	unsigned int changed_nodes;
+	/* Names of nodes written or deleted since the start. */
+	struct hashtable *changed;
+	/* Set if a change couldn't be noted. */
+	const char *err;
+};
+
+struct dump_precopy *dump_state_nodes_start(const void *ctx);
+const char *dump_state_nodes_step(FILE *fp, struct dump_precopy *pc,
+				  unsigned int max, bool *done);
+const char *dump_state_nodes_end(FILE *fp, const void *ctx,
+				 struct dump_precopy *pc);
 const char *dump_state_node_perms(FILE *fp, const struct xs_permissions *perms,
 				  unsigned int n_perms);
 
@@ -32,6 +32,7 @@
 #include "xenstored_transaction.h"
 #include "xenstored_watch.h"
 #include "xenstored_control.h"
+#include "xenstored_ring.h"
 
 #include <xenevtchn.h>
 #include <xenctrl.h>
@@ -89,6 +90,8 @@ struct domain
 	wrl_creditt wrl_credit; /* [ -wrl_config_writecost, +_dburst ] */
 	struct wrl_timestampt wrl_timestamp;
 	bool wrl_delay_logged;
+	/* Is the domain blocked by the write rate limit? */
+	bool wrl_blocked;
 };
 
 struct changed_domain
@@ -104,6 +107,20 @@ struct changed_domain
 };
 
 static struct hashtable *domhash;
+/* Domains by local event channel port. */
+static struct hashtable *porthash;
+
+static void domain_set_port(struct domain *domain, evtchn_port_t port)
+{
+	if (domain->port)
+		hashtable_remove(porthash, &domain->port);
+
+	domain->port = port;
+
+	if (port && !hashtable_insert(porthash, &domain->port, domain))
+		syslog(LOG_ERR, "Could not add port %u of domain %u\n",
+		       port, domain->domid);
+}
 
 static bool check_indexes(XENSTORE_RING_IDX cons, XENSTORE_RING_IDX prod)
 {
@@ -130,12 +147,11 @@ static const void *get_input_chunk(XENSTORE_RING_IDX cons,
 	return buf + MASK_XENSTORE_IDX(cons);
 }
 
-static int writechn(struct connection *conn,
-		    const void *data, unsigned int len)
+int ring_write(struct xenstore_domain_interface *intf,
+	       const void *data, unsigned int len)
 {
 	uint32_t avail;
 	void *dest;
-	struct xenstore_domain_interface *intf = conn->domain->interface;
 	XENSTORE_RING_IDX cons, prod;
 
 	/* Must read indexes once, and before anything else, and verified. */
@@ -156,16 +172,14 @@ static int writechn(struct connection *conn,
 	xen_mb();
 	intf->rsp_prod += len;
 
-	xenevtchn_notify(xce_handle, conn->domain->port);
-
 	return len;
 }
 
-static int readchn(struct connection *conn, void *data, unsigned int len)
+int ring_read(struct xenstore_domain_interface *intf,
+	      void *data, unsigned int len)
 {
 	uint32_t avail;
 	const void *src;
-	struct xenstore_domain_interface *intf = conn->domain->interface;
 	XENSTORE_RING_IDX cons, prod;
 
 	/* Must read indexes once, and before anything else, and verified. */
@@ -186,11 +200,30 @@ static int readchn(struct connection *conn, void *data, unsigned int len)
 	xen_mb();
 	intf->req_cons += len;
 
-	xenevtchn_notify(xce_handle, conn->domain->port);
-
 	return len;
 }
 
+static int writechn(struct connection *conn,
+		    const void *data, unsigned int len)
+{
+	int ret = ring_write(conn->domain->interface, data, len);
+
+	if (ret >= 0)
+		xenevtchn_notify(xce_handle, conn->domain->port);
+
+	return ret;
+}
+
+static int readchn(struct connection *conn, void *data, unsigned int len)
+{
+	int ret = ring_read(conn->domain->interface, data, len);
+
+	if (ret >= 0)
+		xenevtchn_notify(xce_handle, conn->domain->port);
+
+	return ret;
+}
+
 static bool domain_can_write(struct connection *conn)
 {
 	struct xenstore_domain_interface *intf = conn->domain->interface;
@@ -247,6 +280,14 @@ static int domain_tree_remove_sub(const void *ctx, struct connection *conn,
 	if (keep_orphans) {
 		set_tdb_key(node->name, &key);
 		domain->nbentry--;
+		/* The permissions might be shared with the store. */
+		node->perms.p = talloc_memdup(node, node->perms.p,
+					      node->perms.num *
+					      sizeof(*node->perms.p));
+		if (!node->perms.p) {
+			errno = ENOMEM;
+			return WALK_TREE_ERROR_STOP;
+		}
 		node->perms.p[0].id = priv_domid;
 		node->acc.memory = 0;
 		domain_nbentry_inc(NULL, priv_domid);
@@ -321,6 +362,7 @@ static int destroy_domain(void *_domain)
 	if (domain->port) {
 		if (xenevtchn_unbind(xce_handle, domain->port) == -1)
 			eprintf("> Unbinding port %i failed!\n", domain->port);
+		domain_set_port(domain, 0);
 	}
 
 	if (domain->interface) {
@@ -393,16 +435,35 @@ void check_domains(void)
 		fire_special_watches("@releaseDomain");
 }
 
-/* We scan all domains rather than use the information given here. */
+static int domain_set_ready(const void *k, void *v, void *arg)
+{
+	struct domain *domain = v;
+
+	if (domain->conn)
+		conn_set_ready(domain->conn);
+
+	return 0;
+}
+
 void handle_event(void)
 {
 	evtchn_port_t port;
+	struct domain *domain;
 
 	if ((port = xenevtchn_pending(xce_handle)) == -1)
 		barf_perror("Failed to read from event fd");
 
 	if (port == virq_port)
 		check_domains();
+	else {
+		domain = hashtable_search(porthash, &port);
+		if (domain)
+			domain_set_ready(NULL, domain, NULL);
+		else {
+			/* Can't tell the domain, so look at all of them. */
+			hashtable_iterate(domhash, domain_set_ready, NULL);
+		}
+	}
 
 	if (xenevtchn_unmask(xce_handle, port) == -1)
 		barf_perror("Failed to write to event fd");
@@ -499,7 +560,7 @@ static int new_domain(struct domain *domain, int port, bool restore)
 {
 	int rc;
 
-	domain->port = 0;
+	domain_set_port(domain, 0);
 	domain->shutdown = false;
 	domain->path = talloc_domain_path(domain, domain->domid);
 	if (!domain->path) {
@@ -510,14 +571,14 @@ static int new_domain(struct domain *domain, int port, bool restore)
 	wrl_domain_new(domain);
 
 	if (restore)
-		domain->port = port;
+		domain_set_port(domain, port);
 	else {
 		/* Tell kernel we're interested in this event. */
 		rc = xenevtchn_bind_interdomain(xce_handle, domain->domid,
 						port);
 		if (rc == -1)
 			return errno;
-		domain->port = rc;
+		domain_set_port(domain, rc);
 	}
 
 	domain->introduced = true;
@@ -700,7 +761,7 @@ static struct domain *introduce_domain(const void *ctx,
 		if (domain->port)
 			xenevtchn_unbind(xce_handle, domain->port);
 		rc = xenevtchn_bind_interdomain(xce_handle, domid, port);
-		domain->port = (rc == -1) ? 0 : rc;
+		domain_set_port(domain, (rc == -1) ? 0 : rc);
 	}
 
 	return domain;
@@ -935,6 +996,10 @@ void domain_init(int evtfd)
 	if (!domhash)
 		barf_perror("Failed to allocate domain hashtable");
 
+	porthash = create_hashtable(NULL, 8, domhash_fn, domeq_fn, 0);
+	if (!porthash)
+		barf_perror("Failed to allocate port hashtable");
+
 	xc_handle = talloc(talloc_autofree_context(), xc_interface*);
 	if (!xc_handle)
 		barf_perror("Failed to allocate domain handle");
@@ -1033,13 +1098,27 @@ int domain_alloc_permrefs(struct node_perms *perms)
 int domain_adjust_node_perms(struct node *node)
 {
 	unsigned int i;
+	bool copied = false;
 
 	for (i = 1; i < node->perms.num; i++) {
 		if (node->perms.p[i].perms & XS_PERM_IGNORE)
 			continue;
-		if (!chk_domain_generation(node->perms.p[i].id,
-					   node->generation))
-			node->perms.p[i].perms |= XS_PERM_IGNORE;
+		if (chk_domain_generation(node->perms.p[i].id,
+					  node->generation))
+			continue;
+
+		/* The permissions might be shared with the store. */
+		if (!copied) {
+			node->perms.p = talloc_memdup(node, node->perms.p,
+						      node->perms.num *
+						      sizeof(*node->perms.p));
+			if (!node->perms.p) {
+				errno = ENOMEM;
+				return errno;
+			}
+			copied = true;
+		}
+		node->perms.p[i].perms |= XS_PERM_IGNORE;
 	}
 
 	return 0;
@@ -1184,6 +1263,10 @@ int domain_memory_add(unsigned int domid, int mem, bool no_quota_check)
 		if (domain_chk_quota(domain, domain->memory + mem) &&
 		    !no_quota_check)
 			return ENOMEM;
+		/* Reading more requests might have been blocked by the quota. */
+		if (mem < 0 && domain->conn && quota_memory_per_domain_hard &&
+		    domain->memory >= quota_memory_per_domain_hard)
+			conn_set_ready(domain->conn);
 		domain->memory += mem;
 	} else {
 		/*
@@ -1233,11 +1316,18 @@ void domain_outstanding_inc(struct connection *conn)
 	conn->domain->nboutstanding++;
 }
 
+static void domain_outstanding_dec_sub(struct domain *d)
+{
+	/* Reading more requests might have been blocked by the quota. */
+	if (d->nboutstanding-- >= quota_req_outstanding && d->conn)
+		conn_set_ready(d->conn);
+}
+
 void domain_outstanding_dec(struct connection *conn)
 {
 	if (!conn || !conn->domain)
 		return;
-	conn->domain->nboutstanding--;
+	domain_outstanding_dec_sub(conn->domain);
 }
 
 void domain_outstanding_domid_dec(unsigned int domid)
@@ -1245,7 +1335,7 @@ void domain_outstanding_domid_dec(unsigned int domid)
 	struct domain *d = find_domain_by_domid(domid);
 
 	if (d)
-		d->nboutstanding--;
+		domain_outstanding_dec_sub(d);
 }
 
 static wrl_creditt wrl_config_writecost      = WRL_FACTOR;
@@ -1258,6 +1348,7 @@ static wrl_creditt wrl_config_newdoms_dburst =
 long wrl_ntransactions;
 
 static long wrl_ndomains;
+static long wrl_nblocked;
 static wrl_creditt wrl_reserve; /* [-wrl_config_newdoms_dburst, +_gburst ] */
 static time_t wrl_log_last_warning; /* 0: no previous warning */
 
@@ -1316,6 +1407,10 @@ void wrl_domain_new(struct domain *domain)
 void wrl_domain_destroy(struct domain *domain)
 {
 	wrl_ndomains--;
+	if (domain->wrl_blocked) {
+		domain->wrl_blocked = false;
+		wrl_nblocked--;
+	}
 	/*
 	 * Don't bother recalculating domain's credit - this just
 	 * means we don't give the reserve the ending domain's credit
@@ -1411,6 +1506,43 @@ void wrl_check_timeout(struct domain *domain,
 		  wakeup);
 }
 
+struct wrl_check_args {
+	struct wrl_timestampt now;
+	int *ptimeout;
+};
+
+static int wrl_check_domain(const void *k, void *v, void *arg)
+{
+	struct domain *domain = v;
+	struct wrl_check_args *args = arg;
+
+	if (!domain->conn)
+		return 0;
+
+	wrl_check_timeout(domain, args->now, args->ptimeout);
+
+	if (domain->wrl_blocked && domain->wrl_credit >= 0) {
+		domain->wrl_blocked = false;
+		wrl_nblocked--;
+		conn_set_ready(domain->conn);
+	}
+
+	return 0;
+}
+
+/*
+ * Only blocked domains need their credit to be updated while waiting, but
+ * the credit of all other domains is updated as well then, as it flows into
+ * the reserve which the blocked domains draw from.
+ */
+void wrl_check_timeouts(struct wrl_timestampt now, int *ptimeout)
+{
+	struct wrl_check_args args = { .now = now, .ptimeout = ptimeout };
+
+	if (wrl_nblocked)
+		hashtable_iterate(domhash, wrl_check_domain, &args);
+}
+
 #define WRL_LOG(now, ...) \
 	(syslog(LOG_WARNING, "write rate limit: " __VA_ARGS__))
 
@@ -1430,6 +1562,10 @@ void wrl_apply_debit_actual(struct domain *domain)
 		  (long)domain->wrl_credit, (long)wrl_reserve);
 
 	if (domain->wrl_credit < 0) {
+		if (!domain->wrl_blocked) {
+			domain->wrl_blocked = true;
+			wrl_nblocked++;
+		}
 		if (!domain->wrl_delay_logged) {
 			domain->wrl_delay_logged = true;
 			WRL_LOG(now, "domain %ld is affected\n",
@@ -1485,6 +1621,11 @@ const char *dump_state_connections(FILE *fp)
 	struct connection *c;
 
 	list_for_each_entry(c, &connections, list) {
+		if (c->ring) {
+			local_ring_close(c);
+			continue;
+		}
+
 		head.type = XS_STATE_TYPE_CONN;
 		head.length = sizeof(sc);
 
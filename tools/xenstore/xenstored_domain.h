@@ -56,6 +56,16 @@ void dom0_init(void);
 void domain_deinit(void);
 void ignore_connection(struct connection *conn, unsigned int err);
 
+/*
+ * Copy data to the response ring, or from the request ring, of a Xenstore
+ * interface page, as far as there is room or data.  Returns the number of
+ * bytes copied, or -1 if the ring indexes are bogus.
+ */
+int ring_write(struct xenstore_domain_interface *intf,
+	       const void *data, unsigned int len);
+int ring_read(struct xenstore_domain_interface *intf,
+	      void *data, unsigned int len);
+
 /* Returns the implicit path of a connection (only domains have this) */
 const char *get_implicit_path(const struct connection *conn);
 
@@ -121,6 +131,7 @@ void wrl_credit_update(struct domain *domain, struct wrl_timestampt now);
 void wrl_check_timeout(struct domain *domain,
                        struct wrl_timestampt now,
                        int *ptimeout);
+void wrl_check_timeouts(struct wrl_timestampt now, int *ptimeout);
 void wrl_log_periodic(struct wrl_timestampt now);
 void wrl_apply_debit_direct(struct connection *conn);
 void wrl_apply_debit_trans_commit(struct connection *conn);
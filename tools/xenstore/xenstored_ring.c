@@ -0,0 +1,321 @@
+/*
+    Shared memory rings of local connections for Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * A client connected via the socket can move its requests and replies to a
+ * ring in shared memory, laid out like the ring page of a domain.  With the
+ * "ring" control command it passes three file descriptors: a sealed memfd
+ * holding the ring, an eventfd signalled by the client for xenstored, and
+ * one signalled by xenstored for the client.  The reply to the command is
+ * the first message on the ring.
+ *
+ * Other than the event channel of a domain, which is notified for each chunk
+ * of data, the eventfds are signalled only if the other side might wait:
+ * - by a producer making data available after the consumer had emptied
+ *   the ring, and
+ * - by a consumer making room after the producer had found the ring full.
+ * Both sides update their own index, issue a full barrier and only then look
+ * at the index of the other side, so at least one of them sees the update of
+ * the other one.  A client doing one request at a time, with xenstored being
+ * idle in between, thus causes one kick per request and one per reply.
+ *
+ * Nothing is sent on the socket any longer, so an event on it means the
+ * client has gone away.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "talloc.h"
+#include "xenstored_core.h"
+#include "xenstored_domain.h"
+#include "xenstored_ring.h"
+
+/* The memfd with the ring and the two eventfds. */
+#define LOCAL_RING_FDS 3
+
+struct passed_fds {
+	unsigned int nr;
+	int fd[LOCAL_RING_FDS];
+};
+
+struct local_ring {
+	struct xenstore_domain_interface *intf;
+
+	/* Signalled by the client, and for the client. */
+	int req_evt;
+	int rsp_evt;
+
+	/* State of req_evt in the main loop. */
+	struct poll_fd pfd;
+};
+
+static int destroy_passed_fds(void *_fds)
+{
+	struct passed_fds *fds = _fds;
+	unsigned int i;
+
+	for (i = 0; i < fds->nr; i++)
+		close(fds->fd[i]);
+
+	return 0;
+}
+
+int recv_with_fds(struct connection *conn, void *data, unsigned int len)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int) * LOCAL_RING_FDS)];
+	} cmsg;
+	struct iovec iov = {
+		.iov_base = data,
+		.iov_len = len,
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = &cmsg,
+		.msg_controllen = sizeof(cmsg),
+	};
+	struct passed_fds fds;
+	struct cmsghdr *c;
+	int rc;
+
+	rc = recvmsg(conn->fd, &msg, MSG_CMSG_CLOEXEC);
+	if (rc < 0)
+		return rc;
+
+	c = CMSG_FIRSTHDR(&msg);
+	if (!c || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+		return rc;
+
+	fds.nr = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	memcpy(fds.fd, CMSG_DATA(c), fds.nr * sizeof(int));
+
+	/* Any further descriptors have been dropped, so don't use these. */
+	if (msg.msg_flags & MSG_CTRUNC) {
+		destroy_passed_fds(&fds);
+		return rc;
+	}
+
+	talloc_free(conn->passed_fds);
+	conn->passed_fds = talloc_memdup(conn, &fds, sizeof(fds));
+	if (conn->passed_fds)
+		talloc_set_destructor(conn->passed_fds, destroy_passed_fds);
+	else
+		destroy_passed_fds(&fds);
+
+	return rc;
+}
+
+static void kick(int evt)
+{
+	uint64_t one = 1;
+
+	/* Only fails if the counter is about to overflow, so no need to. */
+	while (write(evt, &one, sizeof(one)) < 0 && errno == EINTR)
+		continue;
+}
+
+static void reset_kicks(int evt)
+{
+	uint64_t cnt;
+
+	while (read(evt, &cnt, sizeof(cnt)) < 0 && errno == EINTR)
+		continue;
+}
+
+static int local_ring_write(struct connection *conn,
+			    const void *data, unsigned int len)
+{
+	struct local_ring *ring = conn->ring;
+	XENSTORE_RING_IDX prod = ring->intf->rsp_prod;
+	int ret;
+
+	ret = ring_write(ring->intf, data, len);
+	if (ret > 0) {
+		xen_mb();
+		if (ring->intf->rsp_cons == prod)
+			kick(ring->rsp_evt);
+	}
+
+	return ret;
+}
+
+static int local_ring_read(struct connection *conn, void *data,
+			   unsigned int len)
+{
+	struct local_ring *ring = conn->ring;
+	XENSTORE_RING_IDX cons = ring->intf->req_cons;
+	int ret;
+
+	ret = ring_read(ring->intf, data, len);
+	if (ret > 0) {
+		xen_mb();
+		if (ring->intf->req_prod - cons == XENSTORE_RING_SIZE)
+			kick(ring->rsp_evt);
+	}
+
+	return ret;
+}
+
+static bool local_ring_alive(struct connection *conn)
+{
+	if (conn->pfd.revents) {
+		talloc_free(conn);
+		return false;
+	}
+
+	return true;
+}
+
+static bool local_ring_can_write(struct connection *conn)
+{
+	struct xenstore_domain_interface *intf = conn->ring->intf;
+
+	if (!local_ring_alive(conn))
+		return false;
+
+	xen_mb();
+	return (intf->rsp_prod - intf->rsp_cons) != XENSTORE_RING_SIZE;
+}
+
+static bool local_ring_can_read(struct connection *conn)
+{
+	struct local_ring *ring = conn->ring;
+
+	if (!local_ring_alive(conn))
+		return false;
+
+	/* Kicks arriving after this will be seen by the next wait. */
+	if (ring->pfd.revents) {
+		ring->pfd.revents = 0;
+		reset_kicks(ring->req_evt);
+	}
+
+	xen_mb();
+	return ring->intf->req_cons != ring->intf->req_prod;
+}
+
+static const struct interface_funcs local_ring_funcs = {
+	.write = local_ring_write,
+	.read = local_ring_read,
+	.can_write = local_ring_can_write,
+	.can_read = local_ring_can_read,
+};
+
+static int destroy_local_ring(void *_ring)
+{
+	struct local_ring *ring = _ring;
+
+	poll_fd_del(&ring->pfd);
+	munmap(ring->intf, sizeof(*ring->intf));
+	close(ring->req_evt);
+	close(ring->rsp_evt);
+
+	return 0;
+}
+
+static bool is_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	return flags >= 0 && (flags & O_NONBLOCK);
+}
+
+int local_ring_attach(struct connection *conn)
+{
+	struct passed_fds *fds = conn->passed_fds;
+	struct local_ring *ring;
+	struct stat st;
+	int seals;
+
+	if (conn->domain || conn->ring || !fds || fds->nr != LOCAL_RING_FDS)
+		return EINVAL;
+
+	/* The client truncating the memfd must not kill us with SIGBUS. */
+	seals = fcntl(fds->fd[0], F_GET_SEALS);
+	if (seals < 0 || !(seals & F_SEAL_SHRINK) || fstat(fds->fd[0], &st) ||
+	    st.st_size < sizeof(*ring->intf))
+		return EINVAL;
+
+	/* Resetting the kicks must not block the main loop. */
+	if (!is_nonblocking(fds->fd[1]) || !is_nonblocking(fds->fd[2]))
+		return EINVAL;
+
+	ring = talloc_zero(conn, struct local_ring);
+	if (!ring)
+		return ENOMEM;
+
+	ring->intf = mmap(NULL, sizeof(*ring->intf), PROT_READ | PROT_WRITE,
+			  MAP_SHARED, fds->fd[0], 0);
+	if (ring->intf == MAP_FAILED) {
+		talloc_free(ring);
+		return errno;
+	}
+
+	close(fds->fd[0]);
+	ring->req_evt = fds->fd[1];
+	ring->rsp_evt = fds->fd[2];
+	fds->nr = 0;
+	talloc_free(fds);
+	conn->passed_fds = NULL;
+	talloc_set_destructor(ring, destroy_local_ring);
+
+	conn->ring = ring;
+	conn->funcs = &local_ring_funcs;
+	/* The socket events seen so far were for this request. */
+	conn->pfd.revents = 0;
+
+	return 0;
+}
+
+void local_ring_poll(struct connection *conn, short events)
+{
+	struct local_ring *ring = conn->ring;
+
+	if (!ring->pfd.added)
+		poll_fd_add(&ring->pfd, ring->req_evt, events, conn);
+	else
+		poll_fd_set_events(&ring->pfd, events);
+}
+
+void local_ring_close(struct connection *conn)
+{
+	/* The client sees the socket being closed and has to reconnect. */
+	shutdown(conn->fd, SHUT_RDWR);
+	fcntl(conn->fd, F_SETFD, FD_CLOEXEC);
+}
+
+/*
+ * Local variables:
+ *  mode: C
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
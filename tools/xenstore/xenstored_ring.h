@@ -0,0 +1,64 @@
+/*
+    Shared memory rings of local connections for Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _XENSTORED_RING_H
+#define _XENSTORED_RING_H
+
+#include <unistd.h>
+
+#include "xenstored_core.h"
+
+#ifdef __linux__
+/*
+ * Read from the socket of conn, keeping any file descriptors passed along
+ * in conn->passed_fds.
+ */
+int recv_with_fds(struct connection *conn, void *data, unsigned int len);
+
+/*
+ * Move the requests and replies of socket connection conn to the ring
+ * passed along with the current request.  Returns an errno value.
+ */
+int local_ring_attach(struct connection *conn);
+
+/* Set the events (0 or POLLIN) the main loop waits for on the ring. */
+void local_ring_poll(struct connection *conn, short events);
+
+/* The ring can't be handed over to a new daemon, so close it. */
+void local_ring_close(struct connection *conn);
+#else
+static inline int recv_with_fds(struct connection *conn, void *data,
+				unsigned int len)
+{
+	return read(conn->fd, data, len);
+}
+
+static inline int local_ring_attach(struct connection *conn)
+{
+	return ENOSYS;
+}
+
+static inline void local_ring_poll(struct connection *conn, short events)
+{
+}
+
+static inline void local_ring_close(struct connection *conn)
+{
+}
+#endif
+
+#endif /* _XENSTORED_RING_H */
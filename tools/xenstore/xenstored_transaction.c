@@ -30,6 +30,7 @@
 #include <unistd.h>
 #include "talloc.h"
 #include "list.h"
+#include "hashtable.h"
 #include "xenstored_transaction.h"
 #include "xenstored_watch.h"
 #include "xenstored_domain.h"
@@ -156,6 +157,11 @@ struct transaction
 
 	/* List of accessed nodes. */
 	struct list_head accessed;
+	/* Accessed nodes indexed by node name. */
+	struct hashtable *accessed_hash;
+
+	/* Start of transaction. */
+	time_t start_time;
 
 	/* List of changed domains - to record the changed domain entry number */
 	struct list_head changed_domains;
@@ -166,16 +172,29 @@ struct transaction
 
 uint64_t generation;
 
+/* Statistics of ended transactions. */
+static struct {
+	unsigned long commits;
+	unsigned long conflicts;
+	unsigned long failures;
+	unsigned long aborts;
+	unsigned int max_nodes;
+	uint64_t commit_usec;
+	uint64_t max_commit_usec;
+} ta_stats;
+
 static struct accessed_node *find_accessed_node(struct transaction *trans,
 						const char *name)
 {
-	struct accessed_node *i;
-
-	list_for_each_entry(i, &trans->accessed, list)
-		if (streq(i->node, name))
-			return i;
+	return hashtable_search(trans->accessed_hash, name);
+}
 
-	return NULL;
+static void free_accessed_node(struct transaction *trans,
+			       struct accessed_node *i)
+{
+	hashtable_remove(trans->accessed_hash, i->node);
+	list_del(&i->list);
+	talloc_free(i);
 }
 
 static char *transaction_get_node_name(void *ctx, struct transaction *trans,
@@ -289,6 +308,14 @@ int access_node(struct connection *conn, struct node *node,
 				i->ta_node = true;
 			}
 		}
+		if (!hashtable_insert(trans->accessed_hash, i->node, i)) {
+			/* Drop a transaction specific node written above. */
+			if (i->ta_node) {
+				set_tdb_key(i->trans_name, &local_key);
+				do_tdb_delete(conn, &local_key, NULL);
+			}
+			goto nomem;
+		}
 		trans->nodes++;
 		list_add_tail(&i->list, &trans->accessed);
 	}
@@ -355,20 +382,22 @@ static int finalize_transaction(struct connection *conn,
 	struct accessed_node *i, *n;
 	TDB_DATA key, ta_key, data;
 	struct xs_tdb_record_hdr *hdr;
+	void *rec;
 	uint64_t gen;
 
 	list_for_each_entry_safe(i, n, &trans->accessed, list) {
 		if (i->check_gen) {
 			set_tdb_key(i->node, &key);
-			data = tdb_fetch(tdb_ctx, key);
+			data = do_tdb_fetch(trans, &key);
 			hdr = (void *)data.dptr;
 			if (!data.dptr) {
-				if (tdb_error(tdb_ctx) != TDB_ERR_NOEXIST)
+				if (errno != ENOENT)
 					return EIO;
 				gen = NO_GENERATION;
-			} else
+			} else {
 				gen = hdr->generation;
-			talloc_free(data.dptr);
+				talloc_unlink(trans, data.dptr);
+			}
 			if (i->generation != gen)
 				return EAGAIN;
 		}
@@ -380,8 +409,7 @@ static int finalize_transaction(struct connection *conn,
 				if (do_tdb_delete(conn, &ta_key, NULL))
 					return EIO;
 			}
-			list_del(&i->list);
-			talloc_free(i);
+			free_accessed_node(trans, i);
 		}
 	}
 
@@ -389,7 +417,14 @@ static int finalize_transaction(struct connection *conn,
 		set_tdb_key(i->node, &key);
 		if (i->ta_node) {
 			set_tdb_key(i->trans_name, &ta_key);
-			data = tdb_fetch(tdb_ctx, ta_key);
+			data = do_tdb_fetch(trans, &ta_key);
+			if (data.dptr) {
+				/* The fetched record mustn't be modified. */
+				rec = data.dptr;
+				data.dptr = talloc_memdup(trans, rec,
+							  data.dsize);
+				talloc_unlink(trans, rec);
+			}
 			if (data.dptr) {
 				hdr = (void *)data.dptr;
 				hdr->generation = ++generation;
@@ -415,8 +450,7 @@ static int finalize_transaction(struct connection *conn,
 			fire_watches(conn, trans, i->node, NULL, i->watch_exact,
 				     i->perms.p ? &i->perms : NULL);
 
-		list_del(&i->list);
-		talloc_free(i);
+		free_accessed_node(trans, i);
 	}
 
 	return 0;
@@ -435,8 +469,7 @@ static int destroy_transaction(void *_transaction)
 			set_tdb_key(i->trans_name, &key);
 			do_tdb_delete(trans->conn, &key, NULL);
 		}
-		list_del(&i->list);
-		talloc_free(i);
+		free_accessed_node(trans, i);
 	}
 
 	return 0;
@@ -456,6 +489,36 @@ struct transaction *transaction_lookup(struct connection *conn, uint32_t id)
 	return ERR_PTR(-ENOENT);
 }
 
+static struct transaction *transaction_alloc(const void *ctx,
+					     struct connection *conn)
+{
+	struct transaction *trans;
+
+	trans = talloc_zero(ctx, struct transaction);
+	if (!trans)
+		return NULL;
+
+	trans->accessed_hash = create_hashtable(trans, 8, hash_from_key_fn,
+						keys_equal_fn, 0);
+	if (!trans->accessed_hash) {
+		talloc_free(trans);
+		return NULL;
+	}
+
+	trace_create(trans, "transaction");
+	INIT_LIST_HEAD(&trans->accessed);
+	INIT_LIST_HEAD(&trans->changed_domains);
+	trans->conn = conn;
+	trans->fail = false;
+	trans->generation = ++generation;
+	trans->start_time = time(NULL);
+
+	talloc_set_destructor(trans, destroy_transaction);
+	wrl_ntransactions++;
+
+	return trans;
+}
+
 int do_transaction_start(const void *ctx, struct connection *conn,
 			 struct buffered_data *in)
 {
@@ -471,17 +534,10 @@ int do_transaction_start(const void *ctx, struct connection *conn,
 		return ENOSPC;
 
 	/* Attach transaction to ctx for autofree until it's complete */
-	trans = talloc_zero(ctx, struct transaction);
+	trans = transaction_alloc(ctx, conn);
 	if (!trans)
 		return ENOMEM;
 
-	trace_create(trans, "transaction");
-	INIT_LIST_HEAD(&trans->accessed);
-	INIT_LIST_HEAD(&trans->changed_domains);
-	trans->conn = conn;
-	trans->fail = false;
-	trans->generation = ++generation;
-
 	/* Pick an unused transaction identifier. */
 	do {
 		trans->id = conn->next_transaction_id;
@@ -491,11 +547,9 @@ int do_transaction_start(const void *ctx, struct connection *conn,
 	/* Now we own it. */
 	list_add_tail(&trans->list, &conn->transaction_list);
 	talloc_steal(conn, trans);
-	talloc_set_destructor(trans, destroy_transaction);
 	if (!conn->transaction_started)
 		conn->ta_start_time = time(NULL);
 	conn->transaction_started++;
-	wrl_ntransactions++;
 
 	snprintf(id_str, sizeof(id_str), "%u", trans->id);
 	send_reply(conn, XS_TRANSACTION_START, id_str, strlen(id_str)+1);
@@ -503,12 +557,70 @@ int do_transaction_start(const void *ctx, struct connection *conn,
 	return 0;
 }
 
+static uint64_t get_now_usec(void)
+{
+	struct timespec now_ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now_ts))
+		barf_perror("Could not find time (clock_gettime failed)");
+
+	return now_ts.tv_sec * 1000000 + now_ts.tv_nsec / 1000;
+}
+
+static void account_transaction_end(struct transaction *trans, int ret,
+				    uint64_t usec)
+{
+	if (!ret)
+		ta_stats.commits++;
+	else if (ret == EAGAIN)
+		ta_stats.conflicts++;
+	else
+		ta_stats.failures++;
+
+	if (trans->nodes > ta_stats.max_nodes)
+		ta_stats.max_nodes = trans->nodes;
+	ta_stats.commit_usec += usec;
+	if (usec > ta_stats.max_commit_usec)
+		ta_stats.max_commit_usec = usec;
+
+	trace("transaction %u of domain %u: %u nodes, %s, %"PRIu64" us\n",
+	      trans->id, trans->conn->id, trans->nodes,
+	      ret ? (ret == EAGAIN ? "conflict" : "failed") : "committed",
+	      usec);
+}
+
+static int commit_transaction(struct connection *conn,
+			      struct transaction *trans)
+{
+	bool is_corrupt = false;
+	int ret;
+
+	if (trans->fail)
+		return ENOMEM;
+	ret = acc_fix_domains(&trans->changed_domains, false);
+	if (ret)
+		return ret;
+	ret = finalize_transaction(conn, trans, &is_corrupt);
+	if (ret)
+		return ret;
+
+	wrl_apply_debit_trans_commit(conn);
+
+	/* fix domain entry for each changed domain */
+	acc_fix_domains(&trans->changed_domains, true);
+
+	if (is_corrupt)
+		corrupt(conn, "transaction inconsistency");
+
+	return 0;
+}
+
 int do_transaction_end(const void *ctx, struct connection *conn,
 		       struct buffered_data *in)
 {
 	const char *arg = onearg(in);
 	struct transaction *trans;
-	bool is_corrupt = false;
+	uint64_t start;
 	int ret;
 
 	if (!arg || (!streq(arg, "T") && !streq(arg, "F")))
@@ -527,28 +639,30 @@ int do_transaction_end(const void *ctx, struct connection *conn,
 	talloc_steal(ctx, trans);
 
 	if (streq(arg, "T")) {
-		if (trans->fail)
-			return ENOMEM;
-		ret = acc_fix_domains(&trans->changed_domains, false);
+		start = get_now_usec();
+		ret = commit_transaction(conn, trans);
+		account_transaction_end(trans, ret, get_now_usec() - start);
 		if (ret)
 			return ret;
-		ret = finalize_transaction(conn, trans, &is_corrupt);
-		if (ret)
-			return ret;
-
-		wrl_apply_debit_trans_commit(conn);
-
-		/* fix domain entry for each changed domain */
-		acc_fix_domains(&trans->changed_domains, true);
-
-		if (is_corrupt)
-			corrupt(conn, "transaction inconsistency");
-	}
+	} else
+		ta_stats.aborts++;
 	send_ack(conn, XS_TRANSACTION_END);
 
 	return 0;
 }
 
+struct transaction *transaction_start_internal(const void *ctx,
+					       struct connection *conn)
+{
+	return transaction_alloc(ctx, conn);
+}
+
+int transaction_commit_internal(struct connection *conn,
+				struct transaction *trans)
+{
+	return commit_transaction(conn, trans);
+}
+
 struct list_head *transaction_get_changed_domains(struct transaction *trans)
 {
 	return &trans->changed_domains;
@@ -575,6 +689,53 @@ void conn_delete_all_transactions(struct connection *conn)
 	conn->ta_start_time = 0;
 }
 
+int transaction_get_stats(const void *ctx, struct connection *conn)
+{
+	struct connection *c;
+	struct transaction *trans;
+	struct accessed_node *i;
+	unsigned long ended;
+	unsigned int modified;
+	time_t now = time(NULL);
+	char *resp;
+
+	ended = ta_stats.commits + ta_stats.conflicts + ta_stats.failures;
+
+	resp = talloc_asprintf(ctx,
+		"Ended transactions:\n"
+		"%-16s: %8lu\n%-16s: %8lu\n%-16s: %8lu\n%-16s: %8lu\n"
+		"%-16s: %8u\n%-16s: %8"PRIu64" us\n%-16s: %8"PRIu64" us\n"
+		"Active transactions:\n",
+		"committed", ta_stats.commits,
+		"conflicts", ta_stats.conflicts,
+		"failed", ta_stats.failures,
+		"aborted", ta_stats.aborts,
+		"max. nodes", ta_stats.max_nodes,
+		"avg. commit time", ended ? ta_stats.commit_usec / ended : 0,
+		"max. commit time", ta_stats.max_commit_usec);
+	if (!resp)
+		return ENOMEM;
+
+	list_for_each_entry(c, &connections, list) {
+		list_for_each_entry(trans, &c->transaction_list, list) {
+			modified = 0;
+			list_for_each_entry(i, &trans->accessed, list)
+				modified += i->modified;
+			resp = talloc_asprintf_append(resp,
+				"domain %u transaction %u: %u nodes accessed, "
+				"%u modified, %ld s\n",
+				c->id, trans->id, trans->nodes, modified,
+				(long)(now - trans->start_time));
+			if (!resp)
+				return ENOMEM;
+		}
+	}
+
+	send_reply(conn, XS_CONTROL, resp, strlen(resp) + 1);
+
+	return 0;
+}
+
 int check_transactions(struct hashtable *hash)
 {
 	struct connection *conn;
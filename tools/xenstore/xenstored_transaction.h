@@ -36,6 +36,16 @@ int do_transaction_end(const void *ctx, struct connection *conn,
 
 struct transaction *transaction_lookup(struct connection *conn, uint32_t id);
 
+/*
+ * Transactions used by xenstored itself to make a request atomic.  They are
+ * not visible to the client, the caller has to clear conn->transaction
+ * before committing or freeing them.
+ */
+struct transaction *transaction_start_internal(const void *ctx,
+					       struct connection *conn);
+int transaction_commit_internal(struct connection *conn,
+				struct transaction *trans);
+
 /* This node was accessed. */
 int __must_check access_node(struct connection *conn, struct node *node,
                              enum node_access_type type, TDB_DATA *key);
@@ -54,6 +64,7 @@ void fail_transaction(struct transaction *trans);
 struct list_head *transaction_get_changed_domains(struct transaction *trans);
 
 void conn_delete_all_transactions(struct connection *conn);
+int transaction_get_stats(const void *ctx, struct connection *conn);
 int check_transactions(struct hashtable *hash);
 
 #endif /* _XENSTORED_TRANSACTION_H */
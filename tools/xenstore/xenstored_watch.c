@@ -23,8 +23,10 @@
 #include <sys/time.h>
 #include <time.h>
 #include <assert.h>
+#include <syslog.h>
 #include "talloc.h"
 #include "list.h"
+#include "hashtable.h"
 #include "xenstored_watch.h"
 #include "xenstore_lib.h"
 #include "utils.h"
@@ -36,32 +38,148 @@ struct watch
 	/* Watches on this connection */
 	struct list_head list;
 
+	/* Watches on the same node, in the watch index. */
+	struct list_head index_list;
+
 	/* Current outstanding events applying to this watch. */
 	struct list_head events;
 
+	/* Connection the watch belongs to. */
+	struct connection *conn;
+
+	/* Creation order, for firing in the order of conn->watches. */
+	uint64_t seq;
+
 	/* Offset into path for skipping prefix (used for relative paths). */
 	unsigned int prefix_len;
 
+	/*
+	 * Coalescing watch: its queued event not being sent yet, and the
+	 * number of events merged into queued ones.
+	 */
+	bool coalesce;
+	struct buffered_data *event;
+	unsigned long coalesced;
+
 	char *token;
 	char *node;
 };
 
-/* Is child a subnode of parent, or equal? */
-static bool is_child(const char *child, const char *parent)
+/*
+ * All watches are indexed by the node they are set on, so firing watches
+ * for a node only has to look up the node and each of its parents, instead
+ * of comparing the node against every watch of every connection.
+ */
+struct watch_index_entry
 {
-	unsigned int len = strlen(parent);
+	char *node;
+	struct list_head watches;
+	unsigned int num;
+};
 
-	/*
-	 * / should really be "" for this algorithm to work, but that's a
-	 * usability nightmare.
-	 */
-	if (streq(parent, "/"))
-		return true;
+static struct hashtable *watch_index;
+static uint64_t watch_seq;
+
+/* Events merged into queued ones of coalescing watches. */
+static unsigned long coalesced_events;
+
+static int watch_index_add(struct watch *watch)
+{
+	struct watch_index_entry *entry;
+
+	if (!watch_index) {
+		watch_index = create_hashtable(NULL, 64, hash_from_key_fn,
+					       keys_equal_fn, 0);
+		if (!watch_index)
+			return ENOMEM;
+	}
 
-	if (strncmp(child, parent, len) != 0)
-		return false;
+	entry = hashtable_search(watch_index, watch->node);
+	if (!entry) {
+		entry = talloc_zero(watch_index, struct watch_index_entry);
+		if (!entry)
+			return ENOMEM;
+		entry->node = talloc_strdup(entry, watch->node);
+		if (!entry->node ||
+		    !hashtable_insert(watch_index, entry->node, entry)) {
+			talloc_free(entry);
+			return ENOMEM;
+		}
+		INIT_LIST_HEAD(&entry->watches);
+	}
+
+	list_add_tail(&watch->index_list, &entry->watches);
+	entry->num++;
 
-	return child[len] == '/' || child[len] == '\0';
+	return 0;
+}
+
+static void watch_index_del(struct watch *watch)
+{
+	struct watch_index_entry *entry;
+
+	entry = hashtable_search(watch_index, watch->node);
+	assert(entry);
+
+	list_del(&watch->index_list);
+	if (--entry->num)
+		return;
+
+	hashtable_remove(watch_index, entry->node);
+	talloc_free(entry);
+}
+
+static struct watch_index_entry *watch_index_find(const char *node)
+{
+	return watch_index ? hashtable_search(watch_index, node) : NULL;
+}
+
+/*
+ * Find the index entries of all watches which are to fire for a change of
+ * name: the watches on name itself, and unless exact, the watches on its
+ * parents (see is_child()).  path is a writable copy of name.
+ * Returns the number of entries found.
+ */
+static unsigned int watch_index_match(char *path, bool exact,
+				      struct watch_index_entry **entries)
+{
+	struct watch_index_entry *entry;
+	unsigned int n = 0;
+	char *slash;
+
+	entry = watch_index_find(path);
+	if (entry)
+		entries[n++] = entry;
+	if (exact)
+		return n;
+
+	while ((slash = strrchr(path, '/')) && slash != path) {
+		*slash = 0;
+		entry = watch_index_find(path);
+		if (entry)
+			entries[n++] = entry;
+	}
+
+	/* A watch on / matches everything. */
+	if (!streq(path, "/")) {
+		entry = watch_index_find("/");
+		if (entry)
+			entries[n++] = entry;
+	}
+
+	return n;
+}
+
+/* Group watches by connection, in the order they were set. */
+static int watch_cmp(const void *a, const void *b)
+{
+	const struct watch *wa = *(const struct watch * const *)a;
+	const struct watch *wb = *(const struct watch * const *)b;
+
+	if (wa->conn != wb->conn)
+		return (uintptr_t)wa->conn < (uintptr_t)wb->conn ? -1 : 1;
+
+	return wa->seq < wb->seq ? -1 : wa->seq > wb->seq;
 }
 
 static const char *get_watch_path(const struct watch *watch, const char *name)
@@ -69,6 +187,56 @@ static const char *get_watch_path(const struct watch *watch, const char *name)
 	return name + watch->prefix_len;
 }
 
+/*
+ * A coalescing watch has at most one event queued which isn't being sent
+ * yet.  Further events are merged into that one: if their path differs, the
+ * event is changed to report the watched node itself, which the client has
+ * to take as "something at or below the node has changed".  This is enough
+ * for clients only needing to know that they have to look at the nodes
+ * again, and it keeps event storms off their ring.
+ */
+static void coalesce_event(struct watch *watch, const char *path)
+{
+	struct buffered_data *event = watch->event;
+	const char *wpath;
+	unsigned int len;
+
+	watch->coalesced++;
+	coalesced_events++;
+
+	if (streq(event->buffer, path))
+		return;
+
+	/* The watched node is a prefix of path, so the event can only shrink. */
+	wpath = get_watch_path(watch, watch->node);
+	len = strlen(wpath) + 1 + strlen(watch->token) + 1;
+	if (len == event->hdr.msg.len)
+		return;
+
+	trace("coalescing watch %s %s for domain %u\n", wpath, watch->token,
+	      watch->conn->id);
+	domain_memory_add_nochk(watch->conn->id,
+				(int)len - (int)event->hdr.msg.len);
+	strcpy(event->buffer, wpath);
+	strcpy(event->buffer + strlen(wpath) + 1, watch->token);
+	event->hdr.msg.len = len;
+}
+
+static void watch_event(struct buffered_data *req, struct watch *watch,
+			const char *path)
+{
+	if (watch->event) {
+		coalesce_event(watch, path);
+		return;
+	}
+
+	watch->event = send_event(req, watch->conn, path, watch->token);
+	if (!watch->coalesce)
+		watch->event = NULL;
+	else if (watch->event)
+		watch->event->event_ref = &watch->event;
+}
+
 /*
  * Check permissions of a specific watch to fire:
  * Either the node itself or its parent have to be readable by the connection
@@ -124,9 +292,13 @@ static bool watch_permitted(struct connection *conn, const void *ctx,
 void fire_watches(struct connection *conn, const void *ctx, const char *name,
 		  struct node *node, bool exact, struct node_perms *perms)
 {
-	struct connection *i;
 	struct buffered_data *req;
-	struct watch *watch;
+	struct watch_index_entry **entries;
+	struct watch **watches, *watch;
+	struct connection *last = NULL;
+	unsigned int n_entries, num = 0, i, depth;
+	bool permitted = false;
+	char *path;
 
 	/* During transactions, don't fire watches, but queue them. */
 	if (conn && conn->transaction) {
@@ -134,31 +306,68 @@ void fire_watches(struct connection *conn, const void *ctx, const char *name,
 		return;
 	}
 
+	if (!watch_index || !hashtable_count(watch_index))
+		return;
+
 	req = domain_is_unprivileged(conn) ? conn->in : NULL;
 
+	/* One entry per path element at most, plus the one for /. */
+	for (depth = 2, path = strchr(name, '/'); path;
+	     path = strchr(path + 1, '/'))
+		depth++;
+
+	path = talloc_strdup(ctx, name);
+	entries = talloc_array(ctx, struct watch_index_entry *, depth);
+	if (!path || !entries) {
+		log("fire_watches: ENOMEM for %s", name);
+		return;
+	}
+
+	n_entries = watch_index_match(path, exact, entries);
+	for (i = 0; i < n_entries; i++)
+		num += entries[i]->num;
+	if (!num)
+		return;
+
+	watches = talloc_array(ctx, struct watch *, num);
+	if (!watches) {
+		log("fire_watches: ENOMEM for %s", name);
+		return;
+	}
+
+	num = 0;
+	for (i = 0; i < n_entries; i++)
+		list_for_each_entry(watch, &entries[i]->watches, index_list)
+			watches[num++] = watch;
+
+	qsort(watches, num, sizeof(*watches), watch_cmp);
+
 	/* Create an event for each watch. */
-	list_for_each_entry(i, &connections, list) {
-		if (!watch_permitted(i, ctx, name, node, perms))
-			continue;
-
-		list_for_each_entry(watch, &i->watches, list) {
-			if (exact) {
-				if (streq(name, watch->node))
-					send_event(req, i,
-						   get_watch_path(watch, name),
-						   watch->token);
-			} else {
-				if (is_child(name, watch->node))
-					send_event(req, i,
-						   get_watch_path(watch, name),
-						   watch->token);
-			}
+	for (i = 0; i < num; i++) {
+		watch = watches[i];
+
+		if (watch->conn != last) {
+			last = watch->conn;
+			permitted = watch_permitted(last, ctx, name, node,
+						    perms);
 		}
+
+		if (permitted)
+			watch_event(req, watch, get_watch_path(watch, name));
 	}
+
+	talloc_free(watches);
+	talloc_free(entries);
+	talloc_free(path);
 }
 
 static int destroy_watch(void *_watch)
 {
+	struct watch *watch = _watch;
+
+	watch_index_del(watch);
+	if (watch->event)
+		watch->event->event_ref = NULL;
 	trace_destroy(_watch, "watch");
 	return 0;
 }
@@ -204,9 +413,19 @@ static struct watch *add_watch(struct connection *conn, char *path, char *token,
 		goto nomem;
 
 	watch->prefix_len = relative ? strlen(get_implicit_path(conn)) + 1 : 0;
+	watch->conn = conn;
+	watch->seq = watch_seq++;
+	watch->coalesce = false;
+	watch->event = NULL;
+	watch->coalesced = 0;
 
 	INIT_LIST_HEAD(&watch->events);
 
+	if (watch_index_add(watch)) {
+		domain_memory_add_nochk(conn->id, -strlen(path) - strlen(token));
+		goto nomem;
+	}
+
 	domain_watch_inc(conn);
 	list_add_tail(&watch->list, &conn->watches);
 	talloc_set_destructor(watch, destroy_watch);
@@ -222,10 +441,16 @@ static struct watch *add_watch(struct connection *conn, char *path, char *token,
 int do_watch(const void *ctx, struct connection *conn, struct buffered_data *in)
 {
 	struct watch *watch;
-	char *vec[2];
+	char *vec[4];
+	unsigned int num;
 	bool relative;
 
-	if (get_strings(in, vec, ARRAY_SIZE(vec)) != ARRAY_SIZE(vec))
+	num = get_strings(in, vec, ARRAY_SIZE(vec));
+	if (num == 4) {
+		/* Limiting the depth isn't supported. */
+		if (vec[2][0] || !streq(vec[3], "coalesce"))
+			return EINVAL;
+	} else if (num != 2)
 		return EINVAL;
 
 	errno = check_watch_path(conn, ctx, &(vec[0]), &relative);
@@ -245,6 +470,7 @@ int do_watch(const void *ctx, struct connection *conn, struct buffered_data *in)
 	watch = add_watch(conn, vec[0], vec[1], relative, false);
 	if (!watch)
 		return errno;
+	watch->coalesce = num == 4;
 
 	trace_create(watch, "watch");
 	send_ack(conn, XS_WATCH);
@@ -253,8 +479,7 @@ int do_watch(const void *ctx, struct connection *conn, struct buffered_data *in)
 	 * We fire once up front: simplifies clients and restart.
 	 * This event will not be linked to the XS_WATCH request.
 	 */
-	send_event(NULL, conn, get_watch_path(watch, watch->node),
-		   watch->token);
+	watch_event(NULL, watch, get_watch_path(watch, watch->node));
 
 	return 0;
 }
@@ -298,6 +523,35 @@ void conn_delete_all_watches(struct connection *conn)
 	}
 }
 
+int watch_get_stats(const void *ctx, struct connection *conn)
+{
+	struct connection *c;
+	struct watch *watch;
+	char *resp;
+
+	resp = talloc_asprintf(ctx, "%-16s: %8lu\n", "coalesced events",
+			       coalesced_events);
+	if (!resp)
+		return ENOMEM;
+
+	list_for_each_entry(c, &connections, list) {
+		list_for_each_entry(watch, &c->watches, list) {
+			if (!watch->coalesce)
+				continue;
+			resp = talloc_asprintf_append(resp,
+				"domain %u watch %s %s: %lu coalesced\n",
+				c->id, get_watch_path(watch, watch->node),
+				watch->token, watch->coalesced);
+			if (!resp)
+				return ENOMEM;
+		}
+	}
+
+	send_reply(conn, XS_CONTROL, resp, strlen(resp) + 1);
+
+	return 0;
+}
+
 const char *dump_state_watches(FILE *fp, struct connection *conn,
 			       unsigned int conn_id)
 {
@@ -32,6 +32,9 @@ void fire_watches(struct connection *conn, const void *tmp, const char *name,
 
 void conn_delete_all_watches(struct connection *conn);
 
+/* Reply to the "watches" control command. */
+int watch_get_stats(const void *ctx, struct connection *conn);
+
 const char *dump_state_watches(FILE *fp, struct connection *conn,
 			       unsigned int conn_id);
 
@@ -27,6 +27,15 @@ mread_handle_t mread_init(int fd)
     fstat(fd, &s);
     h->file_size = s.st_size;
 
+    /* Map the whole file if the address space allows, falling back to
+     * a cache of smaller windows if not. */
+    if ( h->file_size > 0 && (size_t)h->file_size == h->file_size )
+    {
+        h->whole = mmap(NULL, h->file_size, PROT_READ, MAP_SHARED, fd, 0);
+        if ( h->whole == MAP_FAILED )
+            h->whole = NULL;
+    }
+
     return h;
 }
 
@@ -66,6 +75,12 @@ ssize_t mread64(mread_handle_t h, void *rec, ssize_t len, off_t offset)
         len = h->file_size - offset;
     }
 
+    if ( h->whole )
+    {
+        bcopy(h->whole + offset, rec, len);
+        return len;
+    }
+
     /* Try to find the offset in our range */
     dprintf(warn, " Trying last, %d\n", last);
     if ( h->map[h->last].buffer
@@ -6,6 +6,8 @@
 typedef struct mread_ctrl {
     int fd;
     off_t file_size;
+    /* Whole file, if it could be mapped in one go. */
+    char * whole;
     struct mread_buffer {
         char * buffer;
         off_t start_offset;
@@ -70,8 +70,13 @@ struct {
     struct symbol_struct * symbols;
     char * symbol_file;
     char * trace_file;
+    char * index_file;
     int output_defined;
     off_t file_size;
+    /* This process's share of per-domain work; see run_workers() */
+    int worker;
+    struct worker_section *sections;
+    int nr_sections;
     struct {
         off_t update_offset;
         int pipe[2];
@@ -83,7 +88,9 @@ struct {
     .symbols = NULL,
     .symbol_file = NULL,
     .trace_file = NULL,
+    .index_file = NULL,
     .output_defined = 0,
+    .worker = 0,
     .file_size = 0,
     .progress = { .update_offset = 0 },
 };
@@ -180,6 +187,7 @@ struct {
         summary:1,
         report_pcpu:1,
         tsc_loop_fatal:1,
+        no_index:1,
         summary_info;
     long long cpu_qhz, cpu_hz;
     int scatterplot_interrupt_vector;
@@ -190,7 +198,14 @@ struct {
     int interrupt_eip_enumeration_vector;
     int default_guest_paging_levels;
     int sample_size, sample_max;
+    int workers;
     enum error_level tolerance; /* Tolerate up to this level of error */
+    struct {
+        /* Seconds from the start of the trace; converted to tsc values
+         * once the index has found the first tsc. */
+        double start, end;
+        tsc_t start_tsc, end_tsc;
+    } window;
     struct {
         tsc_t cycles;
         /* Used if interval is specified in seconds to delay calculating
@@ -253,6 +268,7 @@ struct {
     .summary = 0,
     .report_pcpu = 0,
     .tsc_loop_fatal = 0,
+    .no_index = 0,
     .cpu_hz = DEFAULT_CPU_HZ,
     /* Pre-calculate a multiplier that makes the rest of the
      * calculations easier */
@@ -260,6 +276,7 @@ struct {
     .default_guest_paging_levels = 2,
     .sample_size = DEFAULT_SAMPLE_SIZE,
     .sample_max = DEFAULT_SAMPLE_MAX,
+    .workers = 1,
     .tolerance = ERR_SANITY,
     .interval = { .msec = DEFAULT_INTERVAL_LENGTH },
 };
@@ -1906,6 +1923,8 @@ void update_io_address(struct io_address ** list, unsigned int pa, int dir,
                        tsc_t arc_cycles, unsigned int va);
 int check_extra_words(struct record_info *ri, int expected_size, const char *record);
 int vcpu_set_data_type(struct vcpu_data *v, int type);
+int worker_owns(int did);
+void worker_section(int key);
 
 void cpumask_init(cpu_mask_t *c) {
     *c = 0UL;
@@ -2949,18 +2968,14 @@ void hvm_short_summary(struct hvm_short_summary_struct *hss,
     }
 }
 
-/* Wrapper to try to make sure this is only called once per
- * call site, rather than walking through the list each time */
+/* Handlers are registered on each vcpu that takes the exit, so that a
+ * vcpu's summary doesn't depend on which vcpu took a given exit first. */
 #define hvm_set_summary_handler(_h, _s, _d)                             \
     do {                                                                \
-        static int done=0;                                              \
         int ret;                                                        \
-        if(!done) {                                                     \
-            if ((ret=__hvm_set_summary_handler(_h, _s, _d)))            \
-                fprintf(stderr, "%s: hvm_set_summary_handler returned %d\n", \
-                        __func__, ret);                                 \
-            done=1;                                                     \
-        }                                                               \
+        if ((ret=__hvm_set_summary_handler(_h, _s, _d)))                \
+            fprintf(stderr, "%s: hvm_set_summary_handler returned %d\n", \
+                    __func__, ret);                                     \
     } while(0)
 
 int __hvm_set_summary_handler(struct hvm_data *h, void (*s)(struct hvm_data *h, void*d), void*d) {
@@ -2969,19 +2984,14 @@ int __hvm_set_summary_handler(struct hvm_data *h, void (*s)(struct hvm_data *h,
     {
         struct hvm_summary_handler_node *p, **q;
 
-        /* Find the end of the list, checking to make sure there are no
-         * duplicates along the way */
+        /* Find the end of the list; if the handler is already there,
+         * there's nothing to do. */
         q=&h->exit_reason_summary_handler_list[h->exit_reason];
         p = *q;
         while(p)
         {
             if(p->handler == s && p->data == d)
-            {
-                fprintf(stderr, "%s: Unexpected duplicate handler %p,%p\n",
-                        __func__, s, d);
-                error(ERR_STRICT, NULL);
-            return -EBUSY;
-            }
+                return 0;
             q=&p->next;
             p=*q;
         }
@@ -4677,13 +4687,9 @@ void hvm_generic_postprocess(struct hvm_data *h)
             }
         }
         else
-        {
-            int ret;
-            if((ret=__hvm_set_summary_handler(h, hvm_generic_summary, (void *)evt)))
-                fprintf(stderr, "%s: hvm_set_summary_handler returned %d\n",
-                        __func__, ret);
             registered[evt]=h->exit_reason+1;
-        }
+
+        hvm_set_summary_handler(h, hvm_generic_summary, (void *)evt);
         /* HLT checked at hvm_vmexit_close() */
     }
 }
@@ -5264,6 +5270,19 @@ void hvm_vmentry_process(struct record_info *ri, struct hvm_data *h) {
     h->entry_tsc = ri->tsc;
 }
 
+/* Account an hvm record to its pcpu's log volume */
+void hvm_update_volume(struct pcpu_info *p)
+{
+    struct record_info *ri = &p->ri;
+
+    if(ri->evt.sub == 2)
+        UPDATE_VOLUME(p, hvm[HVM_VOL_HANDLER], ri->size);
+    else if(ri->event == TRC_HVM_VMEXIT || ri->event == TRC_HVM_VMEXIT64)
+        UPDATE_VOLUME(p, hvm[HVM_VOL_VMEXIT], ri->size);
+    else if(ri->event == TRC_HVM_VMENTRY)
+        UPDATE_VOLUME(p, hvm[HVM_VOL_VMENTRY], ri->size);
+}
+
 void hvm_process(struct pcpu_info *p)
 {
     struct record_info *ri = &p->ri;
@@ -5275,9 +5294,10 @@ void hvm_process(struct pcpu_info *p)
     if(vcpu_set_data_type(p->current, VCPU_DATA_HVM))
         return;
 
+    hvm_update_volume(p);
+
     if(ri->evt.sub == 2)
     {
-        UPDATE_VOLUME(p, hvm[HVM_VOL_HANDLER], ri->size);
         hvm_handler_process(ri, h);
     }
     else
@@ -5286,11 +5306,9 @@ void hvm_process(struct pcpu_info *p)
             /* HVM */
         case TRC_HVM_VMEXIT:
         case TRC_HVM_VMEXIT64:
-            UPDATE_VOLUME(p, hvm[HVM_VOL_VMEXIT], ri->size);
             hvm_vmexit_process(ri, h, v);
             break;
         case TRC_HVM_VMENTRY:
-            UPDATE_VOLUME(p, hvm[HVM_VOL_VMENTRY], ri->size);
             hvm_vmentry_process(ri, &p->current->hvm);
             break;
         default:
@@ -9047,6 +9065,322 @@ off_t scan_for_new_pcpu(off_t offset) {
     }
 }
 
+/* -- Trace index --
+ *
+ * The trace is a sequence of windows, each a cpu_change record followed by
+ * one buffer's worth of records from that cpu.  Without an index, each pcpu
+ * reads its way past the cpu_change record of every other pcpu's window to
+ * find its next one.  With an index of the windows, built in one pass and
+ * saved beside the trace, a pcpu jumps straight to its next window, and
+ * processing can start part way through the trace.
+ *
+ * The saved index is only used if the trace's size and modification time
+ * still match.
+ */
+#define INDEX_MAGIC "XALYIDX1"
+
+struct index_window {
+    uint64_t offset;             /* Of the cpu_change record */
+    uint64_t first_tsc, last_tsc; /* 0 if no record has a tsc */
+    uint32_t cpu;
+    uint32_t size;               /* Including the cpu_change record */
+};
+
+struct index_header {
+    char magic[8];
+    uint64_t file_size;
+    int64_t mtime;
+    uint64_t nr_windows;
+};
+
+struct {
+    struct index_window *w;
+    unsigned long nr;
+    /* Each cpu's windows, in file order, as indices into w */
+    unsigned long *cpu[MAX_CPUS];
+    unsigned long cpu_nr[MAX_CPUS];
+} I = { 0 };
+
+void index_header_init(struct index_header *h)
+{
+    struct stat s;
+
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, INDEX_MAGIC, sizeof(h->magic));
+
+    fstat(G.fd, &s);
+    h->file_size = s.st_size;
+    h->mtime = s.st_mtime;
+    h->nr_windows = I.nr;
+}
+
+int index_load(const char *name)
+{
+    struct index_header h, expected;
+    FILE *f;
+
+    if ( (f = fopen(name, "r")) == NULL )
+        return -1;
+
+    index_header_init(&expected);
+
+    if ( fread(&h, sizeof(h), 1, f) != 1
+         || memcmp(h.magic, expected.magic, sizeof(h.magic))
+         || h.file_size != expected.file_size
+         || h.mtime != expected.mtime )
+        goto fail;
+
+    I.nr = h.nr_windows;
+    I.w = malloc(I.nr * sizeof(*I.w));
+    if ( !I.w || fread(I.w, sizeof(*I.w), I.nr, f) != I.nr )
+        goto fail;
+
+    fclose(f);
+    fprintf(warn, "%s: loaded %lu windows from %s\n", __func__, I.nr, name);
+
+    return 0;
+
+ fail:
+    fclose(f);
+    free(I.w);
+    I.w = NULL;
+    I.nr = 0;
+
+    return -1;
+}
+
+void index_save(const char *name)
+{
+    struct index_header h;
+    char tmp[PATH_MAX];
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", name, (int)getpid());
+
+    if ( (f = fopen(tmp, "w")) == NULL )
+        goto fail;
+
+    index_header_init(&h);
+
+    if ( fwrite(&h, sizeof(h), 1, f) != 1
+         || fwrite(I.w, sizeof(*I.w), I.nr, f) != I.nr )
+    {
+        fclose(f);
+        unlink(tmp);
+        goto fail;
+    }
+
+    if ( fclose(f) || rename(tmp, name) )
+    {
+        unlink(tmp);
+        goto fail;
+    }
+
+    return;
+
+ fail:
+    /* Only a missed optimisation for next time */
+    fprintf(warn, "%s: unable to save index %s: %s\n",
+            __func__, name, strerror(errno));
+}
+
+/* Read the trace from the start, noting each window and its tsc range. */
+int index_build(void)
+{
+    struct trace_record rec;
+    struct cpu_change_data *cd;
+    struct index_window *w;
+    off_t offset = 0, end;
+    unsigned long alloc = 0, epoch = 0;
+    int last_cpu = -1;
+    tsc_t tsc;
+    ssize_t r;
+
+    while ( (r = __read_record(&rec, offset)) != 0 )
+    {
+        if ( rec.event != TRC_TRACE_CPU_CHANGE || rec.cycle_flag )
+        {
+            fprintf(warn, "%s: unexpected record event %x at offset %llx\n",
+                    __func__, rec.event, (unsigned long long)offset);
+            return -1;
+        }
+
+        cd = (typeof(cd))rec.u.notsc.data;
+
+        if ( cd->cpu < 0 || cd->cpu >= MAX_CPUS )
+        {
+            fprintf(warn, "%s: cpu %d exceeds MAX_CPUS %d\n",
+                    __func__, cd->cpu, MAX_CPUS);
+            return -1;
+        }
+
+        /* As with early_eof, a short window discards the whole of the
+         * last epoch, so all pcpus end at about the same time. */
+        if ( cd->cpu < last_cpu )
+            epoch = I.nr;
+        last_cpu = cd->cpu;
+
+        end = offset + r + cd->window_size;
+        if ( end > G.file_size )
+        {
+            fprintf(warn, "%s: short cpu_change window, ignoring last %lu windows\n",
+                    __func__, I.nr - epoch);
+            I.nr = epoch;
+            break;
+        }
+
+        if ( I.nr == alloc )
+        {
+            alloc = alloc ? alloc * 2 : 1024;
+            w = realloc(I.w, alloc * sizeof(*I.w));
+            if ( !w )
+            {
+                fprintf(stderr, "%s: realloc failed\n", __func__);
+                error(ERR_SYSTEM, NULL);
+            }
+            I.w = w;
+        }
+
+        w = I.w + I.nr++;
+        w->offset = offset;
+        w->cpu = cd->cpu;
+        w->size = end - offset;
+        w->first_tsc = w->last_tsc = 0;
+
+        for ( offset += r; offset < end; offset += r )
+        {
+            if ( (r = __read_record(&rec, offset)) == 0 )
+                break;
+
+            if ( rec.cycle_flag )
+            {
+                tsc = (((tsc_t)rec.u.tsc.tsc_hi) << 32) | rec.u.tsc.tsc_lo;
+                if ( !w->first_tsc )
+                    w->first_tsc = tsc;
+                w->last_tsc = tsc;
+            }
+        }
+
+        offset = end;
+    }
+
+    return 0;
+}
+
+/*
+ * Find or build the index.  Returns 0 if the index is available, in which
+ * case init_pcpus() and process_cpu_change() use it.
+ */
+int index_init(void)
+{
+    char name[PATH_MAX];
+    unsigned long i;
+    unsigned int cpu;
+
+    if ( G.index_file )
+        snprintf(name, sizeof(name), "%s", G.index_file);
+    else
+        snprintf(name, sizeof(name), "%s.idx", G.trace_file);
+
+    if ( index_load(name) )
+    {
+        if ( index_build() )
+        {
+            fprintf(warn, "%s: not indexing, falling back to scanning\n",
+                    __func__);
+            free(I.w);
+            I.w = NULL;
+            I.nr = 0;
+            return -1;
+        }
+
+        fprintf(warn, "%s: indexed %lu windows\n", __func__, I.nr);
+        index_save(name);
+    }
+
+    for ( i = 0; i < I.nr; i++ )
+    {
+        if ( I.w[i].cpu >= MAX_CPUS )
+        {
+            fprintf(stderr, "%s: corrupt index %s\n", __func__, name);
+            error(ERR_SYSTEM, NULL);
+        }
+        I.cpu_nr[I.w[i].cpu]++;
+    }
+
+    for ( cpu = 0; cpu < MAX_CPUS; cpu++ )
+    {
+        if ( !I.cpu_nr[cpu] )
+            continue;
+
+        I.cpu[cpu] = malloc(I.cpu_nr[cpu] * sizeof(*I.cpu[cpu]));
+        if ( !I.cpu[cpu] )
+        {
+            fprintf(stderr, "%s: malloc failed\n", __func__);
+            error(ERR_SYSTEM, NULL);
+        }
+        I.cpu_nr[cpu] = 0;
+    }
+
+    for ( i = 0; i < I.nr; i++ )
+        I.cpu[I.w[i].cpu][I.cpu_nr[I.w[i].cpu]++] = i;
+
+    return 0;
+}
+
+/*
+ * Offset of the first window of cpu at or after offset, or the end of the
+ * file if there are none.
+ */
+off_t index_next_window(int cpu, off_t offset)
+{
+    unsigned long lo = 0, hi = I.cpu_nr[cpu], mid;
+
+    while ( lo < hi )
+    {
+        mid = (lo + hi) / 2;
+        if ( I.w[I.cpu[cpu][mid]].offset < offset )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo < I.cpu_nr[cpu] ? I.w[I.cpu[cpu][lo]].offset : G.file_size;
+}
+
+/*
+ * Activate each pcpu at its first window which reaches the start of the
+ * time window.
+ */
+void index_activate_pcpus(void)
+{
+    tsc_t base = 0;
+    unsigned long i, j;
+    unsigned int cpu;
+
+    for ( i = 0; i < I.nr; i++ )
+        if ( I.w[i].first_tsc && (!base || I.w[i].first_tsc < base) )
+            base = I.w[i].first_tsc;
+
+    if ( opt.window.start > 0 )
+        opt.window.start_tsc = base + opt.window.start * opt.cpu_hz;
+    if ( opt.window.end > 0 )
+        opt.window.end_tsc = base + opt.window.end * opt.cpu_hz;
+
+    for ( cpu = 0; cpu < MAX_CPUS; cpu++ )
+    {
+        for ( j = 0; j < I.cpu_nr[cpu]; j++ )
+        {
+            i = I.cpu[cpu][j];
+            if ( I.w[i].last_tsc >= opt.window.start_tsc )
+                break;
+        }
+
+        if ( j < I.cpu_nr[cpu] )
+            scan_for_new_pcpu(I.w[i].offset);
+    }
+}
+
 /*
  * Conceptually, when we reach a cpu_change record that's not for our pcpu,
  * we want to scan forward through the file until we reach one that's for us.
@@ -9222,6 +9556,19 @@ void process_cpu_change(struct pcpu_info *p) {
                r->window_size);
     }
 
+    /* With an index, skip straight to this pcpu's next window */
+    if ( I.w )
+    {
+        off_t next = index_next_window(p->pid, p->file_offset);
+
+        if ( next != p->file_offset )
+        {
+            p->file_offset = next;
+            p->next_cpu_change_offset = next;
+            return;
+        }
+    }
+
     /* File sanity check */
     if(p->file_offset != p->next_cpu_change_offset) {
         fprintf(warn, "Strange, pcpu %d expected offset %llx, actual %llx!\n",
@@ -9243,8 +9590,9 @@ void process_cpu_change(struct pcpu_info *p) {
         P.last_epoch_offset = p->file_offset;
     }
 
-    /* If that pcpu has never been activated, activate it. */
-    if(!P.pcpu[r->cpu].active && P.pcpu[r->cpu].file_offset == 0)
+    /* If that pcpu has never been activated, activate it.  The index
+     * has already activated every pcpu it will. */
+    if(!I.w && !P.pcpu[r->cpu].active && P.pcpu[r->cpu].file_offset == 0)
     {
         struct pcpu_info * p2 = P.pcpu + r->cpu;
 
@@ -9339,7 +9687,7 @@ void process_cpu_change(struct pcpu_info *p) {
 
         if(p->next_cpu_change_offset > G.file_size)
             activate_early_eof();
-        else if(p->pid == P.max_active_pcpu)
+        else if(!I.w && p->pid == P.max_active_pcpu)
             scan_for_new_pcpu(p->next_cpu_change_offset);
 
     }
@@ -9439,6 +9787,16 @@ void process_record(struct pcpu_info *p) {
     /* Unify toplevel assertions */
     if ( toplevel_assert_check(toplevel, p) )
     {
+        /* Guest records are only accounted by the worker which owns
+         * their domain, but count towards every worker's pcpu volume. */
+        if ( tl_assert_checks[toplevel].vcpu_data_mode
+             && !worker_owns(p->current->d->did) )
+        {
+            if ( toplevel == TRC_HVM_MAIN )
+                hvm_update_volume(p);
+            goto volume;
+        }
+
         switch(toplevel) {
         case TRC_GEN_MAIN:
             base_process(p);
@@ -9469,6 +9827,7 @@ void process_record(struct pcpu_info *p) {
         }
     }
 
+ volume:
     UPDATE_VOLUME(p, toplevel[toplevel], ri->size);
 
     if(!p->volume.buffer_first_tsc)
@@ -9843,6 +10202,21 @@ void process_records(void) {
         if(!(p=choose_next_record()))
             return;
 
+        if(opt.window.end_tsc && p->order_tsc > opt.window.end_tsc) {
+            fprintf(warn, "%s: reached end of time window\n", __func__);
+            return;
+        }
+
+        /* Records before the time window are only read past. */
+        if(p->order_tsc < opt.window.start_tsc
+           && p->ri.event != TRC_TRACE_CPU_CHANGE) {
+            p->file_offset += p->ri.size;
+            read_record(p);
+            if ( p->active )
+                record_order_bubble(p);
+            continue;
+        }
+
         process_record(p);
 
         /* Lost records gets processed twice. */
@@ -9886,8 +10260,9 @@ void domain_summary(void)
     struct domain_data * d;
     int i;
 
-    if(opt.show_default_domain_summary) {
+    if(opt.show_default_domain_summary && worker_owns(DEFAULT_DOMAIN)) {
         d = &default_domain;
+        worker_section(INT_MIN + 1);
         printf("|-- Default domain --|\n");
 
         for( i = 0; i < MAX_CPUS ; i++ )
@@ -9900,6 +10275,11 @@ void domain_summary(void)
     for ( d = domain_list ; d ; d=d->next )
     {
         int i;
+
+        if ( !worker_owns(d->did) )
+            continue;
+
+        worker_section(d->did);
         printf("|-- Domain %d --|\n", d->did);
 
         sched_summary_domain(d);
@@ -9930,17 +10310,23 @@ char * stringify_cpu_hz(long long cpu_hz);
 
 void summary(void) {
     int i;
-    printf("Total time: %.2lf seconds (using cpu speed %s)\n",
-           ((double)(P.f.total_cycles))/opt.cpu_hz,
-           stringify_cpu_hz(opt.cpu_hz));
-    printf("--- Log volume summary ---\n");
-    for(i=0; i<MAX_CPUS; i++)
+
+    /* The first worker reports on the whole trace */
+    if ( G.worker == 0 )
     {
-        struct pcpu_info *p = P.pcpu+i;
-        if(!p->summary)
-            continue;
-        printf(" - cpu %d -\n", i);
-        volume_summary(&p->volume.total);
+        worker_section(INT_MIN);
+        printf("Total time: %.2lf seconds (using cpu speed %s)\n",
+               ((double)(P.f.total_cycles))/opt.cpu_hz,
+               stringify_cpu_hz(opt.cpu_hz));
+        printf("--- Log volume summary ---\n");
+        for(i=0; i<MAX_CPUS; i++)
+        {
+            struct pcpu_info *p = P.pcpu+i;
+            if(!p->summary)
+                continue;
+            printf(" - cpu %d -\n", i);
+            volume_summary(&p->volume.total);
+        }
     }
     domain_summary();
 }
@@ -9966,6 +10352,206 @@ void report_pcpu(void) {
 
 }
 
+/* -- Workers --
+ *
+ * Most of the work of a summary is accounting guest records to their
+ * domains and vcpus.  With --workers=N, N forked processes each read the
+ * whole trace and follow scheduling, so that each knows which vcpu is
+ * running where, but only account guest records for the domains they own.
+ * Each worker writes its share of the output to a temporary file, noting
+ * where each section starts, and the sections are then put back together
+ * in the order a single process would have printed them.
+ */
+struct worker_section {
+    int key;        /* Domain id, or INT_MIN.. / INT_MAX for global output */
+    int worker;
+    long start, end;
+};
+
+int worker_owns(int did)
+{
+    return opt.workers <= 1 || did % opt.workers == G.worker;
+}
+
+/* Close the current output section, if any */
+void worker_section_end(void)
+{
+    if ( opt.workers <= 1 || !G.nr_sections )
+        return;
+
+    fflush(stdout);
+    G.sections[G.nr_sections - 1].end = ftell(stdout);
+}
+
+/* Start a new output section, to be sorted by key */
+void worker_section(int key)
+{
+    struct worker_section *s;
+
+    if ( opt.workers <= 1 )
+        return;
+
+    worker_section_end();
+
+    s = realloc(G.sections, (G.nr_sections + 1) * sizeof(*s));
+    if ( !s )
+    {
+        fprintf(stderr, "%s: realloc failed\n", __func__);
+        error(ERR_SYSTEM, NULL);
+    }
+    G.sections = s;
+
+    s += G.nr_sections++;
+    s->key = key;
+    s->worker = G.worker;
+    s->start = s->end = ftell(stdout);
+}
+
+/* Output which depends on the order of records across domains can't be
+ * split between workers. */
+int workers_supported(void)
+{
+    return !(opt.dump_all || opt.dump_raw_process || opt.dump_raw_reads
+             || opt.dump_no_processing || opt.dump_ipi_latency
+             || opt.dump_trace_volume_on_lost_record
+             || opt.scatterplot_interrupt_eip || opt.scatterplot_unpin_promote
+             || opt.scatterplot_cr3_switch || opt.scatterplot_wake_to_halt
+             || opt.scatterplot_io || opt.scatterplot_vmexit_eip
+             || opt.scatterplot_runstate || opt.scatterplot_runstate_time
+             || opt.scatterplot_pcpu || opt.scatterplot_extint_cycles
+             || opt.scatterplot_rdtsc || opt.scatterplot_irq
+             || opt.histogram_interrupt_eip || opt.interval_mode
+             || opt.with_cr3_enumeration || opt.progress);
+}
+
+int worker_section_cmp(const void *_a, const void *_b)
+{
+    const struct worker_section *a = _a, *b = _b;
+
+    if ( a->key != b->key )
+        return a->key < b->key ? -1 : 1;
+    return a->worker - b->worker;
+}
+
+void analyze(void);
+
+void run_workers(void)
+{
+    struct {
+        pid_t pid;
+        FILE *out, *sections;
+    } *w;
+    struct worker_section *all = NULL, s;
+    int i, nr = 0, status;
+    char buf[4096];
+    long len;
+    size_t n;
+
+    if ( (w = calloc(opt.workers, sizeof(*w))) == NULL )
+    {
+        fprintf(stderr, "%s: calloc failed\n", __func__);
+        error(ERR_SYSTEM, NULL);
+    }
+
+    for ( i = 0; i < opt.workers; i++ )
+    {
+        w[i].out = tmpfile();
+        w[i].sections = tmpfile();
+        if ( !w[i].out || !w[i].sections )
+        {
+            perror("tmpfile");
+            error(ERR_SYSTEM, NULL);
+        }
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    for ( i = 0; i < opt.workers; i++ )
+    {
+        w[i].pid = fork();
+
+        if ( w[i].pid < 0 )
+        {
+            perror("fork");
+            error(ERR_SYSTEM, NULL);
+        }
+
+        if ( w[i].pid == 0 )
+        {
+            G.worker = i;
+
+            if ( dup2(fileno(w[i].out), STDOUT_FILENO) < 0 )
+            {
+                perror("dup2");
+                exit(1);
+            }
+
+            analyze();
+
+            worker_section_end();
+            if ( fwrite(G.sections, sizeof(*G.sections), G.nr_sections,
+                        w[i].sections) != G.nr_sections
+                 || fflush(w[i].sections) || fflush(stdout) )
+            {
+                perror("worker output");
+                exit(1);
+            }
+
+            exit(0);
+        }
+    }
+
+    for ( i = 0; i < opt.workers; i++ )
+    {
+        if ( waitpid(w[i].pid, &status, 0) < 0
+             || !WIFEXITED(status) || WEXITSTATUS(status) )
+        {
+            fprintf(stderr, "%s: worker %d failed\n", __func__, i);
+            error(ERR_SYSTEM, NULL);
+        }
+
+        rewind(w[i].sections);
+        while ( fread(&s, sizeof(s), 1, w[i].sections) == 1 )
+        {
+            if ( (all = realloc(all, (nr + 1) * sizeof(*all))) == NULL )
+            {
+                fprintf(stderr, "%s: realloc failed\n", __func__);
+                error(ERR_SYSTEM, NULL);
+            }
+            all[nr++] = s;
+        }
+    }
+
+    qsort(all, nr, sizeof(*all), worker_section_cmp);
+
+    for ( i = 0; i < nr; i++ )
+    {
+        FILE *out = w[all[i].worker].out;
+
+        fseek(out, all[i].start, SEEK_SET);
+        for ( len = all[i].end - all[i].start; len > 0; len -= n )
+        {
+            n = fread(buf, 1, len < sizeof(buf) ? len : sizeof(buf), out);
+            if ( !n )
+            {
+                fprintf(stderr, "%s: short read of worker %d output\n",
+                        __func__, all[i].worker);
+                error(ERR_SYSTEM, NULL);
+            }
+            fwrite(buf, 1, n, stdout);
+        }
+    }
+
+    for ( i = 0; i < opt.workers; i++ )
+    {
+        fclose(w[i].out);
+        fclose(w[i].sections);
+    }
+    free(all);
+    free(w);
+}
+
 void init_pcpus(void) {
     int i=0;
     off_t offset = 0;
@@ -9981,6 +10567,12 @@ void init_pcpus(void) {
 
     sched_default_domain_init();
 
+    if ( I.w )
+    {
+        index_activate_pcpus();
+        return;
+    }
+
     /* Scan through the cpu_change recs until we see a duplicate */
     do {
         offset = scan_for_new_pcpu(offset);
@@ -10046,6 +10638,10 @@ enum {
     OPT_PROGRESS,
     OPT_TOLERANCE,
     OPT_TSC_LOOP_FATAL,
+    OPT_NO_INDEX,
+    OPT_INDEX_FILE,
+    OPT_TIME_WINDOW,
+    OPT_WORKERS,
     /* Specific letters */
     OPT_DUMP_ALL='a',
     OPT_INTERVAL_LENGTH='i',
@@ -10526,6 +11122,46 @@ error_t cmd_parser(int key, char *arg, struct argp_state *state)
         opt.tsc_loop_fatal = 1;
         break;
 
+    case OPT_NO_INDEX:
+        opt.no_index = 1;
+        break;
+
+    case OPT_INDEX_FILE:
+        /* FIXME - strcpy */
+        G.index_file = arg;
+        break;
+
+    case OPT_WORKERS:
+    {
+        char *inval;
+
+        opt.workers = (int)strtol(arg, &inval, 0);
+        if ( inval == arg || *inval != '\0' || opt.workers < 1 )
+            argp_usage(state);
+    }
+    break;
+
+    case OPT_TIME_WINDOW:
+    {
+        char *inval;
+
+        opt.window.start = strtod(arg, &inval);
+        if ( inval == arg || opt.window.start < 0 )
+            argp_usage(state);
+
+        if ( *inval == ',' )
+        {
+            arg = inval + 1;
+            opt.window.end = strtod(arg, &inval);
+            if ( inval == arg || opt.window.end <= opt.window.start )
+                argp_usage(state);
+        }
+
+        if ( *inval != '\0' )
+            argp_usage(state);
+    }
+    break;
+
     case ARGP_KEY_ARG:
     {
         /* FIXME - strcpy */
@@ -10548,6 +11184,12 @@ error_t cmd_parser(int key, char *arg, struct argp_state *state)
             opt.summary = 1;
             opt.summary_info = 1;
         }
+
+        if ( opt.workers > 1 && !workers_supported() )
+        {
+            fprintf(stderr, "--workers only supports summary and pcpu reports.\n");
+            exit(1);
+        }
         fprintf(stderr, "Using %s hardware-assisted virtualization.\n",
                 opt.svm_mode?"SVM":"VMX");
     }
@@ -10820,6 +11462,25 @@ const struct argp_option cmd_opts[] =  {
       .arg = "errlevel",
       .doc = "Sets tolerance for errors found in the file.  Default is 3; max is 6.", },
 
+    { .name = "no-index",
+      .key = OPT_NO_INDEX,
+      .doc = "Don't index the trace; scan it for each pcpu's records instead.", },
+
+    { .name = "index-file",
+      .key = OPT_INDEX_FILE,
+      .arg = "filename",
+      .doc = "Where to find or save the trace index.  Default is the trace file name with .idx appended.", },
+
+    { .name = "workers",
+      .key = OPT_WORKERS,
+      .arg = "N",
+      .doc = "Split accounting of guest records by domain between N worker processes.  Only for --summary and --report-pcpu.", },
+
+    { .name = "time-window",
+      .key = OPT_TIME_WINDOW,
+      .arg = "start[,end]",
+      .doc = "Only analyze records between start and end seconds into the trace.  Requires the index.", },
+
 
     { 0 },
 };
@@ -10831,6 +11492,30 @@ const struct argp parser_def = {
     .doc = "",
 };
 
+void analyze(void) {
+    init_pcpus();
+
+    if(opt.progress)
+        progress_init();
+
+    process_records();
+
+    if(opt.interval_mode)
+        interval_tail();
+
+    if(opt.summary)
+        summary();
+
+    if(opt.report_pcpu && G.worker == 0)
+    {
+        worker_section(INT_MAX);
+        report_pcpu();
+    }
+
+    if(opt.progress)
+        progress_finish();
+}
+
 const char *argp_program_bug_address = "George Dunlap <george.dunlap@eu.citrix.com>";
 
 
@@ -10855,30 +11540,25 @@ int main(int argc, char *argv[]) {
     if ( (G.mh = mread_init(G.fd)) == NULL )
         perror("mread");
 
+    if ( !opt.no_index )
+        index_init();
+
+    if ( !I.w && (opt.window.start > 0 || opt.window.end > 0) )
+    {
+        fprintf(stderr, "--time-window requires the trace index\n");
+        exit(1);
+    }
+
     if (G.symbol_file != NULL)
         parse_symbol_file(G.symbol_file);
 
     if(opt.dump_all)
         warn = stdout;
 
-    init_pcpus();
-
-    if(opt.progress)
-        progress_init();
-
-    process_records();
-
-    if(opt.interval_mode)
-        interval_tail();
-
-    if(opt.summary)
-        summary();
-
-    if(opt.report_pcpu)
-        report_pcpu();
-
-    if(opt.progress)
-        progress_finish();
+    if ( opt.workers > 1 )
+        run_workers();
+    else
+        analyze();
 
     return 0;
 }
@@ -173,6 +173,14 @@ const struct cmd_spec cmd_table[] = {
       "-e              Do not wait in the background (on <host>) for the death\n"
       "                of the domain.\n"
       "--debug         Print huge (!) amount of debug during the migration process.\n"
+      "--compress      Compress guest memory in the migration stream.\n"
+      "--postcopy      Start the domain on <host> before all of its memory has\n"
+      "                been sent, and fetch the rest on demand (HVM only).\n"
+      "--max-downtime <ms>\n"
+      "                Keep sending memory while the domain runs until it can\n"
+      "                be paused for at most <ms> milliseconds to send the rest.\n"
+      "--throttle      With --max-downtime, cap the domain's CPU time if it\n"
+      "                dirties memory too fast for the target to be met.\n"
       "-p              Do not unpause domain after migrating it.\n"
       "-D              Preserve the domain id"
     },
@@ -177,7 +177,8 @@ static void migrate_do_preamble(int send_fd, int recv_fd, pid_t child,
 }
 
 static void migrate_domain(uint32_t domid, int preserve_domid,
-                           const char *rune, int debug,
+                           const char *rune, int flags,
+                           unsigned int max_downtime_ms,
                            const char *override_config_file)
 {
     pid_t child = -1;
@@ -186,7 +187,7 @@ static void migrate_domain(uint32_t domid, int preserve_domid,
     char *away_domname;
     char rc_buf;
     uint8_t *config_data;
-    int config_len, flags = LIBXL_SUSPEND_LIVE;
+    int config_len;
 
     save_domain_core_begin(domid, preserve_domid, override_config_file,
                            &config_data, &config_len);
@@ -204,9 +205,8 @@ static void migrate_domain(uint32_t domid, int preserve_domid,
 
     xtl_stdiostream_adjust_flags(logger, XTL_STDIOSTREAM_HIDE_PROGRESS, 0);
 
-    if (debug)
-        flags |= LIBXL_SUSPEND_DEBUG;
-    rc = libxl_domain_suspend(ctx, domid, send_fd, flags, NULL);
+    rc = libxl_domain_suspend_adaptive(ctx, domid, send_fd, flags,
+                                       max_downtime_ms, NULL);
     if (rc) {
         fprintf(stderr, "migration sender: libxl_domain_suspend failed"
                 " (rc=%d)\n", rc);
@@ -252,6 +252,18 @@ static void migrate_domain(uint32_t domid, int preserve_domid,
                              "migration stream", "GO message");
     if (rc) goto failed_badly;
 
+    if (flags & LIBXL_SUSPEND_POSTCOPY) {
+        fprintf(stderr, "migration sender: Sending remaining memory.\n");
+
+        /*
+         * ERROR_ABORTED means the target failed before starting the
+         * domain, so will report that and let us resume it as usual.
+         */
+        rc = libxl_domain_postcopy_send(ctx, domid, send_fd, recv_fd, flags,
+                                        NULL);
+        if (rc && rc != ERROR_ABORTED) goto failed_badly;
+    }
+
     rc = migrate_read_fixedmessage(recv_fd, migrate_report,
                                    sizeof(migrate_report),
                                    "success/failure report message", rune);
@@ -317,7 +329,7 @@ static void migrate_domain(uint32_t domid, int preserve_domid,
 }
 
 static void migrate_receive(int debug, int daemonize, int monitor,
-                            int pause_after_migration,
+                            int pause_after_migration, int postcopy,
                             int send_fd, int recv_fd,
                             libxl_checkpointed_stream checkpointed,
                             char *colo_proxy_script,
@@ -426,10 +438,29 @@ static void migrate_receive(int debug, int daemonize, int monitor,
 
     if (migration_domname) {
         rc = libxl_domain_rename(ctx, domid, migration_domname, common_domname);
-        if (rc) goto perhaps_destroy_notify_rc;
+        /*
+         * With post-copy, the sender is already waiting for pages to be
+         * requested, and only libxl_domain_postcopy_receive() can tell it
+         * to give up and resume the domain.  As with Remus failover, carry
+         * on under the migration name instead.
+         */
+        if (rc && postcopy)
+            fprintf(stderr, "migration target: "
+                    "Failed to rename domain from %s to %s:%d\n",
+                    migration_domname, common_domname, rc);
+        else if (rc)
+            goto perhaps_destroy_notify_rc;
     }
 
-    if (!pause_after_migration) {
+    if (postcopy) {
+        /*
+         * On failure before the domain was started, this has told the
+         * sender, which resumes its copy once we report the failure.
+         */
+        rc = libxl_domain_postcopy_receive(ctx, domid, recv_fd, send_fd,
+                                           !pause_after_migration, NULL);
+        if (rc) goto perhaps_destroy_notify_rc;
+    } else if (!pause_after_migration) {
         rc = libxl_domain_unpause(ctx, domid, NULL);
         if (rc) goto perhaps_destroy_notify_rc;
     }
@@ -479,6 +510,7 @@ static void migrate_receive(int debug, int daemonize, int monitor,
 int main_migrate_receive(int argc, char **argv)
 {
     int debug = 0, daemonize = 1, monitor = 1, pause_after_migration = 0;
+    int postcopy = 0;
     libxl_checkpointed_stream checkpointed = LIBXL_CHECKPOINTED_STREAM_NONE;
     int opt;
     bool userspace_colo_proxy = false;
@@ -488,6 +520,7 @@ int main_migrate_receive(int argc, char **argv)
         /* It is a shame that the management code for disk is not here. */
         {"coloft-script", 1, 0, 0x200},
         {"userspace-colo-proxy", 0, 0, 0x300},
+        {"postcopy", 0, 0, 0x400},
         COMMON_LONG_OPTS
     };
 
@@ -514,6 +547,9 @@ int main_migrate_receive(int argc, char **argv)
     case 0x300:
         userspace_colo_proxy = true;
         break;
+    case 0x400:
+        postcopy = 1;
+        break;
     case 'p':
         pause_after_migration = 1;
         break;
@@ -523,7 +559,7 @@ int main_migrate_receive(int argc, char **argv)
         help("migrate-receive");
         return EXIT_FAILURE;
     }
-    migrate_receive(debug, daemonize, monitor, pause_after_migration,
+    migrate_receive(debug, daemonize, monitor, pause_after_migration, postcopy,
                     STDOUT_FILENO, STDIN_FILENO,
                     checkpointed, script, userspace_colo_proxy);
 
@@ -538,10 +574,16 @@ int main_migrate(int argc, char **argv)
     char *rune = NULL;
     char *host;
     int opt, daemonize = 1, monitor = 1, debug = 0, pause_after_migration = 0;
-    int preserve_domid = 0;
+    int preserve_domid = 0, flags = LIBXL_SUSPEND_LIVE;
+    unsigned int max_downtime_ms = 0;
+    char *endptr;
     static struct option opts[] = {
         {"debug", 0, 0, 0x100},
         {"live", 0, 0, 0x200},
+        {"compress", 0, 0, 0x300},
+        {"postcopy", 0, 0, 0x400},
+        {"max-downtime", 1, 0, 0x500},
+        {"throttle", 0, 0, 0x600},
         COMMON_LONG_OPTS
     };
 
@@ -571,6 +613,30 @@ int main_migrate(int argc, char **argv)
     case 0x200: /* --live */
         /* ignored for compatibility with xm */
         break;
+    case 0x300: /* --compress */
+        flags |= LIBXL_SUSPEND_COMPRESS;
+        break;
+    case 0x400: /* --postcopy */
+        flags |= LIBXL_SUSPEND_POSTCOPY;
+        break;
+    case 0x500: /* --max-downtime */
+        max_downtime_ms = strtoul(optarg, &endptr, 10);
+        if (*endptr || !max_downtime_ms) {
+            fprintf(stderr, "Invalid downtime target '%s'\n", optarg);
+            return EXIT_FAILURE;
+        }
+        break;
+    case 0x600: /* --throttle */
+        flags |= LIBXL_SUSPEND_THROTTLE;
+        break;
+    }
+
+    if (debug)
+        flags |= LIBXL_SUSPEND_DEBUG;
+
+    if ((flags & LIBXL_SUSPEND_THROTTLE) && !max_downtime_ms) {
+        fprintf(stderr, "--throttle needs a --max-downtime target\n");
+        return EXIT_FAILURE;
     }
 
     domid = find_domain(argv[optind]);
@@ -592,17 +658,19 @@ int main_migrate(int argc, char **argv)
         } else {
             verbose_len = (minmsglevel_default - minmsglevel) + 2;
         }
-        xasprintf(&rune, "exec %s %s xl%s%s%.*s migrate-receive%s%s%s",
+        xasprintf(&rune, "exec %s %s xl%s%s%.*s migrate-receive%s%s%s%s",
                   ssh_command, host,
                   pass_tty_arg ? " -t" : "",
                   timestamps ? " -T" : "",
                   verbose_len, verbose_buf,
                   daemonize ? "" : " -e",
                   debug ? " -d" : "",
-                  pause_after_migration ? " -p" : "");
+                  pause_after_migration ? " -p" : "",
+                  (flags & LIBXL_SUSPEND_POSTCOPY) ? " --postcopy" : "");
     }
 
-    migrate_domain(domid, preserve_domid, rune, debug, config_filename);
+    migrate_domain(domid, preserve_domid, rune, flags, max_downtime_ms,
+                   config_filename);
     return EXIT_SUCCESS;
 }
 
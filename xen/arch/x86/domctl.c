@@ -1080,6 +1080,20 @@ long arch_do_domctl(
         break;
     }
 
+    case XEN_DOMCTL_get_p2m_orders:
+    {
+        struct xen_domctl_p2m_orders *po = &domctl->u.p2m_orders;
+
+        ret = -EINVAL;
+        if ( !is_hvm_domain(d) )
+            break;
+
+        ret = p2m_get_orders(d, _gfn(po->start_gfn), &po->nr_gfns,
+                             po->orders);
+        copyback = true;
+        break;
+    }
+
     case XEN_DOMCTL_get_vcpu_msrs:
     case XEN_DOMCTL_set_vcpu_msrs:
     {
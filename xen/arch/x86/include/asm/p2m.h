@@ -664,6 +664,10 @@ static inline bool p2m_is_global_logdirty(const struct domain *d)
 int p2m_is_logdirty_range(struct p2m_domain *, unsigned long start,
                           unsigned long end);
 
+/* Report the order of the entry mapping each gfn of a range (domctl). */
+int p2m_get_orders(struct domain *d, gfn_t start, uint64_t *nr,
+                   XEN_GUEST_HANDLE_64(uint8) orders);
+
 /* Set mmio addresses in the p2m table (for pass-through) */
 int set_mmio_p2m_entry(struct domain *d, gfn_t gfn, mfn_t mfn,
                        unsigned int order);
@@ -28,6 +28,7 @@
 #include <xen/vm_event.h>
 #include <xen/event.h>
 #include <xen/grant_table.h>
+#include <xen/guest_access.h>
 #include <xen/ioreq.h>
 #include <xen/param.h>
 #include <public/vm_event.h>
@@ -1009,6 +1010,71 @@ int p2m_finish_type_change(struct domain *d,
     return rc;
 }
 
+/*
+ * Report the order of the host p2m entry mapping each gfn of a range, as one
+ * octet per gfn, or XEN_DOMCTL_P2M_ORDER_NONE for gfns not mapped to RAM.
+ * Each lookup covers the remainder of the entry found, so large and empty
+ * ranges are cheap.  May stop early if preemption is needed, in which case
+ * *nr is updated to the number of gfns reported.
+ */
+int p2m_get_orders(struct domain *d, gfn_t start, uint64_t *nr,
+                   XEN_GUEST_HANDLE_64(uint8) orders)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    uint8_t buf[256];
+    uint64_t i = 0, base = 0;
+    unsigned long n, k;
+    unsigned int order, fill = 0, lookups = 0;
+    uint8_t val;
+    p2m_access_t a;
+    p2m_type_t t;
+    gfn_t gfn;
+    int rc = 0;
+
+    p2m_read_lock(p2m);
+
+    while ( i < *nr )
+    {
+        gfn = gfn_add(start, i);
+        p2m->get_entry(p2m, gfn, &t, &a, 0, &order, NULL);
+
+        n = (1UL << order) - (gfn_x(gfn) & ((1UL << order) - 1));
+        n = min_t(uint64_t, n, *nr - i);
+        val = p2m_is_ram(t) ? order : XEN_DOMCTL_P2M_ORDER_NONE;
+
+        for ( ; n; n -= k, i += k )
+        {
+            k = min_t(unsigned long, n, sizeof(buf) - fill);
+            memset(buf + fill, val, k);
+            fill += k;
+
+            if ( fill == sizeof(buf) )
+            {
+                if ( copy_to_guest_offset(orders, base, buf, fill) )
+                {
+                    rc = -EFAULT;
+                    goto out;
+                }
+                base += fill;
+                fill = 0;
+            }
+        }
+
+        if ( !(++lookups & 0xff) && hypercall_preempt_check() )
+            break;
+    }
+
+    if ( fill && copy_to_guest_offset(orders, base, buf, fill) )
+        rc = -EFAULT;
+    else
+        *nr = i;
+
+ out:
+    p2m_read_unlock(p2m);
+
+    return rc;
+}
+
 /*
  * Returns:
  *    0              for success
@@ -401,6 +401,99 @@ bool paging_mfn_is_dirty(const struct domain *d, mfn_t gmfn)
 }
 #endif
 
+/*
+ * Sparse log-dirty retrieval.  Each leaf of the log-dirty trie is split into
+ * regions of 2^XEN_DOMCTL_SHADOW_SUMMARY_ORDER pages, each with a bit in the
+ * caller's summary bitmap.  Only dirty regions are copied to the caller's
+ * bitmap, and clean leaves cost a scan rather than a copy.
+ */
+#define LOGDIRTY_REGION_BYTES ((1U << XEN_DOMCTL_SHADOW_SUMMARY_ORDER) / 8)
+
+/* Summary bytes covering the first 'pages' bits of the bitmap. */
+static unsigned long log_dirty_summary_bytes(unsigned long pages)
+{
+    return DIV_ROUND_UP(pages, 8U << XEN_DOMCTL_SHADOW_SUMMARY_ORDER);
+}
+
+/*
+ * The summary is written lazily, as clean leaves leave no trace.  Zero it
+ * from *summary_done up to the summary byte covering 'pages'.
+ */
+static int log_dirty_clear_summary(struct xen_domctl_shadow_op *sc,
+                                   unsigned long pages,
+                                   unsigned long *summary_done)
+{
+    unsigned long end = log_dirty_summary_bytes(pages);
+
+    if ( end <= *summary_done )
+        return 0;
+
+    if ( clear_guest_offset(sc->dirty_summary, *summary_done,
+                            end - *summary_done) )
+        return -EFAULT;
+
+    *summary_done = end;
+    return 0;
+}
+
+/*
+ * Copy out the dirty regions of one leaf, covering 'bytes' bytes of the
+ * bitmap from page 'pages', along with its summary bits.
+ */
+static int log_dirty_copy_sparse(struct xen_domctl_shadow_op *sc,
+                                 const unsigned long *l1, unsigned long pages,
+                                 unsigned int bytes,
+                                 unsigned long *summary_done)
+{
+    const unsigned int nr = DIV_ROUND_UP(bytes, LOGDIRTY_REGION_BYTES);
+    const unsigned int words = LOGDIRTY_REGION_BYTES / sizeof(*l1);
+    uint64_t summary = 0;
+    unsigned int r, w, start;
+
+    BUILD_BUG_ON(PAGE_SIZE / LOGDIRTY_REGION_BYTES > 64);
+
+    for ( r = 0; r < nr; r++ )
+        for ( w = r * words; w < (r + 1) * words; w++ )
+            if ( l1[w] )
+            {
+                summary |= 1ULL << r;
+                break;
+            }
+
+    if ( !summary )
+        return 0;
+
+    /* Leaves start on a summary byte boundary. */
+    if ( log_dirty_clear_summary(sc, pages, summary_done) ||
+         copy_to_guest_offset(sc->dirty_summary, *summary_done,
+                              (uint8_t *)&summary, DIV_ROUND_UP(nr, 8)) )
+        return -EFAULT;
+    *summary_done += DIV_ROUND_UP(nr, 8);
+
+    /* Copy each run of dirty regions in one go. */
+    for ( r = 0; r < nr; )
+    {
+        if ( !(summary & (1ULL << r)) )
+        {
+            r++;
+            continue;
+        }
+
+        for ( start = r; r < nr && (summary & (1ULL << r)); r++ )
+            ;
+
+        if ( copy_to_guest_offset(sc->dirty_bitmap,
+                                  (pages >> 3) + start * LOGDIRTY_REGION_BYTES,
+                                  (const uint8_t *)l1 +
+                                  start * LOGDIRTY_REGION_BYTES,
+                                  min(r * LOGDIRTY_REGION_BYTES, bytes) -
+                                  start * LOGDIRTY_REGION_BYTES) )
+            return -EFAULT;
+    }
+
+    return 0;
+}
+
 /* Read a domain's log-dirty bitmap and stats.  If the operation is a CLEAN,
  * clear the bitmap and stats as well. */
 static int paging_log_dirty_op(struct domain *d,
@@ -408,7 +501,8 @@ static int paging_log_dirty_op(struct domain *d,
                                bool_t resuming)
 {
     int rv = 0, clean = 0, peek = 1;
-    unsigned long pages = 0;
+    bool sparse = sc->mode & XEN_DOMCTL_SHADOW_LOGDIRTY_SUMMARY;
+    unsigned long pages = 0, summary_done;
     mfn_t *l4 = NULL, *l3 = NULL, *l2 = NULL;
     unsigned long *l1 = NULL;
     int i4, i3, i2;
@@ -476,6 +570,8 @@ static int paging_log_dirty_op(struct domain *d,
     i4 = d->arch.paging.preempt.log_dirty.i4;
     i3 = d->arch.paging.preempt.log_dirty.i3;
     pages = d->arch.paging.preempt.log_dirty.done;
+    /* The summary is complete up to the point of any preemption. */
+    summary_done = log_dirty_summary_bytes(pages);
 
     for ( ; (pages < sc->pages) && (i4 < LOGDIRTY_NODE_ENTRIES); i4++, i3 = 0 )
     {
@@ -494,7 +590,16 @@ static int paging_log_dirty_op(struct domain *d,
                       map_domain_page(l2[i2]) : NULL);
                 if ( unlikely(((sc->pages - pages + 7) >> 3) < bytes) )
                     bytes = (unsigned int)((sc->pages - pages + 7) >> 3);
-                if ( likely(peek) )
+                if ( likely(peek) && sparse )
+                {
+                    if ( l1 && log_dirty_copy_sparse(sc, l1, pages, bytes,
+                                                     &summary_done) )
+                    {
+                        rv = -EFAULT;
+                        goto out;
+                    }
+                }
+                else if ( likely(peek) )
                 {
                     if ( (l1 ? copy_to_guest_offset(sc->dirty_bitmap,
                                                     pages >> 3, (uint8_t *)l1,
@@ -540,6 +645,14 @@ static int paging_log_dirty_op(struct domain *d,
     }
     if ( l4 )
         unmap_domain_page(l4);
+    l1 = NULL;
+    l2 = l3 = l4 = NULL;
+
+    if ( peek && sparse && log_dirty_clear_summary(sc, pages, &summary_done) )
+    {
+        rv = -EFAULT;
+        goto out;
+    }
 
     if ( !rv )
     {
@@ -748,7 +861,12 @@ int paging_domctl(struct domain *d, struct xen_domctl_shadow_op *sc,
 
     case XEN_DOMCTL_SHADOW_OP_CLEAN:
     case XEN_DOMCTL_SHADOW_OP_PEEK:
-        if ( sc->mode & ~XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL )
+        if ( sc->mode & ~(XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL |
+                          XEN_DOMCTL_SHADOW_LOGDIRTY_SUMMARY) )
+            return -EINVAL;
+        if ( (sc->mode & XEN_DOMCTL_SHADOW_LOGDIRTY_SUMMARY) &&
+             !guest_handle_is_null(sc->dirty_bitmap) &&
+             guest_handle_is_null(sc->dirty_summary) )
             return -EINVAL;
         return paging_log_dirty_op(d, sc, resuming);
     }
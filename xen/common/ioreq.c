@@ -24,6 +24,7 @@
 #include <xen/irq.h>
 #include <xen/lib.h>
 #include <xen/paging.h>
+#include <xen/perfc.h>
 #include <xen/sched.h>
 #include <xen/trace.h>
 
@@ -58,6 +59,22 @@ void ioreq_signal_mapcache_invalidate(void)
         gprintk(XENLOG_ERR, "Unsuccessful map-cache invalidate\n");
 }
 
+/*
+ * Invalidate the results of ioreq_server_select() cached by the vCPUs of d.
+ * To be called with the ioreq server lock of d held, after the change.
+ */
+static void ioreq_select_invalidate(struct domain *d)
+{
+    unsigned int gen = d->ioreq_server.generation + 1;
+
+    /* Generation 0 is that of the never used cache entries. */
+    if ( !gen )
+        gen = 1;
+
+    smp_wmb(); /* Update of servers and their ranges before generation. */
+    write_atomic(&d->ioreq_server.generation, gen);
+}
+
 static void set_ioreq_server(struct domain *d, unsigned int id,
                              struct ioreq_server *s)
 {
@@ -65,6 +82,7 @@ static void set_ioreq_server(struct domain *d, unsigned int id,
     ASSERT(!s || !d->ioreq_server.server[id]);
 
     d->ioreq_server.server[id] = s;
+    ioreq_select_invalidate(d);
 }
 
 #define GET_IOREQ_SERVER(d, id) \
@@ -547,6 +565,7 @@ static void ioreq_server_enable(struct ioreq_server *s)
     arch_ioreq_server_enable(s);
 
     s->enabled = true;
+    ioreq_select_invalidate(s->target);
 
     list_for_each_entry ( sv,
                           &s->ioreq_vcpu_list,
@@ -567,6 +586,7 @@ static void ioreq_server_disable(struct ioreq_server *s)
     arch_ioreq_server_disable(s);
 
     s->enabled = false;
+    ioreq_select_invalidate(s->target);
 
  done:
     spin_unlock(&s->lock);
@@ -596,7 +616,10 @@ static int ioreq_server_init(struct ioreq_server *s,
     if ( rc )
         return rc;
 
-    s->bufioreq_handling = bufioreq_handling;
+    s->bufioreq_handling = bufioreq_handling &
+                           ~HVM_IOREQSRV_BUFIOREQ_NOTIFY_EMPTY;
+    s->bufioreq_notify_empty = bufioreq_handling &
+                               HVM_IOREQSRV_BUFIOREQ_NOTIFY_EMPTY;
 
     for_each_vcpu ( d, v )
     {
@@ -649,7 +672,9 @@ static int ioreq_server_create(struct domain *d, int bufioreq_handling,
     if ( !IS_ENABLED(CONFIG_X86) && bufioreq_handling )
         return -EINVAL;
 
-    if ( bufioreq_handling > HVM_IOREQSRV_BUFIOREQ_ATOMIC )
+    if ( bufioreq_handling == HVM_IOREQSRV_BUFIOREQ_NOTIFY_EMPTY ||
+         (bufioreq_handling & ~HVM_IOREQSRV_BUFIOREQ_NOTIFY_EMPTY) >
+         HVM_IOREQSRV_BUFIOREQ_ATOMIC )
         return -EINVAL;
 
     s = xzalloc(struct ioreq_server);
@@ -883,6 +908,8 @@ static int ioreq_server_map_io_range(struct domain *d, ioservid_t id,
         goto out;
 
     rc = rangeset_add_range(r, start, end);
+    if ( !rc )
+        ioreq_select_invalidate(d);
 
  out:
     spin_unlock_recursive(&d->ioreq_server.lock);
@@ -935,6 +962,8 @@ static int ioreq_server_unmap_io_range(struct domain *d, ioservid_t id,
         goto out;
 
     rc = rangeset_remove_range(r, start, end);
+    if ( !rc )
+        ioreq_select_invalidate(d);
 
  out:
     spin_unlock_recursive(&d->ioreq_server.lock);
@@ -1096,60 +1125,110 @@ void ioreq_server_destroy_all(struct domain *d)
     spin_unlock_recursive(&d->ioreq_server.lock);
 }
 
-struct ioreq_server *ioreq_server_select(struct domain *d,
-                                         ioreq_t *p)
+/*
+ * Look up the server for an access in the ranges of all servers.  Returns
+ * the ID of the server, or MAX_NR_IOREQ_SERVERS if there is none.
+ */
+static unsigned int ioreq_server_lookup(struct domain *d, uint8_t type,
+                                        uint64_t start, uint64_t end)
 {
     struct ioreq_server *s;
-    uint8_t type;
-    uint64_t addr;
     unsigned int id;
 
-    if ( !arch_ioreq_server_get_type_addr(d, p, &type, &addr) )
-        return NULL;
-
     FOR_EACH_IOREQ_SERVER(d, id, s)
     {
-        struct rangeset *r;
-
         if ( !s->enabled )
             continue;
 
-        r = s->range[type];
+        if ( type == XEN_DMOP_IO_RANGE_PCI
+             ? rangeset_contains_singleton(s->range[type], start)
+             : rangeset_contains_range(s->range[type], start, end) )
+            return id;
+    }
 
-        switch ( type )
-        {
-            unsigned long start, end;
+    return MAX_NR_IOREQ_SERVERS;
+}
 
-        case XEN_DMOP_IO_RANGE_PORT:
-            start = addr;
-            end = start + p->size - 1;
-            if ( rangeset_contains_range(r, start, end) )
-                return s;
+/*
+ * The vCPU doing an access remembers the server selected for the last few
+ * ones, as most accesses go to the same few registers.  The results are
+ * tagged with the generation of the ioreq servers of the domain they were
+ * found in, so any change to the servers or their ranges drops them all.
+ */
+struct ioreq_server *ioreq_server_select(struct domain *d,
+                                         ioreq_t *p)
+{
+    struct vcpu_io *vio = &current->io;
+    struct vio_select *sel;
+    uint8_t type;
+    uint64_t addr, start, end;
+    unsigned int i, id, gen;
 
-            break;
+    ASSERT(d == current->domain);
 
-        case XEN_DMOP_IO_RANGE_MEMORY:
-            start = ioreq_mmio_first_byte(p);
-            end = ioreq_mmio_last_byte(p);
+    if ( !arch_ioreq_server_get_type_addr(d, p, &type, &addr) )
+        return NULL;
 
-            if ( rangeset_contains_range(r, start, end) )
-                return s;
+    switch ( type )
+    {
+    case XEN_DMOP_IO_RANGE_PORT:
+        start = addr;
+        end = start + p->size - 1;
+        break;
 
-            break;
+    case XEN_DMOP_IO_RANGE_MEMORY:
+        start = ioreq_mmio_first_byte(p);
+        end = ioreq_mmio_last_byte(p);
+        break;
 
-        case XEN_DMOP_IO_RANGE_PCI:
-            if ( rangeset_contains_singleton(r, addr >> 32) )
-            {
-                p->type = IOREQ_TYPE_PCI_CONFIG;
-                p->addr = addr;
-                return s;
-            }
+    case XEN_DMOP_IO_RANGE_PCI:
+        start = end = addr >> 32;
+        break;
+
+    default:
+        return NULL;
+    }
+
+    /* The ranges looked at below are at least as new as this generation. */
+    gen = read_atomic(&d->ioreq_server.generation);
+    smp_rmb();
 
+    for ( i = 0; i < ARRAY_SIZE(vio->select); i++ )
+    {
+        sel = &vio->select[i];
+        if ( sel->generation == gen && sel->type == type &&
+             sel->start == start && sel->end == end )
             break;
-        }
     }
 
-    return NULL;
+    if ( i < ARRAY_SIZE(vio->select) )
+    {
+        perfc_incr(ioreq_select_hit);
+        id = sel->id;
+    }
+    else
+    {
+        perfc_incr(ioreq_select_miss);
+        id = ioreq_server_lookup(d, type, start, end);
+
+        sel = &vio->select[vio->select_next++ % ARRAY_SIZE(vio->select)];
+        sel->start = start;
+        sel->end = end;
+        sel->generation = gen;
+        sel->type = type;
+        sel->id = id;
+    }
+
+    if ( id >= MAX_NR_IOREQ_SERVERS )
+        return NULL;
+
+    if ( type == XEN_DMOP_IO_RANGE_PCI )
+    {
+        p->type = IOREQ_TYPE_PCI_CONFIG;
+        p->addr = addr;
+    }
+
+    return GET_IOREQ_SERVER(d, id);
 }
 
 static int ioreq_send_buffered(struct ioreq_server *s, ioreq_t *p)
@@ -1163,6 +1242,8 @@ static int ioreq_send_buffered(struct ioreq_server *s, ioreq_t *p)
                        .dir = p->dir };
     /* Timeoffset sends 64b data, but no address. Use two consecutive slots. */
     int qw = 0;
+    uint32_t wp;
+    bool notify = true;
 
     /* Ensure buffered_iopage fits in a page */
     BUILD_BUG_ON(sizeof(buffered_iopage_t) > PAGE_SIZE);
@@ -1224,7 +1305,19 @@ static int ioreq_send_buffered(struct ioreq_server *s, ioreq_t *p)
 
     /* Make the ioreq_t visible /before/ write_pointer. */
     smp_wmb();
-    pg->ptrs.write_pointer += qw ? 2 : 1;
+    wp = pg->ptrs.write_pointer;
+    pg->ptrs.write_pointer = wp + (qw ? 2 : 1);
+
+    /*
+     * An emulator still busy with the ring will find the request without
+     * being notified: it reads write_pointer only after updating
+     * read_pointer, so one of us sees the update of the other.
+     */
+    if ( s->bufioreq_notify_empty )
+    {
+        smp_mb();
+        notify = read_atomic(&pg->ptrs.read_pointer) == wp;
+    }
 
     /* Canonicalize read/write pointers to prevent their overflow. */
     while ( (s->bufioreq_handling == HVM_IOREQSRV_BUFIOREQ_ATOMIC) &&
@@ -1239,7 +1332,14 @@ static int ioreq_send_buffered(struct ioreq_server *s, ioreq_t *p)
         guest_cmpxchg64(s->emulator, &pg->ptrs.full, old.full, new.full);
     }
 
-    notify_via_xen_event_channel(d, s->bufioreq_evtchn);
+    if ( notify )
+    {
+        perfc_incr(bufioreq_notify);
+        notify_via_xen_event_channel(d, s->bufioreq_evtchn);
+    }
+    else
+        perfc_incr(bufioreq_notify_skip);
+
     spin_unlock(&s->bufioreq_lock);
 
     return IOREQ_STATUS_HANDLED;
@@ -1331,6 +1431,7 @@ unsigned int ioreq_broadcast(ioreq_t *p, bool buffered)
 void ioreq_domain_init(struct domain *d)
 {
     spin_lock_init(&d->ioreq_server.lock);
+    d->ioreq_server.generation = 1;
 
     arch_ioreq_domain_init(d);
 }
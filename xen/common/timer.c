@@ -29,10 +29,15 @@
 static unsigned int timer_slop __read_mostly = 50000; /* 50 us */
 integer_param("timer_slop", timer_slop);
 
+/* Keep near-term timers on a timer wheel rather than on the heap. */
+static bool __read_mostly opt_timer_wheel;
+boolean_param("timer-wheel", opt_timer_wheel);
+
 struct timers {
     spinlock_t     lock;
     struct timer **heap;
     struct timer  *list;
+    struct timer_wheel *wheel;
     struct timer  *running;
     struct list_head inactive;
 } __cacheline_aligned;
@@ -176,6 +181,166 @@ static int add_to_list(struct timer **pprev, struct timer *t)
 }
 
 
+/****************************************************************************
+ * TIMER WHEEL OPERATIONS.
+ *
+ * Time is divided into ticks of 2^TW_TICK_SHIFT ns.  Level 0 of the wheel has
+ * a slot for each of the TW_LEVEL_SIZE ticks from the one being processed
+ * (clk) on, and each further level has a slot for TW_LEVEL_SIZE times as
+ * many ticks as a slot of the level below.  A timer goes to the lowest level
+ * its expiry fits in, and the timers of a slot of a higher level are moved
+ * down ("cascaded") when clk reaches the first tick of the slot.  Adding
+ * and removing a timer thus is O(1), while timers expiring later than the
+ * top level reaches are left to the heap.
+ *
+ * The timers in a slot are not sorted: the earliest deadline is found by
+ * looking at all timers in the first non-empty slot of each level.
+ */
+
+#define TW_TICK_SHIFT   16              /* 65.536us */
+#define TW_LEVEL_BITS   6
+#define TW_LEVEL_SIZE   (1u << TW_LEVEL_BITS)
+#define TW_LEVELS       3               /* 17.18s */
+#define TW_NR_SLOTS     (TW_LEVELS * TW_LEVEL_SIZE)
+
+struct timer_wheel {
+    /* The tick being processed: no timer expires in earlier ones. */
+    uint64_t         clk;
+    /* Bitmaps of the non-empty slots of each level. */
+    uint64_t         pending[TW_LEVELS];
+    /* run_wheel() has timers off the slots: clk must not move under it. */
+    bool             running;
+    struct list_head slots[TW_NR_SLOTS];
+};
+
+static uint64_t wheel_tick(s_time_t t)
+{
+    return t > 0 ? (uint64_t)t >> TW_TICK_SHIFT : 0;
+}
+
+static bool wheel_is_empty(const struct timer_wheel *w)
+{
+    unsigned int lvl;
+
+    for ( lvl = 0; lvl < TW_LEVELS; lvl++ )
+        if ( w->pending[lvl] )
+            return false;
+
+    return true;
+}
+
+/* Add @t to @w. Return FALSE if it expires too late for the wheel. */
+static bool add_to_wheel(struct timer_wheel *w, struct timer *t)
+{
+    uint64_t tick;
+    unsigned int lvl, slot;
+
+    /* Nothing needs clk to stay behind: catch up after idle periods. */
+    if ( !w->running && wheel_is_empty(w) )
+        w->clk = max(w->clk, wheel_tick(NOW()));
+
+    tick = max(wheel_tick(t->expires), w->clk);
+    for ( lvl = 0; lvl < TW_LEVELS; lvl++ )
+        if ( tick - w->clk < (1ULL << ((lvl + 1) * TW_LEVEL_BITS)) )
+            break;
+
+    if ( lvl == TW_LEVELS )
+        return false;
+
+    slot = (tick >> (lvl * TW_LEVEL_BITS)) & (TW_LEVEL_SIZE - 1);
+    w->pending[lvl] |= 1ULL << slot;
+    slot += lvl * TW_LEVEL_SIZE;
+    list_add_tail(&t->wheel, &w->slots[slot]);
+    t->wheel_slot = slot;
+
+    return true;
+}
+
+static void remove_from_wheel(struct timer_wheel *w, struct timer *t)
+{
+    unsigned int slot = t->wheel_slot;
+
+    list_del(&t->wheel);
+    if ( list_empty(&w->slots[slot]) )
+        w->pending[slot / TW_LEVEL_SIZE] &= ~(1ULL << (slot % TW_LEVEL_SIZE));
+}
+
+/*
+ * The first non-empty slot of level @lvl of @w, and the first tick it is
+ * for.  Level 0 starts at the slot of clk, the others at the slot following
+ * the one of clk, which has been cascaded already.  Return FALSE if empty.
+ */
+static bool wheel_first_slot(const struct timer_wheel *w, unsigned int lvl,
+                             unsigned int *slot, uint64_t *tick)
+{
+    unsigned int shift = lvl * TW_LEVEL_BITS;
+    uint64_t idx = (w->clk >> shift) + (lvl != 0);
+    uint64_t pending = w->pending[lvl];
+    unsigned int rot = idx & (TW_LEVEL_SIZE - 1), dist;
+
+    if ( !pending )
+        return false;
+
+    /* Rotate the bitmap so that bit 0 is for the slot at idx. */
+    if ( rot )
+        pending = (pending >> rot) | (pending << (TW_LEVEL_SIZE - rot));
+    dist = ffs64(pending) - 1;
+
+    *slot = lvl * TW_LEVEL_SIZE + ((rot + dist) & (TW_LEVEL_SIZE - 1));
+    *tick = (idx + dist) << shift;
+
+    return true;
+}
+
+/* Earliest expiry of the timers on @w, STIME_MAX if none. */
+static s_time_t wheel_deadline(const struct timer_wheel *w)
+{
+    s_time_t deadline = STIME_MAX;
+    const struct timer *t;
+    unsigned int lvl, slot;
+    uint64_t tick;
+
+    for ( lvl = 0; lvl < TW_LEVELS; lvl++ )
+    {
+        if ( !wheel_first_slot(w, lvl, &slot, &tick) ||
+             (s_time_t)(tick << TW_TICK_SHIFT) >= deadline )
+            continue;
+
+        list_for_each_entry ( t, &w->slots[slot], wheel )
+            deadline = min(deadline, t->expires);
+    }
+
+    return deadline;
+}
+
+static struct timer *first_wheel_entry(const struct timer_wheel *w)
+{
+    unsigned int lvl, slot;
+    uint64_t tick;
+
+    for ( lvl = 0; lvl < TW_LEVELS; lvl++ )
+        if ( wheel_first_slot(w, lvl, &slot, &tick) )
+            return list_first_entry(&w->slots[slot], struct timer, wheel);
+
+    return NULL;
+}
+
+static struct timer_wheel *alloc_wheel(void)
+{
+    struct timer_wheel *w = xzalloc(struct timer_wheel);
+    unsigned int i;
+
+    if ( w )
+    {
+        w->clk = wheel_tick(NOW());
+        for ( i = 0; i < TW_NR_SLOTS; i++ )
+            INIT_LIST_HEAD(&w->slots[i]);
+    }
+
+    return w;
+}
+
+
 /****************************************************************************
  * TIMER OPERATIONS.
  */
@@ -193,6 +358,11 @@ static int remove_entry(struct timer *t)
     case TIMER_STATUS_in_list:
         rc = remove_from_list(&timers->list, t);
         break;
+    case TIMER_STATUS_in_wheel:
+        /* An early timer interrupt only causes the deadline to be updated. */
+        remove_from_wheel(timers->wheel, t);
+        rc = 0;
+        break;
     default:
         rc = 0;
         BUG();
@@ -209,6 +379,15 @@ static int add_entry(struct timer *t)
 
     ASSERT(t->status == TIMER_STATUS_invalid);
 
+    /* Try to add to the wheel, if in use and the timer expires soon enough. */
+    if ( timers->wheel && add_to_wheel(timers->wheel, t) )
+    {
+        s_time_t deadline = per_cpu(timer_deadline, t->cpu);
+
+        t->status = TIMER_STATUS_in_wheel;
+        return !deadline || t->expires < deadline;
+    }
+
     /* Try to add to heap. t->heap_offset indicates whether we succeed. */
     t->heap_offset = 0;
     t->status = TIMER_STATUS_in_heap;
@@ -450,6 +629,101 @@ static void execute_timer(struct timers *ts, struct timer *t)
 }
 
 
+/* Move the timers of the slots starting at clk down to the lower levels. */
+static void cascade_wheel(struct timers *ts)
+{
+    struct timer_wheel *w = ts->wheel;
+    struct timer *t;
+    unsigned int lvl;
+
+    for ( lvl = TW_LEVELS - 1; lvl > 0; lvl-- )
+    {
+        unsigned int shift = lvl * TW_LEVEL_BITS;
+        unsigned int slot = (w->clk >> shift) & (TW_LEVEL_SIZE - 1);
+        LIST_HEAD(cascade);
+
+        if ( w->clk & ((1ULL << shift) - 1) )
+            continue;
+
+        list_splice_init(&w->slots[lvl * TW_LEVEL_SIZE + slot], &cascade);
+        w->pending[lvl] &= ~(1ULL << slot);
+
+        while ( !list_empty(&cascade) )
+        {
+            t = list_first_entry(&cascade, struct timer, wheel);
+            list_del(&t->wheel);
+            /* Those a full turn ahead may have to go to the heap now. */
+            t->status = TIMER_STATUS_invalid;
+            add_entry(t);
+        }
+    }
+}
+
+/*
+ * Execute the timers on the wheel of @ts which expire before @now.  Empty
+ * slots are skipped, so this doesn't take longer after a long idle period.
+ */
+static void run_wheel(struct timers *ts, s_time_t now)
+{
+    struct timer_wheel *w = ts->wheel;
+    uint64_t now_tick = wheel_tick(now), next, tick;
+    struct timer *t;
+    unsigned int lvl, slot;
+
+    if ( wheel_is_empty(w) )
+    {
+        w->clk = max(w->clk, now_tick);
+        return;
+    }
+
+    /* Handlers run with the lock dropped, and may set timers meanwhile. */
+    w->running = true;
+
+    for ( ; ; )
+    {
+        unsigned int idx = w->clk & (TW_LEVEL_SIZE - 1);
+        struct list_head *head = &w->slots[idx];
+        bool progress = true;
+
+        /* Handlers may set timers expiring before now into the same slot. */
+        while ( progress && !list_empty(head) )
+        {
+            LIST_HEAD(expired);
+
+            list_splice_init(head, &expired);
+            w->pending[0] &= ~(1ULL << idx);
+            progress = false;
+
+            while ( !list_empty(&expired) )
+            {
+                t = list_first_entry(&expired, struct timer, wheel);
+                list_del(&t->wheel);
+                if ( t->expires < now )
+                {
+                    execute_timer(ts, t);
+                    progress = true;
+                }
+                else if ( !add_to_wheel(w, t) )
+                    ASSERT_UNREACHABLE();
+            }
+        }
+
+        if ( w->clk >= now_tick )
+            break;
+
+        /* Go to the next slot with timers or to be cascaded, or to now. */
+        next = now_tick;
+        for ( lvl = 0; lvl < TW_LEVELS; lvl++ )
+            if ( wheel_first_slot(w, lvl, &slot, &tick) )
+                next = min(next, tick);
+        w->clk = max(w->clk + 1, next);
+
+        cascade_wheel(ts);
+    }
+
+    w->running = false;
+}
+
 static void cf_check timer_softirq_action(void)
 {
     struct timer  *t, **heap, *next;
@@ -506,6 +780,10 @@ static void cf_check timer_softirq_action(void)
         execute_timer(ts, t);
     }
 
+    /* Execute ready wheel timers. */
+    if ( ts->wheel )
+        run_wheel(ts, now);
+
     /* Try to move timers from linked list to more efficient heap. */
     next = ts->list;
     ts->list = NULL;
@@ -516,9 +794,9 @@ static void cf_check timer_softirq_action(void)
         add_entry(t);
     }
 
-    /* Find earliest deadline from head of linked list and top of heap. */
-    deadline = STIME_MAX;
-    if ( heap_metadata(heap)->size != 0 )
+    /* Find earliest deadline from head of linked list, heap and wheel. */
+    deadline = ts->wheel ? wheel_deadline(ts->wheel) : STIME_MAX;
+    if ( (heap_metadata(heap)->size != 0) && (heap[1]->expires < deadline) )
         deadline = heap[1]->expires;
     if ( (ts->list != NULL) && (ts->list->expires < deadline) )
         deadline = ts->list->expires;
@@ -554,6 +832,8 @@ static void cf_check dump_timerq(unsigned char key)
     s_time_t       now = NOW();
     unsigned int   i, j;
 
+    printk("Timer wheel %sabled\n", opt_timer_wheel ? "en" : "dis");
+
     printk("Dumping timer queues:\n");
 
     for_each_online_cpu( i )
@@ -566,10 +846,78 @@ static void cf_check dump_timerq(unsigned char key)
             dump_timer(ts->heap[j], now);
         for ( t = ts->list; t != NULL; t = t->list_next )
             dump_timer(t, now);
+        for ( j = 0; ts->wheel && j < TW_NR_SLOTS; j++ )
+            list_for_each_entry ( t, &ts->wheel->slots[j], wheel )
+                dump_timer(t, now);
         spin_unlock_irqrestore(&ts->lock, flags);
     }
 }
 
+#define BENCH_TIMERS 4096
+
+static void cf_check bench_timer_fn(void *data)
+{
+    unsigned int *fired = data;
+
+    (*fired)++;
+}
+
+/* Spread the expiries of the benchmark timers over 10ms. */
+static s_time_t bench_spread(unsigned int i)
+{
+    return (i * 2654435761U) % MILLISECS(10);
+}
+
+static void cf_check bench_timers(unsigned char key)
+{
+    unsigned int cpu = smp_processor_id(), fired = 0, i;
+    struct timer *timers = xmalloc_array(struct timer, BENCH_TIMERS);
+    s_time_t start, arm, rearm, stop, fire;
+
+    if ( !timers )
+    {
+        printk("Timer benchmark: out of memory\n");
+        return;
+    }
+
+    for ( i = 0; i < BENCH_TIMERS; i++ )
+        init_timer(&timers[i], bench_timer_fn, &fired, cpu);
+
+    start = NOW();
+    for ( i = 0; i < BENCH_TIMERS; i++ )
+        set_timer(&timers[i], start + MILLISECS(1) + bench_spread(i));
+    arm = NOW() - start;
+
+    start = NOW();
+    for ( i = 0; i < BENCH_TIMERS; i++ )
+        set_timer(&timers[i], start + MILLISECS(1) + bench_spread(i + 1));
+    rearm = NOW() - start;
+
+    start = NOW();
+    for ( i = 0; i < BENCH_TIMERS; i++ )
+        stop_timer(&timers[i]);
+    stop = NOW() - start;
+
+    /* Let all of them expire right away, and run them from the softirq. */
+    start = NOW();
+    for ( i = 0; i < BENCH_TIMERS; i++ )
+        set_timer(&timers[i], start - 1 - bench_spread(i));
+    while ( fired < BENCH_TIMERS && NOW() - start < SECONDS(1) )
+        process_pending_softirqs();
+    fire = NOW() - start;
+
+    for ( i = 0; i < BENCH_TIMERS; i++ )
+        kill_timer(&timers[i]);
+    xfree(timers);
+
+    printk("Timer benchmark on CPU%u (%s, %u timers), ns per timer:\n",
+           cpu, opt_timer_wheel ? "wheel" : "heap", BENCH_TIMERS);
+    printk("  arm %"PRI_stime" re-arm %"PRI_stime" stop %"PRI_stime
+           " arm+fire %"PRI_stime"%s\n",
+           arm / BENCH_TIMERS, rearm / BENCH_TIMERS, stop / BENCH_TIMERS,
+           fire / BENCH_TIMERS, fired < BENCH_TIMERS ? " (timed out)" : "");
+}
+
 static void migrate_timers_from_cpu(unsigned int old_cpu)
 {
     unsigned int new_cpu = cpumask_any(&cpu_online_map);
@@ -594,7 +942,8 @@ static void migrate_timers_from_cpu(unsigned int old_cpu)
     }
 
     while ( (t = heap_metadata(old_ts->heap)->size
-             ? old_ts->heap[1] : old_ts->list) != NULL )
+             ? old_ts->heap[1] : old_ts->list) != NULL ||
+            (old_ts->wheel && (t = first_wheel_entry(old_ts->wheel)) != NULL) )
     {
         remove_entry(t);
         write_atomic(&t->cpu, new_cpu);
@@ -635,6 +984,12 @@ static void free_percpu_timers(unsigned int cpu)
     }
     else
         ASSERT(ts->heap == dummy_heap);
+
+    if ( ts->wheel )
+    {
+        ASSERT(wheel_is_empty(ts->wheel));
+        XFREE(ts->wheel);
+    }
 }
 
 static int cf_check cpu_callback(
@@ -653,6 +1008,15 @@ static int cf_check cpu_callback(
             spin_lock_init(&ts->lock);
             ts->heap = dummy_heap;
         }
+        /* Without a wheel, all timers simply go to the heap. */
+        if ( opt_timer_wheel && !ts->wheel )
+        {
+            struct timer_wheel *w = alloc_wheel();
+
+            spin_lock_irq(&ts->lock);
+            ts->wheel = w;
+            spin_unlock_irq(&ts->lock);
+        }
         break;
 
     case CPU_UP_CANCELED:
@@ -691,6 +1055,7 @@ void __init timer_init(void)
     register_cpu_notifier(&cpu_nfb);
 
     register_keyhandler('a', dump_timerq, "dump timer queues", 1);
+    register_keyhandler('b', bench_timers, "benchmark timers", 0);
 }
 
 /*
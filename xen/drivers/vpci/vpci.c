@@ -21,14 +21,16 @@
 #include <xen/vpci.h>
 #include <xen/vmap.h>
 
-/* Internal struct to store the emulated PCI registers. */
+/*
+ * Internal struct to store the emulated PCI registers.  They are kept in an
+ * array sorted by offset, to be binary searched on each access.
+ */
 struct vpci_register {
     vpci_read_t *read;
     vpci_write_t *write;
     unsigned int size;
     unsigned int offset;
     void *private;
-    struct list_head node;
 };
 
 #ifdef __XEN__
@@ -42,15 +44,9 @@ void vpci_remove_device(struct pci_dev *pdev)
         return;
 
     spin_lock(&pdev->vpci->lock);
-    while ( !list_empty(&pdev->vpci->handlers) )
-    {
-        struct vpci_register *r = list_first_entry(&pdev->vpci->handlers,
-                                                   struct vpci_register,
-                                                   node);
-
-        list_del(&r->node);
-        xfree(r);
-    }
+    XFREE(pdev->vpci->registers);
+    pdev->vpci->nr_registers = 0;
+    pdev->vpci->max_registers = 0;
     spin_unlock(&pdev->vpci->lock);
     if ( pdev->vpci->msix )
     {
@@ -79,7 +75,6 @@ int vpci_add_handlers(struct pci_dev *pdev)
     if ( !pdev->vpci )
         return -ENOMEM;
 
-    INIT_LIST_HEAD(&pdev->vpci->handlers);
     spin_lock_init(&pdev->vpci->lock);
 
     for ( i = 0; i < NUM_VPCI_INIT; i++ )
@@ -112,6 +107,29 @@ static int vpci_register_cmp(const struct vpci_register *r1,
     return 0;
 }
 
+/*
+ * Index of the first register ending after reg, i.e. the first one an
+ * access starting at reg can overlap, or nr_registers if there is none.
+ */
+static unsigned int vpci_register_find(const struct vpci *vpci,
+                                       unsigned int reg)
+{
+    unsigned int lo = 0, hi = vpci->nr_registers;
+
+    while ( lo < hi )
+    {
+        unsigned int mid = lo + (hi - lo) / 2;
+        const struct vpci_register *r = &vpci->registers[mid];
+
+        if ( r->offset + r->size <= reg )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
 /* Dummy hooks, writes are ignored, reads return 1's */
 static uint32_t cf_check vpci_ignored_read(
     const struct pci_dev *pdev, unsigned int reg, void *data)
@@ -140,8 +158,14 @@ int vpci_add_register(struct vpci *vpci, vpci_read_t *read_handler,
                       vpci_write_t *write_handler, unsigned int offset,
                       unsigned int size, void *data)
 {
-    struct list_head *prev;
-    struct vpci_register *r;
+    const struct vpci_register r = {
+        .read = read_handler ?: vpci_ignored_read,
+        .write = write_handler ?: vpci_ignored_write,
+        .size = size,
+        .offset = offset,
+        .private = data,
+    };
+    unsigned int i;
 
     /* Some sanity checks. */
     if ( (size != 1 && size != 2 && size != 4) ||
@@ -149,36 +173,38 @@ int vpci_add_register(struct vpci *vpci, vpci_read_t *read_handler,
          (!read_handler && !write_handler) )
         return -EINVAL;
 
-    r = xmalloc(struct vpci_register);
-    if ( !r )
-        return -ENOMEM;
-
-    r->read = read_handler ?: vpci_ignored_read;
-    r->write = write_handler ?: vpci_ignored_write;
-    r->size = size;
-    r->offset = offset;
-    r->private = data;
-
     spin_lock(&vpci->lock);
 
-    /* The list of handlers must be kept sorted at all times. */
-    list_for_each ( prev, &vpci->handlers )
+    /* The array of handlers must be kept sorted at all times. */
+    i = vpci_register_find(vpci, offset);
+    if ( i < vpci->nr_registers &&
+         !vpci_register_cmp(&r, &vpci->registers[i]) )
     {
-        const struct vpci_register *this =
-            list_entry(prev, const struct vpci_register, node);
-        int cmp = vpci_register_cmp(r, this);
+        spin_unlock(&vpci->lock);
+        return -EEXIST;
+    }
 
-        if ( cmp < 0 )
-            break;
-        if ( cmp == 0 )
+    if ( vpci->nr_registers == vpci->max_registers )
+    {
+        unsigned int max = vpci->max_registers ? vpci->max_registers * 2 : 16;
+        struct vpci_register *registers =
+            xrealloc_array(vpci->registers, max);
+
+        if ( !registers )
         {
             spin_unlock(&vpci->lock);
-            xfree(r);
-            return -EEXIST;
+            return -ENOMEM;
         }
+
+        vpci->registers = registers;
+        vpci->max_registers = max;
     }
 
-    list_add_tail(&r->node, prev);
+    memmove(&vpci->registers[i + 1], &vpci->registers[i],
+            (vpci->nr_registers - i) * sizeof(*vpci->registers));
+    vpci->registers[i] = r;
+    vpci->nr_registers++;
+
     spin_unlock(&vpci->lock);
 
     return 0;
@@ -187,28 +213,21 @@ int vpci_add_register(struct vpci *vpci, vpci_read_t *read_handler,
 int vpci_remove_register(struct vpci *vpci, unsigned int offset,
                          unsigned int size)
 {
-    const struct vpci_register r = { .offset = offset, .size = size };
-    struct vpci_register *rm;
+    unsigned int i;
 
     spin_lock(&vpci->lock);
-    list_for_each_entry ( rm, &vpci->handlers, node )
-    {
-        int cmp = vpci_register_cmp(&r, rm);
 
-        /*
-         * NB: do not use a switch so that we can use break to
-         * get out of the list loop earlier if required.
-         */
-        if ( !cmp && rm->offset == offset && rm->size == size )
-        {
-            list_del(&rm->node);
-            spin_unlock(&vpci->lock);
-            xfree(rm);
-            return 0;
-        }
-        if ( cmp <= 0 )
-            break;
+    i = vpci_register_find(vpci, offset);
+    if ( i < vpci->nr_registers && vpci->registers[i].offset == offset &&
+         vpci->registers[i].size == size )
+    {
+        vpci->nr_registers--;
+        memmove(&vpci->registers[i], &vpci->registers[i + 1],
+                (vpci->nr_registers - i) * sizeof(*vpci->registers));
+        spin_unlock(&vpci->lock);
+        return 0;
     }
+
     spin_unlock(&vpci->lock);
 
     return -ENOENT;
@@ -319,8 +338,7 @@ uint32_t vpci_read(pci_sbdf_t sbdf, unsigned int reg, unsigned int size)
 {
     const struct domain *d = current->domain;
     const struct pci_dev *pdev;
-    const struct vpci_register *r;
-    unsigned int data_offset = 0;
+    unsigned int i, data_offset = 0;
     uint32_t data = ~(uint32_t)0;
 
     if ( !size )
@@ -337,8 +355,10 @@ uint32_t vpci_read(pci_sbdf_t sbdf, unsigned int reg, unsigned int size)
     spin_lock(&pdev->vpci->lock);
 
     /* Read from the hardware or the emulated register handlers. */
-    list_for_each_entry ( r, &pdev->vpci->handlers, node )
+    for ( i = vpci_register_find(pdev->vpci, reg);
+          i < pdev->vpci->nr_registers; i++ )
     {
+        const struct vpci_register *r = &pdev->vpci->registers[i];
         const struct vpci_register emu = {
             .offset = reg + data_offset,
             .size = size - data_offset
@@ -349,8 +369,7 @@ uint32_t vpci_read(pci_sbdf_t sbdf, unsigned int reg, unsigned int size)
 
         if ( cmp < 0 )
             break;
-        if ( cmp > 0 )
-            continue;
+        ASSERT(!cmp);
 
         if ( emu.offset < r->offset )
         {
@@ -422,8 +441,7 @@ void vpci_write(pci_sbdf_t sbdf, unsigned int reg, unsigned int size,
 {
     const struct domain *d = current->domain;
     const struct pci_dev *pdev;
-    const struct vpci_register *r;
-    unsigned int data_offset = 0;
+    unsigned int i, data_offset = 0;
     const unsigned long *ro_map = pci_get_ro_map(sbdf.seg);
 
     if ( !size )
@@ -450,8 +468,10 @@ void vpci_write(pci_sbdf_t sbdf, unsigned int reg, unsigned int size,
     spin_lock(&pdev->vpci->lock);
 
     /* Write the value to the hardware or emulated registers. */
-    list_for_each_entry ( r, &pdev->vpci->handlers, node )
+    for ( i = vpci_register_find(pdev->vpci, reg);
+          i < pdev->vpci->nr_registers; i++ )
     {
+        const struct vpci_register *r = &pdev->vpci->registers[i];
         const struct vpci_register emu = {
             .offset = reg + data_offset,
             .size = size - data_offset
@@ -461,8 +481,7 @@ void vpci_write(pci_sbdf_t sbdf, unsigned int reg, unsigned int size,
 
         if ( cmp < 0 )
             break;
-        if ( cmp > 0 )
-            continue;
+        ASSERT(!cmp);
 
         if ( emu.offset < r->offset )
         {
@@ -21,7 +21,7 @@
 #include "hvm/save.h"
 #include "memory.h"
 
-#define XEN_DOMCTL_INTERFACE_VERSION 0x00000015
+#define XEN_DOMCTL_INTERFACE_VERSION 0x00000016
 
 /*
  * NB. xen_domctl.domain is an IN/OUT parameter for this operation.
@@ -242,6 +242,16 @@ struct xen_domctl_getpageframeinfo3 {
   * writably by the hypervisor in the dirty bitmap.
   */
 #define XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL   (1 << 0)
+ /*
+  * Sparse retrieval: also fill dirty_summary with one bit per
+  * 2^XEN_DOMCTL_SHADOW_SUMMARY_ORDER pages, set if any page in that range is
+  * dirty.  Only the parts of dirty_bitmap covered by set summary bits are
+  * written; the remainder of the caller's buffer is left untouched.  The
+  * summary buffer must hold at least pages >> (SUMMARY_ORDER + 3) bytes,
+  * rounded up.
+  */
+#define XEN_DOMCTL_SHADOW_LOGDIRTY_SUMMARY (1 << 1)
+#define XEN_DOMCTL_SHADOW_SUMMARY_ORDER    9
 
 struct xen_domctl_shadow_op_stats {
     uint32_t fault_count;
@@ -263,6 +273,9 @@ struct xen_domctl_shadow_op {
     XEN_GUEST_HANDLE_64(uint8) dirty_bitmap;
     uint64_aligned_t pages; /* Size of buffer. Updated with actual size. */
     struct xen_domctl_shadow_op_stats stats;
+
+    /* OP_PEEK / OP_CLEAN with XEN_DOMCTL_SHADOW_LOGDIRTY_SUMMARY */
+    XEN_GUEST_HANDLE_64(uint8) dirty_summary;
 };
 
 
@@ -948,6 +961,23 @@ struct xen_domctl_paging_mempool {
     uint64_aligned_t size; /* Size in bytes. */
 };
 
+/*
+ * XEN_DOMCTL_get_p2m_orders.
+ *
+ * Report the order of the p2m entry mapping each gfn of a range, as one octet
+ * per gfn, or XEN_DOMCTL_P2M_ORDER_NONE for gfns not mapped to RAM.  x86 HVM
+ * guests only.
+ *
+ * The operation may be preempted, in which case nr_gfns is updated to the
+ * number of gfns reported, and the caller should continue from there.
+ */
+struct xen_domctl_p2m_orders {
+    uint64_aligned_t start_gfn;        /* IN */
+    uint64_aligned_t nr_gfns;          /* IN/OUT */
+    XEN_GUEST_HANDLE_64(uint8) orders; /* OUT: nr_gfns octets */
+};
+#define XEN_DOMCTL_P2M_ORDER_NONE 0xff
+
 #if defined(__i386__) || defined(__x86_64__)
 struct xen_domctl_vcpu_msr {
     uint32_t         index;
@@ -1278,6 +1308,7 @@ struct xen_domctl {
 #define XEN_DOMCTL_vmtrace_op                    84
 #define XEN_DOMCTL_get_paging_mempool_size       85
 #define XEN_DOMCTL_set_paging_mempool_size       86
+#define XEN_DOMCTL_get_p2m_orders                87
 #define XEN_DOMCTL_gdbsx_guestmemio            1000
 #define XEN_DOMCTL_gdbsx_pausevcpu             1001
 #define XEN_DOMCTL_gdbsx_unpausevcpu           1002
@@ -1340,6 +1371,7 @@ struct xen_domctl {
         struct xen_domctl_vuart_op          vuart_op;
         struct xen_domctl_vmtrace_op        vmtrace_op;
         struct xen_domctl_paging_mempool    paging_mempool;
+        struct xen_domctl_p2m_orders        p2m_orders;
         uint8_t                             pad[128];
     } u;
 };
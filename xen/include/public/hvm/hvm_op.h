@@ -182,6 +182,16 @@ DEFINE_XEN_GUEST_HANDLE(xen_hvm_get_mem_type_t);
  */
 #define HVM_IOREQSRV_BUFIOREQ_ATOMIC 2
 
+/*
+ * May be or-ed into HVM_IOREQSRV_BUFIOREQ_LEGACY or _ATOMIC by an emulator
+ * which, once woken up by the buffered ioreq event channel, keeps consuming
+ * requests until it finds the ring empty, with a full barrier between
+ * updating read_pointer and reading write_pointer.  The event channel is
+ * then only notified for a request put into an empty ring: requests added
+ * while the emulator is still busy with the ring will be seen without.
+ */
+#define HVM_IOREQSRV_BUFIOREQ_NOTIFY_EMPTY 0x80
+
 #endif /* defined(__XEN__) || defined(__XEN_TOOLS__) */
 
 #if defined(__i386__) || defined(__x86_64__)
@@ -55,6 +55,7 @@ struct ioreq_server {
     struct rangeset        *range[NR_IO_RANGE_TYPES];
     bool                   enabled;
     uint8_t                bufioreq_handling;
+    bool                   bufioreq_notify_empty;
 };
 
 static inline paddr_t ioreq_mmio_first_byte(const ioreq_t *p)
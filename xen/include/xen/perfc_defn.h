@@ -83,4 +83,11 @@ PERFCOUNTER(tickled_cpu_overridden, "csched2: tickled_cpu_overridden")
 
 PERFCOUNTER(need_flush_tlb_flush,   "PG_need_flush tlb flushes")
 
+#ifdef CONFIG_IOREQ_SERVER
+PERFCOUNTER(ioreq_select_hit,       "ioreq server select cache hits")
+PERFCOUNTER(ioreq_select_miss,      "ioreq server select cache misses")
+PERFCOUNTER(bufioreq_notify,        "buffered ioreq notifications")
+PERFCOUNTER(bufioreq_notify_skip,   "buffered ioreq notifications skipped")
+#endif
+
 /*#endif*/ /* __XEN_PERFC_DEFN_H__ */
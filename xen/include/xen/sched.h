@@ -167,6 +167,14 @@ struct vcpu_io {
     ioreq_t              req;
     /* Arch specific info pertaining to the io request */
     struct arch_vcpu_io  info;
+    /* Recent results of ioreq_server_select(), replaced round robin. */
+    struct vio_select {
+        uint64_t         start, end;
+        unsigned int     generation;
+        uint8_t          type;
+        uint8_t          id;     /* MAX_NR_IOREQ_SERVERS for none. */
+    } select[4];
+    unsigned int         select_next;
 };
 
 struct vcpu
@@ -597,6 +605,8 @@ struct domain
     struct {
         spinlock_t              lock;
         struct ioreq_server     *server[MAX_NR_IOREQ_SERVERS];
+        /* Bumped whenever ioreq_server_select() may pick differently. */
+        unsigned int            generation;
     } ioreq_server;
 #endif
 
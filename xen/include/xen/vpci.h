@@ -58,8 +58,9 @@ uint32_t cf_check vpci_hw_read32(
 bool __must_check vpci_process_pending(struct vcpu *v);
 
 struct vpci {
-    /* List of vPCI handlers for a device. */
-    struct list_head handlers;
+    /* vPCI handlers for a device, sorted by offset. */
+    struct vpci_register *registers;
+    unsigned int nr_registers, max_registers;
     spinlock_t lock;
 
 #ifdef __XEN__
@@ -47,6 +47,11 @@
     ((typeof(ptr))_xrealloc(ptr, offsetof(typeof(*(ptr)), field[nr]),  \
                             __alignof__(typeof(*(ptr)))))
 
+/* Re-allocate space for an array of typed objects. */
+#define xrealloc_array(ptr, nr)                                      \
+    ((typeof(ptr))_xrealloc_array(ptr, sizeof(typeof(*(ptr))),      \
+                                  __alignof__(typeof(*(ptr))), nr))
+
 /* Allocate untyped storage. */
 #define xmalloc_bytes(_bytes) _xmalloc(_bytes, SMP_CACHE_BYTES)
 #define xzalloc_bytes(_bytes) _xzalloc(_bytes, SMP_CACHE_BYTES)
@@ -94,6 +99,15 @@ static inline void *_xzalloc_array(
     return _xzalloc(size * num, align);
 }
 
+static inline void *_xrealloc_array(
+    void *ptr, unsigned long size, unsigned long align, unsigned long num)
+{
+    /* Check for overflow. */
+    if ( size && num > UINT_MAX / size )
+        return NULL;
+    return _xrealloc(ptr, size * num, align);
+}
+
 /*
  * Pooled allocator interface.
  */
@@ -749,6 +749,7 @@ static int cf_check flask_domctl(struct domain *d, int cmd)
         return current_has_perm(d, SECCLASS_DOMAIN, DOMAIN__SETDEBUGGING);
 
     case XEN_DOMCTL_getpageframeinfo3:
+    case XEN_DOMCTL_get_p2m_orders:
         return current_has_perm(d, SECCLASS_MMU, MMU__PAGEINFO);
 
     case XEN_DOMCTL_hypercall_init: